@@ -9,6 +9,7 @@
 #include "Helper.h"
 #include "statusled.h"
 #include "CImageBasis.h"
+#include "CJpegDecoder.h"
 
 #include "server_ota.h"
 #include "server_GPIO.h"
@@ -633,7 +634,9 @@ static size_t jpg_encode_stream(void *arg, size_t index, const void *data, size_
     return len;
 }
 
-esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
+/* _jpeg: if not NULL, gets a copy of the sensor JPEG (NULL if there is not enough memory), the raw image can be saved
+   or sent without encoding it again */
+esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay, const std::vector<JpegRegion> *_regions, CImageBuffer **_jpeg)
 {
 #ifdef DEBUG_DETAIL_ON
     LogFile.WriteHeapInfo("CaptureToBasisImage - Start");
@@ -677,15 +680,62 @@ esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
         loadNextDemoImage(fb);
     }
 
-    CImageBasis *_zwImage = new CImageBasis("zwImage");
+    if (_jpeg != NULL)
+    {
+        *_jpeg = CImageBuffer::Allocate("rawJPG", fb->len);
+
+        if (*_jpeg != NULL)
+        {
+            memcpy((*_jpeg)->data, fb->buf, fb->len);
+        }
+        else
+        {
+            LogFile.WriteToFile(ESP_LOG_WARN, TAG, "CaptureToBasisImage: Can't keep the JPEG (" + std::to_string(fb->len) + " bytes)");
+        }
+    }
+
+    bool decoded = false;
 
-    if (_zwImage)
+    if ((_regions != NULL) || (_Image->channels == 1))
     {
-        _zwImage->LoadFromMemory(fb->buf, fb->len);
+        // Decode only the MCUs needed by the flow (or only the luminance) directly into the target image, the decoder
+        // fills the rest with black (the image is reused every round, nothing of the last frame may remain)
+        CJpegDecoder *decoder = new CJpegDecoder();
+        if (_Image->RGBImageLock() != NULL)
+        {
+            decoded = decoder->Decode(fb->buf, fb->len, _Image->rgb_image, _Image->width, _Image->height, _regions, 1, _Image->channels);
+            _Image->RGBImageRelease();
+        }
+
+        if (decoded)
+        {
+            LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "CaptureToBasisImage: Direct decode (" + std::to_string(_Image->channels) + " channel), " +
+                                                    std::to_string(decoder->mcus_decoded) + " MCUs decoded, " +
+                                                    std::to_string(decoder->mcus_skipped) + " skipped, " + std::to_string(decoder->entropy_bytes) +
+                                                    " of " + std::to_string(fb->len) + " bytes read");
+        }
+        else
+        {
+            LogFile.WriteToFile(ESP_LOG_WARN, TAG, "CaptureToBasisImage: Direct decode not possible, decode full image");
+        }
+
+        delete decoder;
     }
-    else
+
+    CImageBasis *_zwImage = NULL;
+
+    if (!decoded)
     {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CaptureToBasisImage: Can't allocate _zwImage");
+        _zwImage = new CImageBasis("zwImage");
+
+        if (_zwImage)
+        {
+            _zwImage->LoadFromMemory(fb->buf, fb->len);
+        }
+        else
+        {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CaptureToBasisImage: Can't allocate _zwImage");
+        }
     }
 
     esp_camera_fb_return(fb);
@@ -715,7 +765,7 @@ esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
 
     stbi_uc *p_target;
     stbi_uc *p_source;
-    int channels = 3;
+    int channels = _zwImage->channels;
     int width = CCstatus.ImageWidth;
     int height = CCstatus.ImageHeight;
 
@@ -725,20 +775,22 @@ esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
     LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, _zw);
 #endif
 
-    for (int x = 0; x < width; ++x)
+    if (_Image->RGBImageLock() == NULL)
     {
-        for (int y = 0; y < height; ++y)
-        {
-            p_target = _Image->rgb_image + (channels * (y * width + x));
-            p_source = _zwImage->rgb_image + (channels * (y * width + x));
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CaptureToBasisImage: Target image not available");
+        delete _zwImage;
+        return ESP_FAIL;
+    }
 
-            for (int c = 0; c < channels; c++)
-            {
-                p_target[c] = p_source[c];
-            }
-        }
+    for (int y = 0; y < height; ++y)
+    {
+        p_target = _Image->rgb_image + (_Image->channels * y * width);
+        p_source = _zwImage->rgb_image + (channels * y * width);
+        CImageBasis::CopyPixels(p_source, channels, p_target, _Image->channels, width);
     }
 
+    _Image->RGBImageRelease();
+
     delete _zwImage;
 
 #ifdef DEBUG_DETAIL_ON
@@ -13,6 +13,7 @@
 #include <string>
 #include <esp_http_server.h>
 #include "CImageBasis.h"
+#include "CJpegDecoder.h"
 #include "../../include/defines.h"
 
 typedef struct
@@ -110,7 +111,7 @@ public:
     framesize_t TextToFramesize(const char *text);
 
     esp_err_t CaptureToFile(std::string nm, int delay = 0);
-    esp_err_t CaptureToBasisImage(CImageBasis *_Image, int delay = 0);
+    esp_err_t CaptureToBasisImage(CImageBasis *_Image, int delay = 0, const std::vector<JpegRegion> *_regions = NULL, CImageBuffer **_jpeg = NULL);
 };
 
 extern CCamera Camera;
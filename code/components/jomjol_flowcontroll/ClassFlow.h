@@ -16,7 +16,7 @@ struct HTMLInfo
 {
 	float val;
 	CImageBasis *image = NULL;
-	CImageBasis *image_org = NULL;
+	ImageView image_org;
 	std::string filename;
 	std::string filename_org;	
 };
@@ -42,6 +42,7 @@ public:
 	ClassFlow(void);
 	ClassFlow(std::vector<ClassFlow*> * lfc);
 	ClassFlow(std::vector<ClassFlow*> * lfc, ClassFlow *_prev);	
+	virtual ~ClassFlow() {};
 	
 	virtual bool ReadParameter(FILE* pfile, string &aktparamgraph);
 	virtual bool doFlow(string time);
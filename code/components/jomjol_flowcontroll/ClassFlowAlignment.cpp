@@ -5,6 +5,8 @@
 
 #include "CRotateImage.h"
 #include "esp_log.h"
+#include <algorithm>
+#include <math.h>
 
 #include "ClassLogFile.h"
 #include "psram.h"
@@ -27,6 +29,7 @@ void ClassFlowAlignment::SetInitialParameter(void)
     AlignAndCutImage = NULL;
     ImageBasis = NULL;
     ImageTMP = NULL;
+    ownImageBasis = false;
 #ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
     AlgROI = (ImageData *)malloc_psram_heap(std::string(TAG) + "->AlgROI", sizeof(ImageData), MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM);
 #endif
@@ -50,15 +53,30 @@ ClassFlowAlignment::ClassFlowAlignment(std::vector<ClassFlow *> *lfc)
     if (!ImageBasis)  {
         ESP_LOGD(TAG, "CImageBasis had to be created");
         ImageBasis = new CImageBasis("ImageBasis", namerawimage);
+        ownImageBasis = true;
     }
 }
 
+ClassFlowAlignment::~ClassFlowAlignment()
+{
+    delete AlignAndCutImage;
+    delete ImageTMP;
+
+    if (ownImageBasis) {
+        delete ImageBasis;
+    }
+
+#ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
+    free_psram_heap(std::string(TAG) + "->AlgROI", AlgROI);
+#endif
+}
+
 bool ClassFlowAlignment::ReadParameter(FILE *pfile, string &aktparamgraph)
 {
     std::vector<string> splitted;
     int suchex = 40;
     int suchey = 40;
-    int alg_algo = 0; // default=0; 1 =HIGHACCURACY; 2= FAST; 3= OFF //add disable aligment algo |01.2023
+    int alg_algo = 0; // default=0; 1 =HIGHACCURACY; 2= FAST; 3= OFF //add disable aligment algo |01.2023; 4= PYRAMID; 5= NCC; 6= PHASECORRELATION
 
     aktparamgraph = trim(aktparamgraph);
 
@@ -100,7 +118,7 @@ bool ClassFlowAlignment::ReadParameter(FILE *pfile, string &aktparamgraph)
         else if ((toUpper(splitted[0]) == "ANTIALIASING") && (splitted.size() > 1)) {
             use_antialiasing = alphanumericToBoolean(splitted[1]);
         }
-        else if ((splitted.size() == 3) && (anz_ref < 2)) {
+        else if ((splitted.size() == 3) && (anz_ref < ALIGN_MAX_REFERENCES)) {
             if ((isStringNumeric(splitted[1])) && (isStringNumeric(splitted[2])))
             {
                 References[anz_ref].image_file = FormatFileName("/sdcard" + splitted[0]);
@@ -135,6 +153,15 @@ bool ClassFlowAlignment::ReadParameter(FILE *pfile, string &aktparamgraph)
                 // no align algo if set to 3 = off => no draw ref //add disable aligment algo |01.2023
                 alg_algo = 3;
             }
+            if (toUpper(splitted[1]) == "PYRAMID") {
+                alg_algo = 4;
+            }
+            if (toUpper(splitted[1]) == "NCC") {
+                alg_algo = 5;
+            }
+            if (toUpper(splitted[1]) == "PHASECORRELATION") {
+                alg_algo = 6;
+            }
         }
     }
 
@@ -179,11 +206,14 @@ bool ClassFlowAlignment::doFlow(string time)
             LogFile.WriteHeapInfo("ClassFlowAlignment-doFlow");
         }
     }
+#endif
 
-    if (AlgROI) {
-        ImageBasis->writeToMemoryAsJPG((ImageData *)AlgROI, 90);
+    // HTTP handlers reading the image (alg.jpg, ROI originals) wait until rotation and alignment are complete.
+    // Locked before the tmpImage shares the buffer, the first write to the shared buffer copies it into the tmpImage.
+    if (ImageBasis->RGBImageLock() == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Image not available -> Exec this round aborted!");
+        return false;
     }
-#endif
 
     if (!ImageTMP) {
         ImageTMP = new CImageBasis("tmpImage", ImageBasis); // Make sure the name does not get change, it is relevant for the PSRAM allocation!
@@ -191,6 +221,7 @@ bool ClassFlowAlignment::doFlow(string time)
         if (!ImageTMP) {
             LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate tmpImage -> Exec this round aborted!");
             LogFile.WriteHeapInfo("ClassFlowAlignment-doFlow");
+            ImageBasis->RGBImageRelease();
             return false;
         }
     }
@@ -201,63 +232,87 @@ bool ClassFlowAlignment::doFlow(string time)
     if (!AlignAndCutImage) {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate AlignAndCutImage -> Exec this round aborted!");
         LogFile.WriteHeapInfo("ClassFlowAlignment-doFlow");
+        ImageBasis->RGBImageRelease();
         return false;
     }
 
-    CRotateImage rt("rawImage", AlignAndCutImage, ImageTMP, initialflip);
+    CRotateImage rt("rawImage", AlignAndCutImage, ImageTMP);
+
+    CAffineTransform initial(AlignAndCutImage->width, AlignAndCutImage->height);
+    initial.Rotate(initialrotate, AlignAndCutImage->width / 2, AlignAndCutImage->height / 2);
 
     if (initialflip) {
+        initial.FlipImageSize();
+
         int _zw = ImageBasis->height;
         ImageBasis->height = ImageBasis->width;
         ImageBasis->width = _zw;
-
-        _zw = ImageTMP->width;
-        ImageTMP->width = ImageTMP->height;
-        ImageTMP->height = _zw;
     }
 
-    if ((initialrotate != 0) || initialflip) {
-        if (use_antialiasing) {
-            rt.RotateAntiAliasing(initialrotate);
-        }
-        else {
-            rt.Rotate(initialrotate);
+    // no align algo if set to 3 = off //add disable aligment algo |01.2023
+    bool align = (References[0].alignment_algo != 3);
+
+    if (!initial.IsIdentity()) {
+        // With alignment the rotated image is only needed in ImageTMP to search the references,
+        // Align renders the final image from the raw image with rotation and alignment in one pass
+        if (!rt.Warp(initial, use_antialiasing, !align)) {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Initial rotation failed -> Exec this round aborted!");
+            if (initialflip) {
+                std::swap(ImageBasis->width, ImageBasis->height);
+            }
+            ImageBasis->RGBImageRelease();
+            return false;
         }
 
         if (SaveAllFiles) {
-            AlignAndCutImage->SaveToFile(FormatFileName("/sdcard/img_tmp/rot.jpg"));
+            (align ? ImageTMP : AlignAndCutImage)->SaveToFile(FormatFileName("/sdcard/img_tmp/rot.jpg"));
         }
     }
 
-    // no align algo if set to 3 = off //add disable aligment algo |01.2023
-    if (References[0].alignment_algo != 3) {
-        if (!AlignAndCutImage->Align(&References[0], &References[1])) {
+    if (align) {
+        SetAdaptiveSearchField();
+
+        if (!AlignAndCutImage->Align(References, anz_ref, initial.IsIdentity() ? NULL : &initial, use_antialiasing)) {
             SaveReferenceAlignmentValues();
         }
+
+        UpdateDriftHistory();
     } // no align
 
+    // Drawn by the encoder onto the untouched aligned image. Rebuilt under the image lock, the web server
+    // reads it while encoding with the read lock.
+    Overlay.Clear();
+
+    // no align algo if set to 3 = off => no draw ref //add disable aligment algo |01.2023
+    if (align) {
+        DrawRef(&Overlay);
+    }
+
+    flowctrl.DigitDrawROI(&Overlay);
+    flowctrl.AnalogDrawROI(&Overlay);
+
+    ImageBasis->RGBImageRelease();
+
+    // must be deleted to have memory space for loading tflite
+    delete ImageTMP;
+    ImageTMP = NULL;
+
+    CImageLock *lock = ImageBasis->GetLock();
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Image lock: " + std::to_string(lock->reads) + " reads, " + std::to_string(lock->writes) +
+                                            " writes, " + std::to_string(lock->contended) + " contended, " + std::to_string(lock->timeouts) +
+                                            " timeouts, max. wait " + std::to_string(lock->max_wait_ms) + " ms");
+
 #ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
     if (AlgROI) {
-        // no align algo if set to 3 = off => no draw ref //add disable aligment algo |01.2023
-        if (References[0].alignment_algo != 3) {
-            DrawRef(ImageTMP);
-        }
-
-        flowctrl.DigitDrawROI(ImageTMP);
-        flowctrl.AnalogDrawROI(ImageTMP);
-        ImageTMP->writeToMemoryAsJPG((ImageData *)AlgROI, 90);
+        ImageBasis->writeToMemoryAsJPG((ImageData *)AlgROI, 90, &Overlay);
     }
 #endif
 
     if (SaveAllFiles) {
         AlignAndCutImage->SaveToFile(FormatFileName("/sdcard/img_tmp/alg.jpg"));
-        ImageTMP->SaveToFile(FormatFileName("/sdcard/img_tmp/alg_roi.jpg"));
+        AlignAndCutImage->SaveToFile(FormatFileName("/sdcard/img_tmp/alg_roi.jpg"), &Overlay);
     }
 
-    // must be deleted to have memory space for loading tflite
-    delete ImageTMP;
-    ImageTMP = NULL;
-
     // no align algo if set to 3 = off => no draw ref //add disable aligment algo |01.2023
     if (References[0].alignment_algo != 3) {
         return LoadReferenceAlignmentValues();
@@ -266,6 +321,63 @@ bool ClassFlowAlignment::doFlow(string time)
     return true;
 }
 
+/* Reduce the search field of every reference to the drift envelope of the last rounds plus a margin.
+ * FindTemplate falls back to the configured search field if the match lies on the border of the reduced field
+ * or its RMS difference is clearly worse than in the last rounds. */
+void ClassFlowAlignment::SetAdaptiveSearchField(void)
+{
+    for (int i = 0; i < anz_ref; ++i) {
+        AlignDriftHistory &history = DriftHistory[i];
+
+        References[i].adaptive_search_x = 0;
+        References[i].adaptive_search_y = 0;
+        References[i].adaptive_max_rms = -1;
+
+        if (history.count < ALIGN_DRIFT_MIN_ROUNDS) {
+            continue;
+        }
+
+        int drift_x = 0, drift_y = 0;
+        float rms_sum = 0;
+
+        for (int j = 0; j < history.count; ++j) {
+            drift_x = std::max(drift_x, abs(history.dx[j]));
+            drift_y = std::max(drift_y, abs(history.dy[j]));
+            rms_sum += history.rms[j];
+        }
+
+        References[i].adaptive_search_x = drift_x + ALIGN_DRIFT_MARGIN;
+        References[i].adaptive_search_y = drift_y + ALIGN_DRIFT_MARGIN;
+        References[i].adaptive_max_rms = ALIGN_DRIFT_RMS_FACTOR * rms_sum / history.count + ALIGN_DRIFT_RMS_OFFSET;
+
+        ESP_LOGD(TAG, "Ref %d: adaptive search field %d x %d, max RMS %f", i, References[i].adaptive_search_x,
+                 References[i].adaptive_search_y, References[i].adaptive_max_rms);
+    }
+}
+
+void ClassFlowAlignment::UpdateDriftHistory(void)
+{
+    for (int i = 0; i < anz_ref; ++i) {
+        AlignDriftHistory &history = DriftHistory[i];
+
+        if (References[i].adaptive_fallback) {
+            // Drift outside of the known envelope: start a new history, full search field until it is filled again
+            history.count = 0;
+            history.next = 0;
+        }
+
+        if ((References[i].match_rms < 0) || References[i].outlier) {
+            continue;
+        }
+
+        history.dx[history.next] = References[i].found_x - References[i].target_x;
+        history.dy[history.next] = References[i].found_y - References[i].target_y;
+        history.rms[history.next] = References[i].match_rms;
+        history.next = (history.next + 1) % ALIGN_DRIFT_HISTORY;
+        history.count = std::min(history.count + 1, ALIGN_DRIFT_HISTORY);
+    }
+}
+
 void ClassFlowAlignment::SaveReferenceAlignmentValues()
 {
     FILE *pFile;
@@ -288,17 +400,13 @@ void ClassFlowAlignment::SaveReferenceAlignmentValues()
     fputs(zwtime.c_str(), pFile);
     fputs("\n", pFile);
 
-    zwvalue = std::to_string(References[0].fastalg_x) + "\t" + std::to_string(References[0].fastalg_y);
-    zwvalue = zwvalue + "\t" + std::to_string(References[0].fastalg_SAD) + "\t" + std::to_string(References[0].fastalg_min);
-    zwvalue = zwvalue + "\t" + std::to_string(References[0].fastalg_max) + "\t" + std::to_string(References[0].fastalg_avg);
-    fputs(zwvalue.c_str(), pFile);
-    fputs("\n", pFile);
-
-    zwvalue = std::to_string(References[1].fastalg_x) + "\t" + std::to_string(References[1].fastalg_y);
-    zwvalue = zwvalue + "\t" + std::to_string(References[1].fastalg_SAD) + "\t" + std::to_string(References[1].fastalg_min);
-    zwvalue = zwvalue + "\t" + std::to_string(References[1].fastalg_max) + "\t" + std::to_string(References[1].fastalg_avg);
-    fputs(zwvalue.c_str(), pFile);
-    fputs("\n", pFile);
+    for (int i = 0; i < anz_ref; ++i) {
+        zwvalue = std::to_string(References[i].fastalg_x) + "\t" + std::to_string(References[i].fastalg_y);
+        zwvalue = zwvalue + "\t" + std::to_string(References[i].fastalg_SAD) + "\t" + std::to_string(References[i].fastalg_min);
+        zwvalue = zwvalue + "\t" + std::to_string(References[i].fastalg_max) + "\t" + std::to_string(References[i].fastalg_avg);
+        fputs(zwvalue.c_str(), pFile);
+        fputs("\n", pFile);
+    }
 
     fclose(pFile);
 }
@@ -319,36 +427,24 @@ bool ClassFlowAlignment::LoadReferenceAlignmentValues(void)
     fgets(zw, 1024, pFile);
     ESP_LOGD(TAG, "%s", zw);
 
-    fgets(zw, 1024, pFile);
-    splitted = ZerlegeZeile(std::string(zw), " \t");
-
-    if (splitted.size() < 6) {
-        fclose(pFile);
-        return false;
-    }
-
-    References[0].fastalg_x = stoi(splitted[0]);
-    References[0].fastalg_y = stoi(splitted[1]);
-    References[0].fastalg_SAD = stof(splitted[2]);
-    References[0].fastalg_min = stoi(splitted[3]);
-    References[0].fastalg_max = stoi(splitted[4]);
-    References[0].fastalg_avg = stof(splitted[5]);
+    for (int i = 0; i < anz_ref; ++i) {
+        zw[0] = '\0';
+        fgets(zw, 1024, pFile);
+        splitted = ZerlegeZeile(std::string(zw), " \t");
 
-    fgets(zw, 1024, pFile);
-    splitted = ZerlegeZeile(std::string(zw));
+        if (splitted.size() < 6) {
+            fclose(pFile);
+            return false;
+        }
 
-    if (splitted.size() < 6) {
-        fclose(pFile);
-        return false;
+        References[i].fastalg_x = stoi(splitted[0]);
+        References[i].fastalg_y = stoi(splitted[1]);
+        References[i].fastalg_SAD = stof(splitted[2]);
+        References[i].fastalg_min = stoi(splitted[3]);
+        References[i].fastalg_max = stoi(splitted[4]);
+        References[i].fastalg_avg = stof(splitted[5]);
     }
 
-    References[1].fastalg_x = stoi(splitted[0]);
-    References[1].fastalg_y = stoi(splitted[1]);
-    References[1].fastalg_SAD = stof(splitted[2]);
-    References[1].fastalg_min = stoi(splitted[3]);
-    References[1].fastalg_max = stoi(splitted[4]);
-    References[1].fastalg_avg = stof(splitted[5]);
-
     fclose(pFile);
 
     /*#ifdef DEBUG_DETAIL_ON
@@ -365,10 +461,80 @@ bool ClassFlowAlignment::LoadReferenceAlignmentValues(void)
     return true;
 }
 
-void ClassFlowAlignment::DrawRef(CImageBasis *_zw)
+/* Areas of the raw image needed for a round: the search fields of the references and the ROIs (_rois, aligned image)
+ * with the search field plus ALIGN_DECODE_MARGIN around them, mapped back through the initial rotation and flip.
+ * Returns false as long as the template sizes are unknown (set by the first alignment). */
+bool ClassFlowAlignment::GetDecodeRegions(const std::vector<JpegRegion> &_rois, int _rawwidth, int _rawheight, std::vector<JpegRegion> &_regions)
 {
-    if (_zw->ImageOkay()) {
-        _zw->drawRect(References[0].target_x, References[0].target_y, References[0].width, References[0].height, 255, 0, 0, 2);
-        _zw->drawRect(References[1].target_x, References[1].target_y, References[1].width, References[1].height, 255, 0, 0, 2);
+    _regions.clear();
+
+    CAffineTransform initial(_rawwidth, _rawheight);
+    initial.Rotate(initialrotate, _rawwidth / 2, _rawheight / 2);
+
+    if (initialflip) {
+        initial.FlipImageSize();
+    }
+
+    float inv[2][3];
+
+    if (!initial.Inverse(inv)) {
+        return false;
+    }
+
+    std::vector<JpegRegion> areas;
+    int margin_x = ALIGN_DECODE_MARGIN;
+    int margin_y = ALIGN_DECODE_MARGIN;
+
+    // no align algo if set to 3 = off
+    if (References[0].alignment_algo != 3) {
+        for (int i = 0; i < anz_ref; ++i) {
+            if ((References[i].width == 0) || (References[i].search_x == 0) || (References[i].search_y == 0)) {
+                return false;       // not aligned yet or search in the whole image
+            }
+
+            areas.push_back({References[i].target_x - References[i].search_x, References[i].target_y - References[i].search_y,
+                             References[i].width + 2 * References[i].search_x, References[i].height + 2 * References[i].search_y});
+            margin_x = std::max(margin_x, References[i].search_x + ALIGN_DECODE_MARGIN);
+            margin_y = std::max(margin_y, References[i].search_y + ALIGN_DECODE_MARGIN);
+        }
+    }
+
+    for (const JpegRegion &roi : _rois) {
+        areas.push_back({roi.x - margin_x, roi.y - margin_y, roi.dx + 2 * margin_x, roi.dy + 2 * margin_y});
+    }
+
+    for (const JpegRegion &area : areas) {
+        float x_min = _rawwidth, y_min = _rawheight, x_max = 0, y_max = 0;
+
+        for (int corner = 0; corner < 4; ++corner) {
+            float x = area.x + ((corner & 1) ? area.dx : 0);
+            float y = area.y + ((corner & 2) ? area.dy : 0);
+            float x_raw = inv[0][0] * x + inv[0][1] * y + inv[0][2];
+            float y_raw = inv[1][0] * x + inv[1][1] * y + inv[1][2];
+
+            x_min = std::min(x_min, x_raw);
+            x_max = std::max(x_max, x_raw);
+            y_min = std::min(y_min, y_raw);
+            y_max = std::max(y_max, y_raw);
+        }
+
+        int x0 = std::max((int)floor(x_min) - 1, 0);
+        int y0 = std::max((int)floor(y_min) - 1, 0);
+        int x1 = std::min((int)ceil(x_max) + 1, _rawwidth);
+        int y1 = std::min((int)ceil(y_max) + 1, _rawheight);
+
+        if ((x1 > x0) && (y1 > y0)) {
+            _regions.push_back({x0, y0, x1 - x0, y1 - y0});
+        }
+    }
+
+    return true;
+}
+
+void ClassFlowAlignment::DrawRef(CImageOverlay *_overlay)
+{
+    for (int i = 0; i < anz_ref; ++i) {
+        // Rejected references in yellow
+        _overlay->AddRect(References[i].target_x, References[i].target_y, References[i].width, References[i].height, 255, References[i].outlier ? 255 : 0, 0, 2);
     }
 }
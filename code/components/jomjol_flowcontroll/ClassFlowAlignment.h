@@ -7,40 +7,64 @@
 #include "Helper.h"
 #include "CAlignAndCutImage.h"
 #include "CFindTemplate.h"
+#include "CImageOverlay.h"
+#include "CJpegDecoder.h"
 
 #include <string>
 
 using namespace std;
 
+#define ALIGN_DRIFT_HISTORY 16          // Rounds of found offsets kept per reference
+#define ALIGN_DRIFT_MIN_ROUNDS 5        // Rounds needed before the search field is reduced
+#define ALIGN_DRIFT_MARGIN 4            // Pixel added to the observed drift
+#define ALIGN_DRIFT_RMS_FACTOR 1.5      // Full search field if the match RMS is worse than FACTOR * average + OFFSET
+#define ALIGN_DRIFT_RMS_OFFSET 3
+#define ALIGN_DECODE_MARGIN 8           // Pixel around the ROIs (decode regions) for the rotation found by the alignment and the interpolation
+
+struct AlignDriftHistory {
+    int dx[ALIGN_DRIFT_HISTORY];        // found - target
+    int dy[ALIGN_DRIFT_HISTORY];
+    float rms[ALIGN_DRIFT_HISTORY];
+    int count = 0;
+    int next = 0;
+};
+
 class ClassFlowAlignment : public ClassFlow
 {
 protected:
     float initialrotate;
     bool initialflip;
     bool use_antialiasing;
-    RefInfo References[2];
+    RefInfo References[ALIGN_MAX_REFERENCES];
     int anz_ref;
     string namerawimage;
+    bool ownImageBasis;                 // ImageBasis created by the flow (no TakeImage flow), else the raw image of TakeImage
     bool SaveAllFiles;
     CAlignAndCutImage *AlignAndCutImage;
     std::string FileStoreRefAlignment;
     float SAD_criteria;
+    AlignDriftHistory DriftHistory[ALIGN_MAX_REFERENCES];
 
     void SetInitialParameter(void);
     bool LoadReferenceAlignmentValues(void);
     void SaveReferenceAlignmentValues();
+    void SetAdaptiveSearchField(void);
+    void UpdateDriftHistory(void);
 
 public:
     CImageBasis *ImageBasis, *ImageTMP;
+    CImageOverlay Overlay;              // References and ROIs of the last round, drawn by the JPEG encoder (alg_roi.jpg)
 #ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
     ImageData *AlgROI;
 #endif
 
     ClassFlowAlignment(std::vector<ClassFlow *> *lfc);
+    ~ClassFlowAlignment();
 
     CAlignAndCutImage *GetAlignAndCutImage() { return AlignAndCutImage; };
 
-    void DrawRef(CImageBasis *_zw);
+    void DrawRef(CImageOverlay *_overlay);
+    bool GetDecodeRegions(const std::vector<JpegRegion> &_rois, int _rawwidth, int _rawheight, std::vector<JpegRegion> &_regions);
 
     bool ReadParameter(FILE *pfile, string &aktparamgraph);
     bool doFlow(string time);
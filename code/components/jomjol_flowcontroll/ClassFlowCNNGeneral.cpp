@@ -6,6 +6,7 @@
 #include <sstream>      // std::stringstream
 
 #include "CTfLiteClass.h"
+#include "CRoiSampler.h"
 #include "ClassLogFile.h"
 #include "esp_log.h"
 #include "../../include/defines.h"
@@ -19,7 +20,7 @@ static const char* TAG = "CNN";
     static heap_trace_record_t trace_record[NUM_RECORDS]; // This buffer must be in internal RAM
 #endif
 
-ClassFlowCNNGeneral::ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNType _cnntype) : ClassFlowImage(NULL, TAG) {
+ClassFlowCNNGeneral::ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNType _cnntype, CImageSlab *_roislab) : ClassFlowImage(NULL, TAG), localSlab("ROI images") {
     string cnnmodelfile = "";
     modelxsize = 1;
     modelysize = 1;
@@ -32,9 +33,21 @@ ClassFlowCNNGeneral::ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNTy
     CNNType = AutoDetect;
     CNNType = _cnntype;
     flowpostalignment = _flowalign;
+    roiSlab = (_roislab != NULL) ? _roislab : &localSlab;
     imagesRetention = 5;
 }
 
+ClassFlowCNNGeneral::~ClassFlowCNNGeneral() {
+    // The ROI images belong to the slab
+    for (int _ana = 0; _ana < GENERAL.size(); ++_ana) {
+        for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i) {
+            delete GENERAL[_ana]->ROI[i];
+        }
+
+        delete GENERAL[_ana];
+    }
+}
+
 string ClassFlowCNNGeneral::getReadout(int _analog = 0, bool _extendedResolution, int prev, float _before_narrow_Analog, float AnalogToDigitTransitionStart) {
     string result = "";    
 
@@ -368,7 +381,7 @@ bool ClassFlowCNNGeneral::ReadParameter(FILE* pfile, string& aktparamgraph) {
             
             neuroi->result_float = -1;
             neuroi->image = NULL;
-            neuroi->image_org = NULL;
+            neuroi->image_org = ImageView();
         }
 
         if ((toUpper(splitted[0]) == "SAVEALLFILES") && (splitted.size() > 1)) {
@@ -382,12 +395,27 @@ bool ClassFlowCNNGeneral::ReadParameter(FILE* pfile, string& aktparamgraph) {
         return false;
     }
 
+    // The resized ROI image has the channels of the pipeline (RGB or luminance with TakeImage LuminanceOnly),
+    // CTfLiteClass::LoadInputImage adapts them to the channels of the model input. It is only filled
+    // for saved files and the web UI, the model input is sampled directly from the original ROI.
+    // The original ROI is only a view into the aligned image, set in every round (doAlignAndCut).
+    int imagechannels = 3;
+    if ((flowpostalignment != NULL) && (flowpostalignment->ImageBasis != NULL)) {
+        imagechannels = flowpostalignment->ImageBasis->channels;
+    }
+
+    // All ROI images of the flow are laid out in one block. The slab belongs to the flow control, a reload with
+    // the same ROIs and model size keeps the block and doesn't leave holes between other allocations.
+    int slabsize = 0;
+    for (int _ana = 0; _ana < GENERAL.size(); ++_ana) {
+        slabsize += GENERAL[_ana]->ROI.size() * CImageSlab::Bytes(modelxsize, modelysize, imagechannels);
+    }
+    roiSlab->Reserve(slabsize);
+
     for (int _ana = 0; _ana < GENERAL.size(); ++_ana) {
         for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i) {
-            GENERAL[_ana]->ROI[i]->image = new CImageBasis("ROI " + GENERAL[_ana]->ROI[i]->name, 
-                    modelxsize, modelysize, modelchannel);
-            GENERAL[_ana]->ROI[i]->image_org = new CImageBasis("ROI " + GENERAL[_ana]->ROI[i]->name + " original",
-                    GENERAL[_ana]->ROI[i]->deltax, GENERAL[_ana]->ROI[i]->deltay, 3);
+            GENERAL[_ana]->ROI[i]->image = roiSlab->Carve("ROI " + GENERAL[_ana]->ROI[i]->name, 
+                    modelxsize, modelysize, imagechannels);
         }
     }
 
@@ -510,17 +538,40 @@ bool ClassFlowCNNGeneral::doAlignAndCut(string time) {
         for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i) {
             ESP_LOGD(TAG, "General %d - Align&Cut", i);
             
-            caic->CutAndSave(GENERAL[_ana]->ROI[i]->posx, GENERAL[_ana]->ROI[i]->posy, GENERAL[_ana]->ROI[i]->deltax, GENERAL[_ana]->ROI[i]->deltay, GENERAL[_ana]->ROI[i]->image_org);
+            GENERAL[_ana]->ROI[i]->image_org = caic->GetView(GENERAL[_ana]->ROI[i]->posx, GENERAL[_ana]->ROI[i]->posy, GENERAL[_ana]->ROI[i]->deltax, GENERAL[_ana]->ROI[i]->deltay);
             if (SaveAllFiles) {
                 if (GENERAL[_ana]->name == "default") {
-                    GENERAL[_ana]->ROI[i]->image_org->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
+                    CImageBasis::SaveToFile(GENERAL[_ana]->ROI[i]->image_org, FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
                 }
                 else {
-                    GENERAL[_ana]->ROI[i]->image_org->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
+                    CImageBasis::SaveToFile(GENERAL[_ana]->ROI[i]->image_org, FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
                 }
             } 
+        }
+    }
+
+    return true;
+} 
+
+/* The model input is resampled directly from the view into the input tensor (doNeuralNetwork), the small ROI images
+ * with the same content are filled after the network in the flow, the web server only reads them. They stay
+ * consistent with the values of the round. */
+void ClassFlowCNNGeneral::doROIImages() {
+    CAlignAndCutImage *caic = flowpostalignment->GetAlignAndCutImage();
+
+    if (caic->RGBImageLockRead() == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "doROIImages: Aligned image not available, ROI images not updated");
+        return;
+    }
+
+    for (int _ana = 0; _ana < GENERAL.size(); ++_ana) {
+        for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i) {
+            if (!GENERAL[_ana]->ROI[i]->image || !caic->Contains(GENERAL[_ana]->ROI[i]->image_org)) {
+                continue;
+            }
+
+            CRoiSampler::Resample(GENERAL[_ana]->ROI[i]->image_org, GENERAL[_ana]->ROI[i]->image);
 
-            GENERAL[_ana]->ROI[i]->image_org->Resize(modelxsize, modelysize, GENERAL[_ana]->ROI[i]->image);
             if (SaveAllFiles) {
                 if (GENERAL[_ana]->name == "default") {
                     GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
@@ -528,34 +579,32 @@ bool ClassFlowCNNGeneral::doAlignAndCut(string time) {
                 else {
                     GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
                 }
-            } 
+            }
         }
     }
 
-    return true;
-} 
+    caic->RGBImageReleaseRead();
+}
 
-void ClassFlowCNNGeneral::DrawROI(CImageBasis *_zw) {
-    if (_zw->ImageOkay()) { 
-        if (CNNType == Analogue || CNNType == Analogue100) {
-            int r = 0;
-            int g = 255;
-            int b = 0;
-
-            for (int _ana = 0; _ana < GENERAL.size(); ++_ana) {
-                for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i) {
-                    _zw->drawRect(GENERAL[_ana]->ROI[i]->posx, GENERAL[_ana]->ROI[i]->posy, GENERAL[_ana]->ROI[i]->deltax, GENERAL[_ana]->ROI[i]->deltay, r, g, b, 1);
-                    _zw->drawEllipse( (int) (GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax/2), (int)  (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay/2), (int) (GENERAL[_ana]->ROI[i]->deltax/2), (int) (GENERAL[_ana]->ROI[i]->deltay/2), r, g, b, 2);
-                    _zw->drawLine((int) (GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax/2), (int) GENERAL[_ana]->ROI[i]->posy, (int) (GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax/2), (int) (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay), r, g, b, 2);
-                    _zw->drawLine((int) GENERAL[_ana]->ROI[i]->posx, (int) (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay/2), (int) GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax, (int) (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay/2), r, g, b, 2);
-                }
+void ClassFlowCNNGeneral::DrawROI(CImageOverlay *_overlay) {
+    if (CNNType == Analogue || CNNType == Analogue100) {
+        int r = 0;
+        int g = 255;
+        int b = 0;
+
+        for (int _ana = 0; _ana < GENERAL.size(); ++_ana) {
+            for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i) {
+                _overlay->AddRect(GENERAL[_ana]->ROI[i]->posx, GENERAL[_ana]->ROI[i]->posy, GENERAL[_ana]->ROI[i]->deltax, GENERAL[_ana]->ROI[i]->deltay, r, g, b, 1);
+                _overlay->AddEllipse( (int) (GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax/2), (int)  (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay/2), (int) (GENERAL[_ana]->ROI[i]->deltax/2), (int) (GENERAL[_ana]->ROI[i]->deltay/2), r, g, b, 2);
+                _overlay->AddLine((int) (GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax/2), (int) GENERAL[_ana]->ROI[i]->posy, (int) (GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax/2), (int) (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay), r, g, b, 2);
+                _overlay->AddLine((int) GENERAL[_ana]->ROI[i]->posx, (int) (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay/2), (int) GENERAL[_ana]->ROI[i]->posx + GENERAL[_ana]->ROI[i]->deltax, (int) (GENERAL[_ana]->ROI[i]->posy + GENERAL[_ana]->ROI[i]->deltay/2), r, g, b, 2);
             }
         }
-        else {
-            for (int _dig = 0; _dig < GENERAL.size(); ++_dig) {
-                for (int i = 0; i < GENERAL[_dig]->ROI.size(); ++i) {
-                    _zw->drawRect(GENERAL[_dig]->ROI[i]->posx, GENERAL[_dig]->ROI[i]->posy, GENERAL[_dig]->ROI[i]->deltax, GENERAL[_dig]->ROI[i]->deltay, 0, 0, (255 - _dig*100), 2);
-                }
+    }
+    else {
+        for (int _dig = 0; _dig < GENERAL.size(); ++_dig) {
+            for (int i = 0; i < GENERAL[_dig]->ROI.size(); ++i) {
+                _overlay->AddRect(GENERAL[_dig]->ROI[i]->posx, GENERAL[_dig]->ROI[i]->posy, GENERAL[_dig]->ROI[i]->deltax, GENERAL[_dig]->ROI[i]->deltay, 0, 0, (255 - _dig*100), 2);
             }
         }
     }
@@ -674,7 +723,7 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time) {
                         float f1, f2;
                         f1 = 0; f2 = 0;
 
-                        tflite->LoadInputImageBasis(GENERAL[n]->ROI[roi]->image);        
+                        tflite->LoadInputImage(GENERAL[n]->ROI[roi]->image_org);        
                         tflite->Invoke();
                         LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "After Invoke");
 
@@ -699,7 +748,7 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time) {
                     LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "CNN Type: Digit");
                     {
                         GENERAL[n]->ROI[roi]->result_klasse = 0;
-                        GENERAL[n]->ROI[roi]->result_klasse = tflite->GetClassFromImageBasis(GENERAL[n]->ROI[roi]->image);
+                        GENERAL[n]->ROI[roi]->result_klasse = tflite->GetClassFromImage(GENERAL[n]->ROI[roi]->image_org);
                         ESP_LOGD(TAG, "General result (Digit)%i: %d", roi, GENERAL[n]->ROI[roi]->result_klasse);
 
                         if (isLogImage) {
@@ -723,7 +772,7 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time) {
                         float _fit;
                         float _result_save_file;
 
-                        tflite->LoadInputImageBasis(GENERAL[n]->ROI[roi]->image);        
+                        tflite->LoadInputImage(GENERAL[n]->ROI[roi]->image_org);        
                         tflite->Invoke();
                         LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "After Invoke");
 
@@ -794,7 +843,7 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time) {
                         int _num;
                         float _result_save_file;
                         
-                        tflite->LoadInputImageBasis(GENERAL[n]->ROI[roi]->image);        
+                        tflite->LoadInputImage(GENERAL[n]->ROI[roi]->image_org);        
                         tflite->Invoke();
     
                         _num = tflite->GetOutClassification();
@@ -834,6 +883,8 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time) {
 
     delete tflite;
 
+    doROIImages();
+
     return true;
 }
 
@@ -852,6 +903,7 @@ std::vector<HTMLInfo*> ClassFlowCNNGeneral::GetHTMLInfo() {
         for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i) {
             ESP_LOGD(TAG, "Image: %d", (int) GENERAL[_ana]->ROI[i]->image);
             if (GENERAL[_ana]->ROI[i]->image) {
+                // Filled by the flow (doROIImages)
                 if (GENERAL[_ana]->name == "default") {
                     GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
                 }
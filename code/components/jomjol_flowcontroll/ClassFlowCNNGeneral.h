@@ -5,6 +5,7 @@
 
 #include"ClassFlowDefineTypes.h"
 #include "ClassFlowAlignment.h"
+#include "CImageSlab.h"
 
 
 enum t_CNNType {
@@ -34,6 +35,9 @@ protected:
 
     bool SaveAllFiles;   
 
+    CImageSlab* roiSlab;        // Resized ROI images of all numbers, one PSRAM block sized at config load
+    CImageSlab localSlab;       // Used without a slab from the flow control
+
     int PointerEvalAnalogNew(float zahl, int numeral_preceder);
     int PointerEvalAnalogToDigitNew(float zahl, float numeral_preceder,  int eval_predecessors, float AnalogToDigitTransitionStart);
     int PointerEvalHybridNew(float zahl, float number_of_predecessors, int eval_predecessors, bool Analog_Predecessors = false, float AnalogToDigitTransitionStart=9.2);
@@ -42,11 +46,16 @@ protected:
 
     bool doNeuralNetwork(string time); 
     bool doAlignAndCut(string time);
+    void doROIImages();
 
     bool getNetworkParameter();
 
 public:
-    ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNType _cnntype = AutoDetect);
+    /**
+     * @param _roislab Slab of the ROI images, kept by the flow control over config reloads (NULL: own slab of the flow)
+     */
+    ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNType _cnntype = AutoDetect, CImageSlab *_roislab = NULL);
+    ~ClassFlowCNNGeneral();
 
     bool ReadParameter(FILE* pfile, string& aktparamgraph);
     bool doFlow(string time);
@@ -56,7 +65,7 @@ public:
 
     string getReadoutRawString(int _analog);  
 
-    void DrawROI(CImageBasis *_zw); 
+    void DrawROI(CImageOverlay *_overlay);
 
    	std::vector<HTMLInfo*> GetHTMLInfo();   
 
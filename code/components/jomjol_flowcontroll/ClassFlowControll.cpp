@@ -27,6 +27,8 @@ extern "C" {
 #include "server_help.h"
 #include "MainFlowControl.h"
 #include "basic_auth.h"
+#include "CRoiSampler.h"
+#include "CRoundArena.h"
 #include "../../include/defines.h"
 
 static const char* TAG = "FLOWCTRL";
@@ -175,21 +177,19 @@ t_CNNType ClassFlowControll::GetTypeAnalog()
     return t_CNNType::None;
 }
 
-#ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
-void ClassFlowControll::DigitDrawROI(CImageBasis *_zw)
+void ClassFlowControll::DigitDrawROI(CImageOverlay *_overlay)
 {
     if (flowdigit) {
-        flowdigit->DrawROI(_zw);
+        flowdigit->DrawROI(_overlay);
     }
 }
 
-void ClassFlowControll::AnalogDrawROI(CImageBasis *_zw)
+void ClassFlowControll::AnalogDrawROI(CImageOverlay *_overlay)
 {
     if (flowanalog) {
-        flowanalog->DrawROI(_zw);
+        flowanalog->DrawROI(_overlay);
     }
 }
-#endif
 
 #ifdef ENABLE_MQTT
 bool ClassFlowControll::StartMQTTService() 
@@ -212,12 +212,46 @@ void ClassFlowControll::SetInitialParameter(void)
     flowdigit = NULL;
     flowanalog = NULL;
     flowpostprocessing = NULL;
+    flowtakeimage = NULL;
+    flowalignment = NULL;
     disabled = false;
     aktRunNr = 0;
     aktstatus = "Flow task not yet created";
     aktstatusWithTime = aktstatus;
 }
 
+/* TakeImage option DecodeRegionsOnly: pass the raw image areas needed by alignment and ROIs to the capture,
+ * an empty list (e.g. before the first alignment) decodes the full image */
+void ClassFlowControll::SetDecodeRegions(void)
+{
+    if ((flowtakeimage == NULL) || !flowtakeimage->getDecodeRegionsOnly()) {
+        return;
+    }
+
+    std::vector<JpegRegion> rois, regions;
+    ClassFlowCNNGeneral* cnnflows[] = {flowdigit, flowanalog};
+
+    for (ClassFlowCNNGeneral* cnn : cnnflows) {
+        if (cnn == NULL) {
+            continue;
+        }
+
+        for (int i = 0; i < cnn->getNumberGENERAL(); ++i) {
+            general* _gen = cnn->GetGENERAL(i);
+
+            for (int j = 0; j < _gen->ROI.size(); ++j) {
+                rois.push_back({_gen->ROI[j]->posx, _gen->ROI[j]->posy, _gen->ROI[j]->deltax, _gen->ROI[j]->deltay});
+            }
+        }
+    }
+
+    if ((flowalignment == NULL) || rois.empty() || !flowalignment->GetDecodeRegions(rois, CCstatus.ImageWidth, CCstatus.ImageHeight, regions)) {
+        regions.clear();
+    }
+
+    flowtakeimage->SetDecodeRegions(regions);
+}
+
 bool ClassFlowControll::getIsAutoStart(void)
 {
     //return AutoStart;
@@ -246,12 +280,12 @@ ClassFlow* ClassFlowControll::CreateClassFlow(std::string _type)
     }
 	
     if (toUpper(_type).compare("[ANALOG]") == 0) {
-        cfc = new ClassFlowCNNGeneral(flowalignment);
+        cfc = new ClassFlowCNNGeneral(flowalignment, AutoDetect, &analogSlab);
         flowanalog = (ClassFlowCNNGeneral*) cfc;
     }
 	
     if (toUpper(_type).compare(0, 7, "[DIGITS") == 0) {
-        cfc = new ClassFlowCNNGeneral(flowalignment);
+        cfc = new ClassFlowCNNGeneral(flowalignment, AutoDetect, &digitSlab);
         flowdigit = (ClassFlowCNNGeneral*) cfc;
     }
 	
@@ -318,6 +352,24 @@ void ClassFlowControll::InitFlow(std::string config)
     string line;
     flowpostprocessing = NULL;
 
+    // A reload replaces the flows of the previous configuration, they must not run any more: the slabs with their
+    // ROI images are handed to the new CNN flows
+    for (int i = 0; i < FlowControll.size(); ++i) {
+        delete FlowControll[i];
+    }
+
+    FlowControll.clear();
+    flowdigit = NULL;
+    flowanalog = NULL;
+    flowtakeimage = NULL;
+    flowalignment = NULL;
+
+    RoiSamplerCache.Invalidate();       // ROI and model sizes may change with the configuration
+
+    if (RoundArena.Size() == 0) {
+        RoundArena.Reserve(ROUND_ARENA_SIZE);
+    }
+
     ClassFlow* cfc;
     FILE* pFile;
     config = FormatFileName(config);
@@ -352,6 +404,15 @@ void ClassFlowControll::InitFlow(std::string config)
     }
 
     fclose(pFile);
+
+    // Slabs of CNN flows which are not configured any more
+    if (flowdigit == NULL) {
+        digitSlab.Free();
+    }
+
+    if (flowanalog == NULL) {
+        analogSlab.Free();
+    }
 }
 
 std::string* ClassFlowControll::getActStatusWithTime()
@@ -407,6 +468,8 @@ bool ClassFlowControll::doFlow(string time)
 
     //checkNtpStatus(0);
 
+    SetDecodeRegions();
+
     for (int i = 0; i < FlowControll.size(); ++i) {
         zw_time = getCurrentTimeString("%H:%M:%S");
         aktstatus = TranslateAktstatus(FlowControll[i]->name());
@@ -441,6 +504,19 @@ bool ClassFlowControll::doFlow(string time)
         #endif
     }
 
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Frame buffers: peak " + std::to_string(CImageBuffer::Peak()) + " live this round, " +
+                                            std::to_string(CImageBuffer::Live()) + " now, " + std::to_string(CImageBuffer::SharedCopies()) +
+                                            " copies shared, " + std::to_string(CImageBuffer::CopiesOnWrite()) + " copied on write");
+    CImageBuffer::NextRound();
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "ROI resampling plans: " + std::to_string(RoiSamplerCache.Plans()) + " cached, " +
+                                            std::to_string(RoiSamplerCache.hits) + " hits, " + std::to_string(RoiSamplerCache.misses) + " misses");
+
+    // All temporary buffers of the round are released at once
+    RoundArena.Reset();
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Round arena: high water " + std::to_string(RoundArena.RoundHighWater()) + " of " +
+                                            std::to_string(RoundArena.Size()) + " bytes, " + std::to_string(RoundArena.allocations) +
+                                            " allocations, " + std::to_string(RoundArena.overflows) + " overflows to the heap");
+
     zw_time = getCurrentTimeString("%H:%M:%S");
     aktstatus = "Flow finished";
     aktstatusWithTime = aktstatus + " (" + zw_time + ")";
@@ -693,12 +769,24 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
     #endif
 
     CImageBasis *_send = NULL;
+    const CImageOverlay *_sendoverlay = NULL;   // Reference boxes and ROIs, drawn by the encoder
+    ImageView _sendview;        // ROI original: view into the aligned image
     esp_err_t result = ESP_FAIL;
-    bool _sendDelete = false;
 
-    if (_fn == "alg.jpg") {
+    // "?overlay=1" draws the reference boxes and ROIs onto alg.jpg, "?overlay=0" leaves them out of alg_roi.jpg
+    int overlay = -1;
+    char query[64], value[4];      // The web UI appends "?timestamp=..."
+    if ((httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) &&
+        (httpd_query_key_value(query, "overlay", value, sizeof(value)) == ESP_OK)) {
+        overlay = (atoi(value) != 0) ? 1 : 0;
+    }
+
+    if ((_fn == "alg.jpg") || ((_fn == "alg_roi.jpg") && (overlay == 0))) {
         if (flowalignment && flowalignment->ImageBasis->ImageOkay()) {
             _send = flowalignment->ImageBasis;
+            if (overlay == 1) {
+                _sendoverlay = &flowalignment->Overlay;
+            }
         }
         else {
             LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "ClassFlowControll::GetJPGStream: alg.jpg cannot be served");
@@ -833,24 +921,14 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
                 return ESP_FAIL;
             }
 
-            _send = new CImageBasis("alg_roi", flowalignment->ImageBasis);
-			
-            if (_send->ImageOkay()) {
-                if (flowalignment) { flowalignment->DrawRef(_send); }
-                if (flowdigit) { flowdigit->DrawROI(_send); }
-                if (flowanalog) { flowanalog->DrawROI(_send); }
-                _sendDelete = true; // delete temporary _send element after sending
+            // The overlay of the last round is drawn by the encoder, no copy of the aligned image
+            if (flowalignment->ImageBasis->ImageOkay()) {
+                _send = flowalignment->ImageBasis;
+                _sendoverlay = &flowalignment->Overlay;
             }
             else {
-                LogFile.WriteToFile(ESP_LOG_WARN, TAG, "ClassFlowControll::GetJPGStream: Not enough memory to create alg_roi.jpg -> alg.jpg is going to be served!");
-                
-                if (flowalignment && flowalignment->ImageBasis->ImageOkay()) {
-                    _send = flowalignment->ImageBasis;
-                }
-                else {
-                    httpd_resp_send(req, NULL, 0);
-                    return ESP_OK;
-                }
+                httpd_resp_send(req, NULL, 0);
+                return ESP_OK;
             }
         #endif
     }
@@ -868,15 +946,16 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
             }
 
             if (_fn == htmlinfo[i]->filename_org) {
-                if (htmlinfo[i]->image_org) {
-                    _send = htmlinfo[i]->image_org;
+                if (htmlinfo[i]->image_org.Valid()) {
+                    _sendview = htmlinfo[i]->image_org;
+                    _send = NULL;
                 }
             }
             delete htmlinfo[i];
         }
         htmlinfo.clear();
 
-        if (!_send) {
+        if (!_send && !_sendview.Valid()) {
             htmlinfo = GetAllAnalog();
             ESP_LOGD(TAG, "After getClassFlowControll::GetAllAnalog");
 	        
@@ -888,8 +967,9 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
                 }
 
                 if (_fn == htmlinfo[i]->filename_org) {
-                    if (htmlinfo[i]->image_org) {
-                        _send = htmlinfo[i]->image_org;
+                    if (htmlinfo[i]->image_org.Valid()) {
+                        _sendview = htmlinfo[i]->image_org;
+                        _send = NULL;
                     }
                 }
                 delete htmlinfo[i];
@@ -905,18 +985,32 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
     if (_send) {
         ESP_LOGD(TAG, "Sending file: %s ...", _fn.c_str());
         set_content_type_from_file(req, _fn.c_str());
-        result = _send->SendJPGtoHTTP(req);
+        // The overlay is only changed by the flow while it holds the image lock
+        result = _send->SendJPGtoHTTP(req, 90, _sendoverlay);
 	
         /* Respond with an empty chunk to signal HTTP response completion */
         httpd_resp_send_chunk(req, NULL, 0);
         ESP_LOGD(TAG, "File sending complete");
 
-        if (_sendDelete) {
-            delete _send;
-        }
-            
         _send = NULL;  
     }
+    else if (_sendview.Valid()) {
+        ESP_LOGD(TAG, "Sending file: %s ...", _fn.c_str());
+        set_content_type_from_file(req, _fn.c_str());
+        // The view points into the aligned image, the flow must not change it while encoding
+        CImageBasis *_viewimage = flowalignment ? flowalignment->ImageBasis : NULL;
+        bool locked = _viewimage && (_viewimage->RGBImageLockRead() != NULL);
+        // After a copy-on-write of the aligned image the view of the last round points into a released buffer
+        if (!locked || !_viewimage->Contains(_sendview)) {
+            LogFile.WriteToFile(ESP_LOG_WARN, TAG, "ClassFlowControll::GetJPGStream: " + _fn + " not available until the next round");
+        }
+        else {
+            result = CImageBasis::SendJPGtoHTTP(req, _sendview);
+        }
+        if (locked) { _viewimage->RGBImageReleaseRead(); }
+        httpd_resp_send_chunk(req, NULL, 0);
+        ESP_LOGD(TAG, "File sending complete");
+    }
 
     #ifdef DEBUG_DETAIL_ON 
         LogFile.WriteHeapInfo("ClassFlowControll::GetJPGStream - done");
@@ -33,7 +33,10 @@ protected:
 	ClassFlowCNNGeneral* flowdigit;
 //	ClassFlowDigit* flowdigit;
 	ClassFlowTakeImage* flowtakeimage;
+	CImageSlab digitSlab{"Digit ROI images"};	// ROI images of the CNN flows, kept over config reloads
+	CImageSlab analogSlab{"Analog ROI images"};
 	ClassFlow* CreateClassFlow(std::string _type);
+	void SetDecodeRegions(void);
 
 	bool AutoStart;
 	float AutoInterval;
@@ -60,10 +63,8 @@ public:
 
 	string TranslateAktstatus(std::string _input);
 
-	#ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
-	void DigitDrawROI(CImageBasis *_zw);
-	void AnalogDrawROI(CImageBasis *_zw);
-	#endif
+	void DigitDrawROI(CImageOverlay *_overlay);
+	void AnalogDrawROI(CImageOverlay *_overlay);
 
 	esp_err_t GetJPGStream(std::string _fn, httpd_req_t *req);
 	esp_err_t SendRawJPG(httpd_req_t *req);
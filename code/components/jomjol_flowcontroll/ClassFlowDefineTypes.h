@@ -15,7 +15,8 @@ struct roi {
     int result_klasse;
     bool isReject, CCW;
     string name;
-    CImageBasis *image, *image_org;
+    CImageBasis *image;         // Resized to the model input, owned by the ROI slab of the flow (CImageSlab)
+    ImageView image_org;        // ROI in the aligned image (no copy), valid until the next round
 };
 
 /**
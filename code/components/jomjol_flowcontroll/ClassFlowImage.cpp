@@ -61,6 +61,17 @@ string ClassFlowImage::CreateLogFolder(string time) {
 void ClassFlowImage::LogImage(string logPath, string name, float *resultFloat, int *resultInt, string time, CImageBasis *_img) {
 	if (!isLogImage)
 		return;
+
+	if (_img->RGBImageLockRead() == NULL)
+		return;
+
+	LogImage(logPath, name, resultFloat, resultInt, time, _img->GetView());
+	_img->RGBImageReleaseRead();
+}
+
+void ClassFlowImage::LogImage(string logPath, string name, float *resultFloat, int *resultInt, string time, const ImageView &_img) {
+	if (!isLogImage)
+		return;
 	
     
 	char buf[10];
@@ -86,10 +97,32 @@ void ClassFlowImage::LogImage(string logPath, string name, float *resultFloat, i
 	string output = "/sdcard/img_tmp/" + name + ".jpg";
 	output = FormatFileName(output);
 	ESP_LOGD(logTag, "save to file: %s", nm.c_str());
-	_img->SaveToFile(nm);
+	CImageBasis::SaveToFile(_img, nm);
 //	CopyFile(output, nm);
 }
 
+void ClassFlowImage::LogImage(string logPath, string name, string time, CImageBuffer *_jpeg) {
+	if (!isLogImage)
+		return;
+
+	string nm = FormatFileName(logPath + "/" + name + "_" + time + ".jpg");
+	ESP_LOGD(logTag, "save to file: %s", nm.c_str());
+	WriteJPG(nm, _jpeg);
+}
+
+bool ClassFlowImage::WriteJPG(string _file, CImageBuffer *_jpeg)
+{
+	FILE* file = fopen(_file.c_str(), "wb");
+	if (file == NULL) {
+		LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't write " + _file);
+		return false;
+	}
+
+	bool ok = fwrite(_jpeg->data, 1, _jpeg->size, file) == (size_t) _jpeg->size;
+	fclose(file);
+	return ok;
+}
+
 void ClassFlowImage::RemoveOldLogs()
 {
 	if (!isLogImage)
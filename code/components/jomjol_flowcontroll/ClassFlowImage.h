@@ -17,6 +17,10 @@ protected:
 
 	string CreateLogFolder(string time);
 	void LogImage(string logPath, string name, float *resultFloat, int *resultInt, string time, CImageBasis *_img);
+	void LogImage(string logPath, string name, float *resultFloat, int *resultInt, string time, const ImageView &_img);
+	void LogImage(string logPath, string name, string time, CImageBuffer *_jpeg);	// Encoded JPEG, written as it is
+
+	static bool WriteJPG(string _file, CImageBuffer *_jpeg);
 
 
 public:
@@ -17,6 +17,7 @@
 #include "psram.h"
 
 #include <time.h>
+#include <string.h>
 
 // #define DEBUG_DETAIL_ON
 // #define WIFITURNOFF
@@ -41,14 +42,41 @@ void ClassFlowTakeImage::takePictureWithFlash(int flash_duration)
 
     ESP_LOGD(TAG, "flash_duration: %d", flash_duration);
 
-    Camera.CaptureToBasisImage(rawImage, flash_duration);
+    // The raw image is only decoded partially if it is not saved or logged
+    const std::vector<JpegRegion> *regions = NULL;
+
+    if (DecodeRegionsOnly && !DecodeRegions.empty() && !CCstatus.SaveAllFiles && !isLogImage)
+    {
+        regions = &DecodeRegions;
+    }
+
+    // The sensor JPEG is kept for this round: logging, saving and sending the raw image need no encoding
+    CImageBuffer *jpeg = NULL;
+    Camera.CaptureToBasisImage(rawImage, flash_duration, regions, &jpeg);
+
+    rawJPGMutex.lock();
+    CImageBuffer *previous = rawJPG;
+    rawJPG = jpeg;
+    rawJPGMutex.unlock();
+
+    if (previous != NULL)
+    {
+        previous->Unref();
+    }
 
     time(&TimeImageTaken);
     localtime(&TimeImageTaken);
 
     if (CCstatus.SaveAllFiles)
     {
-        rawImage->SaveToFile(namerawimage);
+        if (jpeg != NULL)
+        {
+            WriteJPG(namerawimage, jpeg);
+        }
+        else
+        {
+            rawImage->SaveToFile(namerawimage);
+        }
     }
 }
 
@@ -58,6 +86,9 @@ void ClassFlowTakeImage::SetInitialParameter(void)
     rawImage = NULL;
     disabled = false;
     namerawimage = "/sdcard/img_tmp/raw.jpg";
+    DecodeRegionsOnly = false;
+    LuminanceOnly = false;
+    rawJPG = NULL;
 }
 
 // auslesen der Kameraeinstellungen aus der config.ini
@@ -504,6 +535,16 @@ bool ClassFlowTakeImage::ReadParameter(FILE *pfile, string &aktparamgraph)
             }
         }
 
+        else if ((toUpper(splitted[0]) == "DECODEREGIONSONLY") && (splitted.size() > 1))
+        {
+            DecodeRegionsOnly = alphanumericToBoolean(splitted[1]);
+        }
+
+        else if ((toUpper(splitted[0]) == "LUMINANCEONLY") && (splitted.size() > 1))
+        {
+            LuminanceOnly = alphanumericToBoolean(splitted[1]);
+        }
+
         else if ((toUpper(splitted[0]) == "DEMO") && (splitted.size() > 1))
         {
             CCstatus.DemoMode = alphanumericToBoolean(splitted[1]);
@@ -518,7 +559,7 @@ bool ClassFlowTakeImage::ReadParameter(FILE *pfile, string &aktparamgraph)
     Camera.SetQualityZoomSize(CCstatus.ImageQuality, CCstatus.ImageFrameSize, CCstatus.ImageZoomEnabled, CCstatus.ImageZoomOffsetX, CCstatus.ImageZoomOffsetY, CCstatus.ImageZoomSize, CCstatus.ImageVflip);
 
     rawImage = new CImageBasis("rawImage");
-    rawImage->CreateEmptyImage(CCstatus.ImageWidth, CCstatus.ImageHeight, 3);
+    rawImage->CreateEmptyImage(CCstatus.ImageWidth, CCstatus.ImageHeight, LuminanceOnly ? 1 : 3);
 
     return true;
 }
@@ -573,7 +614,16 @@ bool ClassFlowTakeImage::doFlow(string zwtime)
     LogFile.WriteHeapInfo("ClassFlowTakeImage::doFlow - After takePictureWithFlash");
 #endif
 
-    LogImage(logPath, "raw", NULL, NULL, zwtime, rawImage);
+    CImageBuffer *jpeg = GetRawJPG();
+    if (jpeg != NULL)
+    {
+        LogImage(logPath, "raw", zwtime, jpeg);
+        jpeg->Unref();
+    }
+    else
+    {
+        LogImage(logPath, "raw", NULL, NULL, zwtime, rawImage);
+    }
 
     RemoveOldLogs();
 
@@ -586,8 +636,34 @@ bool ClassFlowTakeImage::doFlow(string zwtime)
     return true;
 }
 
+CImageBuffer *ClassFlowTakeImage::GetRawJPG(void)
+{
+    std::lock_guard<std::mutex> guard(rawJPGMutex);
+    return (rawJPG != NULL) ? rawJPG->Ref() : NULL;
+}
+
 esp_err_t ClassFlowTakeImage::SendRawJPG(httpd_req_t *req)
 {
+    // The JPEG of the last round as delivered by the sensor, a new picture is only taken if there is none yet
+    CImageBuffer *jpeg = GetRawJPG();
+    if (jpeg != NULL)
+    {
+        esp_err_t res = httpd_resp_set_type(req, "image/jpeg");
+
+        if (res == ESP_OK)
+        {
+            res = httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=raw.jpg");
+        }
+
+        if (res == ESP_OK)
+        {
+            res = httpd_resp_send(req, (const char *)jpeg->data, jpeg->size);
+        }
+
+        jpeg->Unref();
+        return res;
+    }
+
     int flash_duration = (int)(CCstatus.WaitBeforePicture * 1000);
     time(&TimeImageTaken);
     localtime(&TimeImageTaken);
@@ -597,7 +673,28 @@ esp_err_t ClassFlowTakeImage::SendRawJPG(httpd_req_t *req)
 
 ImageData *ClassFlowTakeImage::SendRawImage(void)
 {
-    CImageBasis *zw = new CImageBasis("SendRawImage", rawImage);
+    CImageBuffer *jpeg = GetRawJPG();
+    if (jpeg != NULL)
+    {
+        ImageData *id = NULL;
+
+        if (jpeg->size <= MAX_JPG_SIZE)
+        {
+            id = new ImageData;
+            memcpy(id->data, jpeg->data, jpeg->size);
+            id->size = jpeg->size;
+        }
+
+        jpeg->Unref();
+
+        if (id != NULL)
+        {
+            return id;
+        }
+    }
+
+    // Only the size of the raw image, the pixels are replaced by the new capture
+    CImageBasis *zw = new CImageBasis("SendRawImage", rawImage->width, rawImage->height, rawImage->channels);
     ImageData *id;
     int flash_duration = (int)(CCstatus.WaitBeforePicture * 1000);
     Camera.CaptureToBasisImage(zw, flash_duration);
@@ -614,7 +711,17 @@ time_t ClassFlowTakeImage::getTimeImageTaken(void)
     return TimeImageTaken;
 }
 
+void ClassFlowTakeImage::SetDecodeRegions(const std::vector<JpegRegion> &_regions)
+{
+    DecodeRegions = _regions;
+}
+
 ClassFlowTakeImage::~ClassFlowTakeImage(void)
 {
+    if (rawJPG != NULL)
+    {
+        rawJPG->Unref();
+    }
+
     delete rawImage;
 }
@@ -8,12 +8,18 @@
 #include "../../include/defines.h"
 
 #include <string>
+#include <mutex>
 
 class ClassFlowTakeImage : public ClassFlowImage
 {
 protected:
     time_t TimeImageTaken;
     string namerawimage;
+    bool DecodeRegionsOnly;
+    std::vector<JpegRegion> DecodeRegions;      // Raw image areas needed by the flow, empty = decode full image
+    bool LuminanceOnly;                         // Raw image with one channel (Y), the whole flow works on it
+    CImageBuffer *rawJPG;                       // Sensor JPEG of the current round, NULL if it could not be kept
+    std::mutex rawJPGMutex;                     // rawJPG is replaced by the flow and read by the web server
 
     esp_err_t camera_capture(void);
     void takePictureWithFlash(int flash_duration);
@@ -29,8 +35,11 @@ public:
     bool doFlow(string time);
     string getHTMLSingleStep(string host);
     time_t getTimeImageTaken(void);
+    bool getDecodeRegionsOnly(void) { return DecodeRegionsOnly; };
+    void SetDecodeRegions(const std::vector<JpegRegion> &_regions);
     string name() { return "ClassFlowTakeImage"; };
 
+    CImageBuffer *GetRawJPG(void);              // With a reference (Unref), NULL if there is none
     ImageData *SendRawImage(void);
     esp_err_t SendRawJPG(httpd_req_t *req);
 
@@ -18,6 +18,7 @@
 #include "ClassControllCamera.h"
 
 #include "ClassFlowControll.h"
+#include "CTemplateCache.h"
 
 #include "ClassLogFile.h"
 #include "server_GPIO.h"
@@ -944,6 +945,8 @@ esp_err_t handler_editflow(httpd_req_t *req)
             cim->SaveToFile(out);
             delete cim;
 
+            TemplateCache.Invalidate(out);      // mtime may not change within the resolution of the file system
+
             psram_deinit_shared_memory_for_take_image_step();
             zw = "CutImage Done";
         }
@@ -0,0 +1,74 @@
+#include "CAffineTransform.h"
+
+#include <math.h>
+
+
+CAffineTransform::CAffineTransform(int _width, int _height)
+{
+    m[0][0] = 1; m[0][1] = 0; m[0][2] = 0;
+    m[1][0] = 0; m[1][1] = 1; m[1][2] = 0;
+    width = _width;
+    height = _height;
+}
+
+
+bool CAffineTransform::IsIdentity()
+{
+    return (m[0][0] == 1) && (m[0][1] == 0) && (m[0][2] == 0) && (m[1][0] == 0) && (m[1][1] == 1) && (m[1][2] == 0);
+}
+
+
+void CAffineTransform::Translate(float _dx, float _dy)
+{
+    m[0][2] += _dx;
+    m[1][2] += _dy;
+}
+
+
+void CAffineTransform::Rotate(float _angle, float _centerx, float _centery)
+{
+    _angle = _angle / 180 * M_PI;
+    float c = cos(_angle);
+    float s = sin(_angle);
+
+    // Target = R * (source - center) + center
+    for (int col = 0; col < 3; ++col)
+    {
+        float x = m[0][col];
+        float y = m[1][col];
+        m[0][col] = c * x - s * y;
+        m[1][col] = s * x + c * y;
+    }
+
+    m[0][2] += _centerx - c * _centerx + s * _centery;
+    m[1][2] += _centery - s * _centerx - c * _centery;
+}
+
+
+void CAffineTransform::FlipImageSize()
+{
+    // Same (integer) offset of the center as CRotateImage::Rotate with _flip
+    Translate(height / 2 - width / 2, width / 2 - height / 2);
+
+    int zw = width;
+    width = height;
+    height = zw;
+}
+
+
+bool CAffineTransform::Inverse(float _inv[2][3])
+{
+    float det = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+    if (fabs(det) < 1e-6)
+        return false;
+
+    _inv[0][0] = m[1][1] / det;
+    _inv[0][1] = -m[0][1] / det;
+    _inv[1][0] = -m[1][0] / det;
+    _inv[1][1] = m[0][0] / det;
+    _inv[0][2] = -(_inv[0][0] * m[0][2] + _inv[0][1] * m[1][2]);
+    _inv[1][2] = -(_inv[1][0] * m[0][2] + _inv[1][1] * m[1][2]);
+
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#ifndef CAFFINETRANSFORM_H
+#define CAFFINETRANSFORM_H
+
+
+/**
+ * Affine transform of a frame, composed step by step (e.g. initial rotation, flip, alignment) and rendered
+ * in one pass by CRotateImage::Warp. m maps a source position onto its target position:
+ *   x_target = m[0][0] * x + m[0][1] * y + m[0][2],  y_target = m[1][0] * x + m[1][1] * y + m[1][2]
+ * width / height are the size of the target frame.
+ */
+class CAffineTransform
+{
+    public:
+        float m[2][3];
+        int width, height;
+
+        CAffineTransform(int _width, int _height);
+
+        bool IsIdentity();
+
+        /* The steps are applied after the steps added before */
+        void Translate(float _dx, float _dy);
+        void Rotate(float _angle, float _centerx, float _centery);      // Degree, same direction as CRotateImage::Rotate
+        void FlipImageSize();                                           // Swap width and height, content stays centered
+
+        /**
+         * @brief Inverse mapping (target position -> source position) in the same layout as m
+         * @return false if the transform is not invertible
+         */
+        bool Inverse(float _inv[2][3]);
+};
+
+#endif //CAFFINETRANSFORM_H
@@ -4,7 +4,12 @@
 
 #include <math.h>
 #include <algorithm>
+#include <atomic>
+#include <string.h>
 #include <esp_log.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "psram.h"
 #include "../../include/defines.h"
 
@@ -20,7 +25,7 @@ CAlignAndCutImage::CAlignAndCutImage(std::string _name, CImageBasis *_org, CImag
     bpp = _org->bpp;
     externalImage = true;   
 
-    islocked = false; 
+    ShareLock(_org);
 
     ImageTMP = _temp;
 }
@@ -33,62 +38,191 @@ void CAlignAndCutImage::GetRefSize(int *ref_dx, int *ref_dy)
     ref_dy[1] = t1_dy;
 }
 
-bool CAlignAndCutImage::Align(RefInfo *_temp1, RefInfo *_temp2)
+/* References shared by the matching tasks, every task takes the next unmatched reference */
+struct AlignMatchJob {
+    CImageBasis* image;
+    RefInfo* refs;
+    int count;
+    std::atomic<int> next;
+    bool isSimilar[ALIGN_MAX_REFERENCES];
+    SemaphoreHandle_t done;
+};
+
+
+static void MatchReferences(AlignMatchJob* _job)
 {
-    int dx, dy;
-    int r0_x, r0_y, r1_x, r1_y;
-    bool isSimilar1, isSimilar2;
+    CImageBasis* image = _job->image;
+    CFindTemplate ft("align", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+
+    for (int i = _job->next++; i < _job->count; i = _job->next++)
+    {
+        RefInfo* ref = &_job->refs[i];
+        ESP_LOGD(TAG, "Before ft.FindTemplate(); %s", ref->image_file.c_str());
+        ref->match_rms = -1;
+        _job->isSimilar[i] = ft.FindTemplate(ref);
+        ref->width = ft.tpl_width;
+        ref->height = ft.tpl_height;
+    }
+}
 
-    CFindTemplate* ft = new CFindTemplate("align", rgb_image, channels, width, height, bpp);
 
-    r0_x = _temp1->target_x;
-    r0_y = _temp1->target_y;
-    ESP_LOGD(TAG, "Before ft->FindTemplate(_temp1); %s", _temp1->image_file.c_str());
-    isSimilar1 = ft->FindTemplate(_temp1);
-    _temp1->width = ft->tpl_width;
-    _temp1->height = ft->tpl_height; 
+static void task_MatchReferences(void* _param)
+{
+    AlignMatchJob* job = (AlignMatchJob*) _param;
+    MatchReferences(job);
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
 
-    r1_x = _temp2->target_x;
-    r1_y = _temp2->target_y;
-    ESP_LOGD(TAG, "Before ft->FindTemplate(_temp2); %s", _temp2->image_file.c_str());
-    isSimilar2 = ft->FindTemplate(_temp2);
-    _temp2->width = ft->tpl_width;
-    _temp2->height = ft->tpl_height; 
 
-    delete ft;
+/* Least squares fit of the rigid transform (rotation about the centroid + translation) which maps the found positions
+ * of all references without outlier flag onto their target positions. Sets the residual of all matched references. */
+static void FitAlignment(RefInfo* _refs, int _count, float &_dx, float &_dy, float &_angle, float &_center_x, float &_center_y)
+{
+    float found_x = 0, found_y = 0, target_x = 0, target_y = 0;
+    int n = 0;
 
+    for (int i = 0; i < _count; ++i)
+    {
+        if (_refs[i].outlier)
+            continue;
+        found_x += _refs[i].found_x + _refs[i].subpixel_x;
+        found_y += _refs[i].found_y + _refs[i].subpixel_y;
+        target_x += _refs[i].target_x;
+        target_y += _refs[i].target_y;
+        n++;
+    }
 
-    dx = _temp1->target_x - _temp1->found_x;
-    dy = _temp1->target_y - _temp1->found_y;
+    found_x /= n;
+    found_y /= n;
+    target_x /= n;
+    target_y /= n;
 
-    r0_x += dx;
-    r0_y += dy;
+    float dot = 0, cross = 0;
+    for (int i = 0; i < _count; ++i)
+    {
+        if (_refs[i].outlier)
+            continue;
+        float ax = _refs[i].found_x + _refs[i].subpixel_x - found_x;
+        float ay = _refs[i].found_y + _refs[i].subpixel_y - found_y;
+        float bx = _refs[i].target_x - target_x;
+        float by = _refs[i].target_y - target_y;
+        dot += ax * bx + ay * by;
+        cross += ax * by - ay * bx;
+    }
 
-    r1_x += dx;
-    r1_y += dy;
+    _angle = (n > 1) ? atan2(cross, dot) : 0;
+    _dx = target_x - found_x;
+    _dy = target_y - found_y;
+    _center_x = target_x;
+    _center_y = target_y;
 
-    float w_org, w_ist, d_winkel;
+    float c = cos(_angle), s = sin(_angle);
+    for (int i = 0; i < _count; ++i)
+    {
+        if (_refs[i].match_rms < 0)
+            continue;
+        float ax = _refs[i].found_x + _refs[i].subpixel_x - found_x;
+        float ay = _refs[i].found_y + _refs[i].subpixel_y - found_y;
+        _refs[i].residual = hypot(c * ax - s * ay + target_x - _refs[i].target_x, s * ax + c * ay + target_y - _refs[i].target_y);
+    }
+}
 
-    w_org = atan2(_temp2->found_y - _temp1->found_y, _temp2->found_x - _temp1->found_x);
-    w_ist = atan2(r1_y - r0_y, r1_x - r0_x);
 
-    d_winkel = (w_ist - w_org) * 180 / M_PI;
+bool CAlignAndCutImage::Align(RefInfo *_refs, int _count, CAffineTransform *_initial, bool _antialiasing)
+{
+    AlignMatchJob job;
+    job.image = (_initial != NULL) ? ImageTMP : (CImageBasis*) this;
+    job.refs = _refs;
+    job.count = std::min(_count, ALIGN_MAX_REFERENCES);
+    job.next = 0;
+    job.done = NULL;
+
+    // Match the references on both cores, the calling task takes part in the matching
+    bool parallel = false;
+#if portNUM_PROCESSORS > 1
+    if (job.count > 1)
+    {
+        job.done = xSemaphoreCreateBinary();
+        if (job.done != NULL)
+            parallel = (xTaskCreatePinnedToCore(&task_MatchReferences, "task_MatchRef", ALIGN_MATCH_TASK_STACK, &job,
+                                                uxTaskPriorityGet(NULL), NULL, 1 - xPortGetCoreID()) == pdPASS);
+        if (!parallel)
+            LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Align: Creation of task_MatchRef failed, matching on one core");
+    }
+#endif
 
-/*#ifdef DEBUG_DETAIL_ON
-    std::string zw = "\tdx:\t" + std::to_string(dx) + "\tdy:\t" + std::to_string(dy) + "\td_winkel:\t" + std::to_string(d_winkel);
-    zw = zw + "\tt1_x_y:\t" + std::to_string(_temp1->found_x) + "\t" + std::to_string(_temp1->found_y);
-    zw = zw + "\tpara1_found_min_avg_max_SAD:\t" + std::to_string(_temp1->fastalg_min) + "\t" + std::to_string(_temp1->fastalg_avg) + "\t" + std::to_string(_temp1->fastalg_max) + "\t"+ std::to_string(_temp1->fastalg_SAD);
-    zw = zw + "\tt2_x_y:\t" + std::to_string(_temp2->found_x) + "\t" + std::to_string(_temp2->found_y);
-    zw = zw + "\tpara2_found_min_avg_max:\t" + std::to_string(_temp2->fastalg_min) + "\t" + std::to_string(_temp2->fastalg_avg) + "\t" + std::to_string(_temp2->fastalg_max) + "\t"+ std::to_string(_temp2->fastalg_SAD);
-    LogFile.WriteToDedicatedFile("/sdcard/alignment.txt", zw);
-#endif*/
+    MatchReferences(&job);
+
+    if (parallel)
+        xSemaphoreTake(job.done, portMAX_DELAY);
+    if (job.done != NULL)
+        vSemaphoreDelete(job.done);
+
+    bool isSimilar = true;
+    int inliers = 0;
+
+    for (int i = 0; i < job.count; ++i)
+    {
+        isSimilar = isSimilar && job.isSimilar[i];
+        _refs[i].residual = -1;
+        _refs[i].outlier = (_refs[i].match_rms < 0);
+        if (!_refs[i].outlier)
+            inliers++;
+    }
 
     CRotateImage rt("Align", this, ImageTMP);
-    rt.Translate(dx, dy);
-    rt.Rotate(d_winkel, _temp1->target_x, _temp1->target_y);
-    ESP_LOGD(TAG, "Alignment: dx %d - dy %d - rot %f", dx, dy, d_winkel);
 
-    return (isSimilar1 && isSimilar2);
+    if (inliers == 0)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Align: No reference found, image not aligned");
+        if ((_initial != NULL) && !rt.Warp(*_initial, _antialiasing))
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Align: Image not available, initial rotation not applied");
+        return false;
+    }
+
+    // Reject the worst reference as long as its residual is too large. With two references the residuals are
+    // always equal, an outlier can't be identified.
+    float dx, dy, angle, center_x, center_y;
+
+    while (true)
+    {
+        FitAlignment(_refs, job.count, dx, dy, angle, center_x, center_y);
+
+        if (inliers <= 2)
+            break;
+
+        int worst = -1;
+        for (int i = 0; i < job.count; ++i)
+            if (!_refs[i].outlier && ((worst < 0) || (_refs[i].residual > _refs[worst].residual)))
+                worst = i;
+
+        if (_refs[worst].residual <= ALIGN_MAX_RESIDUAL)
+            break;
+
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Align: " + _refs[worst].image_file + " rejected, residual " + std::to_string(_refs[worst].residual));
+        _refs[worst].outlier = true;
+        inliers--;
+    }
+
+    float d_winkel = angle * 180 / M_PI;
+
+    // Initial rotation/flip, shift and rotation rendered in one pass
+    CAffineTransform transform = (_initial != NULL) ? *_initial : CAffineTransform(width, height);
+    transform.Translate(dx, dy);
+    transform.Rotate(d_winkel, center_x, center_y);
+    if (!rt.Warp(transform, _antialiasing))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Align: Image not available, image not aligned");
+        return false;
+    }
+    ESP_LOGD(TAG, "Alignment: dx %f - dy %f - rot %f, %d of %d references", dx, dy, d_winkel, inliers, job.count);
+
+    for (int i = 0; i < job.count; ++i)
+        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Alignment: " + _refs[i].image_file + " residual " + std::to_string(_refs[i].residual) +
+                            ", confidence " + std::to_string(_refs[i].confidence) + (_refs[i].outlier ? " (outlier)" : ""));
+
+    return isSimilar;
 }
 
 
@@ -108,13 +242,24 @@ void CAlignAndCutImage::CutAndSave(std::string _template1, int x1, int y1, int d
     dx = x2 - x1;
     dy = y2 - y1;
 
+    // Called by the web server (reference update) while the flow may reset the round arena: own allocation
     int memsize = dx * dy * channels;
-    uint8_t* odata = (unsigned char*) malloc_psram_heap(std::string(TAG) + "->odata", memsize, MALLOC_CAP_SPIRAM);
+    uint8_t* odata = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->CutAndSave", memsize, MALLOC_CAP_SPIRAM);
+
+    if (odata == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CutAndSave: Can't allocate " + std::to_string(memsize) + " bytes for " + _template1);
+        return;
+    }
 
     stbi_uc* p_target;
     stbi_uc* p_source;
 
-    RGBImageLock();
+    if (RGBImageLockRead() == NULL)
+    {
+        free_psram_heap(std::string(TAG) + "->CutAndSave", odata);
+        return;
+    }
 
     for (int x = x1; x < x2; ++x)
         for (int y = y1; y < y2; ++y)
@@ -132,9 +277,9 @@ void CAlignAndCutImage::CutAndSave(std::string _template1, int x1, int y1, int d
 #endif
     
 
-    RGBImageRelease();
+    RGBImageReleaseRead();
 
-    stbi_image_free(odata);
+    free_psram_heap(std::string(TAG) + "->CutAndSave", odata);
 }
 
 void CAlignAndCutImage::CutAndSave(int x1, int y1, int dx, int dy, CImageBasis *_target)
@@ -156,21 +301,23 @@ void CAlignAndCutImage::CutAndSave(int x1, int y1, int dx, int dy, CImageBasis *
     }
 
     uint8_t* odata = _target->RGBImageLock();
-    RGBImageLock();
+    if (odata == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CutAndSave: Target image not available");
+        return;
+    }
 
-    stbi_uc* p_target;
-    stbi_uc* p_source;
+    if (RGBImageLockRead() == NULL)
+    {
+        _target->RGBImageRelease();
+        return;
+    }
 
-    for (int x = x1; x < x2; ++x)
-        for (int y = y1; y < y2; ++y)
-        {
-            p_target = odata + (channels * ((y - y1) * dx + (x - x1)));
-            p_source = rgb_image + (channels * (y * width + x));
-            for (int _channels = 0; _channels < channels; ++_channels)
-                p_target[_channels] = p_source[_channels];
-        }
+    // Row by row: one contiguous copy of dx * channels bytes per line, independent of the channel count
+    for (int y = y1; y < y2; ++y)
+        memcpy(odata + channels * (y - y1) * dx, rgb_image + channels * (y * width + x1), channels * dx);
 
-    RGBImageRelease();
+    RGBImageReleaseRead();
     _target->RGBImageRelease();
 }
 
@@ -190,22 +337,23 @@ CImageBasis* CAlignAndCutImage::CutAndSave(int x1, int y1, int dx, int dy)
     int memsize = dx * dy * channels;
     uint8_t* odata = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->odata", memsize, MALLOC_CAP_SPIRAM);
 
-    stbi_uc* p_target;
-    stbi_uc* p_source;
+    if (odata == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CutAndSave: Can't allocate " + std::to_string(memsize) + " bytes");
+        return NULL;
+    }
 
-    RGBImageLock();
+    if (RGBImageLockRead() == NULL)
+    {
+        free_psram_heap(std::string(TAG) + "->odata", odata);
+        return NULL;
+    }
 
-    for (int x = x1; x < x2; ++x)
-        for (int y = y1; y < y2; ++y)
-        {
-            p_target = odata + (channels * ((y - y1) * dx + (x - x1)));
-            p_source = rgb_image + (channels * (y * width + x));
-            for (int _channels = 0; _channels < channels; ++_channels)
-                p_target[_channels] = p_source[_channels];
-        }
+    for (int y = y1; y < y2; ++y)
+        memcpy(odata + channels * (y - y1) * dx, rgb_image + channels * (y * width + x1), channels * dx);
 
     CImageBasis* rs = new CImageBasis("CutAndSave", odata, channels, dx, dy, bpp);
-    RGBImageRelease();
+    RGBImageReleaseRead();
     rs->SetIndepended();
     return rs;
 }
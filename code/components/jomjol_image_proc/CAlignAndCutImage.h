@@ -5,6 +5,11 @@
 
 #include "CImageBasis.h"
 #include "CFindTemplate.h"
+#include "CAffineTransform.h"
+
+#define ALIGN_MAX_REFERENCES 8          // Reference marks per alignment
+#define ALIGN_MAX_RESIDUAL 3.0          // Pixel, references with a larger residual are rejected as outlier (3 and more references)
+#define ALIGN_MATCH_TASK_STACK (6 * 1024)
 
 
 class CAlignAndCutImage : public CImageBasis
@@ -16,7 +21,16 @@ class CAlignAndCutImage : public CImageBasis
         CAlignAndCutImage(std::string name, uint8_t* _rgb_image, int _channels, int _width, int _height, int _bpp) : CImageBasis(name, _rgb_image, _channels, _width, _height, _bpp) {ImageTMP = NULL;};
         CAlignAndCutImage(std::string name, CImageBasis *_org, CImageBasis *_temp);
 
-        bool Align(RefInfo *_temp1, RefInfo *_temp2);
+        /**
+         * @brief Find the references (in parallel on both cores) and rotate/shift the image onto their target positions
+         * (least squares fit, outliers rejected). Sets found position, residual and outlier flag of every reference.
+         * @param _initial Initial rotation/flip. If set, ImageTMP has to hold this image transformed by _initial
+         * (CRotateImage::Warp without copy back): the references are searched there and the aligned image is rendered
+         * from this image with _initial and the alignment in one pass.
+         * @param _antialiasing Bilinear interpolation of the aligned image, else nearest neighbour (parameter "Antialiasing")
+         * @return false if a reference is not similar to the stored values ("Fast") or no reference was found
+         */
+        bool Align(RefInfo *_refs, int _count, CAffineTransform *_initial = NULL, bool _antialiasing = false);
 //        void Align(std::string _template1, int x1, int y1, std::string _template2, int x2, int y2, int deltax = 40, int deltay = 40, std::string imageROI = "");
         void CutAndSave(std::string _template1, int x1, int y1, int dx, int dy);
         CImageBasis* CutAndSave(int x1, int y1, int dx, int dy);
@@ -1,10 +1,16 @@
 #include "CFindTemplate.h"
+#include "CImagePyramid.h"
+#include "CPhaseCorrelation.h"
+#include "CRoundArena.h"
+#include "CMatchKernels.h"
 
 #include "ClassLogFile.h"
+#include "psram.h"
 #include "Helper.h"
 #include "../../include/defines.h"
 
 #include <esp_log.h>
+#include <algorithm>
 
 static const char* TAG = "C FIND TEMPL";
 
@@ -13,19 +19,25 @@ static const char* TAG = "C FIND TEMPL";
 
 bool CFindTemplate::FindTemplate(RefInfo *_ref)
 {
-    uint8_t* rgb_template;
+    // Referenced while matching, "cutref" may invalidate the cache entry meanwhile
+    RefTemplate* tpl = TemplateCache.Get(_ref->image_file, channels);
 
-    if (file_size(_ref->image_file.c_str()) == 0) {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, _ref->image_file + " is empty!");
+    if (tpl == NULL)
         return false;
-    }
-   
-    rgb_template = stbi_load(_ref->image_file.c_str(), &tpl_width, &tpl_height, &tpl_bpp, channels);
 
-    if (rgb_template == NULL) {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Failed to load " + _ref->image_file + "! Is it corrupted?");
-        return false;
-    }
+    bool found = MatchTemplate(_ref, tpl);
+    TemplateCache.Release(tpl);
+
+    return found;
+}
+
+
+bool CFindTemplate::MatchTemplate(RefInfo *_ref, RefTemplate* _tpl)
+{
+    uint8_t* rgb_template = _tpl->rgb;
+    tpl_width = _tpl->width;
+    tpl_height = _tpl->height;
+    tpl_bpp = _tpl->bpp;
 
 //    ESP_LOGD(TAG, "FindTemplate 01");
 
@@ -85,47 +97,55 @@ bool CFindTemplate::FindTemplate(RefInfo *_ref)
 #endif
         _ref->found_x = _ref->fastalg_x;
         _ref->found_y = _ref->fastalg_y;
+        _ref->match_rms = MatchRMS(_tpl, _ref->found_x, _ref->found_y);
+        _ref->adaptive_fallback = false;
+        SubPixelRefine(_ref, _tpl);
 
-        stbi_image_free(rgb_template);
-        
         return true;
     }
 
 //    ESP_LOGD(TAG, "FindTemplate 04");
 
 
-    double aktSAD;
-    double minSAD = pow(tpl_width * tpl_height * 255, 2);
-
-    RGBImageLock();
+    if (RGBImageLockRead() == NULL)
+    {
+        _ref->match_rms = -1;       // Not matched
+        return false;
+    }
 
 //    ESP_LOGD(TAG, "FindTemplate 05");
-    int xouter, youter, tpl_x, tpl_y, _ch;
-    int _anzchannels = channels;
-    if (_ref->alignment_algo == 0)  // 0 = "Default" (nur R-Kanal)
-        _anzchannels = 1;
+    _ref->adaptive_fallback = false;
+
+    if ((_ref->adaptive_search_x > 0) && (_ref->adaptive_search_y > 0) &&
+        ((_ref->adaptive_search_x < _ref->search_x) || (_ref->adaptive_search_y < _ref->search_y)))
+    {
+        // Reduced search field from the drift history, full search field if the match is on its border or worse than usual
+        int aw_start = std::max(_ref->target_x - _ref->adaptive_search_x, ow_start);
+        int aw_stop = std::min(_ref->target_x + _ref->adaptive_search_x, ow_stop);
+        int ah_start = std::max(_ref->target_y - _ref->adaptive_search_y, oh_start);
+        int ah_stop = std::min(_ref->target_y + _ref->adaptive_search_y, oh_stop);
+
+        SearchWindow(_ref, _tpl, aw_start, aw_stop, ah_start, ah_stop);
+        _ref->match_rms = MatchRMS(_tpl, _ref->found_x, _ref->found_y);
 
-    for (xouter = ow_start; xouter <= ow_stop; xouter++)
-        for (youter = oh_start; youter <= oh_stop; ++youter)
+        bool onBorder = ((_ref->found_x == aw_start) && (aw_start > ow_start)) || ((_ref->found_x == aw_stop) && (aw_stop < ow_stop)) ||
+                        ((_ref->found_y == ah_start) && (ah_start > oh_start)) || ((_ref->found_y == ah_stop) && (ah_stop < oh_stop));
+
+        if (onBorder || ((_ref->adaptive_max_rms >= 0) && (_ref->match_rms > _ref->adaptive_max_rms)))
         {
-            aktSAD = 0;
-            for (tpl_x = 0; tpl_x < tpl_width; tpl_x++)
-                for (tpl_y = 0; tpl_y < tpl_height; tpl_y++)
-                {
-                    stbi_uc* p_org = rgb_image + (channels * ((youter + tpl_y) * width + (xouter + tpl_x)));
-                    stbi_uc* p_tpl = rgb_template + (channels * (tpl_y * tpl_width + tpl_x));
-                    for (_ch = 0; _ch < _anzchannels; ++_ch)
-                    {
-                        aktSAD += pow(p_tpl[_ch] - p_org[_ch], 2);
-                    }
-                }
-            if (aktSAD < minSAD)
-            {
-                minSAD = aktSAD;
-                _ref->found_x = xouter;
-                _ref->found_y = youter;
-            }
+            LogFile.WriteToFile(ESP_LOG_INFO, TAG, _ref->image_file + ": Match " + (onBorder ? "on the border of the" : "too weak in the") +
+                    " reduced search field, search full field");
+            _ref->adaptive_fallback = true;
+            SearchWindow(_ref, _tpl, ow_start, ow_stop, oh_start, oh_stop);
         }
+    }
+    else
+    {
+        SearchWindow(_ref, _tpl, ow_start, ow_stop, oh_start, oh_stop);
+    }
+
+    _ref->match_rms = MatchRMS(_tpl, _ref->found_x, _ref->found_y);
+    SubPixelRefine(_ref, _tpl);
 
 //    ESP_LOGD(TAG, "FindTemplate 06");
 
@@ -150,8 +170,7 @@ bool CFindTemplate::FindTemplate(RefInfo *_ref)
     LogFile.WriteToDedicatedFile("/sdcard/alignment.txt", zw);
 #endif*/
 
-    RGBImageRelease();
-    stbi_image_free(rgb_template);
+    RGBImageReleaseRead();
     
 //    ESP_LOGD(TAG, "FindTemplate 08");
 
@@ -160,6 +179,510 @@ bool CFindTemplate::FindTemplate(RefInfo *_ref)
 
 
 
+/* Search the template in the given window with the configured algorithm */
+void CFindTemplate::SearchWindow(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop)
+{
+    int _anzchannels = channels;
+    if (_ref->alignment_algo == 0)  // 0 = "Default" (nur R-Kanal)
+        _anzchannels = 1;
+
+    bool searched = false;
+    if (_ref->alignment_algo == 4)  // 4 = "Pyramid" (nur R-Kanal, coarse-to-fine)
+    {
+        searched = FindTemplatePyramid(_ref, _tpl, _ow_start, _ow_stop, _oh_start, _oh_stop);     // false: out of memory -> exhaustive search
+    }
+    else if (_ref->alignment_algo == 5)  // 5 = "NCC" (nur R-Kanal, normierte Kreuzkorrelation)
+    {
+        searched = FindTemplateNCC(_ref, _tpl, _ow_start, _ow_stop, _oh_start, _oh_stop);     // false: out of memory or flat reference -> exhaustive search
+    }
+    else if (_ref->alignment_algo == 6)  // 6 = "PhaseCorrelation" (nur R-Kanal, FFT)
+    {
+        searched = FindTemplatePhaseCorrelation(_ref, _tpl, _ow_start, _ow_stop, _oh_start, _oh_stop);
+        if (!searched)      // window too large for the reference or out of memory
+            searched = FindTemplatePyramid(_ref, _tpl, _ow_start, _ow_stop, _oh_start, _oh_stop);
+    }
+
+    if (!searched)
+        FindTemplateExhaustive(_ref, _tpl->rgb, _anzchannels, _ow_start, _ow_stop, _oh_start, _oh_stop);
+}
+
+
+/* RMS difference of the R channel between template and image at (_x, _y) */
+float CFindTemplate::MatchRMS(RefTemplate* _tpl, int _x, int _y)
+{
+    uint64_t ssd = MatchSSD1(rgb_image + channels * (_y * width + _x), channels * width, channels,
+                             _tpl->rgb, channels * tpl_width, channels, tpl_width, tpl_height, UINT64_MAX);
+    return sqrt((float) ssd / (tpl_width * tpl_height));
+}
+
+
+/* Sub-pixel position of the match: least squares fit of
+ *   c(x, y) = a + b*x + c*y + d*x^2 + e*x*y + f*y^2
+ * to the SSD (R channel) of the 3x3 neighbourhood of found_x/found_y, the minimum of the fitted surface is the
+ * correction. Stays 0 at the image border or if the surface has no clear minimum. */
+void CFindTemplate::SubPixelRefine(RefInfo *_ref, RefTemplate* _tpl)
+{
+    _ref->subpixel_x = 0;
+    _ref->subpixel_y = 0;
+
+    int x = _ref->found_x;
+    int y = _ref->found_y;
+
+    if ((x < 1) || (y < 1) || (x + 1 > width - tpl_width) || (y + 1 > height - tpl_height))
+        return;
+
+    float s = 0, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+
+    for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            float cost = MatchSSD1(rgb_image + channels * ((y + dy) * width + x + dx), channels * width, channels,
+                                   _tpl->rgb, channels * tpl_width, channels, tpl_width, tpl_height, UINT64_MAX);
+            s += cost;
+            sx += dx * cost;
+            sy += dy * cost;
+            sxx += dx * dx * cost;
+            syy += dy * dy * cost;
+            sxy += dx * dy * cost;
+        }
+
+    // Closed form of the least squares fit on the 3x3 grid (the basis functions are orthogonal there)
+    float b = sx / 6;
+    float c = sy / 6;
+    float d = sxx / 2 - s / 3;
+    float e = sxy / 4;
+    float f = syy / 2 - s / 3;
+    float det = 4 * d * f - e * e;
+
+    if ((d <= 0) || (f <= 0) || (det <= 0))
+        return;
+
+    float ox = (e * c - 2 * f * b) / det;
+    float oy = (e * b - 2 * d * c) / det;
+
+    if ((fabs(ox) > 1) || (fabs(oy) > 1))
+        return;
+
+    _ref->subpixel_x = ox;
+    _ref->subpixel_y = oy;
+}
+
+
+/* Sum of squared differences of a single channel template at position (_x, _y) of a single channel plane.
+ * Aborts as soon as the sum exceeds _limit (result is then only known to be > _limit). */
+static uint64_t PlaneSSD(const uint8_t* _plane, int _planewidth, int _x, int _y, const uint8_t* _tpl, int _tplwidth, int _tplheight, uint64_t _limit)
+{
+    return MatchSSD1(_plane + _y * _planewidth + _x, _planewidth, 1, _tpl, _tplwidth, 1, _tplwidth, _tplheight, _limit);
+}
+
+
+/* Exhaustive search with the SSD of the first _anzchannels channels (1 = R only, 3 = RGB).
+ * The candidates are visited in rings around the last found position (fastalg_x/y, else the target), so a good
+ * match is found early and the row-wise early termination of the kernels skips most of the remaining candidates.
+ * On equal SSD the candidate with the smaller x (then y) wins, the result does not depend on the visiting order. */
+void CFindTemplate::FindTemplateExhaustive(RefInfo *_ref, uint8_t* _rgb_tmpl, int _anzchannels, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop)
+{
+    int cx = _ref->target_x, cy = _ref->target_y;
+    if ((_ref->fastalg_x >= _ow_start) && (_ref->fastalg_x <= _ow_stop) && (_ref->fastalg_y >= _oh_start) && (_ref->fastalg_y <= _oh_stop))
+    {
+        cx = _ref->fastalg_x;
+        cy = _ref->fastalg_y;
+    }
+    cx = std::min(std::max(cx, _ow_start), _ow_stop);
+    cy = std::min(std::max(cy, _oh_start), _oh_stop);
+
+    int imagestride = channels * width;
+    int tplstride = channels * tpl_width;
+    uint64_t minSSD = UINT64_MAX;
+    int best_x = cx, best_y = cy;
+
+    auto visit = [&](int x, int y) {
+        const uint8_t* p_org = rgb_image + channels * (y * width + x);
+        uint64_t aktSSD = (_anzchannels == 3)
+            ? MatchSSD3(p_org, imagestride, channels, _rgb_tmpl, tplstride, channels, tpl_width, tpl_height, minSSD)
+            : MatchSSD1(p_org, imagestride, channels, _rgb_tmpl, tplstride, channels, tpl_width, tpl_height, minSSD);
+
+        if ((aktSSD < minSSD) || ((aktSSD == minSSD) && ((x < best_x) || ((x == best_x) && (y < best_y)))))
+        {
+            minSSD = aktSSD;
+            best_x = x;
+            best_y = y;
+        }
+    };
+
+    int maxr = std::max(std::max(cx - _ow_start, _ow_stop - cx), std::max(cy - _oh_start, _oh_stop - cy));
+
+    visit(cx, cy);
+    for (int r = 1; r <= maxr; ++r)
+    {
+        int x_start = std::max(cx - r, _ow_start);
+        int x_stop = std::min(cx + r, _ow_stop);
+
+        if (cy - r >= _oh_start)                       // top row of the ring
+            for (int x = x_start; x <= x_stop; ++x)
+                visit(x, cy - r);
+        if (cy + r <= _oh_stop)                        // bottom row
+            for (int x = x_start; x <= x_stop; ++x)
+                visit(x, cy + r);
+
+        int y_start = std::max(cy - r + 1, _oh_start);
+        int y_stop = std::min(cy + r - 1, _oh_stop);
+
+        for (int y = y_start; y <= y_stop; ++y)
+        {
+            if (cx - r >= _ow_start)                   // left column
+                visit(cx - r, y);
+            if (cx + r <= _ow_stop)                    // right column
+                visit(cx + r, y);
+        }
+    }
+
+    _ref->found_x = best_x;
+    _ref->found_y = best_y;
+}
+
+
+/* Coarse-to-fine search: exhaustive search on the coarsest pyramid level (1/2 .. 1/8, depending on the
+ * template size), then refinement in a +/-PYRAMID_REFINE_RADIUS neighbourhood on every finer level.
+ * The best PYRAMID_CANDIDATES local minima of the coarse level are refined, so a flat cost surface
+ * does not lock the search into the wrong basin. Uses the R channel only (same as "Default"). */
+#define PYRAMID_REFINE_RADIUS 2
+#define PYRAMID_CANDIDATES 4
+
+struct PyramidCandidate {
+    int x = 0;
+    int y = 0;
+    uint64_t ssd = UINT64_MAX;
+};
+
+
+/* Follow a candidate of pyramid level _level down to level 0, +/-PYRAMID_REFINE_RADIUS per level */
+static PyramidCandidate RefineCandidate(CImagePyramid& _imgpyr, CImagePyramid& _tplpyr, int _level, int _x, int _y)
+{
+    PyramidCandidate result;
+    result.x = _x;
+    result.y = _y;
+
+    if (_level == 0)
+    {
+        result.ssd = PlaneSSD(_imgpyr.plane[0], _imgpyr.width[0], _x, _y, _tplpyr.plane[0], _tplpyr.width[0], _tplpyr.height[0], UINT64_MAX);
+        return result;
+    }
+
+    for (int l = _level - 1; l >= 0; --l)
+    {
+        int x_start = std::max(2 * result.x - PYRAMID_REFINE_RADIUS, 0);
+        int x_stop = std::min(2 * result.x + PYRAMID_REFINE_RADIUS, _imgpyr.width[l] - _tplpyr.width[l]);
+        int y_start = std::max(2 * result.y - PYRAMID_REFINE_RADIUS, 0);
+        int y_stop = std::min(2 * result.y + PYRAMID_REFINE_RADIUS, _imgpyr.height[l] - _tplpyr.height[l]);
+
+        result.ssd = UINT64_MAX;
+        for (int y = y_start; y <= y_stop; ++y)
+            for (int x = x_start; x <= x_stop; ++x)
+            {
+                uint64_t aktSSD = PlaneSSD(_imgpyr.plane[l], _imgpyr.width[l], x, y, _tplpyr.plane[l], _tplpyr.width[l], _tplpyr.height[l], result.ssd);
+                if (aktSSD < result.ssd)
+                {
+                    result.ssd = aktSSD;
+                    result.x = x;
+                    result.y = y;
+                }
+            }
+    }
+
+    return result;
+}
+
+
+bool CFindTemplate::FindTemplatePyramid(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop)
+{
+    int regionwidth = _ow_stop - _ow_start + tpl_width;
+    int regionheight = _oh_stop - _oh_start + tpl_height;
+    CImagePyramid& tplpyr = _tpl->pyramid;
+    int levels = tplpyr.levels;
+
+    CImagePyramid imgpyr("search region", true);
+
+    if (!imgpyr.Build(rgb_image, width, channels, 0, _ow_start, _oh_start, regionwidth, regionheight, levels))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "FindTemplatePyramid: Can't build image pyramid");
+        return false;
+    }
+    levels = std::min(imgpyr.levels, tplpyr.levels);
+
+    // Coarsest level: full cost map, keep the best local minima as candidates
+    int l = levels - 1;
+    int mapwidth = imgpyr.width[l] - tplpyr.width[l] + 1;
+    int mapheight = imgpyr.height[l] - tplpyr.height[l] + 1;
+    uint64_t* costmap = (uint64_t*) RoundArena.Allocate("Pyramid cost map", mapwidth * mapheight * sizeof(uint64_t));
+
+    if (costmap == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "FindTemplatePyramid: Can't allocate the cost map");
+        return false;
+    }
+
+    for (int y = 0; y < mapheight; ++y)
+        for (int x = 0; x < mapwidth; ++x)
+            costmap[y * mapwidth + x] = PlaneSSD(imgpyr.plane[l], imgpyr.width[l], x, y, tplpyr.plane[l], tplpyr.width[l], tplpyr.height[l], UINT64_MAX);
+
+    PyramidCandidate candidates[PYRAMID_CANDIDATES];
+
+    for (int y = 0; y < mapheight; ++y)
+        for (int x = 0; x < mapwidth; ++x)
+        {
+            uint64_t cost = costmap[y * mapwidth + x];
+            bool isLocalMin = true;
+
+            for (int dy = -1; (dy <= 1) && isLocalMin; ++dy)
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    int nx = x + dx, ny = y + dy;
+                    if ((nx >= 0) && (nx < mapwidth) && (ny >= 0) && (ny < mapheight) && (costmap[ny * mapwidth + nx] < cost))
+                    {
+                        isLocalMin = false;
+                        break;
+                    }
+                }
+
+            if (!isLocalMin || (cost >= candidates[PYRAMID_CANDIDATES - 1].ssd))
+                continue;
+
+            int i = PYRAMID_CANDIDATES - 1;         // sorted insert
+            for (; (i > 0) && (candidates[i - 1].ssd > cost); --i)
+                candidates[i] = candidates[i - 1];
+            candidates[i].x = x;
+            candidates[i].y = y;
+            candidates[i].ssd = cost;
+        }
+
+    RoundArena.Free("Pyramid cost map", costmap);
+
+    // Refine every candidate down to level 0
+    PyramidCandidate best;
+
+    for (int c = 0; (c < PYRAMID_CANDIDATES) && (candidates[c].ssd != UINT64_MAX); ++c)
+    {
+        PyramidCandidate refined = (levels > 1) ? RefineCandidate(imgpyr, tplpyr, levels - 1, candidates[c].x, candidates[c].y) : candidates[c];
+
+        if (refined.ssd < best.ssd)
+            best = refined;
+    }
+
+    _ref->found_x = _ow_start + best.x;
+    _ref->found_y = _oh_start + best.y;
+
+#ifdef DEBUG_DETAIL_ON
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "FindTemplatePyramid: " + std::to_string(levels) + " levels, found " +
+            std::to_string(_ref->found_x) + ", " + std::to_string(_ref->found_y));
+#endif
+
+    return true;
+}
+
+
+/* Zero-mean normalized cross-correlation (R channel only):
+ *   ncc = sum(T' * I) / sqrt(sum(T'^2) * (sum(I^2) - sum(I)^2 / n)),  T' = T - mean(T)
+ * sum(T' * mean(I)) is zero, so the numerator does not need the image mean. The image sums of every
+ * candidate window come in O(1) from summed-area tables of the search region, the template statistics
+ * are computed once. Insensitive to brightness and contrast changes between reference and live image.
+ * The tables use uint32 wrap-around arithmetic: the window differences are exact as long as the sum of
+ * squares of one window fits into 32 bit (templates up to 66000 pixel).
+ * The cross term is still a full multiply-accumulate per candidate, so this is roughly 15-20x slower
+ * than the exhaustive SSD search over the same window. */
+bool CFindTemplate::FindTemplateNCC(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop)
+{
+    int regionwidth = _ow_stop - _ow_start + tpl_width;
+    int regionheight = _oh_stop - _oh_start + tpl_height;
+    int n = tpl_width * tpl_height;
+    const uint8_t* tplplane = _tpl->pyramid.plane[0];
+    int32_t tplsum = _tpl->sum[0];
+    double tplvar = (double) _tpl->sumsq[0] - (double) tplsum * tplsum / n;
+
+    if (tplvar <= 0)
+    {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "FindTemplateNCC: " + _ref->image_file + " is flat, no correlation possible");
+        return false;
+    }
+
+    // Temporary buffers of the round, freed in the reverse order (the arena takes them back)
+    CImagePyramid region("NCC region", true);
+    bool built = region.Build(rgb_image, width, channels, 0, _ow_start, _oh_start, regionwidth, regionheight, 1);
+    int16_t* tplzm = (int16_t*) RoundArena.Allocate("NCC template", n * sizeof(int16_t));
+
+    if ((tplzm == NULL) || !built)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "FindTemplateNCC: Can't allocate memory");
+        RoundArena.Free("NCC template", tplzm);
+        return false;
+    }
+
+    // Zero mean template with the rounded mean, the rounding error (meanerror) is corrected below:
+    //   sum((T - mean) * I) = sum((T - tplmean) * I) - meanerror * sum(I)
+    int32_t tplmean = (tplsum + n / 2) / n;
+    double meanerror = (double) tplsum / n - tplmean;
+    for (int i = 0; i < n; ++i)
+        tplzm[i] = tplplane[i] - tplmean;
+
+    // Summed-area tables with one leading row/column of zeros
+    int satwidth = regionwidth + 1;
+    int satsize = satwidth * (regionheight + 1);
+    uint32_t* sat = (uint32_t*) RoundArena.Allocate("NCC sum", satsize * sizeof(uint32_t));
+    uint32_t* sat2 = (uint32_t*) RoundArena.Allocate("NCC sum2", satsize * sizeof(uint32_t));
+
+    if ((sat == NULL) || (sat2 == NULL))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "FindTemplateNCC: Can't allocate summed-area tables (" + std::to_string(2 * satsize * sizeof(uint32_t)) + " bytes)");
+        RoundArena.Free("NCC sum2", sat2);
+        RoundArena.Free("NCC sum", sat);
+        RoundArena.Free("NCC template", tplzm);
+        return false;
+    }
+
+    for (int x = 0; x < satwidth; ++x)
+    {
+        sat[x] = 0;
+        sat2[x] = 0;
+    }
+
+    for (int y = 0; y < regionheight; ++y)
+    {
+        const uint8_t* p_row = region.plane[0] + y * regionwidth;
+        uint32_t* p_sat = sat + (y + 1) * satwidth;
+        uint32_t* p_sat2 = sat2 + (y + 1) * satwidth;
+        uint32_t rowsum = 0, rowsum2 = 0;
+
+        p_sat[0] = 0;
+        p_sat2[0] = 0;
+        for (int x = 0; x < regionwidth; ++x)
+        {
+            rowsum += p_row[x];
+            rowsum2 += p_row[x] * p_row[x];
+            p_sat[x + 1] = p_sat[x + 1 - satwidth] + rowsum;
+            p_sat2[x + 1] = p_sat2[x + 1 - satwidth] + rowsum2;
+        }
+    }
+
+    float maxNCC = -2;
+    int best_x = 0, best_y = 0;
+
+    for (int y = 0; y <= _oh_stop - _oh_start; ++y)
+        for (int x = 0; x <= _ow_stop - _ow_start; ++x)
+        {
+            int top = y * satwidth + x;
+            int bottom = (y + tpl_height) * satwidth + x;
+            uint32_t sum = sat[bottom + tpl_width] - sat[bottom] - sat[top + tpl_width] + sat[top];
+            uint32_t sum2 = sat2[bottom + tpl_width] - sat2[bottom] - sat2[top + tpl_width] + sat2[top];
+            double imgvar = (double) sum2 - (double) sum * sum / n;
+
+            if (imgvar <= 0)      // flat image area, no correlation possible
+                continue;
+
+            int64_t cross = 0;
+            for (int ty = 0; ty < tpl_height; ++ty)
+            {
+                const uint8_t* p_org = region.plane[0] + (y + ty) * regionwidth + x;
+                const int16_t* p_tpl = tplzm + ty * tpl_width;
+                int32_t rowcross = 0;
+                for (int tx = 0; tx < tpl_width; ++tx)
+                    rowcross += p_tpl[tx] * p_org[tx];
+                cross += rowcross;
+            }
+
+            float ncc = (cross - meanerror * sum) / sqrt(tplvar * imgvar);
+            if (ncc > maxNCC)
+            {
+                maxNCC = ncc;
+                best_x = x;
+                best_y = y;
+            }
+        }
+
+    RoundArena.Free("NCC sum2", sat2);
+    RoundArena.Free("NCC sum", sat);
+    RoundArena.Free("NCC template", tplzm);
+
+    _ref->found_x = _ow_start + best_x;
+    _ref->found_y = _oh_start + best_y;
+    _ref->confidence = std::min(std::max(maxNCC, 0.0f), 1.0f);
+
+#ifdef DEBUG_DETAIL_ON
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "FindTemplateNCC: found " + std::to_string(_ref->found_x) + ", " +
+            std::to_string(_ref->found_y) + ", NCC " + std::to_string(maxNCC));
+#endif
+
+    return true;
+}
+
+
+/* Phase correlation (R channel only): translation from the peak of the normalized cross-power spectrum,
+ * O(N log N) independent of the size of the search window. Large windows (e.g. SearchField 0 = whole image)
+ * are correlated on a pyramid level which fits into PHASECORR_MAX_FFT_POINTS, the best peaks are then refined
+ * to full resolution like in "Pyramid". The height of the best peak is reported as confidence. */
+bool CFindTemplate::FindTemplatePhaseCorrelation(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop)
+{
+    int regionwidth = _ow_stop - _ow_start + tpl_width;
+    int regionheight = _oh_stop - _oh_start + tpl_height;
+
+    int level = 0;
+    while (CPhaseCorrelation::FFTSize(regionwidth >> level) * CPhaseCorrelation::FFTSize(regionheight >> level) > PHASECORR_MAX_FFT_POINTS)
+        level++;
+
+    CImagePyramid& tplpyr = _tpl->pyramid;
+
+    if (level >= tplpyr.levels)
+    {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "FindTemplatePhaseCorrelation: Reference too small for the search field, use pyramid search");
+        return false;
+    }
+
+    CImagePyramid imgpyr("search region", true);
+
+    if (!imgpyr.Build(rgb_image, width, channels, 0, _ow_start, _oh_start, regionwidth, regionheight, level + 1) ||
+        (imgpyr.levels <= level))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "FindTemplatePhaseCorrelation: Can't build image pyramid");
+        return false;
+    }
+
+    CPhaseCorrelation pc("align");
+    PhaseCorrPeak peaks[PHASECORR_MAX_PEAKS];
+
+    if (!pc.Correlate(imgpyr.plane[level], imgpyr.width[level], imgpyr.height[level],
+                      tplpyr.plane[level], tplpyr.width[level], tplpyr.height[level], peaks))
+        return false;
+
+    PyramidCandidate best;
+    float bestvalue = 0;
+
+    for (int c = 0; (c < PHASECORR_MAX_PEAKS) && (peaks[c].value > 0); ++c)
+    {
+        PyramidCandidate refined = RefineCandidate(imgpyr, tplpyr, level, peaks[c].x, peaks[c].y);
+
+        if (refined.ssd < best.ssd)
+        {
+            best = refined;
+            bestvalue = peaks[c].value;
+        }
+    }
+
+    if (best.ssd == UINT64_MAX)
+        return false;
+
+    _ref->found_x = _ow_start + best.x;
+    _ref->found_y = _oh_start + best.y;
+    _ref->confidence = std::min(bestvalue, 1.0f);
+
+#ifdef DEBUG_DETAIL_ON
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "FindTemplatePhaseCorrelation: level " + std::to_string(level) + ", FFT " +
+            std::to_string(pc.fftwidth) + "x" + std::to_string(pc.fftheight) + ", found " + std::to_string(_ref->found_x) + ", " +
+            std::to_string(_ref->found_y) + ", peak " + std::to_string(bestvalue));
+#endif
+
+    return true;
+}
+
+
 bool CFindTemplate::CalculateSimularities(uint8_t* _rgb_tmpl, int _startx, int _starty, int _sizex, int _sizey, int &min, float &avg, int &max, float &SAD, float _SADold, float _SADcrit)
 {
     int dif;
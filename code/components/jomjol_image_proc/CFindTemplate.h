@@ -4,6 +4,7 @@
 #define CFINDTEMPLATE_H
 
 #include "CImageBasis.h"
+#include "CTemplateCache.h"
 
 struct RefInfo {
     std::string image_file; 
@@ -13,6 +14,8 @@ struct RefInfo {
     int height = 0;
     int found_x;
     int found_y;
+    float subpixel_x = 0;               // Sub-pixel correction of found_x/found_y (quadratic fit of the SSD, -1 .. 1)
+    float subpixel_y = 0;
     int search_x;
     int search_y;
     int fastalg_x = -1;
@@ -22,7 +25,18 @@ struct RefInfo {
     int fastalg_max = -1;
     float fastalg_SAD = -1;
     float fastalg_SAD_criteria = -1;
-    int alignment_algo = 0;             // 0 = "Default" (nur R-Kanal), 1 = "HighAccuracy" (RGB-Kanal), 2 = "Fast" (1.x RGB, dann isSimilar)
+    int alignment_algo = 0;             // 0 = "Default" (nur R-Kanal), 1 = "HighAccuracy" (RGB-Kanal), 2 = "Fast" (1.x RGB, dann isSimilar), 3 = "Off"
+                                        // 4 = "Pyramid" (R-Kanal, coarse-to-fine), 5 = "NCC" (R-Kanal, normierte Kreuzkorrelation)
+                                        // 6 = "PhaseCorrelation" (R-Kanal, FFT)
+    float confidence = -1;              // Quality of the found position (0 .. 1), only set by "NCC" (correlation coefficient)
+                                        // and "PhaseCorrelation" (height of the correlation peak)
+    float match_rms = -1;               // RMS difference (R channel) between reference and image at the found position
+    int adaptive_search_x = 0;          // Reduced search field from the drift history, 0 = always search_x/search_y
+    int adaptive_search_y = 0;
+    float adaptive_max_rms = -1;        // Search the full field if match_rms in the reduced field is larger (-1 = no limit)
+    bool adaptive_fallback = false;     // Set if the reduced search field was not sufficient
+    float residual = -1;                // Distance of the aligned found position to the target position (-1 = not matched)
+    bool outlier = false;               // Not used for the alignment transform (not matched or residual too large)
 };
 
 
@@ -35,6 +49,14 @@ class CFindTemplate : public CImageBasis
         CFindTemplate(std::string name, uint8_t* _rgb_image, int _channels, int _width, int _height, int _bpp) : CImageBasis(name, _rgb_image, _channels, _width, _height, _bpp) {};
 
         bool FindTemplate(RefInfo *_ref);
+        bool MatchTemplate(RefInfo *_ref, RefTemplate* _tpl);
+        void SearchWindow(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop);
+        float MatchRMS(RefTemplate* _tpl, int _x, int _y);
+        void SubPixelRefine(RefInfo *_ref, RefTemplate* _tpl);
+        void FindTemplateExhaustive(RefInfo *_ref, uint8_t* _rgb_tmpl, int _anzchannels, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop);
+        bool FindTemplatePyramid(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop);
+        bool FindTemplateNCC(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop);
+        bool FindTemplatePhaseCorrelation(RefInfo *_ref, RefTemplate* _tpl, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop);
 
         bool CalculateSimularities(uint8_t* _rgb_tmpl, int _startx, int _starty, int _sizex, int _sizey, int &min, float &avg, int &max, float &SAD, float _SADold, float _SADcrit);
 };
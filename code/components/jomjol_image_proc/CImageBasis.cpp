@@ -1,4 +1,8 @@
 #include "CImageBasis.h"
+#include "CJpegDecoder.h"
+#include "CJpegEncoder.h"
+#include "CPixelKernels.h"
+#include "CRoundArena.h"
 #include "Helper.h"
 #include "psram.h"
 #include "ClassLogFile.h"
@@ -19,151 +23,293 @@ using namespace std;
 
 static const char *TAG = "C IMG BASIS";
 
-bool jpgFileTooLarge = false;   // JPG creation verfication
-
-
 //#define DEBUG_DETAIL_ON
 
 
 uint8_t * CImageBasis::RGBImageLock(int _waitmaxsec)
 {
-    if (islocked)
+    if (!LockForReplace(_waitmaxsec))
+        return NULL;
+
+    // Images working on the buffer of another image change the buffer of the owner
+    bool unshared = bufferowner ? bufferowner->Unshare() : Unshare();
+    if (bufferowner)
+        rgb_image = bufferowner->rgb_image;
+
+    if (!unshared)
     {
-        #ifdef DEBUG_DETAIL_ON   
-                ESP_LOGD(TAG, "Image is locked: sleep for: %ds", _waitmaxsec);
-        #endif
-        TickType_t xDelay;
-        xDelay = 1000 / portTICK_PERIOD_MS;
-        for (int i = 0; i <= _waitmaxsec; ++i)
-        {
-            vTaskDelay( xDelay ); 
-            if (!islocked)
-                break;
-        }
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "RGBImageLock: " + name + " shares its buffer and can't get an own copy");
+        lock->ReleaseWrite();
+        return NULL;
     }
 
-    if (islocked)
+    if (rgb_image == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "RGBImageLock: " + name + " has no image");
+        lock->ReleaseWrite();
         return NULL;
+    }
 
     return rgb_image;
 }
 
 
+bool CImageBasis::LockForReplace(int _waitmaxsec)
+{
+    if (!lock->LockWrite(_waitmaxsec * 1000))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "RGBImageLock: " + name + " not available for writing within " + std::to_string(_waitmaxsec) + "s");
+        return false;
+    }
+
+    return true;
+}
+
+
 void CImageBasis::RGBImageRelease()
 {
-    islocked = false;
+    lock->ReleaseWrite();
 }
 
 
-uint8_t * CImageBasis::RGBImageGet()
+uint8_t * CImageBasis::RGBImageLockRead(int _waitmaxsec)
 {
+    if (!lock->LockRead(_waitmaxsec * 1000))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "RGBImageLockRead: " + name + " not available for reading within " + std::to_string(_waitmaxsec) + "s");
+        return NULL;
+    }
+
+    if (bufferowner)
+        rgb_image = bufferowner->rgb_image;
+
+    if (rgb_image == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "RGBImageLockRead: " + name + " has no image");
+        lock->ReleaseRead();
+        return NULL;
+    }
+
     return rgb_image;
 }
 
 
-void writejpghelp(void *context, void *data, int size)
+void CImageBasis::RGBImageReleaseRead()
 {
-//    ESP_LOGD(TAG, "Size all: %d, size %d", ((ImageData*)context)->size, size);
-    ImageData* _zw = (ImageData*) context;
-    uint8_t *voidstart = _zw->data;
-    uint8_t *datastart = (uint8_t*) data;
-    
-    if ((_zw->size < MAX_JPG_SIZE)) {   // Abort copy to prevent buffer overflow
-        voidstart += _zw->size;
+    lock->ReleaseRead();
+}
+
+
+/* Images working on the buffer of _image (without own buffer) have to use its lock and follow its buffer */
+void CImageBasis::ShareLock(CImageBasis* _image)
+{
+    if (!externalLock)
+        delete lock;
+
+    lock = _image->lock;
+    externalLock = true;
+    bufferowner = _image->bufferowner ? _image->bufferowner : _image;
+}
 
-        for (int i = 0; i < size; ++i)
-            *(voidstart + i) = *(datastart + i);
 
-        _zw->size += size;
+void CImageBasis::SetBuffer(CImageBuffer* _buffer)
+{
+    if (buffer != NULL)
+        buffer->Unref();
+
+    buffer = _buffer;
+    rgb_image = buffer ? buffer->data : NULL;
+    memsize = buffer ? buffer->size : 0;
+}
+
+
+bool CImageBasis::Unshare()
+{
+    if ((buffer == NULL) || !buffer->Shared())
+        return true;
+
+    CImageBuffer* copy = buffer->Duplicate(name, BufferMemory());
+    if (copy == NULL)
+        return false;
+
+    SetBuffer(copy);
+    return true;
+}
+
+
+CImageBuffer::Memory CImageBasis::BufferMemory()
+{
+    // The tmpImage is placed in the shared part of PSRAM, all other images are much smaller and go into the normal PSRAM region
+    return (name == "tmpImage") ? CImageBuffer::SHARED_TMP : CImageBuffer::HEAP;
+}
+
+
+void CImageBasis::SetIndepended()
+{
+    // The image takes over the external buffer (allocated with malloc_psram_heap)
+    if (externalImage && (rgb_image != NULL) && (bufferowner == NULL))
+        SetBuffer(CImageBuffer::Adopt(name, rgb_image, width * height * channels, CImageBuffer::HEAP));
+
+    externalImage = false;
+}
+
+
+void CImageBasis::MoveFrom(CImageBasis *_source)
+{
+    if ((bufferowner != NULL) || (_source->bufferowner != NULL) || (_source->externalImage && (_source->rgb_image != NULL)))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "MoveFrom: " + _source->name + " -> " + name + " not possible, the buffer belongs to another image");
+        return;
     }
-    else {
-        jpgFileTooLarge = true;
+
+    if (!LockForReplace())
+        return;
+
+    if (!_source->LockForReplace())
+    {
+        RGBImageRelease();
+        return;
     }
+
+    SetBuffer(_source->buffer);
+    externalImage = false;
+    width = _source->width;
+    height = _source->height;
+    channels = _source->channels;
+    bpp = _source->bpp;
+
+    _source->buffer = NULL;
+    _source->SetBuffer(NULL);
+    _source->width = 0;
+    _source->height = 0;
+
+    _source->RGBImageRelease();
+    RGBImageRelease();
 }
 
 
-ImageData* CImageBasis::writeToMemoryAsJPG(const int quality)
+/* Views keep the address of the buffer, it changes with a copy-on-write or a new image */
+bool CImageBasis::Contains(const ImageView &_view)
 {
-    ImageData* ii = new ImageData;
+    return (rgb_image != NULL) && _view.Valid() && (_view.data >= rgb_image) &&
+           (_view.data + (_view.height - 1) * _view.stride + _view.width * _view.channels <= rgb_image + width * height * channels);
+}
 
-    RGBImageLock();
-    stbi_write_jpg_to_func(writejpghelp, ii, width, height, channels, rgb_image, quality);
-    RGBImageRelease();
 
-    if (jpgFileTooLarge) {
-        jpgFileTooLarge = false;
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "writeToMemoryAsJPG: Creation aborted! JPG size > preallocated buffer: " + std::to_string(MAX_JPG_SIZE));
-    }
-    return ii;
+bool CImageBasis::SharesBuffer(CImageBasis *_image)
+{
+    CImageBasis* owner = bufferowner ? bufferowner : this;
+    CImageBasis* other = _image->bufferowner ? _image->bufferowner : _image;
+    return (owner->buffer != NULL) && (owner->buffer == other->buffer);
+}
+
+
+uint8_t * CImageBasis::RGBImageGet()
+{
+    return rgb_image;
+}
+
+
+/* Appends a chunk to the ImageData, aborts the encoding if the JPG does not fit */
+static bool JpgToImageData(void* _context, const uint8_t* _data, int _size)
+{
+    ImageData* _zw = (ImageData*) _context;
+
+    if (_zw->size + _size > MAX_JPG_SIZE)
+        return false;
+
+    memcpy(_zw->data + _zw->size, _data, _size);
+    _zw->size += _size;
+    return true;
 }
 
 
-void CImageBasis::writeToMemoryAsJPG(ImageData* i, const int quality)
+ImageData* CImageBasis::writeToMemoryAsJPG(const int quality)
 {
     ImageData* ii = new ImageData;
-    
-    RGBImageLock();
-    stbi_write_jpg_to_func(writejpghelp, ii, width, height, channels, rgb_image, quality);
-    RGBImageRelease();
+    writeToMemoryAsJPG(ii, quality);
+    return ii;
+}
+
 
-    if (jpgFileTooLarge) {
-        jpgFileTooLarge = false;
+void CImageBasis::writeToMemoryAsJPG(ImageData* i, const int quality, const CImageOverlay* _overlay)
+{
+    // Appended to the target chunk by chunk, no temporary ImageData
+    CJpegEncoder* encoder = CJpegEncoder::Create();
+    uint8_t chunk[HTTP_BUFFER_SENT];
+    i->size = 0;
+
+    if (RGBImageLockRead() == NULL) {
+        delete encoder;
+        return;
+    }
+
+    bool ok = encoder->Encode(GetView(), quality, chunk, HTTP_BUFFER_SENT, JpgToImageData, i, _overlay);
+    RGBImageReleaseRead();
+
+    if (!ok) {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "writeToMemoryAsJPG: Creation aborted! JPG size > preallocated buffer: " + std::to_string(MAX_JPG_SIZE));
     }
-    memCopy((uint8_t*) ii, (uint8_t*) i, sizeof(ImageData));
-    delete ii;
+    delete encoder;
 }
 
 
-struct SendJPGHTTP
+esp_err_t CImageBasis::SendJPGtoHTTP(httpd_req_t *_req, const int quality, const CImageOverlay* _overlay)
 {
-    httpd_req_t *req;
-    esp_err_t res;
-    char buf[HTTP_BUFFER_SENT];
-    int size = 0;
-};
+    if (RGBImageLockRead() == NULL)
+        return ESP_FAIL;
+
+    esp_err_t res = SendJPGtoHTTP(_req, GetView(), quality, _overlay);
+    RGBImageReleaseRead();
+
+    return res;
+}  
 
 
-inline void writejpgtohttphelp(void *context, void *data, int size)
+#ifndef STBI_ONLY_JPEG
+/* The BMP writer needs the pixels without gaps between the rows: a view of a part of an image is copied */
+static uint8_t* ContiguousPixels(const ImageView &_view, bool &_copied)
 {
-    SendJPGHTTP* _send = (SendJPGHTTP*) context;
-    if ((_send->size + size) >= HTTP_BUFFER_SENT)     // data no longer fits in buffer
+    _copied = (_view.stride != _view.width * _view.channels);
+    if (!_copied)
+        return _view.data;
+
+    uint8_t* pixels = (uint8_t*) RoundArena.Allocate("ContiguousPixels", _view.width * _view.height * _view.channels);
+    if (pixels == NULL)
     {
-        if (httpd_resp_send_chunk(_send->req, _send->buf, _send->size) != ESP_OK) 
-        {
-                    ESP_LOGE(TAG, "File sending failed!");
-                    _send->res = ESP_FAIL;  
-        }
-        _send->size = 0;      
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "ContiguousPixels: Can't allocate " + std::to_string(_view.width * _view.height * _view.channels) + " bytes");
+        return NULL;
     }
-    std::memcpy((void*) (&(_send->buf[0]) + _send->size), data, size);
-    _send->size+= size;
-} 
 
+    for (int y = 0; y < _view.height; ++y)
+        memcpy(pixels + y * _view.width * _view.channels, _view.Pixel(0, y), _view.width * _view.channels);
 
-esp_err_t CImageBasis::SendJPGtoHTTP(httpd_req_t *_req, const int quality)
-{
-    SendJPGHTTP ii;
-    ii.req = _req;
-    ii.res = ESP_OK;
-    ii.size = 0;
+    return pixels;
+}
+#endif
 
-    RGBImageLock();
-    stbi_write_jpg_to_func(writejpgtohttphelp, &ii, width, height, channels, rgb_image, quality);
 
-    if (ii.size > 0)
-    {
-        if (httpd_resp_send_chunk(_req, (char*) ii.buf, ii.size) != ESP_OK)             //still send the rest
-        {
-            ESP_LOGE(TAG, "File sending failed!");
-            ii.res = ESP_FAIL;  
-        }
+static bool JpgToHTTP(void* _context, const uint8_t* _data, int _size)
+{
+    if (httpd_resp_send_chunk((httpd_req_t*) _context, (const char*) _data, _size) != ESP_OK) {
+        ESP_LOGE(TAG, "File sending failed!");
+        return false;
     }
+    return true;
+}
 
-    RGBImageRelease();
 
-    return ii.res;
-}  
+esp_err_t CImageBasis::SendJPGtoHTTP(httpd_req_t *_req, const ImageView &_view, const int quality, const CImageOverlay* _overlay)
+{
+    // Every chunk of the encoder goes out as soon as it is full, the JPG is never kept as a whole
+    CJpegEncoder* encoder = CJpegEncoder::Create();
+    uint8_t chunk[HTTP_BUFFER_SENT];
+
+    bool ok = encoder->Encode(_view, quality, chunk, HTTP_BUFFER_SENT, JpgToHTTP, _req, _overlay);
+
+    delete encoder;
+    return ok ? ESP_OK : ESP_FAIL;
+}
 
 
 bool CImageBasis::CopyFromMemory(uint8_t* _source, int _size)
@@ -175,7 +321,9 @@ bool CImageBasis::CopyFromMemory(uint8_t* _source, int _size)
         return false;
     }
 
-    RGBImageLock();
+    if (RGBImageLock() == NULL)
+        return false;
+
     memCopy(_source, rgb_image, _size);
     RGBImageRelease();
 
@@ -214,11 +362,11 @@ bool CImageBasis::isInImage(int x, int y)
 }
 
 
-void CImageBasis::setPixelColor(int x, int y, int r, int g, int b)
+/* Write lock taken by the caller */
+void CImageBasis::putPixel(int x, int y, int r, int g, int b)
 {
     stbi_uc* p_source;
 
-    RGBImageLock();
     p_source = rgb_image + (channels * (y * width + x));
     p_source[0] = r;
     if ( channels > 2)
@@ -226,59 +374,54 @@ void CImageBasis::setPixelColor(int x, int y, int r, int g, int b)
         p_source[1] = g;
         p_source[2] = b;
     }
+}
+
+
+void CImageBasis::setPixelColor(int x, int y, int r, int g, int b)
+{
+    if (RGBImageLock() == NULL)
+        return;
+
+    putPixel(x, y, r, g, b);
     RGBImageRelease();
 }
 
 
 void CImageBasis::drawRect(int x, int y, int dx, int dy, int r, int g, int b, int thickness)
 {
-    int zwx1, zwx2, zwy1, zwy2;
-    int _x, _y, _thick;
+    if (RGBImageLock() == NULL)
+        return;
 
-    zwx1 = x - thickness + 1;
-    zwx2 = x + dx + thickness - 1;
-    zwy1 = y;
-    zwy2 = y;
+    drawRect(GetView(), x, y, dx, dy, r, g, b, thickness);
+    RGBImageRelease();
+}
 
-    RGBImageLock();
 
-    for (_thick = 0; _thick < thickness; _thick++)
-        for (_x = zwx1; _x <= zwx2; ++_x)
-            for (_y = zwy1; _y <= zwy2; _y++)
-                if (isInImage(_x, _y))
-                    setPixelColor(_x, _y - _thick, r, g, b);
-
-    zwx1 = x - thickness + 1;
-    zwx2 = x + dx + thickness - 1;
-    zwy1 = y + dy;
-    zwy2 = y + dy;
-    for (_thick = 0; _thick < thickness; _thick++)
-        for (_x = zwx1; _x <= zwx2; ++_x)
-            for (_y = zwy1; _y <= zwy2; _y++)
-                if (isInImage(_x, _y))
-                    setPixelColor(_x, _y + _thick, r, g, b);
-
-    zwx1 = x;
-    zwx2 = x;
-    zwy1 = y;
-    zwy2 = y + dy;
-    for (_thick = 0; _thick < thickness; _thick++)
-        for (_x = zwx1; _x <= zwx2; ++_x)
-            for (_y = zwy1; _y <= zwy2; _y++)
-                if (isInImage(_x, _y))
-                    setPixelColor(_x - _thick, _y, r, g, b);
-
-    zwx1 = x + dx;
-    zwx2 = x + dx;
-    zwy1 = y;
-    zwy2 = y + dy;
-    for (_thick = 0; _thick < thickness; _thick++)
-        for (_x = zwx1; _x <= zwx2; ++_x)
-            for (_y = zwy1; _y <= zwy2; _y++)
-                if (isInImage(_x, _y))
-                    setPixelColor(_x + _thick, _y, r, g, b);
+/* Fills the part of the rectangle inside the view */
+static void FillViewRect(const ImageView &_view, int x, int y, int dx, int dy, const uint8_t* _color)
+{
+    int x1 = std::max(x, 0), y1 = std::max(y, 0);
+    int x2 = std::min(x + dx, _view.width), y2 = std::min(y + dy, _view.height);
 
-    RGBImageRelease();
+    if ((x2 > x1) && (y2 > y1))
+        PixelFillRect(_view.Pixel(x1, y1), _view.stride, _view.channels, x2 - x1, y2 - y1, _color);
+}
+
+
+/* Frame with the lines outside of the rectangle for thickness > 1, clipped to the view.
+ * Drawn as four filled bars: top and bottom including the corners, left and right in between. */
+void CImageBasis::drawRect(const ImageView &_view, int x, int y, int dx, int dy, int r, int g, int b, int thickness)
+{
+    if (thickness < 1)
+        return;
+
+    uint8_t color[3] = {(uint8_t) r, (uint8_t) g, (uint8_t) b};
+    int outer = thickness - 1;
+
+    FillViewRect(_view, x - outer, y - outer, dx + 2 * thickness - 1, thickness, color);
+    FillViewRect(_view, x - outer, y + dy, dx + 2 * thickness - 1, thickness, color);
+    FillViewRect(_view, x - outer, y, thickness, dy + 1, color);
+    FillViewRect(_view, x + dx, y, thickness, dy + 1, color);
 }
 
 
@@ -288,7 +431,8 @@ void CImageBasis::drawLine(int x1, int y1, int x2, int y2, int r, int g, int b,
     int _zwy1, _zwy2;
     thickness = (thickness-1) / 2;
 
-    RGBImageLock();
+    if (RGBImageLock() == NULL)
+        return;
 
     for (_thick = 0; _thick <= thickness; ++_thick)
         for (_x = x1 - _thick; _x <= x2 + _thick; ++_x)
@@ -306,7 +450,7 @@ void CImageBasis::drawLine(int x1, int y1, int x2, int y2, int r, int g, int b,
 
             for (_y = _zwy1 - _thick; _y <= _zwy2 + _thick; _y++)
                 if (isInImage(_x, _y))
-                    setPixelColor(_x, _y, r, g, b);
+                    putPixel(_x, _y, r, g, b);
         }
     
     RGBImageRelease();
@@ -324,7 +468,8 @@ void CImageBasis::drawEllipse(int x1, int y1, int radx, int rady, int r, int g,
 
     deltarad = 1 / (4 * M_PI * (rad + thickness - 1));
 
-    RGBImageLock();
+    if (RGBImageLock() == NULL)
+        return;
 
     for (aktrad = 0; aktrad <= (2 * M_PI); aktrad += deltarad)
         for (_thick = 0; _thick < thickness; ++_thick)
@@ -332,7 +477,7 @@ void CImageBasis::drawEllipse(int x1, int y1, int radx, int rady, int r, int g,
             _x = sin(aktrad) * (radx + _thick) + x1;
             _y = cos(aktrad) * (rady + _thick) + y1;
             if (isInImage(_x, _y))
-                setPixelColor(_x, _y, r, g, b);
+                putPixel(_x, _y, r, g, b);
         }
 
     RGBImageRelease();
@@ -346,7 +491,8 @@ void CImageBasis::drawCircle(int x1, int y1, int rad, int r, int g, int b, int t
 
     deltarad = 1 / (4 * M_PI * (rad + thickness - 1));
 
-    RGBImageLock();
+    if (RGBImageLock() == NULL)
+        return;
 
     for (aktrad = 0; aktrad <= (2 * M_PI); aktrad += deltarad)
         for (_thick = 0; _thick < thickness; ++_thick)
@@ -354,7 +500,7 @@ void CImageBasis::drawCircle(int x1, int y1, int rad, int r, int g, int b, int t
             _x = sin(aktrad) * (rad + _thick) + x1;
             _y = cos(aktrad) * (rad + _thick) + y1;
             if (isInImage(_x, _y))
-                setPixelColor(_x, _y, r, g, b);
+                putPixel(_x, _y, r, g, b);
         }
 
     RGBImageRelease();
@@ -369,7 +515,7 @@ CImageBasis::CImageBasis(string _name)
     width = 0;
     height = 0;
     channels = 0;    
-    islocked = false;
+    lock = new CImageLock();
 }
 
 
@@ -380,7 +526,8 @@ void CImageBasis::CreateEmptyImage(int _width, int _height, int _channels)
     height = _height;
     channels = _channels;
 
-    RGBImageLock();
+    if (!LockForReplace())
+        return;
 
     #ifdef DEBUG_DETAIL_ON 
         LogFile.WriteHeapInfo("CreateEmptyImage");
@@ -388,7 +535,8 @@ void CImageBasis::CreateEmptyImage(int _width, int _height, int _channels)
 
     memsize = width * height * channels;
 
-    rgb_image = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->CImageBasis (" + name + ")", memsize, MALLOC_CAP_SPIRAM);
+    SetBuffer(NULL);
+    SetBuffer(CImageBuffer::Allocate("CImageBasis (" + name + ")", memsize));
 
     if (rgb_image == NULL)
     {
@@ -398,15 +546,8 @@ void CImageBasis::CreateEmptyImage(int _width, int _height, int _channels)
         return;
     }
 
-    stbi_uc* p_source;    
-
-    for (int x = 0; x < width; ++x)
-        for (int y = 0; y < height; ++y)
-        {
-            p_source = rgb_image + (channels * (y * width + x));
-            for (int _channels = 0; _channels < channels; ++_channels)
-                p_source[_channels] = (uint8_t) 0;
-        }
+    const uint8_t black[4] = {0, 0, 0, 0};
+    PixelFill(rgb_image, width * height, channels, black);
 
     RGBImageRelease();
 }
@@ -418,32 +559,28 @@ void CImageBasis::EmptyImage()
         LogFile.WriteHeapInfo("EmptyImage");
     #endif
 
-    stbi_uc* p_source;
-
-    RGBImageLock();
+    if (RGBImageLock() == NULL)
+        return;
 
-    for (int x = 0; x < width; ++x)
-        for (int y = 0; y < height; ++y)
-        {
-            p_source = rgb_image + (channels * (y * width + x));
-            for (int _channels = 0; _channels < channels; ++_channels)
-                p_source[_channels] = (uint8_t) 0;
-        }
+    const uint8_t black[4] = {0, 0, 0, 0};
+    PixelFill(rgb_image, width * height, channels, black);
 
     RGBImageRelease();
 }
 
 
-void CImageBasis::LoadFromMemory(stbi_uc *_buffer, int len)
+void CImageBasis::LoadFromMemory(stbi_uc *_buffer, int len, int _scale)
 {
-    RGBImageLock();
-
-    if (rgb_image != NULL) {
-        stbi_image_free(rgb_image);
-        //free_psram_heap(std::string(TAG) + "->rgb_image (LoadFromMemory)", rgb_image);
+    if ((_scale > 1) && LoadScaledFromMemory(_buffer, len, _scale)) {
+        return;
     }
 
-    rgb_image = stbi_load_from_memory(_buffer, len, &width, &height, &channels, STBI_rgb);
+    if (!LockForReplace())
+        return;
+
+    SetBuffer(NULL);
+    uint8_t* data = stbi_load_from_memory(_buffer, len, &width, &height, &channels, STBI_rgb);
+    SetBuffer(CImageBuffer::Adopt("CImageBasis LoadFromMemory (" + name + ")", data, width * height * channels, CImageBuffer::STBI));
     bpp = channels;
     ESP_LOGD(TAG, "Image loaded from memory: %d, %d, %d", width, height, channels);
     
@@ -456,6 +593,72 @@ void CImageBasis::LoadFromMemory(stbi_uc *_buffer, int len)
         doReboot();
     }
     RGBImageRelease();
+
+    if (_scale > 1) {
+        // Decoder does not support this JPEG: full decode, then resize
+        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "LoadFromMemory: DCT scaling not possible, resize the decoded image");
+        Resize(CJpegDecoder::ScaledSize(width, _scale), CJpegDecoder::ScaledSize(height, _scale));
+    }
+}
+
+
+bool CImageBasis::LoadScaledFromMemory(stbi_uc *_buffer, int len, int _scale)
+{
+    int jpeg_width, jpeg_height;
+
+    if (!CJpegDecoder::GetSize(_buffer, len, jpeg_width, jpeg_height)) {
+        return false;
+    }
+
+    int new_width = CJpegDecoder::ScaledSize(jpeg_width, _scale);
+    int new_height = CJpegDecoder::ScaledSize(jpeg_height, _scale);
+
+    if (!LockForReplace()) {
+        return false;
+    }
+
+    SetBuffer(NULL);
+
+    channels = 3;
+    bpp = channels;
+    width = new_width;
+    height = new_height;
+    SetBuffer(CImageBuffer::Allocate("CImageBasis LoadFromMemory (" + name + ")", width * height * channels));
+
+    CJpegDecoder *decoder = new CJpegDecoder();
+    bool decoded = (rgb_image != NULL) && decoder->Decode(_buffer, len, rgb_image, width, height, NULL, _scale);
+    delete decoder;
+
+    if (!decoded) {
+        SetBuffer(NULL);
+    }
+
+    ESP_LOGD(TAG, "Image loaded from memory with scale 1/%d: %d, %d, %d", _scale, width, height, channels);
+
+    RGBImageRelease();
+    return decoded;
+}
+
+
+void CImageBasis::CopyPixels(const uint8_t* _source, int _sourcechannels, uint8_t* _target, int _targetchannels, int _pixels)
+{
+    if (_sourcechannels == _targetchannels) {
+        memcpy(_target, _source, _pixels * _targetchannels);
+    }
+    else if ((_sourcechannels == 3) && (_targetchannels == 1)) {
+        for (int i = 0; i < _pixels; ++i, _source += 3) {
+            _target[i] = (77 * _source[0] + 150 * _source[1] + 29 * _source[2] + 128) >> 8;
+        }
+    }
+    else if ((_sourcechannels == 1) && (_targetchannels == 3)) {
+        for (int i = 0; i < _pixels; ++i, _target += 3) {
+            _target[0] = _target[1] = _target[2] = _source[i];
+        }
+    }
+    else {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CopyPixels: " + std::to_string(_sourcechannels) + " -> " +
+                                                std::to_string(_targetchannels) + " channels not supported");
+    }
 }
 
 
@@ -468,6 +671,10 @@ void CImageBasis::crop_image(unsigned short cropLeft, unsigned short cropRight,
     unsigned short newHeight = height - cropTop - cropBottom;
 
     unsigned int writeIndex = 0;
+
+    if (RGBImageLock() == NULL)
+        return;
+
     // Loop over all bytes
     for (int i = 0; i < width * height * channels; i += channels) {
         // Calculate current X, Y pixel position
@@ -494,20 +701,23 @@ void CImageBasis::crop_image(unsigned short cropLeft, unsigned short cropRight,
     // Set the new dimensions of the framebuffer for further use.
     width = newWidth;
     height = newHeight;
+
+    RGBImageRelease();
 }
 
 
 CImageBasis::CImageBasis(string _name, CImageBasis *_copyfrom) 
 {
     name = _name;
-    islocked = false;
+    lock = new CImageLock();
     externalImage = false;
     channels = _copyfrom->channels;
     width = _copyfrom->width;
     height = _copyfrom->height;
     bpp = _copyfrom->bpp;
 
-    RGBImageLock();
+    if (!LockForReplace())
+        return;
 
     #ifdef DEBUG_DETAIL_ON 
         LogFile.WriteHeapInfo("CImageBasis_copyfrom - Start");
@@ -515,23 +725,35 @@ CImageBasis::CImageBasis(string _name, CImageBasis *_copyfrom)
 
     memsize = width * height * channels;
 
+    if (_copyfrom->RGBImageLockRead() == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CImageBasis-Copyfrom: " + _copyfrom->name + " not available");
+        RGBImageRelease();
+        return;
+    }
 
-    if (name == "tmpImage") {
-        rgb_image = (unsigned char*)psram_reserve_shared_tmp_image_memory();
+    CImageBasis* owner = _copyfrom->bufferowner ? _copyfrom->bufferowner : _copyfrom;
+
+    if (owner->buffer != NULL) {
+        // Copy-on-write: the pixels are duplicated when one of the images is written
+        SetBuffer(owner->buffer->Ref());
     }
     else {
-        rgb_image = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->CImageBasis (" + name + ")", memsize, MALLOC_CAP_SPIRAM);
-    }
+        SetBuffer(CImageBuffer::Allocate("CImageBasis (" + name + ")", memsize, BufferMemory()));
 
-    if (rgb_image == NULL)
-    {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CImageBasis-Copyfrom: Can't allocate enough memory: " + std::to_string(memsize));
-        LogFile.WriteHeapInfo("CImageBasis-Copyfrom");
-        RGBImageRelease();
-        return;
+        if (rgb_image == NULL)
+        {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CImageBasis-Copyfrom: Can't allocate enough memory: " + std::to_string(memsize));
+            LogFile.WriteHeapInfo("CImageBasis-Copyfrom");
+            _copyfrom->RGBImageReleaseRead();
+            RGBImageRelease();
+            return;
+        }
+
+        memCopy(_copyfrom->rgb_image, rgb_image, memsize);
     }
 
-    memCopy(_copyfrom->rgb_image, rgb_image, memsize);
+    _copyfrom->RGBImageReleaseRead();
     RGBImageRelease();
 
     #ifdef DEBUG_DETAIL_ON 
@@ -543,14 +765,15 @@ CImageBasis::CImageBasis(string _name, CImageBasis *_copyfrom)
 CImageBasis::CImageBasis(string _name, int _width, int _height, int _channels)
 {
     name = _name;
-    islocked = false;
+    lock = new CImageLock();
     externalImage = false;
     channels = _channels;
     width = _width;
     height = _height;
     bpp = _channels;
 
-    RGBImageLock();
+    if (!LockForReplace())
+        return;
 
      #ifdef DEBUG_DETAIL_ON 
         LogFile.WriteHeapInfo("CImageBasis_width,height,ch - Start");
@@ -558,7 +781,7 @@ CImageBasis::CImageBasis(string _name, int _width, int _height, int _channels)
 
     memsize = width * height * channels;
 
-    rgb_image = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->CImageBasis (" + name + ")", memsize, MALLOC_CAP_SPIRAM);
+    SetBuffer(CImageBuffer::Allocate("CImageBasis (" + name + ")", memsize));
 
     if (rgb_image == NULL)
     {
@@ -579,7 +802,7 @@ CImageBasis::CImageBasis(string _name, int _width, int _height, int _channels)
 CImageBasis::CImageBasis(string _name, std::string _image)
 {
     name = _name;
-    islocked = false;
+    lock = new CImageLock();
     channels = 3;
     externalImage = false;
     filename = _image;
@@ -589,13 +812,15 @@ CImageBasis::CImageBasis(string _name, std::string _image)
         return;
     }
 
-    RGBImageLock();
+    if (!LockForReplace())
+        return;
 
     #ifdef DEBUG_DETAIL_ON 
         LogFile.WriteHeapInfo("CImageBasis_image - Start");
     #endif
 
-    rgb_image = stbi_load(_image.c_str(), &width, &height, &bpp, channels);
+    uint8_t* data = stbi_load(_image.c_str(), &width, &height, &bpp, channels);
+    SetBuffer(CImageBuffer::Adopt("CImageBasis (" + name + ")", data, width * height * channels, CImageBuffer::STBI));
 
     if (rgb_image == NULL) {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CImageBasis-image: Failed to load " + _image + "! Is it corrupted?");
@@ -626,7 +851,7 @@ bool CImageBasis::ImageOkay(){
 CImageBasis::CImageBasis(string _name, uint8_t* _rgb_image, int _channels, int _width, int _height, int _bpp)
 {
     name = _name;
-    islocked = false;
+    lock = new CImageLock();
     rgb_image = _rgb_image;
     channels = _channels;
     width = _width;
@@ -638,13 +863,10 @@ CImageBasis::CImageBasis(string _name, uint8_t* _rgb_image, int _channels, int _
 
 void CImageBasis::Negative(void)
 {
-    RGBImageLock();
+    if (RGBImageLock() == NULL)
+        return;
 
-    for (int i = 0; i < width * height * channels; i += channels) {
-        for (int c = 0; c < channels; c++) {
-            rgb_image[i+c] = 255 - rgb_image[i+c];
-        }
-    }
+    PixelNegate(rgb_image, width * height * channels);
 
     RGBImageRelease();
 }
@@ -652,21 +874,13 @@ void CImageBasis::Negative(void)
 
 void CImageBasis::Contrast(float _contrast)  //input range [-100..100]
 {
-    stbi_uc* p_source;
-    
-    float contrast = (_contrast/100) + 1;  //convert to decimal & shift range: [0..2]
-    float intercept = 128 * (1 - contrast);
-
-    RGBImageLock();
+    uint8_t lut[256];
+    PixelContrastTable(lut, _contrast);
 
+    if (RGBImageLock() == NULL)
+        return;
 
-    for (int x = 0; x < width; ++x)
-        for (int y = 0; y < height; ++y)
-        {
-            p_source = rgb_image + (channels * (y * width + x));
-            for (int _channels = 0; _channels < channels; ++_channels)
-                p_source[_channels] = (uint8_t) std::min(255, std::max(0, (int) (p_source[_channels] * contrast + intercept)));
-        }
+    PixelApplyTable(rgb_image, width * height * channels, lut);
 
     RGBImageRelease();
 }
@@ -674,65 +888,105 @@ void CImageBasis::Contrast(float _contrast)  //input range [-100..100]
 
 CImageBasis::~CImageBasis()
 {
-    RGBImageLock();
-
-
+    // Waits until no other task reads the image any more. Images on the buffer of another image may use
+    // its lock only while it exists, they don't free anything. A shared buffer is freed with its last image.
     if (!externalImage) {
-        if (name == "tmpImage") { // This image should be placed in the shared part of PSRAM
-            psram_free_shared_temp_image_memory();
+        if (!LockForReplace()) {
+            // Still read by another task: the buffer and the lock are left to it instead of being freed under it
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "~CImageBasis: " + name + " still in use, buffer not freed");
+            return;
         }
-        else { // All other images are much smaller and can go into the normal PSRAM region
-            //stbi_image_free(rgb_image);
-            if (memsize == 0) {
-                LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Not freeing (" + name + " as there was never PSRAM allocated for it)");
-            }
-            else {
-                free_psram_heap(std::string(TAG) + "->CImageBasis (" + name + ", " + to_string(memsize) + ")", rgb_image);
-            }
+
+        if (buffer == NULL) {
+            LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Not freeing (" + name + " as there was never PSRAM allocated for it)");
         }
+
+        SetBuffer(NULL);
+        RGBImageRelease();
     }
 
-    RGBImageRelease();
+    if (!externalLock)
+        delete lock;
 }
 
 
-void CImageBasis::SaveToFile(std::string _imageout)
+void CImageBasis::SaveToFile(std::string _imageout, const CImageOverlay* _overlay)
 {
-    string typ = getFileType(_imageout);
+    if (RGBImageLockRead() == NULL)
+        return;
 
-    RGBImageLock();
+    SaveToFile(GetView(), _imageout, _overlay);
+    RGBImageReleaseRead();
+}
+
+
+static bool JpgToFile(void* _context, const uint8_t* _data, int _size)
+{
+    return fwrite(_data, 1, _size, (FILE*) _context) == (size_t) _size;
+}
+
+
+void CImageBasis::SaveToFile(const ImageView &_view, std::string _imageout, const CImageOverlay* _overlay)
+{
+    string typ = getFileType(_imageout);
 
     if ((typ == "jpg") || (typ == "JPG"))       // CAUTION PROBLEMATIC IN ESP32
     {
-        stbi_write_jpg(_imageout.c_str(), width, height, channels, rgb_image, 0);
+        FILE* file = fopen(_imageout.c_str(), "wb");
+        if (file == NULL)
+        {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "SaveToFile: Can't open " + _imageout);
+            return;
+        }
+
+        CJpegEncoder* encoder = CJpegEncoder::Create();
+        uint8_t chunk[HTTP_BUFFER_SENT];
+        encoder->Encode(_view, 0, chunk, HTTP_BUFFER_SENT, JpgToFile, file, _overlay);
+        delete encoder;
+
+        fclose(file);
     }
  
 #ifndef STBI_ONLY_JPEG
     if ((typ == "bmp") || (typ == "BMP"))
     {
-        stbi_write_bmp(_imageout.c_str(), width, height, channels, rgb_image);
+        bool copied;
+        uint8_t* pixels = ContiguousPixels(_view, copied);
+        if (pixels == NULL)
+            return;
+
+        stbi_write_bmp(_imageout.c_str(), _view.width, _view.height, _view.channels, pixels);
+
+        if (copied)
+            RoundArena.Free("ContiguousPixels", pixels);
     }
 #endif
-    RGBImageRelease();
 }
 
 
 void CImageBasis::Resize(int _new_dx, int _new_dy)
 {
-    memsize = _new_dx * _new_dy * channels;
-    uint8_t* odata = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->odata", memsize, MALLOC_CAP_SPIRAM);
+    // Resized directly into the new buffer, the old one is released afterwards
+    CImageBuffer* resized = CImageBuffer::Allocate("CImageBasis Resize (" + name + ")", _new_dx * _new_dy * channels);
 
-    RGBImageLock();
+    if (resized == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Resize: Can't allocate enough memory: " + std::to_string(_new_dx * _new_dy * channels));
+        return;
+    }
 
-    stbir_resize_uint8(rgb_image, width, height, 0, odata, _new_dx, _new_dy, 0, channels);
+    if (!LockForReplace())
+    {
+        resized->Unref();
+        return;
+    }
 
-    rgb_image = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->CImageBasis Resize (" + name + ")", memsize, MALLOC_CAP_SPIRAM);
-    memCopy(odata, rgb_image, memsize);
+    stbir_resize_uint8(rgb_image, width, height, 0, resized->data, _new_dx, _new_dy, 0, channels);
+
+    SetBuffer(resized);
     width = _new_dx;
     height = _new_dy;
 
-    free_psram_heap(std::string(TAG) + "->odata", odata);
-
     RGBImageRelease();
 }
 
@@ -745,11 +999,52 @@ void CImageBasis::Resize(int _new_dx, int _new_dy, CImageBasis *_target)
         return;
     }
 
-    RGBImageLock();
+    if (RGBImageLockRead() == NULL)
+        return;
+
+    Resize(GetView(), _target);
+    RGBImageReleaseRead();
+}
 
-    uint8_t* odata = _target->rgb_image;
-    stbir_resize_uint8(rgb_image, width, height, 0, odata, _new_dx, _new_dy, 0, channels);
 
-    RGBImageRelease();
+void CImageBasis::Resize(const ImageView &_source, CImageBasis *_target)
+{
+    if ((_target->channels != _source.channels) || !_source.Valid())
+    {
+        ESP_LOGE(TAG, "Resize - Source view does not fit to the target image!");
+        return;
+    }
+
+    if (_target->RGBImageLock() == NULL)
+        return;
+
+    stbir_resize_uint8(_source.data, _source.width, _source.height, _source.stride,
+                       _target->rgb_image, _target->width, _target->height, 0, _source.channels);
+    _target->RGBImageRelease();
+}
+
+
+ImageView CImageBasis::GetView()
+{
+    return GetView(0, 0, width, height);
+}
+
+
+ImageView CImageBasis::GetView(int x, int y, int dx, int dy)
+{
+    ImageView view;
+
+    int x2 = std::min(x + dx, width);
+    int y2 = std::min(y + dy, height);
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+
+    view.channels = channels;
+    view.stride = width * channels;
+    view.width = std::max(x2 - x, 0);
+    view.height = std::max(y2 - y, 0);
+    view.data = (rgb_image != NULL) ? rgb_image + y * view.stride + x * channels : NULL;
+
+    return view;
 }
 
@@ -17,6 +17,9 @@
 
 #include "esp_heap_caps.h"
 
+#include "CImageLock.h"
+#include "CImageBuffer.h"
+
 struct ImageData
 {
     uint8_t data[MAX_JPG_SIZE];
@@ -24,6 +27,20 @@ struct ImageData
 };
 
 
+/* Non-owning view of a rectangle of an image (pixels are not copied), valid as long as the image buffer exists */
+struct ImageView
+{
+    uint8_t* data = NULL;       // First pixel of the rectangle
+    int stride = 0;             // Bytes from one row to the next
+    int width = 0, height = 0, channels = 0;
+
+    bool Valid() const { return (data != NULL) && (width > 0) && (height > 0); };
+    uint8_t* Pixel(int x, int y) const { return data + y * stride + x * channels; };
+};
+
+
+class CImageOverlay;            // Drawn by the JPEG encoder (CImageOverlay.h)
+
 
 class CImageBasis
 {
@@ -35,22 +52,62 @@ class CImageBasis
 
         void memCopy(uint8_t* _source, uint8_t* _target, int _size);
         bool isInImage(int x, int y);
+        void putPixel(int x, int y, int r, int g, int b);
+
+        CImageLock* lock = NULL;        // Shared with the images working on the same buffer (CRotateImage, CAlignAndCutImage)
+        bool externalLock = false;
+
+        CImageBuffer* buffer = NULL;    // Owns rgb_image (NULL for external images), shared with copies until one of them writes
+        CImageBasis* bufferowner = NULL;// Image owning the buffer of the images working on it
 
-        bool islocked;
+        void ShareLock(CImageBasis* _image);
+
+        /**
+         * @brief Replaces the buffer (the old one loses a reference), NULL frees the image
+         */
+        void SetBuffer(CImageBuffer* _buffer);
+
+        /**
+         * @brief Copy-on-write: own copy of a shared buffer before writing, called with the write lock held
+         */
+        bool Unshare();
+        CImageBuffer::Memory BufferMemory();
+
+        /**
+         * @brief Write lock without copy-on-write, for replacing the whole buffer
+         */
+        bool LockForReplace(int _waitmaxsec = 60);
+
+        bool LoadScaledFromMemory(stbi_uc *_buffer, int len, int _scale);
 
     public:
         uint8_t* rgb_image = NULL;
         int channels;
         int width, height, bpp; 
 
+        /**
+         * @brief Exclusive access for changing the image, NULL if the image is not available within _waitmaxsec
+         * or has no pixels (the lock is not held then, no release). A buffer shared with copies of the image is
+         * duplicated first, rgb_image can change.
+         */
         uint8_t * RGBImageLock(int _waitmaxsec = 60);
         void RGBImageRelease();
+
+        /**
+         * @brief Shared access for reading the image (several readers at the same time, no writer),
+         * NULL as RGBImageLock (not locked then)
+         */
+        uint8_t * RGBImageLockRead(int _waitmaxsec = 60);
+        void RGBImageReleaseRead();
+
         uint8_t * RGBImageGet();
+        CImageLock* GetLock(){return lock;};
 
         int getWidth(){return this->width;};   
         int getHeight(){return this->height;};   
         int getChannels(){return this->channels;};   
         void drawRect(int x, int y, int dx, int dy, int r = 255, int g = 255, int b = 255, int thickness = 1);
+        static void drawRect(const ImageView &_view, int x, int y, int dx, int dy, int r = 255, int g = 255, int b = 255, int thickness = 1);
         void drawLine(int x1, int y1, int x2, int y2, int r, int g, int b, int thickness = 1);
         void drawCircle(int x1, int y1, int rad, int r, int g, int b, int thickness = 1);
         void drawEllipse(int x1, int y1, int radx, int rady, int r, int g, int b, int thickness = 1);
@@ -61,7 +118,13 @@ class CImageBasis
         bool ImageOkay();
         bool CopyFromMemory(uint8_t* _source, int _size);
 
-        void SetIndepended(){externalImage = false;};
+        void SetIndepended();
+
+        /**
+         * @brief Takes over the buffer of _source without copying the pixels, _source is empty afterwards
+         */
+        void MoveFrom(CImageBasis *_source);
+        bool SharesBuffer(CImageBasis *_image);
 
         void CreateEmptyImage(int _width, int _height, int _channels);
         void EmptyImage();
@@ -71,24 +134,52 @@ class CImageBasis
         CImageBasis(std::string name, std::string _image);
         CImageBasis(std::string name, uint8_t* _rgb_image, int _channels, int _width, int _height, int _bpp);
         CImageBasis(std::string name, int _width, int _height, int _channels);
+        /**
+         * @brief Copy of _copyfrom, shares its buffer until one of the images is written (external images are copied)
+         */
         CImageBasis(std::string name, CImageBasis *_copyfrom);
 
         void Resize(int _new_dx, int _new_dy);        
         void Resize(int _new_dx, int _new_dy, CImageBasis *_target);        
+        static void Resize(const ImageView &_source, CImageBasis *_target);
+
+        /**
+         * @brief View of the whole image / of a rectangle (clipped to the image), no copy
+         */
+        ImageView GetView();
+        ImageView GetView(int x, int y, int dx, int dy);
+        bool Contains(const ImageView &_view);
         void crop_image(unsigned short cropLeft, unsigned short cropRight, unsigned short cropTop, unsigned short cropBottom);
 
-        void LoadFromMemory(stbi_uc *_buffer, int len);
+        /**
+         * @brief Decode a JPEG, _scale 2, 4 or 8 reduces the size already in the DCT domain (CJpegDecoder)
+         */
+        void LoadFromMemory(stbi_uc *_buffer, int len, int _scale = 1);
+
+        /**
+         * @brief Copy _pixels pixels between interleaved buffers with 1 or 3 channels:
+         * same channels copy, RGB -> luminance (BT.601), luminance -> replicated RGB
+         */
+        static void CopyPixels(const uint8_t* _source, int _sourcechannels, uint8_t* _target, int _targetchannels, int _pixels);
 
         ImageData* writeToMemoryAsJPG(const int quality = 90);
-        void writeToMemoryAsJPG(ImageData* ii, const int quality = 90);
+        /**
+         * @brief _overlay is drawn by the encoder, the image stays unchanged
+         */
+        void writeToMemoryAsJPG(ImageData* ii, const int quality = 90, const CImageOverlay* _overlay = NULL);
 
-        esp_err_t SendJPGtoHTTP(httpd_req_t *req, const int quality = 90);   
+        esp_err_t SendJPGtoHTTP(httpd_req_t *req, const int quality = 90, const CImageOverlay* _overlay = NULL);
+        static esp_err_t SendJPGtoHTTP(httpd_req_t *req, const ImageView &_view, const int quality = 90, const CImageOverlay* _overlay = NULL);
 
         uint8_t GetPixelColor(int x, int y, int ch);
 
         ~CImageBasis();
 
-        void SaveToFile(std::string _imageout);
+        /**
+         * @brief _overlay: JPEG only
+         */
+        void SaveToFile(std::string _imageout, const CImageOverlay* _overlay = NULL);
+        static void SaveToFile(const ImageView &_view, std::string _imageout, const CImageOverlay* _overlay = NULL);
 };
 
 
@@ -0,0 +1,144 @@
+#include "CImageBuffer.h"
+
+#include "psram.h"
+#include "ClassLogFile.h"
+#include "../stb/stb_image.h"
+
+#include <string.h>
+
+static const char* TAG = "C IMG BUFFER";
+
+
+static std::atomic<int> live(0);
+static std::atomic<int> peak(0);
+static std::atomic<int> roundpeak(0);
+static std::atomic<uint32_t> sharedcopies(0);
+static std::atomic<uint32_t> copiesonwrite(0);
+
+
+CImageBuffer::CImageBuffer(std::string _name, uint8_t* _data, int _size, Memory _memory) : refs(1)
+{
+    name = _name;
+    data = _data;
+    size = _size;
+    memory = _memory;
+
+    int now = ++live;
+    int max = peak.load();
+    while ((now > max) && !peak.compare_exchange_weak(max, now))
+        ;
+}
+
+
+CImageBuffer::~CImageBuffer()
+{
+    if (memory == SHARED_TMP) {
+        psram_free_shared_temp_image_memory();
+    }
+    else if (memory == STBI) {
+        stbi_image_free(data);
+    }
+    else {
+        free_psram_heap(std::string(TAG) + "->" + name + " (" + std::to_string(size) + ")", data);
+    }
+
+    live--;
+}
+
+
+CImageBuffer* CImageBuffer::Allocate(std::string _name, int _size, Memory _memory)
+{
+    uint8_t* data;
+
+    if (_memory == SHARED_TMP) {
+        data = (uint8_t*)psram_reserve_shared_tmp_image_memory();
+    }
+    else {
+        _memory = HEAP;
+        data = (uint8_t*)malloc_psram_heap(std::string(TAG) + "->" + _name, _size, MALLOC_CAP_SPIRAM);
+    }
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    return new CImageBuffer(_name, data, _size, _memory);
+}
+
+
+CImageBuffer* CImageBuffer::Adopt(std::string _name, uint8_t* _data, int _size, Memory _memory)
+{
+    if (_data == NULL) {
+        return NULL;
+    }
+
+    return new CImageBuffer(_name, _data, _size, _memory);
+}
+
+
+CImageBuffer* CImageBuffer::Duplicate(std::string _name, Memory _memory)
+{
+    CImageBuffer* copy = Allocate(_name, size, _memory);
+
+    if (copy == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Duplicate: Can't allocate " + std::to_string(size) + " bytes for " + _name);
+        return NULL;
+    }
+
+    memcpy(copy->data, data, size);
+    copiesonwrite++;
+    return copy;
+}
+
+
+CImageBuffer* CImageBuffer::Ref()
+{
+    refs++;
+    sharedcopies++;
+    return this;
+}
+
+
+void CImageBuffer::Unref()
+{
+    if (--refs == 0) {
+        delete this;
+    }
+}
+
+
+int CImageBuffer::Live()
+{
+    return live.load();
+}
+
+
+int CImageBuffer::Peak()
+{
+    return peak.load();
+}
+
+
+int CImageBuffer::RoundPeak()
+{
+    return roundpeak.load();
+}
+
+
+uint32_t CImageBuffer::SharedCopies()
+{
+    return sharedcopies.load();
+}
+
+
+uint32_t CImageBuffer::CopiesOnWrite()
+{
+    return copiesonwrite.load();
+}
+
+
+void CImageBuffer::NextRound()
+{
+    roundpeak = peak.load();
+    peak = live.load();
+}
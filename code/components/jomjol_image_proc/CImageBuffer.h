@@ -0,0 +1,77 @@
+#pragma once
+
+#ifndef CIMAGEBUFFER_H
+#define CIMAGEBUFFER_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+
+/**
+ * Reference counted pixel buffer of CImageBasis. A copy of an image only takes a reference to the buffer of the
+ * original (copy-on-write): the first image writing to a shared buffer gets its own copy (CImageBasis::RGBImageLock),
+ * images which are only read never duplicate their pixels. The memory is freed with the last reference.
+ *
+ * The buffer frees its memory the way it was allocated: PSRAM heap, shared PSRAM region of the tmpImage
+ * (psram_reserve_shared_tmp_image_memory) or STBI (stbi_load).
+ *
+ * The sensor JPEG of a round is kept in a buffer as well (ClassFlowTakeImage), the web server takes a reference
+ * while it sends it.
+ *
+ * The live buffers are counted, the peak within a round shows how many frames were in PSRAM at the same time.
+ */
+class CImageBuffer
+{
+    public:
+        enum Memory {
+            HEAP,                       // malloc_psram_heap
+            SHARED_TMP,                 // Shared PSRAM region, only one buffer at a time
+            STBI                        // stbi_load, freed with stbi_image_free
+        };
+
+        uint8_t* data;
+        int size;
+
+        /**
+         * @brief New buffer of _size bytes with one reference, NULL if there is not enough memory
+         */
+        static CImageBuffer* Allocate(std::string _name, int _size, Memory _memory = HEAP);
+
+        /**
+         * @brief Takes the ownership of _data (allocated as _memory), one reference
+         */
+        static CImageBuffer* Adopt(std::string _name, uint8_t* _data, int _size, Memory _memory);
+
+        /**
+         * @brief New buffer with a copy of the pixels, one reference
+         */
+        CImageBuffer* Duplicate(std::string _name, Memory _memory = HEAP);
+
+        CImageBuffer* Ref();
+        void Unref();
+        bool Shared() { return refs.load() > 1; };
+        int References() { return refs.load(); };
+
+        // Statistics of all buffers
+        static int Live();              // Buffers existing at the moment
+        static int Peak();              // Most buffers at the same time since the start of the round
+        static int RoundPeak();         // Peak of the last completed round
+        static uint32_t SharedCopies(); // Image copies which only took a reference
+        static uint32_t CopiesOnWrite();// Shared buffers duplicated because an image was written
+
+        /**
+         * @brief Completes a round: the peak is kept as RoundPeak(), the next round starts with the live buffers
+         */
+        static void NextRound();
+
+    protected:
+        std::atomic<int> refs;
+        Memory memory;
+        std::string name;
+
+        CImageBuffer(std::string _name, uint8_t* _data, int _size, Memory _memory);
+        ~CImageBuffer();
+};
+
+#endif //CIMAGEBUFFER_H
@@ -0,0 +1,363 @@
+#include "CImageLock.h"
+
+#include "ClassLogFile.h"
+
+static const char* TAG = "C IMG LOCK";
+
+
+#ifdef ESP_PLATFORM
+/* Takes _semaphore within the rest of _ticks since _start, _waited is set if it was not free immediately */
+static bool TakeUntil(SemaphoreHandle_t _semaphore, TickType_t _start, TickType_t _ticks, bool &_waited)
+{
+    if (xSemaphoreTake(_semaphore, 0) == pdTRUE)
+        return true;
+
+    _waited = true;
+    TickType_t elapsed = xTaskGetTickCount() - _start;
+    return (elapsed < _ticks) && (xSemaphoreTake(_semaphore, _ticks - elapsed) == pdTRUE);
+}
+#endif
+
+
+CImageLock::CImageLock()
+{
+#ifdef ESP_PLATFORM
+    portMUX_INITIALIZE(&state);
+    writer = NULL;
+    resource = xSemaphoreCreateBinary();
+    turnstile = xSemaphoreCreateMutex();
+    readgate = xSemaphoreCreateMutex();
+
+    if ((resource == NULL) || (turnstile == NULL) || (readgate == NULL))
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "CImageLock: Can't create semaphores");
+    else
+        xSemaphoreGive(resource);
+#endif
+}
+
+
+CImageLock::~CImageLock()
+{
+#ifdef ESP_PLATFORM
+    if (resource != NULL)
+        vSemaphoreDelete(resource);
+    if (turnstile != NULL)
+        vSemaphoreDelete(turnstile);
+    if (readgate != NULL)
+        vSemaphoreDelete(readgate);
+#endif
+}
+
+
+void CImageLock::Enter()
+{
+#ifdef ESP_PLATFORM
+    portENTER_CRITICAL(&state);
+#else
+    state.lock();
+#endif
+}
+
+
+void CImageLock::Exit()
+{
+#ifdef ESP_PLATFORM
+    portEXIT_CRITICAL(&state);
+#else
+    state.unlock();
+#endif
+}
+
+
+ImageLockTask CImageLock::CurrentTask()
+{
+#ifdef ESP_PLATFORM
+    return xTaskGetCurrentTaskHandle();
+#else
+    return std::this_thread::get_id();
+#endif
+}
+
+
+/* Index of _task in readers, -1 if it does not read (call within Enter / Exit) */
+int CImageLock::FindReader(ImageLockTask _task)
+{
+    for (int i = 0; i < nreaders; ++i)
+        if (readers[i].task == _task)
+            return i;
+    return -1;
+}
+
+
+/* The task holds the write lock, also if only the read locks nested in it are left (call within Enter / Exit) */
+bool CImageLock::Writing(ImageLockTask _task)
+{
+    return ((writedepth > 0) || (writereads > 0)) && (writer == _task);
+}
+
+
+/* Releases the buffer held exclusively by the writer */
+void CImageLock::ReleaseResource()
+{
+#ifdef ESP_PLATFORM
+    xSemaphoreGive(resource);
+#else
+    resource.unlock();
+#endif
+}
+
+
+void CImageLock::Account(bool _write, bool _taken, bool _waited, uint32_t _waitms)
+{
+    Enter();
+    if (_taken)
+        (_write ? writes : reads)++;
+    else
+        timeouts++;
+    if (_waited)
+        contended++;
+    if (_waitms > max_wait_ms)
+        max_wait_ms = _waitms;
+    Exit();
+}
+
+
+bool CImageLock::LockRead(int _waitmaxms)
+{
+    ImageLockTask task = CurrentTask();
+
+    // Recursion: the writer reads its own image, a reader reads again (without the turnstile, a waiting writer
+    // would wait for this task)
+    Enter();
+    if (Writing(task))
+    {
+        writereads++;
+        Exit();
+        return true;
+    }
+    int r = FindReader(task);
+    if (r >= 0)
+    {
+        readers[r].depth++;
+        Exit();
+        return true;
+    }
+    Exit();
+
+    bool waited = false;
+    bool taken = false;
+
+#ifdef ESP_PLATFORM
+    TickType_t start = xTaskGetTickCount();
+    TickType_t ticks = pdMS_TO_TICKS(_waitmaxms);
+
+    if (TakeUntil(turnstile, start, ticks, waited))
+    {
+        xSemaphoreGive(turnstile);
+
+        // The reader table only changes with the readgate taken, the first reader takes the resource for all readers
+        if (TakeUntil(readgate, start, ticks, waited))
+        {
+            if (nreaders < IMAGELOCK_MAX_READERS)
+                taken = (nreaders > 0) || TakeUntil(resource, start, ticks, waited);
+
+            if (taken)
+            {
+                Enter();
+                readers[nreaders].task = task;
+                readers[nreaders].depth = 1;
+                nreaders++;
+                Exit();
+            }
+            xSemaphoreGive(readgate);
+        }
+    }
+    uint32_t waitms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+#else
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = start + std::chrono::milliseconds(_waitmaxms);
+
+    bool passed = turnstile.try_lock();
+    if (!passed)
+    {
+        waited = true;
+        passed = turnstile.try_lock_until(deadline);
+    }
+
+    if (passed)
+    {
+        turnstile.unlock();
+        taken = resource.try_lock_shared();
+        if (!taken)
+        {
+            waited = true;
+            taken = resource.try_lock_shared_until(deadline);
+        }
+    }
+
+    if (taken)
+    {
+        Enter();
+        if (nreaders < IMAGELOCK_MAX_READERS)
+        {
+            readers[nreaders].task = task;
+            readers[nreaders].depth = 1;
+            nreaders++;
+        }
+        else
+        {
+            resource.unlock_shared();
+            taken = false;
+        }
+        Exit();
+    }
+    uint32_t waitms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+
+    Account(false, taken, waited, waitms);
+    return taken;
+}
+
+
+void CImageLock::ReleaseRead()
+{
+    ImageLockTask task = CurrentTask();
+
+    Enter();
+    if (Writing(task))
+    {
+        if (writereads == 0)
+        {
+            Exit();
+            return;
+        }
+        bool last = (--writereads == 0) && (writedepth == 0);
+        Exit();
+
+        if (last)                   // Write lock released before this nested read lock
+            ReleaseResource();
+        return;
+    }
+    int r = FindReader(task);
+    if ((r < 0) || (--readers[r].depth > 0))
+    {
+        Exit();
+        return;
+    }
+    Exit();
+
+#ifdef ESP_PLATFORM
+    xSemaphoreTake(readgate, portMAX_DELAY);
+
+    Enter();
+    readers[FindReader(task)] = readers[--nreaders];
+    bool last = (nreaders == 0);
+    Exit();
+
+    if (last)
+        xSemaphoreGive(resource);
+    xSemaphoreGive(readgate);
+#else
+    Enter();
+    readers[FindReader(task)] = readers[--nreaders];
+    Exit();
+
+    resource.unlock_shared();
+#endif
+}
+
+
+bool CImageLock::LockWrite(int _waitmaxms)
+{
+    ImageLockTask task = CurrentTask();
+
+    Enter();
+    if (Writing(task))
+    {
+        writedepth++;
+        Exit();
+        return true;
+    }
+    bool reading = (FindReader(task) >= 0);
+    Exit();
+
+    if (reading)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "LockWrite: Task holds a read lock, upgrade not possible");
+        Account(true, false, false, 0);
+        return false;
+    }
+
+    bool waited = false;
+    bool taken = false;
+
+#ifdef ESP_PLATFORM
+    TickType_t start = xTaskGetTickCount();
+    TickType_t ticks = pdMS_TO_TICKS(_waitmaxms);
+
+    if (TakeUntil(turnstile, start, ticks, waited))
+    {
+        taken = TakeUntil(resource, start, ticks, waited);
+        xSemaphoreGive(turnstile);
+    }
+    uint32_t waitms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+#else
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = start + std::chrono::milliseconds(_waitmaxms);
+
+    bool passed = turnstile.try_lock();
+    if (!passed)
+    {
+        waited = true;
+        passed = turnstile.try_lock_until(deadline);
+    }
+
+    if (passed)
+    {
+        taken = resource.try_lock();
+        if (!taken)
+        {
+            waited = true;
+            taken = resource.try_lock_until(deadline);
+        }
+        turnstile.unlock();
+    }
+    uint32_t waitms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+
+    if (taken)
+    {
+        Enter();
+        writer = task;
+        writedepth = 1;
+        Exit();
+    }
+
+    Account(true, taken, waited, waitms);
+    return taken;
+}
+
+
+void CImageLock::ReleaseWrite()
+{
+    ImageLockTask task = CurrentTask();
+
+    Enter();
+    if ((writedepth == 0) || (writer != task))
+    {
+        Exit();
+        return;
+    }
+    bool last = (--writedepth == 0);
+    int pending = writereads;
+    Exit();
+
+    if (!last)
+        return;
+
+    // The buffer stays locked until the nested read locks are released as well
+    if (pending > 0)
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "ReleaseWrite: " + std::to_string(pending) + " nested read lock(s) still held");
+    else
+        ReleaseResource();
+}
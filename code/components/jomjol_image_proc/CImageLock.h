@@ -0,0 +1,90 @@
+#pragma once
+
+#ifndef CIMAGELOCK_H
+#define CIMAGELOCK_H
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+    #include "freertos/FreeRTOS.h"
+    #include "freertos/semphr.h"
+    #include "freertos/task.h"
+    typedef TaskHandle_t ImageLockTask;
+#else
+    #include <chrono>
+    #include <mutex>
+    #include <shared_mutex>
+    #include <thread>
+    typedef std::thread::id ImageLockTask;
+#endif
+
+#define IMAGELOCK_MAX_READERS 8         // Tasks reading at the same time (HTTP server tasks + flow)
+
+
+/**
+ * Reader / writer lock of an image buffer: several tasks can read at the same time (e.g. HTTP handlers encoding
+ * a JPEG), a writer waits until all readers are done and has the buffer exclusively. A waiting writer stops new
+ * readers, a continuous stream of HTTP requests can't starve the flow.
+ *
+ * The locks are recursive per task: the task holding the write lock can lock again for reading or writing,
+ * a reading task can read again. Upgrading a read lock to a write lock is refused (it would wait for itself).
+ * Releasing a lock which the task does not hold (e.g. after a timeout) is ignored. The writer releases the
+ * buffer when its write and nested read locks are all released; a write lock released before the read locks
+ * nested in it is logged as error.
+ *
+ * On the ESP32 the lock consists of FreeRTOS semaphores, on a host of std::shared_timed_mutex (with timeout).
+ */
+class CImageLock
+{
+    public:
+        // Statistics since creation, recursive locks are not counted
+        uint32_t reads = 0;             // Read locks taken
+        uint32_t writes = 0;            // Write locks taken
+        uint32_t contended = 0;         // Locks which had to wait for another task
+        uint32_t timeouts = 0;          // Locks not available within the timeout
+        uint32_t max_wait_ms = 0;       // Longest wait for a lock
+
+        CImageLock();
+        ~CImageLock();
+
+        /**
+         * @brief Wait at most _waitmaxms for the lock, false if it could not be taken
+         */
+        bool LockRead(int _waitmaxms);
+        void ReleaseRead();
+        bool LockWrite(int _waitmaxms);
+        void ReleaseWrite();
+
+    protected:
+        struct Reader {
+            ImageLockTask task;
+            int depth;
+        };
+
+        ImageLockTask writer;           // Task holding the write lock
+        int writedepth = 0;
+        int writereads = 0;             // Read locks taken by the writer within its write lock
+        Reader readers[IMAGELOCK_MAX_READERS];
+        int nreaders = 0;
+
+#ifdef ESP_PLATFORM
+        portMUX_TYPE state;             // Short critical sections on the fields above
+        SemaphoreHandle_t resource;     // Held by the writer or by the group of readers
+        SemaphoreHandle_t turnstile;    // Held by a waiting writer, readers pass it before they enter
+        SemaphoreHandle_t readgate;     // Serializes first / last reader
+#else
+        std::mutex state;
+        std::shared_timed_mutex resource;
+        std::timed_mutex turnstile;
+#endif
+
+        void Enter();
+        void Exit();
+        static ImageLockTask CurrentTask();
+        int FindReader(ImageLockTask _task);
+        bool Writing(ImageLockTask _task);
+        void ReleaseResource();
+        void Account(bool _write, bool _taken, bool _waited, uint32_t _waitms);
+};
+
+#endif //CIMAGELOCK_H
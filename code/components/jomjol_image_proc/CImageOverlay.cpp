@@ -0,0 +1,178 @@
+#include "CImageOverlay.h"
+
+#include <math.h>
+#include <algorithm>
+
+
+static bool PointBefore(const ImageOverlayPoint &_a, const ImageOverlayPoint &_b)
+{
+    return (_a.y < _b.y) || ((_a.y == _b.y) && (_a.x < _b.x));
+}
+
+
+static bool PointSame(const ImageOverlayPoint &_a, const ImageOverlayPoint &_b)
+{
+    return (_a.x == _b.x) && (_a.y == _b.y);
+}
+
+
+static bool PointAboveRow(const ImageOverlayPoint &_point, int _row)
+{
+    return _point.y < _row;
+}
+
+
+ImageOverlayItem CImageOverlay::NewItem(ImageOverlayShape _shape, int r, int g, int b, int thickness)
+{
+    ImageOverlayItem item;
+    item.shape = _shape;
+    item.x = item.y = item.dx = item.dy = 0;
+    item.thickness = thickness;
+    item.top = item.bottom = 0;
+    item.first = points.size();
+    item.count = 0;
+    item.color[0] = r;
+    item.color[1] = g;
+    item.color[2] = b;
+    return item;
+}
+
+
+void CImageOverlay::AddPoint(const ImageOverlayItem &_item, int x, int y)
+{
+    ImageOverlayPoint point = {(int16_t) x, (int16_t) y};
+
+    // The rasterization visits most pixels several times in a row
+    if (((int) points.size() > _item.first) && PointSame(points.back(), point))
+        return;
+
+    points.push_back(point);
+}
+
+
+/* Sorted by row without duplicates, so Render finds the rows of a strip by binary search */
+void CImageOverlay::FinishPoints(ImageOverlayItem &_item)
+{
+    std::vector<ImageOverlayPoint>::iterator first = points.begin() + _item.first;
+
+    std::sort(first, points.end(), PointBefore);
+    points.erase(std::unique(first, points.end(), PointSame), points.end());
+
+    _item.count = points.size() - _item.first;
+    if (_item.count > 0) {
+        _item.top = points[_item.first].y;
+        _item.bottom = points.back().y;
+        items.push_back(_item);
+    }
+}
+
+
+void CImageOverlay::AddRect(int x, int y, int dx, int dy, int r, int g, int b, int thickness)
+{
+    if (thickness < 1)
+        return;
+
+    ImageOverlayItem item = NewItem(OVERLAY_RECT, r, g, b, thickness);
+    item.x = x;
+    item.y = y;
+    item.dx = dx;
+    item.dy = dy;
+    item.top = y - thickness + 1;
+    item.bottom = y + dy + thickness - 1;
+    items.push_back(item);
+}
+
+
+/* Same pixels as CImageBasis::drawLine */
+void CImageOverlay::AddLine(int x1, int y1, int x2, int y2, int r, int g, int b, int thickness)
+{
+    ImageOverlayItem item = NewItem(OVERLAY_POINTS, r, g, b, thickness);
+    int _x, _y, _thick;
+    int _zwy1, _zwy2;
+    thickness = (thickness-1) / 2;
+
+    for (_thick = 0; _thick <= thickness; ++_thick)
+        for (_x = x1 - _thick; _x <= x2 + _thick; ++_x)
+        {
+            if (x2 == x1)
+            {
+                _zwy1 = y1;
+                _zwy2 = y2;
+            }
+            else
+            {
+                _zwy1 = (y2 - y1) * (float)(_x - x1) / (float)(x2 - x1) + y1;
+                _zwy2 = (y2 - y1) * (float)(_x + 1 - x1) / (float)(x2 - x1) + y1;
+            }
+
+            for (_y = _zwy1 - _thick; _y <= _zwy2 + _thick; _y++)
+                AddPoint(item, _x, _y);
+        }
+
+    FinishPoints(item);
+}
+
+
+/* Same pixels as CImageBasis::drawEllipse, one ring after the other (the angles of every ring are the same) */
+void CImageOverlay::AddEllipse(int x1, int y1, int radx, int rady, int r, int g, int b, int thickness)
+{
+    ImageOverlayItem item = NewItem(OVERLAY_POINTS, r, g, b, thickness);
+    float deltarad, aktrad;
+    int _thick, _x, _y;
+    int rad = radx;
+
+    if (rady > radx)
+        rad = rady;
+
+    deltarad = 1 / (4 * M_PI * (rad + thickness - 1));
+
+    for (_thick = 0; _thick < thickness; ++_thick)
+        for (aktrad = 0; aktrad <= (2 * M_PI); aktrad += deltarad)
+        {
+            _x = sin(aktrad) * (radx + _thick) + x1;
+            _y = cos(aktrad) * (rady + _thick) + y1;
+            AddPoint(item, _x, _y);
+        }
+
+    FinishPoints(item);
+}
+
+
+void CImageOverlay::Clear()
+{
+    items.clear();
+    points.clear();
+}
+
+
+void CImageOverlay::Render(const ImageView &_view, int _top) const
+{
+    int bottom = _top + _view.height - 1;
+
+    for (int i = 0; i < items.size(); ++i) {
+        const ImageOverlayItem &item = items[i];
+
+        if ((item.bottom < _top) || (item.top > bottom))
+            continue;
+
+        if (item.shape == OVERLAY_RECT) {
+            CImageBasis::drawRect(_view, item.x, item.y - _top, item.dx, item.dy, item.color[0], item.color[1], item.color[2], item.thickness);
+            continue;
+        }
+
+        const ImageOverlayPoint* first = points.data() + item.first;
+        const ImageOverlayPoint* last = first + item.count;
+
+        for (const ImageOverlayPoint* p = std::lower_bound(first, last, _top, PointAboveRow); (p < last) && (p->y <= bottom); ++p) {
+            if ((p->x < 0) || (p->x >= _view.width))
+                continue;
+
+            uint8_t* pixel = _view.Pixel(p->x, p->y - _top);
+            pixel[0] = item.color[0];
+            if (_view.channels > 2) {
+                pixel[1] = item.color[1];
+                pixel[2] = item.color[2];
+            }
+        }
+    }
+}
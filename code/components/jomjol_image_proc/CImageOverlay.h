@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef CIMAGEOVERLAY_H
+#define CIMAGEOVERLAY_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "CImageBasis.h"
+
+
+enum ImageOverlayShape {
+    OVERLAY_RECT,                       // Frame as CImageBasis::drawRect
+    OVERLAY_POINTS                      // Pixels of a line or an ellipse, rasterized when added
+};
+
+struct ImageOverlayPoint {
+    int16_t x, y;
+};
+
+struct ImageOverlayItem {
+    ImageOverlayShape shape;
+    int x, y, dx, dy;                   // Rectangle as drawRect
+    int thickness;
+    int top, bottom;                    // Rows touched by the item
+    int first, count;                   // Points of the item, sorted by row
+    uint8_t color[3];
+};
+
+
+/**
+ * Description of what is drawn onto an image for display (reference boxes, ROI frames), instead of drawing it
+ * onto a copy of the image. The JPEG encoder draws it onto the rows it is reading (CJpegEncoder::Encode),
+ * the image itself stays untouched and the overlay can be left out per request.
+ *
+ * The shapes give the same pixels as the draw functions of CImageBasis with the same parameters.
+ * Lines and ellipses are rasterized when they are added, the points of an item are kept sorted by row,
+ * so a strip of rows only touches the points inside it. Items are drawn in the order they were added.
+ */
+class CImageOverlay
+{
+    public:
+        void AddRect(int x, int y, int dx, int dy, int r, int g, int b, int thickness = 1);
+        void AddLine(int x1, int y1, int x2, int y2, int r, int g, int b, int thickness = 1);
+        void AddEllipse(int x1, int y1, int radx, int rady, int r, int g, int b, int thickness = 1);
+
+        /**
+         * @brief Removes all items, the memory is kept for the items of the next round
+         */
+        void Clear();
+
+        bool Empty() const { return items.empty(); };
+        int Items() const { return items.size(); };
+
+        /**
+         * @brief Draws the items onto _view, which holds the rows _top .. _top + height - 1 of the image
+         * the overlay belongs to (a strip of an encoder). Pixels outside of the view are skipped.
+         */
+        void Render(const ImageView &_view, int _top) const;
+
+    protected:
+        std::vector<ImageOverlayItem> items;
+        std::vector<ImageOverlayPoint> points;
+
+        ImageOverlayItem NewItem(ImageOverlayShape _shape, int r, int g, int b, int thickness);
+        void AddPoint(const ImageOverlayItem &_item, int x, int y);
+        void FinishPoints(ImageOverlayItem &_item);
+};
+
+#endif //CIMAGEOVERLAY_H
@@ -0,0 +1,104 @@
+#include "CImagePyramid.h"
+#include "CPixelKernels.h"
+#include "CRoundArena.h"
+
+#include "ClassLogFile.h"
+#include "psram.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+static const char* TAG = "C IMG PYRAMID";
+
+
+/* Number of levels which can be used for a template of the given size */
+int CImagePyramid::MaxLevels(int _tpl_width, int _tpl_height)
+{
+    int _levels = 1;
+
+    while ((_levels < PYRAMID_MAX_LEVELS) &&
+           ((_tpl_width >> _levels) >= PYRAMID_MIN_TEMPLATE_SIZE) &&
+           ((_tpl_height >> _levels) >= PYRAMID_MIN_TEMPLATE_SIZE))
+        _levels++;
+
+    return _levels;
+}
+
+
+bool CImagePyramid::Build(const uint8_t* _image, int _imagewidth, int _channels, int _channel, int _x, int _y, int _dx, int _dy, int _levels)
+{
+    Free();
+
+    _levels = std::min(_levels, PYRAMID_MAX_LEVELS);
+
+    width[0] = _dx;
+    height[0] = _dy;
+    plane[0] = AllocatePlane(0, _dx * _dy);
+
+    if (plane[0] == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Build: Can't allocate level 0 (" + std::to_string(_dx * _dy) + " bytes)");
+        return false;
+    }
+    levels = 1;
+
+    for (int y = 0; y < _dy; ++y)
+        PixelExtractChannel(_image + _channels * ((_y + y) * _imagewidth + _x), _channels, _channel, plane[0] + y * _dx, _dx);
+
+    for (int l = 1; l < _levels; ++l) {
+        int w = width[l-1] / 2;
+        int h = height[l-1] / 2;
+
+        if ((w == 0) || (h == 0))
+            break;
+
+        plane[l] = AllocatePlane(l, w * h);
+
+        if (plane[l] == NULL) {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Build: Can't allocate level " + std::to_string(l) + " (" + std::to_string(w * h) + " bytes)");
+            break;
+        }
+
+        int srcw = width[l-1];
+        for (int y = 0; y < h; ++y) {
+            const uint8_t* p_row0 = plane[l-1] + (2 * y) * srcw;
+            const uint8_t* p_row1 = p_row0 + srcw;
+            uint8_t* p_target = plane[l] + y * w;
+            for (int x = 0; x < w; ++x)
+                p_target[x] = (p_row0[2*x] + p_row0[2*x + 1] + p_row1[2*x] + p_row1[2*x + 1] + 2) >> 2;
+        }
+
+        width[l] = w;
+        height[l] = h;
+        levels = l + 1;
+    }
+
+    return true;
+}
+
+
+uint8_t* CImagePyramid::AllocatePlane(int _level, int _size)
+{
+    if (round) {
+        return (uint8_t*) RoundArena.Allocate(name + " level " + std::to_string(_level), _size);
+    }
+
+    return (uint8_t*) malloc_psram_heap(std::string(TAG) + "->" + name + " level " + std::to_string(_level), _size, MALLOC_CAP_SPIRAM);
+}
+
+
+void CImagePyramid::Free()
+{
+    // Coarsest level first: the arena takes the planes back in the reverse order of the allocation
+    for (int l = PYRAMID_MAX_LEVELS - 1; l >= 0; --l) {
+        if ((plane[l] != NULL) && round) {
+            RoundArena.Free(name + " level " + std::to_string(l), plane[l]);
+        }
+        else if (plane[l] != NULL) {
+            free_psram_heap(std::string(TAG) + "->" + name + " level " + std::to_string(l), plane[l]);
+        }
+        plane[l] = NULL;
+        width[l] = 0;
+        height[l] = 0;
+    }
+    levels = 0;
+}
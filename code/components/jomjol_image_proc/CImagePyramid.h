@@ -0,0 +1,43 @@
+#pragma once
+
+#ifndef CIMAGEPYRAMID_H
+#define CIMAGEPYRAMID_H
+
+#include <stdint.h>
+#include <string>
+
+#define PYRAMID_MAX_LEVELS 4            // Level 0 (full resolution) up to level 3 (1/8)
+#define PYRAMID_MIN_TEMPLATE_SIZE 6     // Smallest template edge (pixel) still usable on the coarsest level
+
+
+/**
+ * Single channel image pyramid. Level 0 is a copy of one channel of the source rectangle,
+ * every following level halves width and height (2x2 box filter).
+ */
+class CImagePyramid
+{
+    public:
+        int levels = 0;
+        uint8_t* plane[PYRAMID_MAX_LEVELS] = {};
+        int width[PYRAMID_MAX_LEVELS] = {};
+        int height[PYRAMID_MAX_LEVELS] = {};
+
+        /**
+         * @param _round Temporary pyramid of a round (search region), the planes are taken from the RoundArena
+         */
+        CImagePyramid(std::string _name, bool _round = false) {name = _name; round = _round;};
+        ~CImagePyramid() {Free();};
+
+        bool Build(const uint8_t* _image, int _imagewidth, int _channels, int _channel, int _x, int _y, int _dx, int _dy, int _levels);
+        void Free();
+
+        static int MaxLevels(int _tpl_width, int _tpl_height);
+
+    protected:
+        std::string name;
+        bool round;
+
+        uint8_t* AllocatePlane(int _level, int _size);
+};
+
+#endif //CIMAGEPYRAMID_H
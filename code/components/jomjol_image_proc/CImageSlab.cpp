@@ -0,0 +1,119 @@
+#include "CImageSlab.h"
+
+#include "psram.h"
+#include "ClassLogFile.h"
+
+#include <esp_log.h>
+
+static const char* TAG = "C IMG SLAB";
+
+
+CImageSlab::CImageSlab(std::string _name, ImageSlabAllocate _allocate, ImageSlabRelease _release, void* _context)
+{
+    name = _name;
+    allocate = _allocate;
+    release = _release;
+    context = _context;
+}
+
+
+CImageSlab::~CImageSlab()
+{
+    Free();
+}
+
+
+int CImageSlab::Bytes(int _width, int _height, int _channels)
+{
+    int bytes = _width * _height * _channels;
+    return (bytes + IMAGESLAB_ALIGN - 1) & ~(IMAGESLAB_ALIGN - 1);
+}
+
+
+void CImageSlab::Clear()
+{
+    // Images in the block are external images, deleting them doesn't free their pixels
+    for (int i = 0; i < images.size(); ++i) {
+        delete images[i];
+    }
+
+    images.clear();
+    used = 0;
+    separate = 0;
+}
+
+
+bool CImageSlab::Reserve(int _size)
+{
+    Clear();
+
+    if ((block != NULL) && (_size == size)) {
+        ESP_LOGD(TAG, "%s: keeping the block of %d bytes", name.c_str(), size);
+        return true;
+    }
+
+    Free();
+
+    if (_size <= 0) {
+        return true;
+    }
+
+    // The start of the block is aligned as well
+    if (allocate != NULL) {
+        block = allocate(context, _size + IMAGESLAB_ALIGN);
+    }
+    else {
+        block = (uint8_t*) malloc_psram_heap(std::string(TAG) + "->" + name, _size + IMAGESLAB_ALIGN, MALLOC_CAP_SPIRAM);
+    }
+
+    if (block == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Reserve: Can't allocate " + std::to_string(_size) + " bytes for " + name);
+        return false;
+    }
+
+    size = _size;
+    return true;
+}
+
+
+CImageBasis* CImageSlab::Carve(std::string _name, int _width, int _height, int _channels)
+{
+    int bytes = Bytes(_width, _height, _channels);
+    CImageBasis* image;
+
+    if ((block != NULL) && (used + bytes <= size)) {
+        uint8_t* base = (uint8_t*) (((uintptr_t) block + IMAGESLAB_ALIGN - 1) & ~(uintptr_t) (IMAGESLAB_ALIGN - 1));
+        image = new CImageBasis(_name, base + used, _channels, _width, _height, _channels);
+        used += bytes;
+    }
+    else {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Carve: " + _name + " doesn't fit into " + name + " ("
+                + std::to_string(used) + " of " + std::to_string(size) + " bytes used), allocated separately");
+        image = new CImageBasis(_name, _width, _height, _channels);
+        separate++;
+
+        if (image->rgb_image == NULL) {
+            delete image;
+            return NULL;
+        }
+    }
+
+    images.push_back(image);
+    return image;
+}
+
+
+void CImageSlab::Free()
+{
+    Clear();
+
+    if ((block != NULL) && (release != NULL)) {
+        release(context, block);
+    }
+    else if (block != NULL) {
+        free_psram_heap(std::string(TAG) + "->" + name + " (" + std::to_string(size) + ")", block);
+    }
+
+    block = NULL;
+    size = 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef CIMAGESLAB_H
+#define CIMAGESLAB_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "CImageBasis.h"
+
+#define IMAGESLAB_ALIGN 16              // Start of every image in the slab, bytes
+
+// Allocation of the block, NULL: PSRAM heap (replaced e.g. by a simulated heap in the tests)
+typedef uint8_t* (*ImageSlabAllocate)(void* _context, int _size);
+typedef void (*ImageSlabRelease)(void* _context, uint8_t* _block);
+
+
+/**
+ * One PSRAM block holding the pixels of several small images of fixed size, e.g. the resized ROI images of a
+ * CNN flow. The images are laid out one after the other (external images on the block), so they cost one
+ * heap allocation instead of one per image and leave no holes between other allocations when the
+ * configuration is reloaded.
+ *
+ * The block is sized at config load (Reserve). Reloading a configuration with the same ROIs and model size
+ * keeps the block and doesn't touch the heap at all, so the slab has to live longer than the flow using it
+ * (ClassFlowControll owns the slabs of the CNN flows).
+ */
+class CImageSlab
+{
+    public:
+        CImageSlab(std::string _name, ImageSlabAllocate _allocate = NULL, ImageSlabRelease _release = NULL, void* _context = NULL);
+        ~CImageSlab();
+
+        /**
+         * @brief Bytes of an image in the slab (aligned to IMAGESLAB_ALIGN)
+         */
+        static int Bytes(int _width, int _height, int _channels);
+
+        /**
+         * @brief Deletes the images of the slab and makes sure the block holds _size bytes
+         * @return false if the block can't be allocated, Carve falls back to separate images then
+         */
+        bool Reserve(int _size);
+
+        /**
+         * @brief Next image of the slab, owned by the slab (valid until the next Reserve / Free).
+         * Allocated separately if the slab is full or has no block, NULL if that fails as well.
+         */
+        CImageBasis* Carve(std::string _name, int _width, int _height, int _channels);
+
+        /**
+         * @brief Deletes the images and releases the block
+         */
+        void Free();
+
+        int Size() { return size; };
+        int Used() { return used; };
+        int Images() { return images.size(); };
+        int Separate() { return separate; };   // Images which didn't fit into the block
+
+    protected:
+        std::string name;
+        ImageSlabAllocate allocate;
+        ImageSlabRelease release;
+        void* context;
+        uint8_t* block = NULL;
+        int size = 0;
+        int used = 0;
+        int separate = 0;
+        std::vector<CImageBasis*> images;
+
+        void Clear();
+};
+
+#endif //CIMAGESLAB_H
@@ -0,0 +1,733 @@
+#include "CJpegDecoder.h"
+
+#include "ClassLogFile.h"
+
+#include <esp_log.h>
+#include <string.h>
+#include <algorithm>
+
+static const char* TAG = "C JPEG DECODER";
+
+
+static const uint8_t zigzag[64 + 16] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+    63, 63, 63, 63, 63, 63, 63, 63,     // Corrupt data with k > 63 writes into the last coefficient
+    63, 63, 63, 63, 63, 63, 63, 63
+};
+
+
+static inline uint8_t Clamp(int _value)
+{
+    return (_value < 0) ? 0 : ((_value > 255) ? 255 : _value);
+}
+
+
+/* Integer IDCT (islow of the IJG libjpeg), 13 bit constants, 2 extra bits between the passes */
+#define IDCT_CONST_BITS 13
+#define IDCT_PASS1_BITS 2
+#define IDCT_DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+#define IDCT_1D(s0, s1, s2, s3, s4, s5, s6, s7)                     \
+    int32_t z1 = ((s2) + (s6)) * 4433;                              \
+    int32_t tmp2 = z1 - (s6) * 15137;                               \
+    int32_t tmp3 = z1 + (s2) * 6270;                                \
+    int32_t tmp0 = ((s0) + (s4)) * (1 << IDCT_CONST_BITS);          \
+    int32_t tmp1 = ((s0) - (s4)) * (1 << IDCT_CONST_BITS);          \
+    int32_t tmp10 = tmp0 + tmp3;                                    \
+    int32_t tmp13 = tmp0 - tmp3;                                    \
+    int32_t tmp11 = tmp1 + tmp2;                                    \
+    int32_t tmp12 = tmp1 - tmp2;                                    \
+    tmp0 = (s7); tmp1 = (s5); tmp2 = (s3); tmp3 = (s1);             \
+    z1 = tmp0 + tmp3;                                               \
+    int32_t z2 = tmp1 + tmp2;                                       \
+    int32_t z3 = tmp0 + tmp2;                                       \
+    int32_t z4 = tmp1 + tmp3;                                       \
+    int32_t z5 = (z3 + z4) * 9633;                                  \
+    tmp0 *= 2446; tmp1 *= 16819; tmp2 *= 25172; tmp3 *= 12299;      \
+    z1 *= -7373; z2 *= -20995; z3 *= -16069; z4 *= -3196;           \
+    z3 += z5; z4 += z5;                                             \
+    tmp0 += z1 + z3; tmp1 += z2 + z4;                               \
+    tmp2 += z2 + z3; tmp3 += z1 + z4;
+
+
+static void IDCT8x8(const int16_t* _in, uint8_t* _out, int _outstride)
+{
+    int32_t ws[64];
+
+    // Columns
+    for (int c = 0; c < 8; ++c)
+    {
+        const int16_t* in = _in + c;
+        int32_t* w = ws + c;
+
+        if ((in[8] | in[16] | in[24] | in[32] | in[40] | in[48] | in[56]) == 0)
+        {
+            int32_t dc = in[0] * (1 << IDCT_PASS1_BITS);
+            for (int r = 0; r < 8; ++r)
+                w[8 * r] = dc;
+            continue;
+        }
+
+        IDCT_1D(in[0], in[8], in[16], in[24], in[32], in[40], in[48], in[56])
+
+        w[0]  = IDCT_DESCALE(tmp10 + tmp3, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        w[56] = IDCT_DESCALE(tmp10 - tmp3, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        w[8]  = IDCT_DESCALE(tmp11 + tmp2, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        w[48] = IDCT_DESCALE(tmp11 - tmp2, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        w[16] = IDCT_DESCALE(tmp12 + tmp1, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        w[40] = IDCT_DESCALE(tmp12 - tmp1, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        w[24] = IDCT_DESCALE(tmp13 + tmp0, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        w[32] = IDCT_DESCALE(tmp13 - tmp0, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+    }
+
+    // Rows, +128 level shift
+    for (int r = 0; r < 8; ++r)
+    {
+        const int32_t* w = ws + 8 * r;
+        uint8_t* out = _out + r * _outstride;
+        const int shift = IDCT_CONST_BITS + IDCT_PASS1_BITS + 3;
+
+        IDCT_1D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7])
+
+        out[0] = Clamp(IDCT_DESCALE(tmp10 + tmp3, shift) + 128);
+        out[7] = Clamp(IDCT_DESCALE(tmp10 - tmp3, shift) + 128);
+        out[1] = Clamp(IDCT_DESCALE(tmp11 + tmp2, shift) + 128);
+        out[6] = Clamp(IDCT_DESCALE(tmp11 - tmp2, shift) + 128);
+        out[2] = Clamp(IDCT_DESCALE(tmp12 + tmp1, shift) + 128);
+        out[5] = Clamp(IDCT_DESCALE(tmp12 - tmp1, shift) + 128);
+        out[3] = Clamp(IDCT_DESCALE(tmp13 + tmp0, shift) + 128);
+        out[4] = Clamp(IDCT_DESCALE(tmp13 - tmp0, shift) + 128);
+    }
+}
+
+
+/* Reduced IDCT for the scaled decode: _n x _n pixels from the lowest _n x _n coefficients, each pixel is the
+ * 8 x 8 IDCT evaluated at the center of the _n x _n pixels it replaces. Rows of the tables: output pixel,
+ * columns: frequency, k(u) * cos((2x + 1) * u * pi / (2 * _n)) with k(0) = 1 / (2 * sqrt(2)), k(u) = 1/2 (13 bit) */
+static const int16_t idct_table4[4 * 4] = {
+    2896,  3784,  2896,  1567,
+    2896,  1567, -2896, -3784,
+    2896, -1567, -2896,  3784,
+    2896, -3784,  2896, -1567
+};
+
+static const int16_t idct_table2[2 * 2] = {
+    2896,  2896,
+    2896, -2896
+};
+
+
+static void IDCTScaled(const int16_t* _in, int _n, uint8_t* _out, int _outstride)
+{
+    if (_n == 1)
+    {
+        _out[0] = Clamp(IDCT_DESCALE((int)_in[0], 3) + 128);     // DC only
+        return;
+    }
+
+    const int16_t* table = (_n == 4) ? idct_table4 : idct_table2;
+    int32_t ws[4 * 4];
+
+    // Columns
+    for (int u = 0; u < _n; ++u)
+        for (int y = 0; y < _n; ++y)
+        {
+            int32_t sum = 0;
+            for (int v = 0; v < _n; ++v)
+                sum += table[y * _n + v] * _in[v * 8 + u];
+            ws[y * _n + u] = IDCT_DESCALE(sum, IDCT_CONST_BITS - IDCT_PASS1_BITS);
+        }
+
+    // Rows, +128 level shift
+    for (int y = 0; y < _n; ++y)
+    {
+        uint8_t* out = _out + y * _outstride;
+        for (int x = 0; x < _n; ++x)
+        {
+            int32_t sum = 0;
+            for (int u = 0; u < _n; ++u)
+                sum += table[x * _n + u] * ws[y * _n + u];
+            out[x] = Clamp(IDCT_DESCALE(sum, IDCT_CONST_BITS + IDCT_PASS1_BITS) + 128);
+        }
+    }
+}
+
+
+bool CJpegDecoder::BuildHuffman(JpegHuffman &_h, const uint8_t* _counts, const uint8_t* _symbols, int _nsymbols)
+{
+    memset(_h.fast, 0, sizeof(_h.fast));
+    memcpy(_h.symbols, _symbols, _nsymbols);
+
+    int code = 0;
+    int k = 0;
+
+    for (int len = 1; len <= 16; ++len)
+    {
+        _h.valptr[len] = k;
+        _h.mincode[len] = code;
+
+        for (int i = 0; i < _counts[len - 1]; ++i, ++k, ++code)
+        {
+            if (len <= JPEG_HUFFMAN_FAST_BITS)
+            {
+                int first = code << (JPEG_HUFFMAN_FAST_BITS - len);
+                int count = 1 << (JPEG_HUFFMAN_FAST_BITS - len);
+                for (int j = 0; j < count; ++j)
+                    _h.fast[first + j] = (len << 8) | _symbols[k];
+            }
+        }
+
+        _h.maxcode[len] = (_counts[len - 1] > 0) ? code - 1 : -1;
+
+        if (code > (1 << len))
+            return false;           // More codes than possible with this length
+
+        code <<= 1;
+    }
+
+    _h.maxcode[17] = INT32_MAX;
+    _h.defined = true;
+    return true;
+}
+
+
+bool CJpegDecoder::ReadMarkers(const uint8_t* _jpeg, int _len, bool _headeronly)
+{
+    const uint8_t* p = _jpeg;
+    const uint8_t* e = _jpeg + _len;
+    bool frame = false;
+
+    if ((_len < 4) || (p[0] != 0xFF) || (p[1] != 0xD8))
+        return false;
+    p += 2;
+
+    while (p + 4 <= e)
+    {
+        if (p[0] != 0xFF)
+        {
+            p++;                    // Fill bytes / garbage between the segments
+            continue;
+        }
+
+        int marker = p[1];
+        if ((marker == 0xFF) || (marker == 0xD8) || ((marker >= 0xD0) && (marker <= 0xD7)))
+        {
+            p += (marker == 0xFF) ? 1 : 2;
+            continue;
+        }
+        if (marker == 0xD9)
+            return false;           // EOI before SOS
+
+        int length = (p[2] << 8) | p[3];
+        const uint8_t* seg = p + 4;
+        const uint8_t* segend = p + 2 + length;
+        if ((length < 2) || (segend > e))
+            return false;
+
+        switch (marker)
+        {
+            case 0xDB:              // DQT
+                while (seg < segend)
+                {
+                    int precision = seg[0] >> 4;
+                    int id = seg[0] & 3;
+                    seg++;
+                    for (int i = 0; i < 64; ++i)
+                    {
+                        quant[id][i] = (precision == 0) ? seg[i] : ((seg[2 * i] << 8) | seg[2 * i + 1]);
+                    }
+                    seg += (precision == 0) ? 64 : 128;
+                }
+                break;
+
+            case 0xC4:              // DHT
+                while (seg + 17 <= segend)
+                {
+                    int tc = seg[0] >> 4;
+                    int id = seg[0] & 3;
+                    int nsymbols = 0;
+                    for (int i = 0; i < 16; ++i)
+                        nsymbols += seg[1 + i];
+                    if ((tc > 1) || (nsymbols > 256) || (seg + 17 + nsymbols > segend))
+                        return false;
+                    if (!BuildHuffman(huffman[tc][id], seg + 1, seg + 17, nsymbols))
+                        return false;
+                    seg += 17 + nsymbols;
+                }
+                break;
+
+            case 0xC0:              // SOF0 baseline
+            case 0xC1:              // SOF1 extended sequential, Huffman
+                if ((seg[0] != 8) || (seg[5] < 1) || (seg[5] > JPEG_MAX_COMPONENTS) || (seg[5] == 2))
+                    return false;
+                height = (seg[1] << 8) | seg[2];
+                width = (seg[3] << 8) | seg[4];
+                ncomponents = seg[5];
+                hmax = 1;
+                vmax = 1;
+                for (int i = 0; i < ncomponents; ++i)
+                {
+                    components[i].id = seg[6 + 3 * i];
+                    components[i].h = seg[7 + 3 * i] >> 4;
+                    components[i].v = seg[7 + 3 * i] & 15;
+                    components[i].tq = seg[8 + 3 * i] & 3;
+                    if ((components[i].h < 1) || (components[i].h > 2) || (components[i].v < 1) || (components[i].v > 2))
+                        return false;
+                    hmax = std::max(hmax, components[i].h);
+                    vmax = std::max(vmax, components[i].v);
+                }
+                if (ncomponents == 1)
+                {
+                    components[0].h = components[0].v = hmax = vmax = 1;     // Non-interleaved: one block per MCU
+                }
+                frame = true;
+                if (_headeronly)
+                    return true;
+                break;
+
+            case 0xDD:              // DRI
+                restart_interval = (seg[0] << 8) | seg[1];
+                break;
+
+            case 0xDA:              // SOS
+            {
+                if (!frame || (seg[0] != ncomponents))
+                    return false;       // Only interleaved scans of all components
+                for (int i = 0; i < ncomponents; ++i)
+                {
+                    int id = seg[1 + 2 * i];
+                    int c = 0;
+                    while ((c < ncomponents) && (components[c].id != id))
+                        c++;
+                    if (c == ncomponents)
+                        return false;
+                    components[c].td = seg[2 + 2 * i] >> 4;
+                    components[c].ta = seg[2 + 2 * i] & 3;
+                    if ((components[c].td > 3) || !huffman[0][components[c].td].defined || !huffman[1][components[c].ta].defined)
+                        return false;
+                }
+                pos = segend;
+                end = e;
+                return true;
+            }
+
+            default:
+                if ((marker >= 0xC2) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC))
+                    return false;       // Progressive, lossless, arithmetic coding
+                break;
+        }
+
+        p = segend;
+    }
+
+    return false;
+}
+
+
+bool CJpegDecoder::GetSize(const uint8_t* _jpeg, int _len, int &_width, int &_height)
+{
+    CJpegDecoder* decoder = new CJpegDecoder();
+    bool ok = decoder->ReadMarkers(_jpeg, _len, true);
+    _width = decoder->width;
+    _height = decoder->height;
+    delete decoder;
+    return ok;
+}
+
+
+void CJpegDecoder::FillBits()
+{
+    while (bitcnt <= 24)
+    {
+        uint32_t b = 0;
+
+        if (!marker_hit && (pos < end))
+        {
+            b = *pos++;
+            if (b == 0xFF)
+            {
+                if ((pos < end) && (*pos == 0x00))
+                {
+                    pos++;          // Stuffed byte
+                }
+                else
+                {
+                    marker_hit = true;      // End of the entropy coded segment, fill with 0
+                    pos--;
+                    b = 0;
+                }
+            }
+        }
+
+        bitbuf |= b << (24 - bitcnt);
+        bitcnt += 8;
+    }
+}
+
+
+int CJpegDecoder::DecodeHuffman(const JpegHuffman &_h)
+{
+    if (bitcnt < 16)
+        FillBits();
+
+    int fast = _h.fast[bitbuf >> (32 - JPEG_HUFFMAN_FAST_BITS)];
+    if (fast != 0)
+    {
+        int len = fast >> 8;
+        bitbuf <<= len;
+        bitcnt -= len;
+        return fast & 0xFF;
+    }
+
+    for (int len = JPEG_HUFFMAN_FAST_BITS + 1; len <= 16; ++len)
+    {
+        int32_t code = bitbuf >> (32 - len);
+        if (code <= _h.maxcode[len])
+        {
+            bitbuf <<= len;
+            bitcnt -= len;
+            return _h.symbols[(_h.valptr[len] + code - _h.mincode[len]) & 0xFF];
+        }
+    }
+
+    return -1;
+}
+
+
+int CJpegDecoder::ReceiveExtend(int _bits)
+{
+    if (_bits == 0)
+        return 0;
+
+    if (bitcnt < _bits)
+        FillBits();
+
+    int value = bitbuf >> (32 - _bits);
+    bitbuf <<= _bits;
+    bitcnt -= _bits;
+
+    if (value < (1 << (_bits - 1)))
+        value += 1 - (1 << _bits);
+
+    return value;
+}
+
+
+/* Entropy decode one block. _coef == NULL: only advance the bit stream and the DC prediction */
+bool CJpegDecoder::DecodeBlock(JpegComponent &_c, int16_t* _coef)
+{
+    int t = DecodeHuffman(huffman[0][_c.td]);
+    if ((t < 0) || (t > 11))
+        return false;
+
+    _c.dcpred += ReceiveExtend(t);
+
+    const uint16_t* q = quant[_c.tq];
+    int16_t* ac_coef = (blocksize > 1) ? _coef : NULL;      // 1/8 scale: DC only
+
+    if (_coef != NULL)
+    {
+        if (ac_coef != NULL)
+            memset(_coef, 0, 64 * sizeof(int16_t));
+        _coef[0] = _c.dcpred * q[0];
+    }
+
+    const JpegHuffman &ac = huffman[1][_c.ta];
+    for (int k = 1; k < 64; )
+    {
+        int rs = DecodeHuffman(ac);
+        if (rs < 0)
+            return false;
+
+        int r = rs >> 4;
+        int s = rs & 15;
+
+        if (s == 0)
+        {
+            if (r != 15)
+                break;          // EOB
+            k += 16;
+            continue;
+        }
+
+        k += r;
+        int value = ReceiveExtend(s);
+        if (ac_coef != NULL)
+            ac_coef[zigzag[std::min(k, 63)]] = value * q[std::min(k, 63)];
+        k++;
+    }
+
+    return true;
+}
+
+
+void CJpegDecoder::Restart()
+{
+    // Skip the remaining bits and the RSTn marker
+    while ((pos + 1 < end) && !((pos[0] == 0xFF) && (pos[1] >= 0xD0) && (pos[1] <= 0xD7)))
+        pos++;
+    if (pos + 1 < end)
+        pos += 2;
+
+    bitbuf = 0;
+    bitcnt = 0;
+    marker_hit = false;
+
+    for (int i = 0; i < ncomponents; ++i)
+        components[i].dcpred = 0;
+}
+
+
+/* Upsample (pixel replication) and convert the decoded MCU at (_x, _y) of the output image */
+void CJpegDecoder::ConvertMCU(uint8_t* _rgb, int _x, int _y)
+{
+    int mcuwidth = std::min(blocksize * hmax, outwidth - _x);
+    int mcuheight = std::min(blocksize * vmax, outheight - _y);
+
+    for (int y = 0; y < mcuheight; ++y)
+    {
+        uint8_t* p_target = _rgb + outchannels * ((_y + y) * outwidth + _x);
+        const JpegComponent &cy = components[0];
+
+        if ((ncomponents == 1) || (outchannels == 1))
+        {
+            const uint8_t* p_y = mcubuffer[0] + (y * cy.v / vmax) * blocksize * cy.h;
+            int shift_y = (cy.h < hmax) ? 1 : 0;
+
+            if (outchannels == 1)
+            {
+                for (int x = 0; x < mcuwidth; ++x)
+                    p_target[x] = p_y[x >> shift_y];
+            }
+            else
+            {
+                for (int x = 0; x < mcuwidth; ++x, p_target += 3)
+                    p_target[0] = p_target[1] = p_target[2] = p_y[x >> shift_y];
+            }
+            continue;
+        }
+
+        const JpegComponent &cb = components[1];
+        const JpegComponent &cr = components[2];
+        const uint8_t* p_y = mcubuffer[0] + (y * cy.v / vmax) * blocksize * cy.h;
+        const uint8_t* p_cb = mcubuffer[1] + (y * cb.v / vmax) * blocksize * cb.h;
+        const uint8_t* p_cr = mcubuffer[2] + (y * cr.v / vmax) * blocksize * cr.h;
+        int shift_y = (cy.h < hmax) ? 1 : 0;
+        int shift_cb = (cb.h < hmax) ? 1 : 0;
+        int shift_cr = (cr.h < hmax) ? 1 : 0;
+
+        int x = 0;
+
+        if ((shift_y == 0) && (shift_cb == 1) && (shift_cr == 1))
+        {
+            // Camera format (4:2:2 / 4:2:0): chroma once per two pixels
+            for (; x + 1 < mcuwidth; x += 2, p_target += 6)
+            {
+                int b = p_cb[x >> 1] - 128;
+                int r = p_cr[x >> 1] - 128;
+                int add_r = (91881 * r + 32768) >> 16;
+                int add_g = (-22554 * b - 46802 * r + 32768) >> 16;
+                int add_b = (116130 * b + 32768) >> 16;
+
+                int lum = p_y[x];
+                p_target[0] = Clamp(lum + add_r);
+                p_target[1] = Clamp(lum + add_g);
+                p_target[2] = Clamp(lum + add_b);
+                lum = p_y[x + 1];
+                p_target[3] = Clamp(lum + add_r);
+                p_target[4] = Clamp(lum + add_g);
+                p_target[5] = Clamp(lum + add_b);
+            }
+        }
+
+        for (; x < mcuwidth; ++x, p_target += 3)
+        {
+            int lum = p_y[x >> shift_y];
+            int b = p_cb[x >> shift_cb] - 128;
+            int r = p_cr[x >> shift_cr] - 128;
+
+            // YCbCr -> RGB (JFIF), 16 bit fixed point
+            p_target[0] = Clamp(lum + ((91881 * r + 32768) >> 16));
+            p_target[1] = Clamp(lum + ((-22554 * b - 46802 * r + 32768) >> 16));
+            p_target[2] = Clamp(lum + ((116130 * b + 32768) >> 16));
+        }
+    }
+}
+
+
+/* Sets the part of the rectangle inside the output image to JPEG_SKIPPED_FILL */
+void CJpegDecoder::FillOutput(uint8_t* _rgb, int _x, int _y, int _dx, int _dy)
+{
+    _dx = std::min(_dx, outwidth - _x);
+    _dy = std::min(_dy, outheight - _y);
+
+    if ((_dx <= 0) || (_dy <= 0))
+        return;
+
+    if ((_x == 0) && (_dx == outwidth))
+    {
+        memset(_rgb + outchannels * _y * outwidth, JPEG_SKIPPED_FILL, outchannels * _dx * _dy);
+        return;
+    }
+
+    for (int y = _y; y < _y + _dy; ++y)
+        memset(_rgb + outchannels * (y * outwidth + _x), JPEG_SKIPPED_FILL, outchannels * _dx);
+}
+
+
+bool CJpegDecoder::Decode(const uint8_t* _jpeg, int _len, uint8_t* _rgb, int _width, int _height, const std::vector<JpegRegion>* _regions,
+                          int _scale, int _channels)
+{
+    if ((_channels != 1) && (_channels != 3))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Decode: " + std::to_string(_channels) + " channels not supported");
+        return false;
+    }
+    outchannels = _channels;
+
+    if ((_scale != 1) && (_scale != 2) && (_scale != 4) && (_scale != 8))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Decode: Scale 1/" + std::to_string(_scale) + " not supported");
+        return false;
+    }
+
+    mcus_decoded = 0;
+    mcus_skipped = 0;
+    entropy_bytes = 0;
+    output_bytes = 0;
+    restart_interval = 0;
+    width = 0;
+    height = 0;
+    for (int tc = 0; tc < 2; ++tc)
+        for (int id = 0; id < 4; ++id)
+            huffman[tc][id].defined = false;
+
+    if (!ReadMarkers(_jpeg, _len, false))
+    {
+        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Decode: Unsupported or corrupt JPEG");
+        return false;
+    }
+
+    blocksize = 8 / _scale;
+    outwidth = ScaledSize(width, _scale);
+    outheight = ScaledSize(height, _scale);
+
+    if ((outwidth != _width) || (outheight != _height))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Decode: Image size " + std::to_string(outwidth) + " x " + std::to_string(outheight) +
+                            " instead of " + std::to_string(_width) + " x " + std::to_string(_height));
+        return false;
+    }
+
+    int mcuwidth = 8 * hmax;
+    int mcuheight = 8 * vmax;
+    int mcus_x = (width + mcuwidth - 1) / mcuwidth;
+    int mcus_y = (height + mcuheight - 1) / mcuheight;
+
+    // MCU rows and columns intersecting the regions
+    std::vector<uint8_t> needed(mcus_x);
+    int lastrow = mcus_y - 1;
+
+    if (_regions != NULL)
+    {
+        lastrow = -1;
+        for (const JpegRegion &r : *_regions)
+            if ((r.dx > 0) && (r.dy > 0) && (r.y < height))
+                lastrow = std::max(lastrow, std::min(r.y + r.dy - 1, height - 1) / mcuheight);
+    }
+
+    const uint8_t* scanstart = pos;
+    bitbuf = 0;
+    bitcnt = 0;
+    marker_hit = false;
+    for (int i = 0; i < ncomponents; ++i)
+        components[i].dcpred = 0;
+
+    int16_t coef[64];
+    int restarts_left = restart_interval;
+
+    for (int my = 0; my <= lastrow; ++my)
+    {
+        if (_regions == NULL)
+        {
+            std::fill(needed.begin(), needed.end(), 1);
+        }
+        else
+        {
+            std::fill(needed.begin(), needed.end(), 0);
+            for (const JpegRegion &r : *_regions)
+            {
+                if ((r.dx <= 0) || (r.dy <= 0) || (r.y + r.dy <= my * mcuheight) || (r.y >= (my + 1) * mcuheight))
+                    continue;
+                int first = std::max(r.x, 0) / mcuwidth;
+                int last = std::min(r.x + r.dx - 1, width - 1) / mcuwidth;
+                for (int mx = first; mx <= last; ++mx)
+                    needed[mx] = 1;
+            }
+        }
+
+        for (int mx = 0; mx < mcus_x; ++mx)
+        {
+            if (restart_interval > 0)
+            {
+                if (restarts_left == 0)
+                {
+                    Restart();
+                    restarts_left = restart_interval;
+                }
+                restarts_left--;
+            }
+
+            for (int c = 0; c < ncomponents; ++c)
+            {
+                JpegComponent &comp = components[c];
+                bool transform = needed[mx] && ((c == 0) || (outchannels == 3));    // Luminance only: no IDCT for the chroma
+
+                for (int by = 0; by < comp.v; ++by)
+                    for (int bx = 0; bx < comp.h; ++bx)
+                    {
+                        if (!DecodeBlock(comp, transform ? coef : NULL))
+                        {
+                            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Decode: Corrupt entropy coded data");
+                            return false;
+                        }
+                        if (!transform)
+                            continue;
+
+                        uint8_t* block = mcubuffer[c] + (by * comp.h * blocksize + bx) * blocksize;
+                        if (blocksize == 8)
+                            IDCT8x8(coef, block, 8 * comp.h);
+                        else
+                            IDCTScaled(coef, blocksize, block, blocksize * comp.h);
+                    }
+            }
+
+            if (needed[mx])
+            {
+                int x = mx * blocksize * hmax;
+                int y = my * blocksize * vmax;
+                ConvertMCU(_rgb, x, y);
+                output_bytes += outchannels * std::min(blocksize * hmax, outwidth - x) * std::min(blocksize * vmax, outheight - y);
+                mcus_decoded++;
+            }
+            else
+            {
+                FillOutput(_rgb, mx * blocksize * hmax, my * blocksize * vmax, blocksize * hmax, blocksize * vmax);
+                mcus_skipped++;
+            }
+        }
+    }
+
+    FillOutput(_rgb, 0, (lastrow + 1) * blocksize * vmax, outwidth, outheight);
+    mcus_skipped += (mcus_y - 1 - lastrow) * mcus_x;
+    entropy_bytes = pos - scanstart;
+
+    return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#ifndef CJPEGDECODER_H
+#define CJPEGDECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define JPEG_MAX_COMPONENTS 3
+#define JPEG_HUFFMAN_FAST_BITS 9
+#define JPEG_SKIPPED_FILL 0             // Value of the pixels of MCUs outside of the regions (black)
+
+
+/* Rectangle of the image which has to be decoded */
+struct JpegRegion {
+    int x, y, dx, dy;
+};
+
+
+/* Huffman table with lookup of the codes up to JPEG_HUFFMAN_FAST_BITS bits, longer codes are searched by length */
+struct JpegHuffman {
+    uint16_t fast[1 << JPEG_HUFFMAN_FAST_BITS];     // (length << 8) | symbol, 0 = longer code
+    uint8_t symbols[256];
+    int32_t maxcode[18];                            // Largest code of each length, -1 = no code
+    int valptr[17];                                 // Index of the first symbol of each length
+    int mincode[17];
+    bool defined = false;
+};
+
+
+struct JpegComponent {
+    int id;
+    int h, v;                                       // Sampling factors
+    int tq;                                         // Quantization table
+    int td, ta;                                     // Huffman tables DC / AC
+    int dcpred;
+};
+
+
+/**
+ * Streaming decoder for baseline JPEGs (as delivered by the camera) into an interleaved RGB or a luminance image, MCU row by MCU row.
+ * Optionally only the MCUs intersecting a list of regions are transformed (IDCT, color conversion) and written,
+ * the other pixels of the image are set to JPEG_SKIPPED_FILL (a reused target keeps nothing of an earlier frame).
+ * The entropy coded data has to be read anyway up to the last MCU row containing a region, decoding stops there.
+ * Progressive JPEGs and non-interleaved scans are not supported (Decode returns false, use stbi instead).
+ * Chroma is upsampled by pixel replication.
+ * The image can be scaled down by 2, 4 or 8 in the DCT domain (reduced IDCT, DC only at 1/8), this costs
+ * only the entropy decoding plus a fraction of the transform of a full decode.
+ */
+class CJpegDecoder
+{
+    public:
+        // Statistics of the last Decode
+        int mcus_decoded = 0;           // MCUs with IDCT and color conversion
+        int mcus_skipped = 0;           // MCUs only entropy decoded or not read at all
+        int entropy_bytes = 0;          // Bytes of the entropy coded data read
+        int output_bytes = 0;           // Bytes decoded into the output image (without the filled MCUs)
+
+        /**
+         * @brief Width and height from the frame header
+         */
+        static bool GetSize(const uint8_t* _jpeg, int _len, int &_width, int &_height);
+
+        /**
+         * @brief Size of the image decoded with scale 1/_scale
+         */
+        static int ScaledSize(int _size, int _scale) { return (_size + _scale - 1) / _scale; };
+
+        /**
+         * @brief Decode into _rgb (_width * _height * _channels bytes), _width/_height have to match the scaled size of the JPEG
+         * @param _regions NULL: decode the whole image, regions in coordinates of the unscaled image
+         * @param _scale 1, 2, 4 or 8: output scaled by 1/_scale
+         * @param _channels 3: RGB, 1: luminance (Y component only, chroma is only entropy decoded)
+         */
+        bool Decode(const uint8_t* _jpeg, int _len, uint8_t* _rgb, int _width, int _height, const std::vector<JpegRegion>* _regions = NULL,
+                    int _scale = 1, int _channels = 3);
+
+    protected:
+        uint16_t quant[4][64];          // Zigzag order
+        JpegHuffman huffman[2][4];      // [DC/AC][id]
+        JpegComponent components[JPEG_MAX_COMPONENTS];
+        int ncomponents;
+        int width, height;
+        int hmax, vmax;
+        int restart_interval;
+        int blocksize = 8;              // Output pixels per block and direction (8 / scale)
+        int outwidth, outheight;
+        int outchannels = 3;
+
+        const uint8_t* pos;
+        const uint8_t* end;
+        uint32_t bitbuf;
+        int bitcnt;
+        bool marker_hit;
+
+        uint8_t mcubuffer[JPEG_MAX_COMPONENTS][4 * 64];    // One MCU per component, up to 2x2 blocks
+
+        bool ReadMarkers(const uint8_t* _jpeg, int _len, bool _headeronly);
+        bool BuildHuffman(JpegHuffman &_h, const uint8_t* _counts, const uint8_t* _symbols, int _nsymbols);
+        void FillBits();
+        int DecodeHuffman(const JpegHuffman &_h);
+        int ReceiveExtend(int _bits);
+        bool DecodeBlock(JpegComponent &_c, int16_t* _coef);
+        void Restart();
+        void ConvertMCU(uint8_t* _rgb, int _x, int _y);
+        void FillOutput(uint8_t* _rgb, int _x, int _y, int _dx, int _dy);
+};
+
+#endif //CJPEGDECODER_H
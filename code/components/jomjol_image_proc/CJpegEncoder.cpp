@@ -0,0 +1,587 @@
+#include "CJpegEncoder.h"
+
+#include "CRoundArena.h"
+#include "ClassLogFile.h"
+
+#include <string.h>
+#include <algorithm>
+
+static const char* TAG = "JPEG ENCODER";
+
+
+static const uint8_t zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+
+/* Quantization tables of Annex K.1 (natural order), scaled by the quality */
+static const uint8_t std_quant[2][64] = {
+    {
+        16, 11, 10, 16, 24, 40, 51, 61,
+        12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56,
+        14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77,
+        24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99
+    },
+    {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99
+    }
+};
+
+
+/* Huffman tables of Annex K.3: number of codes of each length 1..16, symbols */
+static const uint8_t std_dc_bits[2][16] = {
+    {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+    {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}
+};
+
+static const uint8_t std_dc_symbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t std_ac_bits[2][16] = {
+    {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+    {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}
+};
+
+static const uint8_t std_ac_symbols[2][162] = {
+    {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+    }
+};
+
+
+CJpegEncoder* CJpegEncoder::Create(JpegEncoderType _type)
+{
+    if (_type == JPEG_ENCODER_STB)
+        return new CJpegEncoderStb();
+
+    return new CJpegEncoderFast();
+}
+
+
+bool CJpegEncoder::Encode(const ImageView &_view, int _quality, uint8_t* _chunk, int _chunksize, JpegWriteFunc _write, void* _context,
+                          const CImageOverlay* _overlay)
+{
+    output_bytes = 0;
+    chunks = 0;
+
+    if (!_view.Valid() || ((_view.channels != 1) && (_view.channels != 3)) || (_chunk == NULL) || (_chunksize <= 0) || (_write == NULL)) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Encode: Invalid image (" + std::to_string(_view.width) + "x" + std::to_string(_view.height) +
+                                                "x" + std::to_string(_view.channels) + ") or output");
+        return false;
+    }
+
+    if (_quality <= 0)
+        _quality = 90;
+    _quality = std::min(_quality, 100);
+
+    chunk = _chunk;
+    chunksize = _chunksize;
+    fill = 0;
+    write = _write;
+    context = _context;
+    failed = false;
+    overlay = ((_overlay != NULL) && !_overlay->Empty()) ? _overlay : NULL;
+
+    bool ok = EncodeView(_view, _quality);
+    Flush();
+
+    chunk = NULL;
+    overlay = NULL;
+    return ok && !failed;
+}
+
+
+void CJpegEncoder::Flush()
+{
+    if ((fill > 0) && !failed) {
+        if (write(context, chunk, fill)) {
+            output_bytes += fill;
+            chunks++;
+        }
+        else {
+            failed = true;
+        }
+    }
+    fill = 0;
+}
+
+
+void CJpegEncoder::Put(const uint8_t* _data, int _size)
+{
+    while (_size > 0) {
+        if (fill == chunksize)
+            Flush();
+
+        int n = std::min(_size, chunksize - fill);
+        memcpy(chunk + fill, _data, n);
+        fill += n;
+        _data += n;
+        _size -= n;
+    }
+}
+
+
+void CJpegEncoderStb::StbWrite(void* _context, void* _data, int _size)
+{
+    CJpegEncoderStb* encoder = (CJpegEncoderStb*)_context;
+    if (!encoder->failed)
+        encoder->Put((const uint8_t*)_data, _size);
+}
+
+
+bool CJpegEncoderStb::EncodeView(const ImageView &_view, int _quality)
+{
+    // stb needs the pixels without gaps between the rows: a view of a part of an image is copied,
+    // as well as an image the overlay is drawn onto
+    int rowbytes = _view.width * _view.channels;
+    uint8_t* pixels = _view.data;
+
+    if ((_view.stride != rowbytes) || (overlay != NULL)) {
+        pixels = (uint8_t*) RoundArena.Allocate("JPEG pixels", rowbytes * _view.height);
+        if (pixels == NULL) {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "EncodeView: Can't allocate " + std::to_string(rowbytes * _view.height) + " bytes");
+            return false;
+        }
+
+        for (int y = 0; y < _view.height; ++y)
+            memcpy(pixels + y * rowbytes, _view.Pixel(0, y), rowbytes);
+
+        if (overlay != NULL) {
+            ImageView copy = _view;
+            copy.data = pixels;
+            copy.stride = rowbytes;
+            overlay->Render(copy, 0);
+        }
+    }
+
+    bool ok = stbi_write_jpg_to_func(StbWrite, this, _view.width, _view.height, _view.channels, pixels, _quality) != 0;
+
+    if (pixels != _view.data)
+        RoundArena.Free("JPEG pixels", pixels);
+
+    return ok;
+}
+
+
+/* Huffman codes of the symbols from the number of codes of each length (Annex C) */
+static void BuildHuffman(const uint8_t* _bits, const uint8_t* _symbols, uint16_t* _code, uint8_t* _size)
+{
+    int code = 0, k = 0;
+
+    for (int length = 1; length <= 16; ++length) {
+        for (int i = 0; i < _bits[length - 1]; ++i) {
+            _code[_symbols[k]] = code++;
+            _size[_symbols[k]] = length;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+
+CJpegEncoderFast::CJpegEncoderFast()
+{
+    memset(ac_size, 0, sizeof(ac_size));
+
+    for (int t = 0; t < 2; ++t) {
+        BuildHuffman(std_dc_bits[t], std_dc_symbols, dc_code[t], dc_size[t]);
+        BuildHuffman(std_ac_bits[t], std_ac_symbols[t], ac_code[t], ac_size[t]);
+    }
+}
+
+
+/* Quality scaling of libjpeg (jpeg_quality_scaling) */
+void CJpegEncoderFast::SetQuality(int _quality)
+{
+    int scale = (_quality < 50) ? (5000 / _quality) : (200 - _quality * 2);
+
+    for (int t = 0; t < 2; ++t) {
+        for (int i = 0; i < 64; ++i) {
+            int q = std::min(std::max((std_quant[t][i] * scale + 50) / 100, 1), 255);
+            reciprocal[t][i] = ((1 << 18) + q * 4) / (q * 8);     // The DCT output is scaled by 8
+        }
+        for (int i = 0; i < 64; ++i)
+            quant[t][i] = std::min(std::max((std_quant[t][zigzag[i]] * scale + 50) / 100, 1), 255);
+    }
+}
+
+
+void CJpegEncoderFast::WriteHeaders(int _width, int _height, int _components, bool _subsampled)
+{
+    static const uint8_t jfif[] = {0xFF, 0xD8, 0xFF, 0xE0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    Put(jfif, sizeof(jfif));
+
+    int tables = (_components == 1) ? 1 : 2;
+
+    // Quantization tables
+    PutByte(0xFF); PutByte(0xDB);
+    PutByte(0); PutByte(2 + 65 * tables);
+    for (int t = 0; t < tables; ++t) {
+        PutByte(t);
+        Put(quant[t], 64);
+    }
+
+    // Frame header: Y with 2x2 or 1x1 sampling, Cb and Cr 1x1
+    PutByte(0xFF); PutByte(0xC0);
+    PutByte(0); PutByte(8 + 3 * _components);
+    PutByte(8);
+    PutByte(_height >> 8); PutByte(_height & 0xFF);
+    PutByte(_width >> 8); PutByte(_width & 0xFF);
+    PutByte(_components);
+    for (int c = 0; c < _components; ++c) {
+        PutByte(c + 1);
+        PutByte(((c == 0) && _subsampled) ? 0x22 : 0x11);
+        PutByte((c == 0) ? 0 : 1);
+    }
+
+    // Huffman tables
+    int length = 2;
+    for (int t = 0; t < tables; ++t)
+        length += 17 + 12 + 17 + 162;
+
+    PutByte(0xFF); PutByte(0xC4);
+    PutByte(length >> 8); PutByte(length & 0xFF);
+    for (int t = 0; t < tables; ++t) {
+        PutByte(0x00 | t);
+        Put(std_dc_bits[t], 16);
+        Put(std_dc_symbols, 12);
+        PutByte(0x10 | t);
+        Put(std_ac_bits[t], 16);
+        Put(std_ac_symbols[t], 162);
+    }
+
+    // Scan header
+    PutByte(0xFF); PutByte(0xDA);
+    PutByte(0); PutByte(6 + 2 * _components);
+    PutByte(_components);
+    for (int c = 0; c < _components; ++c) {
+        PutByte(c + 1);
+        PutByte((c == 0) ? 0x00 : 0x11);
+    }
+    PutByte(0); PutByte(63); PutByte(0);
+}
+
+
+/* Integer forward DCT of the IJG (jfdctint.c), the output is scaled by 8 */
+#define CONST_BITS 13
+#define PASS1_BITS 2
+
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+#define DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+static void ForwardDCT(int16_t* _block, int32_t* _out)
+{
+    int32_t tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    int32_t tmp10, tmp11, tmp12, tmp13;
+    int32_t z1, z2, z3, z4, z5;
+
+    // Rows
+    for (int row = 0; row < 8; ++row) {
+        const int16_t* in = _block + row * 8;
+        int32_t* out = _out + row * 8;
+
+        tmp0 = in[0] + in[7];
+        tmp7 = in[0] - in[7];
+        tmp1 = in[1] + in[6];
+        tmp6 = in[1] - in[6];
+        tmp2 = in[2] + in[5];
+        tmp5 = in[2] - in[5];
+        tmp3 = in[3] + in[4];
+        tmp4 = in[3] - in[4];
+
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+
+        out[0] = (tmp10 + tmp11) << PASS1_BITS;
+        out[4] = (tmp10 - tmp11) << PASS1_BITS;
+
+        z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        out[2] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS - PASS1_BITS);
+        out[6] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS - PASS1_BITS);
+
+        z1 = tmp4 + tmp7;
+        z2 = tmp5 + tmp6;
+        z3 = tmp4 + tmp6;
+        z4 = tmp5 + tmp7;
+        z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+
+        out[7] = DESCALE(tmp4 + z1 + z3, CONST_BITS - PASS1_BITS);
+        out[5] = DESCALE(tmp5 + z2 + z4, CONST_BITS - PASS1_BITS);
+        out[3] = DESCALE(tmp6 + z2 + z3, CONST_BITS - PASS1_BITS);
+        out[1] = DESCALE(tmp7 + z1 + z4, CONST_BITS - PASS1_BITS);
+    }
+
+    // Columns
+    for (int col = 0; col < 8; ++col) {
+        int32_t* d = _out + col;
+
+        tmp0 = d[0] + d[56];
+        tmp7 = d[0] - d[56];
+        tmp1 = d[8] + d[48];
+        tmp6 = d[8] - d[48];
+        tmp2 = d[16] + d[40];
+        tmp5 = d[16] - d[40];
+        tmp3 = d[24] + d[32];
+        tmp4 = d[24] - d[32];
+
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+
+        d[0] = DESCALE(tmp10 + tmp11, PASS1_BITS);
+        d[32] = DESCALE(tmp10 - tmp11, PASS1_BITS);
+
+        z1 = (tmp12 + tmp13) * FIX_0_541196100;
+        d[16] = DESCALE(z1 + tmp13 * FIX_0_765366865, CONST_BITS + PASS1_BITS);
+        d[48] = DESCALE(z1 - tmp12 * FIX_1_847759065, CONST_BITS + PASS1_BITS);
+
+        z1 = tmp4 + tmp7;
+        z2 = tmp5 + tmp6;
+        z3 = tmp4 + tmp6;
+        z4 = tmp5 + tmp7;
+        z5 = (z3 + z4) * FIX_1_175875602;
+
+        tmp4 *= FIX_0_298631336;
+        tmp5 *= FIX_2_053119869;
+        tmp6 *= FIX_3_072711026;
+        tmp7 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+
+        d[56] = DESCALE(tmp4 + z1 + z3, CONST_BITS + PASS1_BITS);
+        d[40] = DESCALE(tmp5 + z2 + z4, CONST_BITS + PASS1_BITS);
+        d[24] = DESCALE(tmp6 + z2 + z3, CONST_BITS + PASS1_BITS);
+        d[8] = DESCALE(tmp7 + z1 + z4, CONST_BITS + PASS1_BITS);
+    }
+}
+
+
+/* Number of bits of the magnitude (category of Annex F.1.2) */
+static inline int Category(int _value)
+{
+    return (_value == 0) ? 0 : 32 - __builtin_clz((unsigned)_value);
+}
+
+
+void CJpegEncoderFast::EncodeBlock(int16_t* _block, int _table, int &_dcpred)
+{
+    int32_t dct[64];
+    int16_t coef[64];               // Zigzag order
+    const uint32_t* recip = reciprocal[_table];
+
+    ForwardDCT(_block, dct);
+
+    int last = 0;                   // Last coefficient which is not 0, the AC loop stops there
+    for (int i = 0; i < 64; ++i) {
+        int k = zigzag[i];
+        int32_t v = dct[k];
+        int32_t q = (int32_t)(((uint32_t)std::abs(v) * recip[k] + (1 << 17)) >> 18);
+        coef[i] = (v < 0) ? -q : q;
+        last = (q != 0) ? i : last;
+    }
+
+    // DC: difference to the previous block of the component
+    int diff = coef[0] - _dcpred;
+    _dcpred = coef[0];
+
+    int size = Category(std::abs(diff));
+    PutCode(dc_code[_table][size], dc_size[_table][size], (diff < 0 ? diff - 1 : diff) & ((1 << size) - 1), size);
+
+    // AC: run of zeros and category
+    int run = 0;
+    for (int i = 1; i <= last; ++i) {
+        int v = coef[i];
+        if (v == 0) {
+            run++;
+            continue;
+        }
+
+        while (run > 15) {
+            PutBits(ac_code[_table][0xF0], ac_size[_table][0xF0]);
+            run -= 16;
+        }
+
+        size = Category(std::abs(v));
+        int symbol = (run << 4) | size;
+        PutCode(ac_code[_table][symbol], ac_size[_table][symbol], (v < 0 ? v - 1 : v) & ((1 << size) - 1), size);
+        run = 0;
+    }
+
+    if (last < 63)
+        PutBits(ac_code[_table][0x00], ac_size[_table][0x00]);
+}
+
+
+bool CJpegEncoderFast::EncodeView(const ImageView &_view, int _quality)
+{
+    bool color = (_view.channels == 3);
+    bool subsampled = color && (_quality <= 90);
+    int mcusize = subsampled ? 16 : 8;
+    int components = color ? 3 : 1;
+    int rowbytes = _view.width * _view.channels;
+
+    // The rows of an MCU row with the overlay drawn onto them
+    uint8_t* strip = NULL;
+    if (overlay != NULL) {
+        strip = (uint8_t*) RoundArena.Allocate("JPEG overlay strip", rowbytes * mcusize);
+        if (strip == NULL) {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "EncodeView: Can't allocate " + std::to_string(rowbytes * mcusize) + " bytes for the overlay");
+            return false;
+        }
+    }
+
+    SetQuality(_quality);
+    WriteHeaders(_view.width, _view.height, components, subsampled);
+
+    bitbuffer = 0;
+    bitcount = 0;
+    mcus = 0;
+
+    int16_t y[4][64];
+    int16_t cb[16 * 16], cr[16 * 16];   // Full resolution (rows of mcusize), averaged to one block if subsampled
+    int16_t cbblock[64], crblock[64];
+    int dcpred[3] = {0, 0, 0};
+    int column[16];
+
+    for (int my = 0; (my < _view.height) && !failed; my += mcusize) {
+        ImageView rows = _view;
+        rows.data = _view.Pixel(0, my);
+        rows.height = std::min(mcusize, _view.height - my);
+
+        if (strip != NULL) {
+            for (int j = 0; j < rows.height; ++j)
+                memcpy(strip + j * rowbytes, rows.Pixel(0, j), rowbytes);
+
+            rows.data = strip;
+            rows.stride = rowbytes;
+            overlay->Render(rows, my);
+        }
+
+        for (int mx = 0; mx < _view.width; mx += mcusize) {
+            // Pixels beyond the border repeat the last column / row
+            for (int i = 0; i < mcusize; ++i)
+                column[i] = std::min(mx + i, _view.width - 1) * _view.channels;
+
+            for (int j = 0; j < mcusize; ++j) {
+                const uint8_t* row = rows.Pixel(0, std::min(j, rows.height - 1));
+                int16_t* yblock = y[(j >> 3) * 2] + (j & 7) * 8;
+
+                if (!color) {
+                    for (int i = 0; i < 8; ++i)
+                        yblock[i] = row[column[i]] - 128;
+                    continue;
+                }
+
+                int16_t* cbrow = cb + j * mcusize;
+                int16_t* crrow = cr + j * mcusize;
+
+                for (int i = 0; i < mcusize; ++i) {
+                    // JFIF YCbCr, 16 bit fixed point
+                    const uint8_t* p = row + column[i];
+                    int r = p[0], g = p[1], b = p[2];
+                    yblock[(i >> 3) * 64 + (i & 7)] = ((19595 * r + 38470 * g + 7471 * b + 32768) >> 16) - 128;
+                    cbrow[i] = (-11059 * r - 21709 * g + 32768 * b + 32768) >> 16;
+                    crrow[i] = (32768 * r - 27439 * g - 5329 * b + 32768) >> 16;
+                }
+            }
+
+            if (!subsampled) {
+                EncodeBlock(y[0], 0, dcpred[0]);
+                if (color) {
+                    EncodeBlock(cb, 1, dcpred[1]);
+                    EncodeBlock(cr, 1, dcpred[2]);
+                }
+            }
+            else {
+                for (int b = 0; b < 4; ++b)
+                    EncodeBlock(y[b], 0, dcpred[0]);
+
+                for (int j = 0; j < 8; ++j)
+                    for (int i = 0; i < 8; ++i) {
+                        int k = j * 32 + i * 2;
+                        cbblock[j * 8 + i] = (cb[k] + cb[k + 1] + cb[k + 16] + cb[k + 17] + 2) >> 2;
+                        crblock[j * 8 + i] = (cr[k] + cr[k + 1] + cr[k + 16] + cr[k + 17] + 2) >> 2;
+                    }
+                EncodeBlock(cbblock, 1, dcpred[1]);
+                EncodeBlock(crblock, 1, dcpred[2]);
+            }
+
+            mcus++;
+        }
+    }
+
+    // Fill the last byte with 1 bits, end of image
+    if (bitcount > 0)
+        PutBits((1 << (8 - bitcount)) - 1, 8 - bitcount);
+    PutByte(0xFF);
+    PutByte(0xD9);
+
+    RoundArena.Free("JPEG overlay strip", strip);
+    return true;
+}
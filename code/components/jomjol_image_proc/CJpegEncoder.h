@@ -0,0 +1,148 @@
+#pragma once
+
+#ifndef CJPEGENCODER_H
+#define CJPEGENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "CImageBasis.h"
+#include "CImageOverlay.h"
+
+
+/* Receives the next chunk of the JPEG, false aborts the encoding (e.g. the connection is closed, the buffer is full) */
+typedef bool (*JpegWriteFunc)(void* _context, const uint8_t* _data, int _size);
+
+
+enum JpegEncoderType {
+    JPEG_ENCODER_FAST,                  // CJpegEncoderFast: integer DCT
+    JPEG_ENCODER_STB                    // CJpegEncoderStb: stbi_write_jpg_to_func
+};
+
+#ifndef JPEG_ENCODER_DEFAULT
+#define JPEG_ENCODER_DEFAULT JPEG_ENCODER_FAST
+#endif
+
+
+/**
+ * Baseline JPEG encoder writing into a chunk buffer of the caller. Every full chunk is handed to the write function,
+ * the last (partial) one when the image is done, so the JPEG never exists as a whole in memory
+ * (e.g. streamed into httpd_resp_send_chunk).
+ * The pixels are read from a view (1 channel: grayscale, 3 channels: RGB), a part of an image is not copied.
+ * An overlay is drawn onto a copy of the rows being encoded, the view itself is never written.
+ */
+class CJpegEncoder
+{
+    public:
+        // Statistics of the last Encode
+        int output_bytes = 0;           // Bytes handed to the write function
+        int chunks = 0;                 // Calls of the write function
+
+        virtual ~CJpegEncoder() {};
+
+        static CJpegEncoder* Create(JpegEncoderType _type = JPEG_ENCODER_DEFAULT);
+
+        virtual const char* Name() = 0;
+
+        /**
+         * @brief Encode _view, the output is written in chunks of _chunksize bytes
+         * @param _quality 1..100, 0: 90 (as stbi_write_jpg)
+         * @param _chunk Buffer of _chunksize bytes for the output
+         * @param _overlay Drawn onto the encoded image (coordinates of the view), NULL: none
+         * @return false if the view can't be encoded or the write function aborted
+         */
+        bool Encode(const ImageView &_view, int _quality, uint8_t* _chunk, int _chunksize, JpegWriteFunc _write, void* _context,
+                    const CImageOverlay* _overlay = NULL);
+
+    protected:
+        uint8_t* chunk = NULL;
+        int chunksize = 0;
+        int fill = 0;
+        JpegWriteFunc write = NULL;
+        void* context = NULL;
+        bool failed = false;            // The write function aborted, the remaining output is discarded
+        const CImageOverlay* overlay = NULL;    // NULL if there is nothing to draw
+
+        virtual bool EncodeView(const ImageView &_view, int _quality) = 0;
+
+        void Flush();
+        void Put(const uint8_t* _data, int _size);
+        inline void PutByte(uint8_t _byte) {
+            if (fill == chunksize)
+                Flush();
+            chunk[fill++] = _byte;
+        };
+};
+
+
+/**
+ * Encoder of stb_image_write (float DCT, always the whole image), a view with gaps between the rows or with an overlay
+ * is copied first
+ */
+class CJpegEncoderStb : public CJpegEncoder
+{
+    public:
+        const char* Name() { return "stb"; };
+
+    protected:
+        bool EncodeView(const ImageView &_view, int _quality);
+        static void StbWrite(void* _context, void* _data, int _size);
+};
+
+
+/**
+ * Baseline encoder with the integer DCT of the IJG (islow), standard tables of the JPEG specification (Annex K)
+ * scaled like libjpeg. Chroma is subsampled 2x2 up to quality 90, like stb does.
+ * The MCUs are read directly from the view, the bits are written straight into the chunk buffer.
+ * With an overlay the rows of one MCU row are copied into a strip and the overlay is drawn onto the strip.
+ */
+class CJpegEncoderFast : public CJpegEncoder
+{
+    public:
+        int mcus = 0;                   // MCUs encoded by the last Encode
+
+        CJpegEncoderFast();
+        const char* Name() { return "fast"; };
+
+    protected:
+        uint8_t quant[2][64];           // Zigzag order, as written into the DQT segment
+        uint32_t reciprocal[2][64];     // Natural order, 2^18 / divisor of the scaled DCT output
+        uint16_t dc_code[2][12];        // Huffman codes [luminance/chroma][category]
+        uint8_t dc_size[2][12];
+        uint16_t ac_code[2][256];       // [luminance/chroma][run << 4 | category]
+        uint8_t ac_size[2][256];
+
+        uint32_t bitbuffer = 0;
+        int bitcount = 0;
+
+        bool EncodeView(const ImageView &_view, int _quality);
+
+        void SetQuality(int _quality);
+        void WriteHeaders(int _width, int _height, int _components, bool _subsampled);
+        void EncodeBlock(int16_t* _block, int _table, int &_dcpred);
+
+        inline void PutBits(uint32_t _code, int _size) {
+            bitbuffer = (bitbuffer << _size) | _code;
+            bitcount += _size;
+            while (bitcount >= 8) {
+                uint8_t byte = (uint8_t)(bitbuffer >> (bitcount - 8));
+                PutByte(byte);
+                if (byte == 0xFF)
+                    PutByte(0);         // Byte stuffing
+                bitcount -= 8;
+            }
+        };
+
+        /* Huffman code followed by the bits of the value, written at once if they fit into the bit buffer */
+        inline void PutCode(uint32_t _code, int _codesize, uint32_t _bits, int _size) {
+            if (_codesize + _size <= 24) {
+                PutBits((_code << _size) | _bits, _codesize + _size);
+            }
+            else {
+                PutBits(_code, _codesize);
+                PutBits(_bits, _size);
+            }
+        };
+};
+
+#endif //CJPEGENCODER_H
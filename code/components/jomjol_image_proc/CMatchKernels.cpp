@@ -0,0 +1,53 @@
+#include "CMatchKernels.h"
+
+
+uint64_t MatchSSD1(const uint8_t* _image, int _imagestride, int _imagestep, const uint8_t* _tpl, int _tplstride, int _tplstep, int _tplwidth, int _tplheight, uint64_t _limit)
+{
+    uint64_t sum = 0;
+
+    for (int y = 0; y < _tplheight; ++y)
+    {
+        const uint8_t* p_org = _image + y * _imagestride;
+        const uint8_t* p_tpl = _tpl + y * _tplstride;
+        uint32_t rowsum = 0;
+        for (int x = 0; x < _tplwidth; ++x)
+        {
+            int dif = *p_tpl - *p_org;
+            rowsum += dif * dif;
+            p_org += _imagestep;
+            p_tpl += _tplstep;
+        }
+        sum += rowsum;
+        if (sum > _limit)
+            break;
+    }
+
+    return sum;
+}
+
+
+uint64_t MatchSSD3(const uint8_t* _image, int _imagestride, int _imagestep, const uint8_t* _tpl, int _tplstride, int _tplstep, int _tplwidth, int _tplheight, uint64_t _limit)
+{
+    uint64_t sum = 0;
+
+    for (int y = 0; y < _tplheight; ++y)
+    {
+        const uint8_t* p_org = _image + y * _imagestride;
+        const uint8_t* p_tpl = _tpl + y * _tplstride;
+        uint32_t rowsum = 0;
+        for (int x = 0; x < _tplwidth; ++x)
+        {
+            int dr = p_tpl[0] - p_org[0];
+            int dg = p_tpl[1] - p_org[1];
+            int db = p_tpl[2] - p_org[2];
+            rowsum += dr * dr + dg * dg + db * db;
+            p_org += _imagestep;
+            p_tpl += _tplstep;
+        }
+        sum += rowsum;
+        if (sum > _limit)
+            break;
+    }
+
+    return sum;
+}
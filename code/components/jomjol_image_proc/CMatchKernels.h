@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef CMATCHKERNELS_H
+#define CMATCHKERNELS_H
+
+#include <stdint.h>
+
+
+/**
+ * Integer template matching kernels (sum of squared differences), walking image and template row by row.
+ * _image and _tpl point to the first pixel (first channel) of the compared rectangles,
+ * _imagestride / _tplstride are the row lengths in bytes, _imagestep / _tplstep the distance of two pixels
+ * in bytes (1 for a single channel plane, 3 for interleaved RGB). The "1" kernels compare one channel,
+ * the "3" kernels three consecutive channels.
+ *
+ * The sum is checked after every row: as soon as it exceeds _limit the candidate can't win any more and
+ * the kernel returns the partial sum (> _limit). Pass UINT64_MAX for the full sum.
+ * A row is summed in 32 bit (fits up to 66000 values, e.g. 22000 pixel with 3 channels), the rows in 64 bit,
+ * so the size of the reference (from the configuration) is not limited.
+ */
+uint64_t MatchSSD1(const uint8_t* _image, int _imagestride, int _imagestep, const uint8_t* _tpl, int _tplstride, int _tplstep, int _tplwidth, int _tplheight, uint64_t _limit);
+uint64_t MatchSSD3(const uint8_t* _image, int _imagestride, int _imagestep, const uint8_t* _tpl, int _tplstride, int _tplstep, int _tplwidth, int _tplheight, uint64_t _limit);
+
+#endif //CMATCHKERNELS_H
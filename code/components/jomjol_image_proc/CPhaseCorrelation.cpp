@@ -0,0 +1,239 @@
+#include "CPhaseCorrelation.h"
+
+#include "CRoundArena.h"
+#include "ClassLogFile.h"
+
+#include <esp_log.h>
+#include <math.h>
+#include <algorithm>
+
+static const char* TAG = "C PHASE CORR";
+
+
+/* Smallest power of 2 >= _size */
+int CPhaseCorrelation::FFTSize(int _size)
+{
+    int n = 1;
+    while (n < _size)
+        n <<= 1;
+    return n;
+}
+
+
+/* In-place iterative radix-2 FFT of _n interleaved complex values with a distance of _step floats.
+ * _twiddle holds exp(-2*pi*i*k/_twiddlesize) for k < _twiddlesize/2, _n has to divide _twiddlesize. */
+static void FFT1D(float* _d, int _n, int _step, const float* _twiddle, int _twiddlesize)
+{
+    // Bit reversal permutation
+    for (int i = 1, j = 0; i < _n; ++i)
+    {
+        int bit = _n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j)
+        {
+            std::swap(_d[i * _step], _d[j * _step]);
+            std::swap(_d[i * _step + 1], _d[j * _step + 1]);
+        }
+    }
+
+    for (int len = 2; len <= _n; len <<= 1)
+    {
+        int half = len >> 1;
+        int twstep = _twiddlesize / len;
+
+        for (int i = 0; i < _n; i += len)
+            for (int k = 0; k < half; ++k)
+            {
+                float wr = _twiddle[2 * k * twstep];
+                float wi = _twiddle[2 * k * twstep + 1];
+                float* a = _d + (i + k) * _step;
+                float* b = _d + (i + k + half) * _step;
+                float tr = b[0] * wr - b[1] * wi;
+                float ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+    }
+}
+
+
+void CPhaseCorrelation::FFT2D()
+{
+    int twiddlesize = std::max(fftwidth, fftheight);
+
+    for (int k = 0; k < twiddlesize / 2; ++k)
+    {
+        twiddle[2 * k] = cosf(-2 * M_PI * k / twiddlesize);
+        twiddle[2 * k + 1] = sinf(-2 * M_PI * k / twiddlesize);
+    }
+
+    for (int y = 0; y < fftheight; ++y)
+        FFT1D(data + 2 * y * fftwidth, fftwidth, 2, twiddle, twiddlesize);
+
+    // Columns are copied into a contiguous buffer, the strided access would thrash the PSRAM cache
+    for (int x = 0; x < fftwidth; ++x)
+    {
+        for (int y = 0; y < fftheight; ++y)
+        {
+            line[2 * y] = data[2 * (y * fftwidth + x)];
+            line[2 * y + 1] = data[2 * (y * fftwidth + x) + 1];
+        }
+
+        FFT1D(line, fftheight, 2, twiddle, twiddlesize);
+
+        for (int y = 0; y < fftheight; ++y)
+        {
+            data[2 * (y * fftwidth + x)] = line[2 * y];
+            data[2 * (y * fftwidth + x) + 1] = line[2 * y + 1];
+        }
+    }
+}
+
+
+bool CPhaseCorrelation::Correlate(const uint8_t* _region, int _regionwidth, int _regionheight,
+                                  const uint8_t* _tpl, int _tplwidth, int _tplheight,
+                                  PhaseCorrPeak _peaks[PHASECORR_MAX_PEAKS])
+{
+    for (int i = 0; i < PHASECORR_MAX_PEAKS; ++i)
+        _peaks[i] = PhaseCorrPeak();
+
+    int w = FFTSize(_regionwidth);
+    int h = FFTSize(_regionheight);
+
+    if (w * h > PHASECORR_MAX_FFT_POINTS)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Correlate: Region too large (" + std::to_string(_regionwidth) + " x " + std::to_string(_regionheight) + ")");
+        return false;
+    }
+
+    if ((w != fftwidth) || (h != fftheight))
+    {
+        Free();
+        fftwidth = w;
+        fftheight = h;
+        data = (float*) RoundArena.Allocate(name + " data", 2 * w * h * sizeof(float));
+        line = (float*) RoundArena.Allocate(name + " line", (2 * h + std::max(w, h)) * sizeof(float));
+
+        if ((data == NULL) || (line == NULL))
+        {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Correlate: Can't allocate FFT buffer (" + std::to_string(2 * w * h * sizeof(float)) + " bytes)");
+            Free();
+            return false;
+        }
+        twiddle = line + 2 * h;
+    }
+
+    // Zero mean region (real part) and template (imaginary part), zero padded
+    int32_t regionsum = 0, tplsum = 0;
+    for (int i = 0; i < _regionwidth * _regionheight; ++i)
+        regionsum += _region[i];
+    for (int i = 0; i < _tplwidth * _tplheight; ++i)
+        tplsum += _tpl[i];
+    float regionmean = (float) regionsum / (_regionwidth * _regionheight);
+    float tplmean = (float) tplsum / (_tplwidth * _tplheight);
+
+    std::fill(data, data + 2 * w * h, 0.0f);
+    for (int y = 0; y < _regionheight; ++y)
+        for (int x = 0; x < _regionwidth; ++x)
+            data[2 * (y * w + x)] = _region[y * _regionwidth + x] - regionmean;
+    for (int y = 0; y < _tplheight; ++y)
+        for (int x = 0; x < _tplwidth; ++x)
+            data[2 * (y * w + x) + 1] = _tpl[y * _tplwidth + x] - tplmean;
+
+    FFT2D();
+
+    /* Split the spectra of the two real signals (Z = FFT(a + i*b), M = conj(Z[-k])):
+     *   A = (Z + M) / 2,  B = (Z - M) / 2i
+     * Cross-power spectrum R = A * conj(B) / |A * conj(B)|, R[-k] = conj(R[k]).
+     * The inverse FFT is done as forward FFT of conj(R), only the real part is needed. */
+    for (int ky = 0; ky < h; ++ky)
+        for (int kx = 0; kx < w; ++kx)
+        {
+            int k = ky * w + kx;
+            int m = ((h - ky) & (h - 1)) * w + ((w - kx) & (w - 1));
+            if (m < k)
+                continue;       // already done together with its mirror
+
+            float zr = data[2 * k], zi = data[2 * k + 1];
+            float mr = data[2 * m], mi = -data[2 * m + 1];
+            float ar = (zr + mr) / 2, ai = (zi + mi) / 2;
+            float br = (zi - mi) / 2, bi = -(zr - mr) / 2;
+            float cr = ar * br + ai * bi;           // A * conj(B)
+            float ci = ai * br - ar * bi;
+            float mag = sqrtf(cr * cr + ci * ci);
+
+            if (mag > 1e-6f)
+            {
+                cr /= mag;
+                ci /= mag;
+            }
+            else
+            {
+                cr = 0;
+                ci = 0;
+            }
+
+            data[2 * k] = cr;               // conj(R[k])
+            data[2 * k + 1] = -ci;
+            data[2 * m] = cr;               // conj(R[m]) = R[k]
+            data[2 * m + 1] = ci;
+        }
+
+    FFT2D();
+
+    // Highest local maxima inside the valid shift range
+    int maxdx = _regionwidth - _tplwidth;
+    int maxdy = _regionheight - _tplheight;
+    float norm = 1.0f / (w * h);
+
+    for (int y = 0; y <= maxdy; ++y)
+        for (int x = 0; x <= maxdx; ++x)
+        {
+            float value = data[2 * (y * w + x)] * norm;
+
+            if (value <= _peaks[PHASECORR_MAX_PEAKS - 1].value)
+                continue;
+
+            bool isLocalMax = true;
+            for (int dy = -1; (dy <= 1) && isLocalMax; ++dy)
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    int nx = (x + dx) & (w - 1), ny = (y + dy) & (h - 1);
+                    if (data[2 * (ny * w + nx)] * norm > value)
+                    {
+                        isLocalMax = false;
+                        break;
+                    }
+                }
+
+            if (!isLocalMax)
+                continue;
+
+            int i = PHASECORR_MAX_PEAKS - 1;        // sorted insert
+            for (; (i > 0) && (_peaks[i - 1].value < value); --i)
+                _peaks[i] = _peaks[i - 1];
+            _peaks[i].x = x;
+            _peaks[i].y = y;
+            _peaks[i].value = value;
+        }
+
+    return true;
+}
+
+
+void CPhaseCorrelation::Free()
+{
+    // Reverse order of the allocation, the arena takes them back
+    RoundArena.Free(name + " line", line);
+    RoundArena.Free(name + " data", data);
+    line = NULL;
+    data = NULL;
+    twiddle = NULL;
+    fftwidth = 0;
+    fftheight = 0;
+}
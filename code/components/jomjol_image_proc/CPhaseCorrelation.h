@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef CPHASECORRELATION_H
+#define CPHASECORRELATION_H
+
+#include <stdint.h>
+#include <string>
+
+#define PHASECORR_MAX_FFT_POINTS (512 * 256)     // Largest FFT (width * height), needs 8 byte per point (1 MByte)
+#define PHASECORR_MAX_PEAKS 16
+
+
+struct PhaseCorrPeak {
+    int x = 0;
+    int y = 0;
+    float value = -1;                   // Height of the correlation peak, 1 = perfect (cyclic) shift
+};
+
+
+/**
+ * Phase correlation of a single channel template against a single channel search region.
+ * Both are zero mean, zero padded to the same power of 2 size and transformed together with one complex
+ * radix-2 FFT (region = real part, template = imaginary part). The normalized cross-power spectrum is
+ * transformed back, its maxima are the offsets of the template inside the region.
+ * The FFT buffers are temporary buffers of the round (RoundArena).
+ */
+class CPhaseCorrelation
+{
+    public:
+        int fftwidth = 0;
+        int fftheight = 0;
+
+        CPhaseCorrelation(std::string _name) {name = _name;};
+        ~CPhaseCorrelation() {Free();};
+
+        /**
+         * @brief Correlate the template with the region
+         * @param _peaks receives the highest local maxima with 0 <= x <= _regionwidth - _tplwidth
+         *               (same for y), sorted by descending value. Unused entries have value -1
+         * @return false if the region needs more than PHASECORR_MAX_FFT_POINTS or the buffer can't be allocated
+         */
+        bool Correlate(const uint8_t* _region, int _regionwidth, int _regionheight,
+                       const uint8_t* _tpl, int _tplwidth, int _tplheight,
+                       PhaseCorrPeak _peaks[PHASECORR_MAX_PEAKS]);
+        void Free();
+
+        static int FFTSize(int _size);
+
+    protected:
+        std::string name;
+        float* data = NULL;             // Interleaved complex (re, im), fftwidth * fftheight
+        float* line = NULL;             // One column, interleaved complex
+        float* twiddle = NULL;          // exp(-2*pi*i*k/N), placed behind line
+
+        void FFT2D();
+};
+
+#endif //CPHASECORRELATION_H
@@ -0,0 +1,290 @@
+#include "CPixelKernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(PIXELKERNELS_SSE2)
+    #include <emmintrin.h>
+#elif defined(PIXELKERNELS_NEON)
+    #include <arm_neon.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+    #error "CPixelKernels: PixelExtractChannel assumes little endian words"
+#endif
+
+
+#define PIXEL_LOW7 0x7F7F7F7Fu
+#define PIXEL_HIGH 0x80808080u
+
+
+/* Aligned word access, _p has to be a multiple of 4 (memcpy avoids aliasing problems and compiles to one load / store) */
+static inline uint32_t LoadWord(const uint8_t* _p)
+{
+    uint32_t w;
+    memcpy(&w, __builtin_assume_aligned(_p, 4), 4);
+    return w;
+}
+
+
+static inline void StoreWord(uint8_t* _p, uint32_t _w)
+{
+    memcpy(__builtin_assume_aligned(_p, 4), &_w, 4);
+}
+
+
+/* Index of the first word aligned byte of _data starting at _start (at most _size) */
+static inline int AlignedIndex(const uint8_t* _data, int _start, int _size)
+{
+    return std::min(_size, _start + (int)((4 - ((uintptr_t)(_data + _start) & 3)) & 3));
+}
+
+
+/* Four saturated byte additions in one word: the low 7 bits are added without carry into the next byte,
+ * bit 7 and the overflow of each byte are computed separately, overflowed bytes are set to 255 */
+static inline uint32_t AddSaturated(uint32_t _x, uint32_t _b)
+{
+    uint32_t low = (_x & PIXEL_LOW7) + (_b & PIXEL_LOW7);
+    uint32_t sum = low ^ ((_x ^ _b) & PIXEL_HIGH);
+    uint32_t overflow = ((_x & _b) | (low & (_x | _b))) & PIXEL_HIGH;
+    return sum | ((overflow >> 7) * 0xFF);
+}
+
+
+const char* PixelKernelBackend()
+{
+#if defined(PIXELKERNELS_SSE2)
+    return "SSE2";
+#elif defined(PIXELKERNELS_NEON)
+    return "NEON";
+#else
+    return "SWAR";
+#endif
+}
+
+
+void PixelContrastTable(uint8_t* _lut, float _contrast)
+{
+    float contrast = (_contrast / 100) + 1;         // [0..2]
+    float intercept = 128 * (1 - contrast);
+
+    for (int v = 0; v < 256; ++v)
+        _lut[v] = (uint8_t) std::min(255, std::max(0, (int) (v * contrast + intercept)));
+}
+
+
+void PixelBrightnessTable(uint8_t* _lut, int _offset)
+{
+    for (int v = 0; v < 256; ++v)
+        _lut[v] = (uint8_t) std::min(255, std::max(0, v + _offset));
+}
+
+
+void PixelApplyTable(uint8_t* _data, int _size, const uint8_t* _lut)
+{
+    // No byte shuffle in SSE2, all backends look up word by word
+    int i = 0;
+    int head = AlignedIndex(_data, 0, _size);
+
+    for (; i < head; ++i)
+        _data[i] = _lut[_data[i]];
+
+    for (; i + 4 <= _size; i += 4)
+    {
+        uint32_t w = LoadWord(_data + i);
+        StoreWord(_data + i, _lut[w & 0xFF] | (_lut[(w >> 8) & 0xFF] << 8) | (_lut[(w >> 16) & 0xFF] << 16) | ((uint32_t) _lut[w >> 24] << 24));
+    }
+
+    for (; i < _size; ++i)
+        _data[i] = _lut[_data[i]];
+}
+
+
+void PixelNegate(uint8_t* _data, int _size)
+{
+    int i = 0;
+
+#if defined(PIXELKERNELS_SSE2)
+    __m128i ones = _mm_set1_epi8((char) 0xFF);
+    for (; i + 16 <= _size; i += 16)
+        _mm_storeu_si128((__m128i*) (_data + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*) (_data + i)), ones));
+#elif defined(PIXELKERNELS_NEON)
+    for (; i + 16 <= _size; i += 16)
+        vst1q_u8(_data + i, vmvnq_u8(vld1q_u8(_data + i)));
+#endif
+
+    int head = AlignedIndex(_data, i, _size);
+    for (; i < head; ++i)
+        _data[i] = ~_data[i];
+
+    for (; i + 4 <= _size; i += 4)
+        StoreWord(_data + i, ~LoadWord(_data + i));
+
+    for (; i < _size; ++i)
+        _data[i] = ~_data[i];
+}
+
+
+void PixelBrightness(uint8_t* _data, int _size, int _offset)
+{
+    // Subtraction as addition on the negated values: 255 - min(255, (255 - v) + b) = max(0, v - b)
+    bool subtract = (_offset < 0);
+    uint8_t b = (uint8_t) std::min(255, abs(_offset));
+    int i = 0;
+
+#if defined(PIXELKERNELS_SSE2)
+    __m128i vb = _mm_set1_epi8((char) b);
+    for (; i + 16 <= _size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (_data + i));
+        _mm_storeu_si128((__m128i*) (_data + i), subtract ? _mm_subs_epu8(v, vb) : _mm_adds_epu8(v, vb));
+    }
+#elif defined(PIXELKERNELS_NEON)
+    uint8x16_t vb = vdupq_n_u8(b);
+    for (; i + 16 <= _size; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(_data + i);
+        vst1q_u8(_data + i, subtract ? vqsubq_u8(v, vb) : vqaddq_u8(v, vb));
+    }
+#endif
+
+    int head = AlignedIndex(_data, i, _size);
+    for (; i < head; ++i)
+        _data[i] = subtract ? std::max(0, _data[i] - b) : std::min(255, _data[i] + b);
+
+    uint32_t bw = b * 0x01010101u;
+    for (; i + 4 <= _size; i += 4)
+    {
+        uint32_t w = LoadWord(_data + i);
+        StoreWord(_data + i, subtract ? ~AddSaturated(~w, bw) : AddSaturated(w, bw));
+    }
+
+    for (; i < _size; ++i)
+        _data[i] = subtract ? std::max(0, _data[i] - b) : std::min(255, _data[i] + b);
+}
+
+
+void PixelExtractChannel(const uint8_t* _source, int _channels, int _channel, uint8_t* _target, int _pixels)
+{
+    if (_channels == 1)
+    {
+        memcpy(_target, _source, _pixels);
+        return;
+    }
+
+    const uint8_t* p_source = _source + _channel;
+    int i = 0;
+
+#if defined(PIXELKERNELS_NEON)
+    if (_channels == 3)
+        for (; i + 16 <= _pixels; i += 16)
+            vst1q_u8(_target + i, vld3q_u8(_source + 3 * i).val[_channel]);
+    else if (_channels == 4)
+        for (; i + 16 <= _pixels; i += 16)
+            vst1q_u8(_target + i, vld4q_u8(_source + 4 * i).val[_channel]);
+#endif
+
+    // Four source bytes gathered into one target word (SSE2 has no byte deinterleave)
+    int head = AlignedIndex(_target, i, _pixels);
+    for (; i < head; ++i)
+        _target[i] = p_source[i * _channels];
+
+    for (; i + 4 <= _pixels; i += 4)
+    {
+        const uint8_t* p = p_source + i * _channels;
+        StoreWord(_target + i, p[0] | (p[_channels] << 8) | (p[2 * _channels] << 16) | ((uint32_t) p[3 * _channels] << 24));
+    }
+
+    for (; i < _pixels; ++i)
+        _target[i] = p_source[i * _channels];
+}
+
+
+void PixelFill(uint8_t* _data, int _pixels, int _channels, const uint8_t* _color)
+{
+    int size = _pixels * _channels;
+
+    if (_channels == 1)
+    {
+        memset(_data, _color[0], size);
+        return;
+    }
+
+    // 12 bytes (48 for the vectors) hold a whole number of pixels for 1 to 4 channels
+    int i = 0;
+
+#if defined(PIXELKERNELS_SSE2) || defined(PIXELKERNELS_NEON)
+    if (size >= 48)
+    {
+        uint8_t pattern[48];
+        for (int k = 0; k < 48; ++k)
+            pattern[k] = _color[k % _channels];
+#if defined(PIXELKERNELS_SSE2)
+        __m128i v0 = _mm_loadu_si128((const __m128i*) pattern);
+        __m128i v1 = _mm_loadu_si128((const __m128i*) (pattern + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i*) (pattern + 32));
+        for (; i + 48 <= size; i += 48)
+        {
+            _mm_storeu_si128((__m128i*) (_data + i), v0);
+            _mm_storeu_si128((__m128i*) (_data + i + 16), v1);
+            _mm_storeu_si128((__m128i*) (_data + i + 32), v2);
+        }
+#else
+        uint8x16_t v0 = vld1q_u8(pattern), v1 = vld1q_u8(pattern + 16), v2 = vld1q_u8(pattern + 32);
+        for (; i + 48 <= size; i += 48)
+        {
+            vst1q_u8(_data + i, v0);
+            vst1q_u8(_data + i + 16, v1);
+            vst1q_u8(_data + i + 32, v2);
+        }
+#endif
+    }
+#endif
+
+    int head = AlignedIndex(_data, i, size);
+    for (; i < head; ++i)
+        _data[i] = _color[i % _channels];
+
+    if (i + 12 <= size)
+    {
+        // Pattern words starting with the channel at the first aligned byte
+        uint8_t phase[12];
+        for (int k = 0; k < 12; ++k)
+            phase[k] = _color[(i + k) % _channels];
+        uint32_t w0, w1, w2;
+        memcpy(&w0, phase, 4);
+        memcpy(&w1, phase + 4, 4);
+        memcpy(&w2, phase + 8, 4);
+
+        for (; i + 12 <= size; i += 12)
+        {
+            StoreWord(_data + i, w0);
+            StoreWord(_data + i + 4, w1);
+            StoreWord(_data + i + 8, w2);
+        }
+    }
+
+    for (; i < size; ++i)
+        _data[i] = _color[i % _channels];
+}
+
+
+void PixelFillRect(uint8_t* _data, int _stride, int _channels, int _dx, int _dy, const uint8_t* _color)
+{
+    if (_dx * _channels >= 16)
+    {
+        for (int y = 0; y < _dy; ++y)
+            PixelFill(_data + y * _stride, _dx, _channels, _color);
+        return;
+    }
+
+    // Narrow bars (the sides of a frame): too short for words, pixel by pixel without any setup
+    for (int y = 0; y < _dy; ++y)
+    {
+        uint8_t* p = _data + y * _stride;
+        for (int x = 0; x < _dx; ++x)
+            for (int ch = 0; ch < _channels; ++ch)
+                *p++ = _color[ch];
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef CPIXELKERNELS_H
+#define CPIXELKERNELS_H
+
+#include <stdint.h>
+
+
+/**
+ * Pixel operation kernels on interleaved 8 bit images, _size is the number of bytes (pixels * channels).
+ * The kernels work on 32 bit words (four bytes per word, SWAR) with the unaligned head and tail byte by byte,
+ * value mappings (contrast, brightness) use a 256 entry lookup table applied word by word.
+ *
+ * On hosts with SSE2 (x86) or NEON (ARM) the word loops are replaced by 16 byte vectors, the backend is selected
+ * at compile time (define PIXELKERNELS_NO_SIMD to force the SWAR kernels). The ESP32 always uses SWAR.
+ * All backends give results identical to the plain per-pixel loops.
+ */
+
+#if !defined(PIXELKERNELS_NO_SIMD) && defined(__SSE2__)
+    #define PIXELKERNELS_SSE2
+#elif !defined(PIXELKERNELS_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+    #define PIXELKERNELS_NEON
+#endif
+
+/* "SSE2", "NEON" or "SWAR" */
+const char* PixelKernelBackend();
+
+/* Lookup tables: contrast as CImageBasis::Contrast (range [-100..100]), brightness as saturated offset */
+void PixelContrastTable(uint8_t* _lut, float _contrast);
+void PixelBrightnessTable(uint8_t* _lut, int _offset);
+void PixelApplyTable(uint8_t* _data, int _size, const uint8_t* _lut);
+
+/* 255 - value */
+void PixelNegate(uint8_t* _data, int _size);
+
+/* value + _offset, saturated to [0..255] */
+void PixelBrightness(uint8_t* _data, int _size, int _offset);
+
+/* Copies channel _channel of _pixels interleaved pixels with _channels channels into the plane _target */
+void PixelExtractChannel(const uint8_t* _source, int _channels, int _channel, uint8_t* _target, int _pixels);
+
+/* Fills _pixels pixels with _color (_channels values, 1 to 4 channels) */
+void PixelFill(uint8_t* _data, int _pixels, int _channels, const uint8_t* _color);
+
+/* Fills a rectangle of _dx * _dy pixels, _data points to the first pixel, rows are _stride bytes apart (no clipping) */
+void PixelFillRect(uint8_t* _data, int _stride, int _channels, int _dx, int _dy, const uint8_t* _color);
+
+#endif //CPIXELKERNELS_H
@@ -0,0 +1,319 @@
+#include "CRoiSampler.h"
+#include "ClassLogFile.h"
+
+#include <math.h>
+#include <algorithm>
+#include <esp_log.h>
+
+static const char* TAG = "C ROI SAMPLER";
+
+CRoiSamplerCache RoiSamplerCache;
+
+
+void RoiSamplerPlan::BuildTaps(int _sourcesize, int _targetsize, std::vector<RoiSamplerTaps> &_taps)
+{
+    const int one = 1 << ROISAMPLER_WEIGHT_BITS;
+    float scale = (float) _sourcesize / _targetsize;
+
+    _taps.resize(_targetsize);
+
+    for (int i = 0; i < _targetsize; ++i)
+    {
+        RoiSamplerTaps &t = _taps[i];
+        t.weights = weights.size();
+
+        if (scale >= 1)
+        {
+            // Area: coverage of the source pixels by [i * scale, (i + 1) * scale)
+            float start = i * scale;
+            float stop = std::min((i + 1) * scale, (float) _sourcesize);
+            t.first = (int) start;
+            t.count = std::max((int) ceilf(stop - 0.0001f) - t.first, 1);
+
+            for (int k = 0; k < t.count; ++k)
+            {
+                float left = std::max(start, (float) (t.first + k));
+                float right = std::min(stop, (float) (t.first + k + 1));
+                weights.push_back((uint16_t) lroundf((right - left) / scale * one));
+            }
+        }
+        else
+        {
+            // Linear interpolation between the two nearest source pixels
+            float center = std::min(std::max((i + 0.5f) * scale - 0.5f, 0.0f), (float) (_sourcesize - 1));
+            t.first = std::min((int) center, std::max(_sourcesize - 2, 0));
+            t.count = std::min(2, _sourcesize);
+            int w1 = (int) lroundf((center - t.first) * one);
+
+            weights.push_back((uint16_t) (one - w1));
+            if (t.count > 1)
+                weights.push_back((uint16_t) w1);
+        }
+
+        // Rounding: the weights have to sum up to exactly 1, the difference goes to the largest weight
+        int sum = 0, largest = t.weights;
+        for (int k = t.weights; k < t.weights + t.count; ++k)
+        {
+            sum += weights[k];
+            if (weights[k] > weights[largest])
+                largest = k;
+        }
+        weights[largest] += one - sum;
+    }
+}
+
+
+void RoiSamplerPlan::Build(int _sourcewidth, int _sourceheight, int _width, int _height, int _channels)
+{
+    sourcewidth = _sourcewidth;
+    sourceheight = _sourceheight;
+    width = _width;
+    height = _height;
+    channels = _channels;
+
+    weights.clear();
+    BuildTaps(_sourcewidth, _width, taps_x);
+    BuildTaps(_sourceheight, _height, taps_y);
+    line.resize(_width * _channels);
+}
+
+
+bool RoiSamplerPlan::Matches(int _sourcewidth, int _sourceheight, int _width, int _height, int _channels) const
+{
+    return (sourcewidth == _sourcewidth) && (sourceheight == _sourceheight) && (width == _width) && (height == _height) && (channels == _channels);
+}
+
+
+int RoiSamplerPlan::Bytes() const
+{
+    return sizeof(RoiSamplerPlan) + (taps_x.capacity() + taps_y.capacity()) * sizeof(RoiSamplerTaps) +
+           weights.capacity() * sizeof(uint16_t) + line.capacity() * sizeof(uint32_t);
+}
+
+
+RoiSamplerPlan* CRoiSamplerCache::Get(int _sourcewidth, int _sourceheight, int _width, int _height, int _channels, bool &_scratch)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    RoiSamplerPlan* plan = NULL;
+    for (int i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i]->Matches(_sourcewidth, _sourceheight, _width, _height, _channels))
+        {
+            hits++;
+            plan = entries[i];
+            break;
+        }
+    }
+
+    if (plan == NULL)
+    {
+        misses++;
+
+        if (entries.size() >= ROISAMPLER_MAX_PLANS)
+        {
+            LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "More than " + std::to_string(ROISAMPLER_MAX_PLANS) + " ROI geometries, dropping the unused plans");
+            for (int i = entries.size() - 1; i >= 0; --i)
+            {
+                if (entries[i]->users == 0)
+                {
+                    delete entries[i];
+                    entries.erase(entries.begin() + i);
+                }
+            }
+        }
+
+        plan = new RoiSamplerPlan();
+        plan->Build(_sourcewidth, _sourceheight, _width, _height, _channels);
+        entries.push_back(plan);
+    }
+
+    _scratch = (plan->users == 0);
+    plan->users++;
+
+    xSemaphoreGive(mutex);
+    return plan;
+}
+
+
+void CRoiSamplerCache::Release(RoiSamplerPlan* _plan)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    _plan->users--;
+    xSemaphoreGive(mutex);
+}
+
+
+void CRoiSamplerCache::Invalidate()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    for (int i = entries.size() - 1; i >= 0; --i)
+    {
+        if (entries[i]->users == 0)
+        {
+            delete entries[i];
+            entries.erase(entries.begin() + i);
+        }
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+
+int CRoiSamplerCache::Plans()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int plans = entries.size();
+    xSemaphoreGive(mutex);
+    return plans;
+}
+
+
+int CRoiSamplerCache::Bytes()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int bytes = 0;
+    for (int i = 0; i < entries.size(); ++i)
+        bytes += entries[i]->Bytes();
+    xSemaphoreGive(mutex);
+    return bytes;
+}
+
+
+bool CRoiSampler::Init(const ImageView &_source, int _width, int _height, bool _cached)
+{
+    Release();
+
+    if (!_source.Valid() || (_width <= 0) || (_height <= 0))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Init: Invalid source or target size");
+        return false;
+    }
+
+    source = _source;
+    width = _width;
+    height = _height;
+    channels = _source.channels;
+    cached = _cached;
+
+    if (cached)
+    {
+        plan = RoiSamplerCache.Get(_source.width, _source.height, _width, _height, channels, scratch);
+    }
+    else
+    {
+        plan = new RoiSamplerPlan();
+        plan->Build(_source.width, _source.height, _width, _height, channels);
+        scratch = true;
+    }
+
+    if (scratch)
+    {
+        line = plan->line.data();
+    }
+    else
+    {
+        ownline.resize(_width * channels);
+        line = ownline.data();
+    }
+
+    return true;
+}
+
+
+void CRoiSampler::Release()
+{
+    if (plan == NULL)
+        return;
+
+    if (cached)
+        RoiSamplerCache.Release(plan);
+    else
+        delete plan;
+
+    plan = NULL;
+    line = NULL;
+}
+
+
+void CRoiSampler::Row(int _y, uint8_t* _target)
+{
+    const std::vector<RoiSamplerTaps> &taps_x = plan->taps_x;
+    const RoiSamplerTaps &ty = plan->taps_y[_y];
+    std::fill(line, line + width * channels, 0);
+
+    const uint16_t* w_all = plan->weights.data();
+    uint32_t* p_line = line;
+
+    for (int ky = 0; ky < ty.count; ++ky)
+    {
+        const uint8_t* p_row = source.Pixel(0, ty.first + ky);
+        uint32_t wy = w_all[ty.weights + ky];
+
+        // Horizontal result reduced to 1/16 pixel value, so the vertical sum fits into 32 bit
+        if (channels == 3)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const RoiSamplerTaps &tx = taps_x[x];
+                const uint8_t* p = p_row + tx.first * 3;
+                const uint16_t* w = w_all + tx.weights;
+                uint32_t s0 = 0, s1 = 0, s2 = 0;
+
+                for (int kx = 0; kx < tx.count; ++kx, p += 3)
+                {
+                    s0 += w[kx] * p[0];
+                    s1 += w[kx] * p[1];
+                    s2 += w[kx] * p[2];
+                }
+                p_line[3 * x] += wy * ((s0 + 128) >> 8);
+                p_line[3 * x + 1] += wy * ((s1 + 128) >> 8);
+                p_line[3 * x + 2] += wy * ((s2 + 128) >> 8);
+            }
+        }
+        else
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const RoiSamplerTaps &tx = taps_x[x];
+                const uint8_t* p = p_row + tx.first * channels;
+                const uint16_t* w = w_all + tx.weights;
+
+                for (int ch = 0; ch < channels; ++ch)
+                {
+                    uint32_t sum = 0;
+                    for (int kx = 0; kx < tx.count; ++kx)
+                        sum += w[kx] * p[kx * channels + ch];
+                    p_line[x * channels + ch] += wy * ((sum + 128) >> 8);
+                }
+            }
+        }
+    }
+
+    const int shift = 2 * ROISAMPLER_WEIGHT_BITS - 8;
+    for (int i = 0; i < width * channels; ++i)
+        _target[i] = (uint8_t) std::min((line[i] + (1u << (shift - 1))) >> shift, 255u);
+}
+
+
+bool CRoiSampler::Resample(const ImageView &_source, CImageBasis *_target)
+{
+    CRoiSampler sampler;
+
+    if ((_target->channels != _source.channels) || !sampler.Init(_source, _target->width, _target->height))
+        return false;
+
+    uint8_t* odata = _target->RGBImageLock();
+    if (odata == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Resample: Target image not available");
+        return false;
+    }
+
+    for (int y = 0; y < sampler.height; ++y)
+        sampler.Row(y, odata + y * sampler.width * sampler.channels);
+    _target->RGBImageRelease();
+
+    return true;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef CROISAMPLER_H
+#define CROISAMPLER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "CImageBasis.h"
+
+#define ROISAMPLER_WEIGHT_BITS 12       // Filter weights in 1/4096
+#define ROISAMPLER_MAX_PLANS 32         // Cached geometries, the unused plans are dropped when the cache is full
+
+
+/* Source pixels contributing to one target pixel along one axis */
+struct RoiSamplerTaps {
+    int first;                          // First source pixel
+    int count;
+    int weights;                        // Index of the first weight
+};
+
+
+/* Filter taps of one geometry (source size, target size, channels), independent of the pixels */
+struct RoiSamplerPlan {
+    int sourcewidth = 0, sourceheight = 0;
+    int width = 0, height = 0, channels = 0;
+    std::vector<RoiSamplerTaps> taps_x, taps_y;
+    std::vector<uint16_t> weights;
+    std::vector<uint32_t> line;                     // Scratch line, used by one sampler at a time
+    int users = 0;                                  // Samplers working with the plan
+
+    void Build(int _sourcewidth, int _sourceheight, int _width, int _height, int _channels);
+    bool Matches(int _sourcewidth, int _sourceheight, int _width, int _height, int _channels) const;
+    int Bytes() const;
+
+    protected:
+        void BuildTaps(int _sourcesize, int _targetsize, std::vector<RoiSamplerTaps> &_taps);
+};
+
+
+/**
+ * Keeps the plans of the ROI geometries, so the taps are computed and allocated once and not for every ROI
+ * every round: the ROI and model sizes only change with the configuration (InitFlow drops the plans).
+ * The first sampler of a plan uses its scratch line, samplers working with the same plan at the same time
+ * (other task) get their own line.
+ */
+class CRoiSamplerCache
+{
+    public:
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+
+        CRoiSamplerCache() {mutex = xSemaphoreCreateMutex();};
+        ~CRoiSamplerCache() {Invalidate(); vSemaphoreDelete(mutex);};
+
+        /**
+         * @brief Plan of the geometry, built if it is not cached. Has to be released.
+         * @param _scratch true if the caller may use the scratch line of the plan
+         */
+        RoiSamplerPlan* Get(int _sourcewidth, int _sourceheight, int _width, int _height, int _channels, bool &_scratch);
+        void Release(RoiSamplerPlan* _plan);
+
+        /**
+         * @brief Drop the plans which are not in use
+         */
+        void Invalidate();
+
+        int Plans();
+        int Bytes();
+
+    protected:
+        std::vector<RoiSamplerPlan*> entries;
+        SemaphoreHandle_t mutex;
+};
+
+extern CRoiSamplerCache RoiSamplerCache;
+
+
+/**
+ * Resamples an image view to a fixed size row by row, without an intermediate image: area average
+ * (box filter with fractional coverage) when reducing, linear interpolation when enlarging.
+ * The rows are written to a small line buffer of the caller, e.g. to convert them directly into the input tensor.
+ */
+class CRoiSampler
+{
+    public:
+        int width = 0, height = 0, channels = 0;        // Target size
+
+        CRoiSampler() {};
+        CRoiSampler(const CRoiSampler&) = delete;
+        ~CRoiSampler() {Release();};
+
+        /**
+         * @brief Take the filter taps for resampling _source to _width x _height
+         * @param _cached false: compute a plan of its own instead of using RoiSamplerCache
+         */
+        bool Init(const ImageView &_source, int _width, int _height, bool _cached = true);
+
+        /**
+         * @brief Target row _y (width * channels bytes) into _target
+         */
+        void Row(int _y, uint8_t* _target);
+
+        /**
+         * @brief Resample _source into the image _target (size of _target, same channels)
+         */
+        static bool Resample(const ImageView &_source, CImageBasis *_target);
+
+    protected:
+        ImageView source;
+        RoiSamplerPlan* plan = NULL;
+        bool cached = false;
+        bool scratch = false;                           // Works with the scratch line of the plan
+        std::vector<uint32_t> ownline;
+        uint32_t* line = NULL;                          // Horizontal result of one source row, 1/16 pixel value
+
+        void Release();
+};
+
+#endif //CROISAMPLER_H
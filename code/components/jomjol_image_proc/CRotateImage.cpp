@@ -1,9 +1,241 @@
 #include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
 #include "CRotateImage.h"
+#include "ClassLogFile.h"
 #include "psram.h"
 
 static const char *TAG = "C ROTATE IMG";
 
+#define ROTATE_TILE 16          // Tile size of the transposing copy (90 / 270 degree)
+
+
+/* Target rows of the warps, incremental: source position of the first pixel (_x, _y) and step per target pixel
+ * (_dx, _dy) in Q16 fixed point. Source positions outside of the image give white pixels. */
+static inline int32_t ToQ16(float _value)
+{
+    return (int32_t) lroundf(_value * 65536);
+}
+
+
+/* Bilinear with 8 bit weights. On the last column/row the missing right/lower neighbour is replaced by the pixel itself. */
+static void WarpRowBilinear(const uint8_t* _source, int _width, int _height, int _channels, uint8_t* _target, int _count,
+                            int32_t _x, int32_t _y, int32_t _dx, int32_t _dy)
+{
+    int stride = _width * _channels;
+
+    // Round the position to 1/256 pixel, so x0/y0 and the weights fit together
+    _x += 128;
+    _y += 128;
+
+    for (int i = 0; i < _count; ++i, _x += _dx, _y += _dy, _target += _channels)
+    {
+        int x0 = _x >> 16;
+        int y0 = _y >> 16;
+        int dx1 = _channels;
+        int dy1 = stride;
+
+        if (((unsigned) x0 >= (unsigned) (_width - 1)) || ((unsigned) y0 >= (unsigned) (_height - 1)))
+        {
+            if ((x0 < 0) || (y0 < 0) || (x0 >= _width) || (y0 >= _height))
+            {
+                for (int ch = 0; ch < _channels; ++ch)
+                    _target[ch] = 255;
+                continue;
+            }
+            if (x0 == _width - 1)
+                dx1 = 0;
+            if (y0 == _height - 1)
+                dy1 = 0;
+        }
+
+        int wx = (_x >> 8) & 0xFF;          // Weight of the right/lower neighbour in 1/256
+        int wy = (_y >> 8) & 0xFF;
+        int w00 = (256 - wx) * (256 - wy);
+        int w01 = wx * (256 - wy);
+        int w10 = (256 - wx) * wy;
+        int w11 = wx * wy;
+        const uint8_t* p = _source + y0 * stride + x0 * _channels;
+
+        if (_channels == 3)
+        {
+            // Whole RGB pixel, weights shared by the channels
+            _target[0] = (p[0] * w00 + p[dx1] * w01 + p[dy1] * w10 + p[dy1 + dx1] * w11 + 32768) >> 16;
+            _target[1] = (p[1] * w00 + p[dx1 + 1] * w01 + p[dy1 + 1] * w10 + p[dy1 + dx1 + 1] * w11 + 32768) >> 16;
+            _target[2] = (p[2] * w00 + p[dx1 + 2] * w01 + p[dy1 + 2] * w10 + p[dy1 + dx1 + 2] * w11 + 32768) >> 16;
+        }
+        else if (_channels == 1)
+        {
+            // Luminance image
+            _target[0] = (p[0] * w00 + p[dx1] * w01 + p[dy1] * w10 + p[dy1 + dx1] * w11 + 32768) >> 16;
+        }
+        else
+        {
+            for (int ch = 0; ch < _channels; ++ch)
+                _target[ch] = (p[ch] * w00 + p[dx1 + ch] * w01 + p[dy1 + ch] * w10 + p[dy1 + dx1 + ch] * w11 + 32768) >> 16;
+        }
+    }
+}
+
+
+/* Integer mapping target -> source if _m is a signed permutation of the axes (multiple of 90 degree, flip of the image
+ * size, mirror) with an integer offset, within the precision needed to give the same pixels as the interpolation */
+static bool AxisAlignedMapping(const float _m[2][3], int _map[2][3])
+{
+    for (int r = 0; r < 2; ++r)
+        for (int c = 0; c < 3; ++c)
+        {
+            _map[r][c] = (int) lroundf(_m[r][c]);
+            float tolerance = (c == 2) ? 1.0f / 1024 : 1.0f / 65536;    // The steps add up over a whole row
+            if (fabsf(_m[r][c] - _map[r][c]) > tolerance)
+                return false;
+        }
+
+    return (abs(_map[0][0]) + abs(_map[0][1]) == 1) && (abs(_map[1][0]) + abs(_map[1][1]) == 1) &&
+           (_map[0][0] * _map[1][1] - _map[0][1] * _map[1][0] != 0);
+}
+
+
+static inline void CopyPixel(uint8_t* _target, const uint8_t* _source, int _channels)
+{
+    if (_channels == 3)
+    {
+        _target[0] = _source[0];
+        _target[1] = _source[1];
+        _target[2] = _source[2];
+    }
+    else
+    {
+        for (int ch = 0; ch < _channels; ++ch)
+            _target[ch] = _source[ch];
+    }
+}
+
+
+/* Target columns [_first, _last] whose source coordinate _step * x + _offset lies in [0, _size - 1] */
+static void InsideRange(int _step, int _offset, int _size, int _count, int &_first, int &_last)
+{
+    if (_step > 0)
+    {
+        _first = -_offset;
+        _last = _size - 1 - _offset;
+    }
+    else
+    {
+        _first = _offset - (_size - 1);
+        _last = _offset;
+    }
+
+    _first = std::max(_first, 0);
+    _last = std::min(_last, _count - 1);
+}
+
+
+/* Exact copy through an axis aligned mapping, source positions outside of the image give white pixels.
+ * Without transpose (0 / 180 degree, mirror) every target row comes from one source row: memcpy, or pixels in reverse
+ * order. With transpose (90 / 270 degree) a target row is a source column: the copy runs in tiles of
+ * ROTATE_TILE x ROTATE_TILE pixels, the source rows of a tile stay in the cache for all of its target rows. */
+static void WarpAxisAligned(const uint8_t* _source, int _width, int _height, int _channels,
+                            uint8_t* _target, int _twidth, int _theight, const int _map[2][3])
+{
+    int stride = _width * _channels;
+    int tstride = _twidth * _channels;
+
+    if (_map[0][1] == 0)
+    {
+        int first, last;
+        InsideRange(_map[0][0], _map[0][2], _width, _twidth, first, last);
+
+        for (int y = 0; y < _theight; ++y)
+        {
+            uint8_t* p_target = _target + y * tstride;
+            int ys = _map[1][1] * y + _map[1][2];
+
+            if ((ys < 0) || (ys >= _height) || (first > last))
+            {
+                memset(p_target, 255, tstride);
+                continue;
+            }
+
+            const uint8_t* p_source = _source + ys * stride + (_map[0][0] * first + _map[0][2]) * _channels;
+
+            memset(p_target, 255, first * _channels);
+            if (_map[0][0] > 0)
+            {
+                memcpy(p_target + first * _channels, p_source, (last - first + 1) * _channels);
+            }
+            else
+            {
+                for (int x = first; x <= last; ++x, p_source -= _channels)
+                    CopyPixel(p_target + x * _channels, p_source, _channels);
+            }
+            memset(p_target + (last + 1) * _channels, 255, (_twidth - 1 - last) * _channels);
+        }
+        return;
+    }
+
+    // Transpose: x_source = _map[0][1] * y + _map[0][2], y_source = _map[1][0] * x + _map[1][2]
+    int first, last;
+    InsideRange(_map[1][0], _map[1][2], _height, _twidth, first, last);
+    int sourcestep = _map[1][0] * stride;
+
+    for (int ty = 0; ty < _theight; ty += ROTATE_TILE)
+        for (int tx = 0; tx < _twidth; tx += ROTATE_TILE)
+        {
+            int y_end = std::min(ty + ROTATE_TILE, _theight);
+            int x_end = std::min(tx + ROTATE_TILE, _twidth);
+
+            for (int y = ty; y < y_end; ++y)
+            {
+                uint8_t* p_target = _target + y * tstride;
+                int xs = _map[0][1] * y + _map[0][2];
+
+                if ((xs < 0) || (xs >= _width))
+                {
+                    memset(p_target + tx * _channels, 255, (x_end - tx) * _channels);
+                    continue;
+                }
+
+                int x0 = std::max(tx, first);
+                int x1 = std::min(x_end - 1, last);
+                const uint8_t* p_source = _source + (_map[1][0] * x0 + _map[1][2]) * stride + xs * _channels;
+
+                for (int x = tx; x < std::min(x0, x_end); ++x)
+                    memset(p_target + x * _channels, 255, _channels);
+                for (int x = x0; x <= x1; ++x, p_source += sourcestep)
+                    CopyPixel(p_target + x * _channels, p_source, _channels);
+                for (int x = std::max(x1 + 1, tx); x < x_end; ++x)
+                    memset(p_target + x * _channels, 255, _channels);
+            }
+        }
+}
+
+
+static void WarpRowNearest(const uint8_t* _source, int _width, int _height, int _channels, uint8_t* _target, int _count,
+                           int32_t _x, int32_t _y, int32_t _dx, int32_t _dy)
+{
+    _x += 32768;
+    _y += 32768;
+
+    for (int i = 0; i < _count; ++i, _x += _dx, _y += _dy, _target += _channels)
+    {
+        int xs = _x >> 16;
+        int ys = _y >> 16;
+
+        if (((unsigned) xs >= (unsigned) _width) || ((unsigned) ys >= (unsigned) _height))
+        {
+            for (int ch = 0; ch < _channels; ++ch)
+                _target[ch] = 255;
+            continue;
+        }
+
+        const uint8_t* p = _source + (ys * _width + xs) * _channels;
+        for (int ch = 0; ch < _channels; ++ch)
+            _target[ch] = p[ch];
+    }
+}
+
 CRotateImage::CRotateImage(std::string _name, CImageBasis *_org, CImageBasis *_temp, bool _flip) : CImageBasis(_name)
 {
     rgb_image = _org->rgb_image;
@@ -14,11 +246,52 @@ CRotateImage::CRotateImage(std::string _name, CImageBasis *_org, CImageBasis *_t
     externalImage = true;   
     ImageTMP = _temp;   
     ImageOrg = _org; 
-    islocked = false;
+    ShareLock(_org);
     doflip = _flip;
 }
 
-void CRotateImage::Rotate(float _angle, int _centerx, int _centery)
+/* Target of the transformation (ImageTMP or a temporary buffer) and the write lock of the image,
+ * NULL with nothing held if one of them is not available */
+uint8_t* CRotateImage::LockTarget(int _memsize)
+{
+    uint8_t* odata;
+    if (ImageTMP)
+    {
+        odata = ImageTMP->RGBImageLock();
+    }
+    else
+    {
+        odata = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->odata", _memsize, MALLOC_CAP_SPIRAM);
+    }
+
+    if (odata == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "LockTarget: Target buffer not available");
+        return NULL;
+    }
+
+    if (RGBImageLock() == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "LockTarget: Image not available");
+        ReleaseTarget(odata);
+        return NULL;
+    }
+
+    return odata;
+}
+
+
+/* Releases the target only, the image is released by the caller */
+void CRotateImage::ReleaseTarget(uint8_t* _odata)
+{
+    if (ImageTMP)
+        ImageTMP->RGBImageRelease();
+    else
+        free_psram_heap(std::string(TAG) + "->odata", _odata);
+}
+
+
+bool CRotateImage::Rotate(float _angle, int _centerx, int _centery)
 {
     int org_width, org_height;
     float m[2][3];
@@ -27,6 +300,12 @@ void CRotateImage::Rotate(float _angle, int _centerx, int _centery)
     float y_center = _centery;
     _angle = _angle / 180 * M_PI;
 
+    // The same size flipped or not
+    int memsize = width * height * channels;
+    uint8_t* odata = LockTarget(memsize);
+    if (odata == NULL)
+        return false;
+
     if (doflip)
     {
         org_width = width;
@@ -61,64 +340,55 @@ void CRotateImage::Rotate(float _angle, int _centerx, int _centery)
         m[1][2] = m[1][2] - (org_width/2) + (org_height/2);
     }
 
-    int memsize = width * height * channels;
-    uint8_t* odata;
-    if (ImageTMP)
-    {
-        odata = ImageTMP->RGBImageLock();
-    }
-    else
-    {
-        odata = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->odata", memsize, MALLOC_CAP_SPIRAM);
-    }
-    
-
     int x_source, y_source;
     stbi_uc* p_target;
     stbi_uc* p_source;
+    int map[2][3];
 
-    RGBImageLock();
 
-    for (int x = 0; x < width; ++x)
-        for (int y = 0; y < height; ++y)
-        {
-            p_target = odata + (channels * (y * width + x));
+    if (AxisAlignedMapping(m, map))
+    {
+        // Multiple of 90 degree: exact copy
+        WarpAxisAligned(rgb_image, org_width, org_height, channels, odata, width, height, map);
+    }
+    else
+    {
+        for (int x = 0; x < width; ++x)
+            for (int y = 0; y < height; ++y)
+            {
+                p_target = odata + (channels * (y * width + x));
 
-            x_source = int(m[0][0] * x + m[0][1] * y);
-            y_source = int(m[1][0] * x + m[1][1] * y);
+                x_source = int(m[0][0] * x + m[0][1] * y);
+                y_source = int(m[1][0] * x + m[1][1] * y);
 
-            x_source += int(m[0][2]);
-            y_source += int(m[1][2]);
+                x_source += int(m[0][2]);
+                y_source += int(m[1][2]);
 
-            if ((x_source >= 0) && (x_source < org_width) && (y_source >= 0) && (y_source < org_height))
-            {
-                p_source = rgb_image + (channels * (y_source * org_width + x_source));
-                for (int _channels = 0; _channels < channels; ++_channels)
-                    p_target[_channels] = p_source[_channels];
-            }
-            else
-            {
-                for (int _channels = 0; _channels < channels; ++_channels)
-                    p_target[_channels] = 255;
+                if ((x_source >= 0) && (x_source < org_width) && (y_source >= 0) && (y_source < org_height))
+                {
+                    p_source = rgb_image + (channels * (y_source * org_width + x_source));
+                    for (int _channels = 0; _channels < channels; ++_channels)
+                        p_target[_channels] = p_source[_channels];
+                }
+                else
+                {
+                    for (int _channels = 0; _channels < channels; ++_channels)
+                        p_target[_channels] = 255;
+                }
             }
-        }
+    }
 
     //    memcpy(rgb_image, odata, memsize);
     memCopy(odata, rgb_image, memsize);
 
-    if (!ImageTMP)
-    {
-        free_psram_heap(std::string(TAG) + "->odata", odata);
-    }
-    if (ImageTMP)
-        ImageTMP->RGBImageRelease();
-
+    ReleaseTarget(odata);
     RGBImageRelease();
+    return true;
 }
 
 
 
-void CRotateImage::RotateAntiAliasing(float _angle, int _centerx, int _centery)
+bool CRotateImage::RotateAntiAliasing(float _angle, int _centerx, int _centery)
 {
     int org_width, org_height;
     float m[2][3];
@@ -127,6 +397,12 @@ void CRotateImage::RotateAntiAliasing(float _angle, int _centerx, int _centery)
     float y_center = _centery;
     _angle = _angle / 180 * M_PI;
 
+    // The same size flipped or not
+    int memsize = width * height * channels;
+    uint8_t* odata = LockTarget(memsize);
+    if (odata == NULL)
+        return false;
+
     if (doflip)
     {
         org_width = width;
@@ -161,149 +437,181 @@ void CRotateImage::RotateAntiAliasing(float _angle, int _centerx, int _centery)
         m[1][2] = m[1][2] - (org_width/2) + (org_height/2);
     }
 
-    int memsize = width * height * channels;
-    uint8_t* odata;
-    if (ImageTMP)
+    int map[2][3];
+    if (AxisAlignedMapping(m, map))
     {
-        odata = ImageTMP->RGBImageLock();
+        // Multiple of 90 degree: exact copy
+        WarpAxisAligned(rgb_image, org_width, org_height, channels, odata, width, height, map);
     }
     else
     {
-        odata = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->odata", memsize, MALLOC_CAP_SPIRAM);
-    }
-    
-
-    int x_source_1, y_source_1, x_source_2, y_source_2;
-    float x_source, y_source;
-    float quad_ul, quad_ur, quad_ol, quad_or;
-    stbi_uc* p_target;
-    stbi_uc *p_source_ul, *p_source_ur, *p_source_ol, *p_source_or;
-
-    RGBImageLock();
-
-    for (int x = 0; x < width; ++x)
         for (int y = 0; y < height; ++y)
-        {
-            p_target = odata + (channels * (y * width + x));
-
-            x_source = (m[0][0] * x + m[0][1] * y);
-            y_source = (m[1][0] * x + m[1][1] * y);
-
-            x_source += (m[0][2]);
-            y_source += (m[1][2]);
-
-            x_source_1 = (int)x_source;
-            x_source_2 = x_source_1 + 1;
-            y_source_1 = (int)y_source;
-            y_source_2 = y_source_1 + 1;
-
-            quad_ul = (x_source_2 - x_source) * (y_source_2 - y_source);
-            quad_ur = (1- (x_source_2 - x_source)) * (y_source_2 - y_source);
-            quad_or = (x_source_2 - x_source) * (1-(y_source_2 - y_source));
-            quad_ol = (1- (x_source_2 - x_source)) * (1-(y_source_2 - y_source));
-
-
-            if ((x_source_1 >= 0) && (x_source_2 < org_width) && (y_source_1 >= 0) && (y_source_2 < org_height))
-            {
-                p_source_ul = rgb_image + (channels * (y_source_1 * org_width + x_source_1));
-                p_source_ur = rgb_image + (channels * (y_source_1 * org_width + x_source_2));
-                p_source_or = rgb_image + (channels * (y_source_2 * org_width + x_source_1));
-                p_source_ol = rgb_image + (channels * (y_source_2 * org_width + x_source_2));
-                for (int _channels = 0; _channels < channels; ++_channels)
-                {
-                    p_target[_channels] = (int)((float)p_source_ul[_channels] * quad_ul
-                                                + (float)p_source_ur[_channels] * quad_ur
-                                                + (float)p_source_or[_channels] * quad_or
-                                                + (float)p_source_ol[_channels] * quad_ol);
-                }
-            }
-            else
-            {
-                for (int _channels = 0; _channels < channels; ++_channels)
-                    p_target[_channels] = 255;
-            }
-        }
+            WarpRowBilinear(rgb_image, org_width, org_height, channels, odata + y * width * channels, width,
+                            ToQ16(m[0][1] * y + m[0][2]), ToQ16(m[1][1] * y + m[1][2]), ToQ16(m[0][0]), ToQ16(m[1][0]));
+    }
 
     //    memcpy(rgb_image, odata, memsize);
     memCopy(odata, rgb_image, memsize);
 
-    if (!ImageTMP)
-    {
-        free_psram_heap(std::string(TAG) + "->odata", odata);
-    }
-    if (ImageTMP)
-        ImageTMP->RGBImageRelease();
-
+    ReleaseTarget(odata);
     RGBImageRelease();
+    return true;
 }
 
 
-void CRotateImage::Rotate(float _angle)
+bool CRotateImage::Rotate(float _angle)
 {
 //    ESP_LOGD(TAG, "width %d, height %d", width, height);
-    Rotate(_angle, width / 2, height / 2);
+    return Rotate(_angle, width / 2, height / 2);
 }
 
-void CRotateImage::RotateAntiAliasing(float _angle)
+bool CRotateImage::RotateAntiAliasing(float _angle)
 {
 //    ESP_LOGD(TAG, "width %d, height %d", width, height);
-    RotateAntiAliasing(_angle, width / 2, height / 2);
+    return RotateAntiAliasing(_angle, width / 2, height / 2);
 }
 
-void CRotateImage::Translate(int _dx, int _dy)
+bool CRotateImage::Translate(float _dx, float _dy)
 {
-    int memsize = width * height * channels;
-    uint8_t* odata;
-    if (ImageTMP)
-    {
-        odata = ImageTMP->RGBImageLock();
-    }
-    else
+    int ix = (int) floor(_dx);
+    int iy = (int) floor(_dy);
+
+    // Weights of the left/upper source pixel in 1/256
+    int wx = (int) round((_dx - ix) * 256);
+    int wy = (int) round((_dy - iy) * 256);
+
+    if ((wx == 0 || wx == 256) && (wy == 0 || wy == 256))
     {
-        odata = (unsigned char*)malloc_psram_heap(std::string(TAG) + "->odata", memsize, MALLOC_CAP_SPIRAM);
+        return Translate((int) round(_dx), (int) round(_dy));
     }
 
+    int memsize = width * height * channels;
+    uint8_t* odata = LockTarget(memsize);
+    if (odata == NULL)
+        return false;
 
+    int w00 = wx * wy;
+    int w01 = (256 - wx) * wy;
+    int w10 = wx * (256 - wy);
+    int w11 = (256 - wx) * (256 - wy);
+    int stride = channels * width;
 
-    int x_source, y_source;
-    stbi_uc* p_target;
-    stbi_uc* p_source;
 
-    RGBImageLock();
+    for (int y = 0; y < height; ++y)
+    {
+        // Source of target (x, y) is (x - _dx, y - _dy), between (x - ix - 1, y - iy - 1) and (x - ix, y - iy)
+        int y0 = y - iy - 1;
+        stbi_uc* p_target = odata + y * stride;
 
-    for (int x = 0; x < width; ++x)
-        for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
         {
-            p_target = odata + (channels * (y * width + x));
-
-            x_source = x - _dx;
-            y_source = y - _dy;
+            int x0 = x - ix - 1;
 
-            if ((x_source >= 0) && (x_source < width) && (y_source >= 0) && (y_source < height))
+            if ((x0 >= 0) && (x0 + 1 < width) && (y0 >= 0) && (y0 + 1 < height))
             {
-                p_source = rgb_image + (channels * (y_source * width + x_source));
+                stbi_uc* p_source = rgb_image + (channels * (y0 * width + x0));
                 for (int _channels = 0; _channels < channels; ++_channels)
-                    p_target[_channels] = p_source[_channels];
+                    p_target[_channels] = (p_source[_channels] * w00 + p_source[channels + _channels] * w01 +
+                                           p_source[stride + _channels] * w10 + p_source[stride + channels + _channels] * w11 + 32768) >> 16;
             }
             else
             {
                 for (int _channels = 0; _channels < channels; ++_channels)
                     p_target[_channels] = 255;
             }
+            p_target += channels;
         }
+    }
+
+    memCopy(odata, rgb_image, memsize);
+    ReleaseTarget(odata);
+    RGBImageRelease();
+    return true;
+}
+
+
+bool CRotateImage::Translate(int _dx, int _dy)
+{
+    int memsize = width * height * channels;
+    uint8_t* odata = LockTarget(memsize);
+    if (odata == NULL)
+        return false;
+
+
+
+    // Integer shift: row by row memcpy
+    const int map[2][3] = {{1, 0, -_dx}, {0, 1, -_dy}};
+
+
+    WarpAxisAligned(rgb_image, width, height, channels, odata, width, height, map);
 
     //    memcpy(rgb_image, odata, memsize);
     memCopy(odata, rgb_image, memsize);
-    if (!ImageTMP)
+    ReleaseTarget(odata);
+    RGBImageRelease();
+    return true;
+}
+
+
+bool CRotateImage::Warp(CAffineTransform &_transform, bool _bilinear, bool _copyback)
+{
+    float inv[2][3];
+
+    if (!_transform.Inverse(inv) || (!ImageTMP && !_copyback))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Warp: Invalid transform or no target image");
+        return false;
+    }
+
+    int org_width = width;
+    int org_height = height;
+    int memsize = width * height * channels;
+    uint8_t* odata = LockTarget(memsize);
+    if (odata == NULL)
+        return false;
+
+
+    int map[2][3];
+    if (AxisAlignedMapping(inv, map))
     {
-        free_psram_heap(std::string(TAG) + "->odata", odata);
+        // Multiple of 90 degree (initial rotation, flip) without alignment: exact copy, no interpolation
+        WarpAxisAligned(rgb_image, org_width, org_height, channels, odata, _transform.width, _transform.height, map);
+    }
+    else
+    {
+        for (int y = 0; y < _transform.height; ++y)
+        {
+            // Source position of (0, y), moving by (inv[0][0], inv[1][0]) per target pixel
+            int32_t x_source = ToQ16(inv[0][1] * y + inv[0][2]);
+            int32_t y_source = ToQ16(inv[1][1] * y + inv[1][2]);
+            uint8_t* p_target = odata + y * _transform.width * channels;
+
+            if (_bilinear)
+                WarpRowBilinear(rgb_image, org_width, org_height, channels, p_target, _transform.width, x_source, y_source, ToQ16(inv[0][0]), ToQ16(inv[1][0]));
+            else
+                WarpRowNearest(rgb_image, org_width, org_height, channels, p_target, _transform.width, x_source, y_source, ToQ16(inv[0][0]), ToQ16(inv[1][0]));
+        }
     }
 
     if (ImageTMP)
     {
-        ImageTMP->RGBImageRelease();
+        ImageTMP->width = _transform.width;
+        ImageTMP->height = _transform.height;
     }
-    RGBImageRelease();
 
-}
+    if (_copyback)
+    {
+        memCopy(odata, rgb_image, memsize);
+        width = _transform.width;
+        height = _transform.height;
+        if (ImageOrg)
+        {
+            ImageOrg->width = width;
+            ImageOrg->height = height;
+        }
+    }
 
+    ReleaseTarget(odata);
+    RGBImageRelease();
+    return true;
+}
@@ -4,6 +4,7 @@
 #define CROTATEIMAGE_H
 
 #include "CImageBasis.h"
+#include "CAffineTransform.h"
 
 
 class CRotateImage: public CImageBasis
@@ -16,13 +17,26 @@ class CRotateImage: public CImageBasis
         CRotateImage(std::string name, uint8_t* _rgb_image, int _channels, int _width, int _height, int _bpp, bool _flip = false) : CImageBasis(name, _rgb_image, _channels, _width, _height, _bpp) {ImageTMP = NULL;  ImageOrg = NULL; doflip = _flip;};
         CRotateImage(std::string name, CImageBasis *_org, CImageBasis *_temp, bool _flip = false);
 
-        void Rotate(float _angle);
-        void RotateAntiAliasing(float _angle);
+        bool Rotate(float _angle);
+        bool RotateAntiAliasing(float _angle);
        
-        void Rotate(float _angle, int _centerx, int _centery);
-        void RotateAntiAliasing(float _angle, int _centerx, int _centery);
-
-        void Translate(int _dx, int _dy);
+        bool Rotate(float _angle, int _centerx, int _centery);
+        bool RotateAntiAliasing(float _angle, int _centerx, int _centery);
+
+        bool Translate(int _dx, int _dy);
+        bool Translate(float _dx, float _dy);      // Sub-pixel shift, bilinear
+
+        /**
+         * @brief Render the image through _transform in one row-major pass (nearest neighbour or bilinear)
+         * into ImageTMP. Width and height of the image change to the size of the transformed frame.
+         * @param _copyback false: leave the result in ImageTMP only, the image itself stays unchanged
+         * @return false if the image or the target could not be locked (logged), nothing is changed then
+         */
+        bool Warp(CAffineTransform &_transform, bool _bilinear, bool _copyback = true);
+
+    protected:
+        uint8_t* LockTarget(int _memsize);
+        void ReleaseTarget(uint8_t* _odata);
 };
 
 #endif //CROTATEIMAGE_H
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "CRoundArena.h"
+
+#include "psram.h"
+#include "ClassLogFile.h"
+
+#include <algorithm>
+#include <esp_log.h>
+
+static const char* TAG = "C ROUND ARENA";
+
+CRoundArena RoundArena;
+
+
+/* In front of every allocation: where it starts and ends, so the most recent one can be taken back */
+struct RoundArenaHeader {
+    uint32_t start;
+    uint32_t end;
+    uint8_t padding[ROUNDARENA_ALIGN - 2 * sizeof(uint32_t)];
+};
+
+
+CRoundArena::~CRoundArena()
+{
+    if (block != NULL) {
+        free_psram_heap(std::string(TAG) + "->block", block);
+    }
+    vSemaphoreDelete(mutex);
+}
+
+
+bool CRoundArena::Reserve(size_t _size)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if ((block != NULL) && (live > 0)) {
+        xSemaphoreGive(mutex);
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Reserve: " + std::to_string(live) + " allocations still in use");
+        return false;
+    }
+
+    if (block != NULL) {
+        free_psram_heap(std::string(TAG) + "->block", block);
+    }
+
+    // The start of the block is aligned as well
+    block = (uint8_t*) malloc_psram_heap(std::string(TAG) + "->block", _size + ROUNDARENA_ALIGN, MALLOC_CAP_SPIRAM);
+    size = (block != NULL) ? _size : 0;
+    top = 0;
+    highwater = 0;
+
+    xSemaphoreGive(mutex);
+
+    if (block == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Reserve: Can't allocate " + std::to_string(_size) + " bytes, temporary buffers go to the heap");
+        return false;
+    }
+
+    return true;
+}
+
+
+void* CRoundArena::Allocate(std::string _name, size_t _size)
+{
+    size_t bytes = sizeof(RoundArenaHeader) + ((_size + ROUNDARENA_ALIGN - 1) & ~(size_t) (ROUNDARENA_ALIGN - 1));
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if ((block != NULL) && (top + bytes <= size)) {
+        uint8_t* base = (uint8_t*) (((uintptr_t) block + ROUNDARENA_ALIGN - 1) & ~(uintptr_t) (ROUNDARENA_ALIGN - 1));
+        RoundArenaHeader* header = (RoundArenaHeader*) (base + top);
+        header->start = top;
+        header->end = top + bytes;
+
+        top += bytes;
+        highwater = std::max(highwater, top);
+        live++;
+        allocations++;
+
+        xSemaphoreGive(mutex);
+        return header + 1;
+    }
+
+    overflows++;
+    xSemaphoreGive(mutex);
+
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Allocate: " + _name + " (" + std::to_string(_size) + " bytes) doesn't fit into the arena ("
+            + std::to_string(top) + " of " + std::to_string(size) + " bytes used)");
+    return malloc_psram_heap(std::string(TAG) + "->" + _name, _size, MALLOC_CAP_SPIRAM);
+}
+
+
+void CRoundArena::Free(std::string _name, void* _ptr)
+{
+    if (_ptr == NULL) {
+        return;
+    }
+
+    if (!Contains(_ptr)) {
+        free_psram_heap(std::string(TAG) + "->" + _name, _ptr);
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    RoundArenaHeader* header = (RoundArenaHeader*) _ptr - 1;
+    if (header->end == top) {
+        top = header->start;
+    }
+
+    if (--live == 0) {
+        top = 0;
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+
+void CRoundArena::Reset()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if (live == 0) {
+        top = 0;
+    }
+    else {
+        ESP_LOGW(TAG, "Reset: %d allocations still in use, the arena is released with the last one", live);
+    }
+
+    roundhighwater = highwater;
+    highwater = top;
+
+    xSemaphoreGive(mutex);
+}
+
+
+bool CRoundArena::Contains(const void* _ptr)
+{
+    return (block != NULL) && ((const uint8_t*) _ptr >= block) && ((const uint8_t*) _ptr < block + size + ROUNDARENA_ALIGN);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#ifndef CROUNDARENA_H
+#define CROUNDARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define ROUNDARENA_ALIGN 16             // Start of every allocation, bytes
+
+
+/**
+ * Arena for the temporary buffers of the image work in a round (search regions, summed-area tables, FFT buffers,
+ * resize scratch, copies for the encoder). One PSRAM block reserved at startup, the allocations are taken from it
+ * one after the other: no general heap allocation for them, no holes between long-lived allocations.
+ *
+ * Freeing the most recent allocation takes it back (scoped buffers use the arena like a stack), everything else is
+ * released with the reset at the end of the round (ClassFlowControll::doFlow) or when the last allocation in use
+ * is freed. Buffers still in use by another task (e.g. the web server encoding an image) defer the reset until they
+ * are freed.
+ *
+ * Tasks working at the same time (the reference matching on both cores, CAlignAndCutImage::Align) interleave their
+ * allocations, their frees are mostly not the most recent allocation and nothing is taken back until both are done:
+ * the arena grows by the buffers of both tasks. The size (ROUND_ARENA_SIZE) is chosen for that.
+ *
+ * Exceptions, allocated on the PSRAM heap and counted as overflows: requests larger than the free part of the arena.
+ * With the default algorithm and search field a round fits. The summed-area tables of "NCC" grow with the search
+ * field (two uint32 per pixel of the search region), the FFT buffers of "PhaseCorrelation" with the power of two
+ * above it (8 bytes per complex value), both usually exceed the arena.
+ *
+ * Only for buffers freed within the round, never for image buffers which are kept.
+ */
+class CRoundArena
+{
+    public:
+        uint32_t allocations = 0;       // Taken from the arena
+        uint32_t overflows = 0;         // Didn't fit, allocated on the PSRAM heap
+
+        CRoundArena() {mutex = xSemaphoreCreateMutex();};
+        ~CRoundArena();
+
+        /**
+         * @brief Allocates the block of the arena (startup), without it all requests go to the heap
+         */
+        bool Reserve(size_t _size);
+
+        void* Allocate(std::string _name, size_t _size);
+
+        /**
+         * @brief Memory of Allocate, NULL is ignored
+         */
+        void Free(std::string _name, void* _ptr);
+
+        /**
+         * @brief End of the round: the whole arena is free again, the high water mark of the round is kept
+         * as RoundHighWater(). Deferred as long as allocations are in use.
+         */
+        void Reset();
+
+        bool Contains(const void* _ptr);
+
+        size_t Size() { return size; };
+        size_t Used() { return top; };
+        int Live() { return live; };                    // Allocations in the arena not freed yet
+        size_t HighWater() { return highwater; };       // Most bytes in use since the start of the round
+        size_t RoundHighWater() { return roundhighwater; };
+
+    protected:
+        SemaphoreHandle_t mutex;
+        uint8_t* block = NULL;
+        size_t size = 0;
+        size_t top = 0;                 // Offset of the next allocation
+        int live = 0;
+        size_t highwater = 0;
+        size_t roundhighwater = 0;
+};
+
+extern CRoundArena RoundArena;
+
+#endif //CROUNDARENA_H
@@ -0,0 +1,157 @@
+#include "CTemplateCache.h"
+
+#include "ClassLogFile.h"
+#include "psram.h"
+#include "../stb/stb_image.h"
+
+#include <esp_log.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char* TAG = "C TEMPL CACHE";
+
+CTemplateCache TemplateCache;
+
+
+RefTemplate::~RefTemplate()
+{
+    if (rgb != NULL)
+        free_psram_heap(std::string(TAG) + "->" + image_file, rgb);
+}
+
+
+RefTemplate* CTemplateCache::Get(std::string _file, int _channels)
+{
+    struct stat file_stat;
+
+    if ((stat(_file.c_str(), &file_stat) != 0) || (file_stat.st_size == 0))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, _file + " is missing or empty!");
+        return NULL;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    for (int i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i]->image_file != _file)
+            continue;
+
+        if ((entries[i]->mtime == file_stat.st_mtime) && (entries[i]->filesize == file_stat.st_size) && (entries[i]->channels == _channels))
+        {
+            hits++;
+            ESP_LOGD(TAG, "Hit %s (hits %lu, misses %lu)", _file.c_str(), (unsigned long) hits, (unsigned long) misses);
+            RefTemplate* entry = entries[i];
+            entry->refs++;
+            xSemaphoreGive(mutex);
+            return entry;
+        }
+
+        Unlink(i);                  // outdated
+        break;
+    }
+
+    misses++;
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Load " + _file + " (hits " + std::to_string(hits) + ", misses " + std::to_string(misses) + ")");
+
+    RefTemplate* entry = Load(_file, _channels, file_stat.st_mtime, file_stat.st_size);
+    if (entry != NULL)
+    {
+        entry->refs = 1;
+        entries.push_back(entry);
+    }
+
+    xSemaphoreGive(mutex);
+    return entry;
+}
+
+
+RefTemplate* CTemplateCache::Load(std::string _file, int _channels, time_t _mtime, long _filesize)
+{
+    RefTemplate* entry = new RefTemplate();
+    entry->image_file = _file;
+    entry->mtime = _mtime;
+    entry->filesize = _filesize;
+    entry->channels = _channels;
+
+    // stbi works in the shared PSRAM region, the cache has to keep its own copy
+    uint8_t* decoded = stbi_load(_file.c_str(), &entry->width, &entry->height, &entry->bpp, _channels);
+
+    if (decoded == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Failed to load " + _file + "! Is it corrupted?");
+        delete entry;
+        return NULL;
+    }
+
+    int pixels = entry->width * entry->height;
+    entry->rgb = (uint8_t*) malloc_psram_heap(std::string(TAG) + "->" + _file, pixels * _channels, MALLOC_CAP_SPIRAM);
+
+    if (entry->rgb == NULL)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Load: Can't allocate " + std::to_string(pixels * _channels) + " bytes for " + _file);
+        stbi_image_free(decoded);
+        delete entry;
+        return NULL;
+    }
+
+    memcpy(entry->rgb, decoded, pixels * _channels);
+    stbi_image_free(decoded);
+
+    for (int i = 0; i < pixels; ++i)
+        for (int ch = 0; (ch < _channels) && (ch < 3); ++ch)
+        {
+            uint8_t value = entry->rgb[_channels * i + ch];
+            entry->sum[ch] += value;
+            entry->sumsq[ch] += value * value;
+        }
+
+    if (!entry->pyramid.Build(entry->rgb, entry->width, _channels, 0, 0, 0, entry->width, entry->height,
+                              CImagePyramid::MaxLevels(entry->width, entry->height)))
+    {
+        delete entry;
+        return NULL;
+    }
+
+    return entry;
+}
+
+
+void CTemplateCache::Release(RefTemplate* _entry)
+{
+    if (_entry == NULL)
+        return;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if ((--_entry->refs == 0) && !_entry->linked)
+        delete _entry;
+
+    xSemaphoreGive(mutex);
+}
+
+
+/* Takes the entry out of the cache (mutex taken), an entry in use is freed by its last Release */
+void CTemplateCache::Unlink(int _index)
+{
+    RefTemplate* entry = entries[_index];
+    entries.erase(entries.begin() + _index);
+    entry->linked = false;
+
+    if (entry->refs == 0)
+        delete entry;
+}
+
+
+void CTemplateCache::Invalidate(std::string _file)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    for (int i = entries.size() - 1; i >= 0; --i)
+    {
+        if (_file.empty() || (entries[i]->image_file == _file))
+            Unlink(i);
+    }
+
+    xSemaphoreGive(mutex);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#ifndef CTEMPLATECACHE_H
+#define CTEMPLATECACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "CImagePyramid.h"
+
+
+/**
+ * Decoded reference image (alignment mark) plus the data derived from it by the matchers.
+ * The R channel is kept as single channel pyramid (level 0 = R plane), which is the only plane the
+ * R channel matchers ("Default", "Pyramid", "NCC", "PhaseCorrelation") work on.
+ */
+struct RefTemplate {
+    std::string image_file;
+    time_t mtime = 0;
+    long filesize = 0;
+
+    uint8_t* rgb = NULL;                // Interleaved, "channels" per pixel
+    int width = 0;
+    int height = 0;
+    int bpp = 0;                        // Channels of the file
+    int channels = 0;                   // Channels of rgb
+
+    uint32_t sum[3] = {};               // Per channel sum of all pixel values
+    uint64_t sumsq[3] = {};             // Per channel sum of the squared pixel values
+    CImagePyramid pyramid;              // R channel, CImagePyramid::MaxLevels(width, height) levels
+
+    int refs = 0;                       // Users between Get and Release
+    bool linked = true;                 // In the cache, false once invalidated or outdated (freed with the last Release)
+
+    RefTemplate() : pyramid("template") {};
+    ~RefTemplate();
+};
+
+
+/**
+ * Keeps the reference images of the alignment in PSRAM, so they are decoded only once and not every round.
+ * An entry is valid as long as modification time and size of the file did not change; files rewritten within
+ * the time resolution of the file system (e.g. by "cutref") have to be invalidated explicitly.
+ * Get and Invalidate may be called from several tasks (parallel matching of the references, "cutref" of the web server);
+ * loading is serialized, as stbi decodes into the shared PSRAM region.
+ * Every entry returned by Get is referenced until Release: an entry invalidated or outdated while it is in use
+ * is only taken out of the cache and freed with its last Release.
+ */
+class CTemplateCache
+{
+    public:
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+
+        CTemplateCache() {mutex = xSemaphoreCreateMutex();};
+        ~CTemplateCache() {Invalidate(); vSemaphoreDelete(mutex);};
+
+        /**
+         * @brief Get the decoded reference image, load it if it is not cached or outdated
+         * @return NULL if the file can't be read or decoded, otherwise referenced until Release
+         */
+        RefTemplate* Get(std::string _file, int _channels);
+
+        /**
+         * @brief End of the use of an entry returned by Get, NULL is ignored
+         */
+        void Release(RefTemplate* _entry);
+
+        /**
+         * @brief Drop the entry of _file, all entries if _file is empty (entries in use are freed with their last Release)
+         */
+        void Invalidate(std::string _file = "");
+
+    protected:
+        std::vector<RefTemplate*> entries;
+        SemaphoreHandle_t mutex;
+
+        RefTemplate* Load(std::string _file, int _channels, time_t _mtime, long _filesize);
+        void Unlink(int _index);
+};
+
+extern CTemplateCache TemplateCache;
+
+#endif //CTEMPLATECACHE_H
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <string>
 #include "psram.h"
+#include "CRoundArena.h"
 
 #include "../../include/defines.h"
 
@@ -24,5 +25,9 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "../stb/stb_image_write.h"
 
+// Scratch of the resize, only used within the call
+#define STBIR_MALLOC(size, context)   RoundArena.Allocate("STBIR", size)
+#define STBIR_FREE(ptr, context)      RoundArena.Free("STBIR", ptr)
+
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "../stb/stb_image_resize.h"
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "CTfLiteClass.h"
+#include "CRoiSampler.h"
 #include "ClassLogFile.h"
 #include "Helper.h"
 #include "psram.h"
@@ -6,6 +7,9 @@
 #include "../../include/defines.h"
 
 #include <sys/stat.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
 
 // #define DEBUG_DETAIL_ON
 
@@ -42,7 +46,13 @@ float CTfLiteClass::GetOutputValue(int nr)
 
 int CTfLiteClass::GetClassFromImageBasis(CImageBasis *rs)
 {
-    if (!LoadInputImageBasis(rs))
+    return GetClassFromImage(rs->GetView());
+}
+
+
+int CTfLiteClass::GetClassFromImage(const ImageView &_view)
+{
+    if (!LoadInputImage(_view))
       return -1000;
 
     Invoke();
@@ -160,35 +170,83 @@ void CTfLiteClass::Invoke()
 
 
 bool CTfLiteClass::LoadInputImageBasis(CImageBasis *rs)
+{
+    return LoadInputImage(rs->GetView());
+}
+
+
+bool CTfLiteClass::LoadInputImage(const ImageView &_view)
 {
     #ifdef DEBUG_DETAIL_ON 
-        LogFile.WriteHeapInfo("CTfLiteClass::LoadInputImageBasis - Start");
+        LogFile.WriteHeapInfo("CTfLiteClass::LoadInputImage - Start");
     #endif
 
-    unsigned int w = rs->width;
-    unsigned int h = rs->height;
-    unsigned char red, green, blue;
-//    ESP_LOGD(TAG, "Image: %s size: %d x %d\n", _fn.c_str(), w, h);
-
     input_i = 0;
-    float* input_data_ptr = (interpreter->input(0))->data.f;
-
-    for (int y = 0; y < h; ++y)
-        for (int x = 0; x < w; ++x)
-            {
-                red = rs->GetPixelColor(x, y, 0);
-                green = rs->GetPixelColor(x, y, 1);
-                blue = rs->GetPixelColor(x, y, 2);
-                *(input_data_ptr) = (float) red;
-                input_data_ptr++;
-                *(input_data_ptr) = (float) green;
-                input_data_ptr++;
-                *(input_data_ptr) = (float) blue;
-                input_data_ptr++;
-            }
+    TfLiteTensor* input_tensor = interpreter->input(0);
+    int modelheight = input_tensor->dims->data[1];
+    int modelwidth = input_tensor->dims->data[2];
+    int modelchannels = (input_tensor->dims->size > 3) ? input_tensor->dims->data[3] : 1;
+    int channels = _view.channels;
+
+    // The image is RGB or luminance (TakeImage LuminanceOnly), the model input RGB or gray:
+    // consume as is, replicate the luminance or convert RGB to luminance
+    if (((channels != 1) && (channels != 3)) || ((modelchannels != 1) && (modelchannels != 3)))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "LoadInputImage: " + std::to_string(channels) + " image channels for " +
+                                                std::to_string(modelchannels) + " model channels not supported");
+        return false;
+    }
+
+    if ((input_tensor->type != kTfLiteFloat32) && (input_tensor->type != kTfLiteInt8) && (input_tensor->type != kTfLiteUInt8))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "LoadInputImage: Input type " + std::to_string(input_tensor->type) + " not supported");
+        return false;
+    }
+
+    // The view (e.g. the ROI in the aligned image) is resampled to the model size row by row,
+    // every row goes directly into the input tensor
+    CRoiSampler sampler;
+    if (!sampler.Init(_view, modelwidth, modelheight))
+        return false;
+
+    // Quantized input: value 0 .. 255 -> round(value / scale) + zero_point, as table
+    int8_t quantized[256];
+    if (input_tensor->type != kTfLiteFloat32)
+    {
+        float scale = input_tensor->params.scale;
+        int zero_point = input_tensor->params.zero_point;
+        int qmin = (input_tensor->type == kTfLiteInt8) ? -128 : 0;
+        int qmax = (input_tensor->type == kTfLiteInt8) ? 127 : 255;
+
+        for (int v = 0; v < 256; ++v)
+            quantized[v] = (int8_t) std::min(std::max((int) lroundf(v / scale) + zero_point, qmin), qmax);
+    }
+
+    std::vector<uint8_t> row(modelwidth * channels);
+    std::vector<uint8_t> modelrow(modelwidth * modelchannels);
+    int rowsize = modelwidth * modelchannels;
+
+    for (int y = 0; y < modelheight; ++y)
+    {
+        sampler.Row(y, row.data());
+        CImageBasis::CopyPixels(row.data(), channels, modelrow.data(), modelchannels, modelwidth);
+
+        if (input_tensor->type == kTfLiteFloat32)
+        {
+            float* p_target = input_tensor->data.f + y * rowsize;
+            for (int i = 0; i < rowsize; ++i)
+                p_target[i] = (float) modelrow[i];
+        }
+        else
+        {
+            int8_t* p_target = input_tensor->data.int8 + y * rowsize;      // uint8 as the same bits
+            for (int i = 0; i < rowsize; ++i)
+                p_target[i] = quantized[modelrow[i]];
+        }
+    }
 
     #ifdef DEBUG_DETAIL_ON 
-        LogFile.WriteHeapInfo("CTfLiteClass::LoadInputImageBasis - done");
+        LogFile.WriteHeapInfo("CTfLiteClass::LoadInputImage - done");
     #endif
 
     return true;
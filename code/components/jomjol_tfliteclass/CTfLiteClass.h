@@ -42,11 +42,17 @@ class CTfLiteClass
         bool MakeAllocate();
         void GetInputTensorSize();
         bool LoadInputImageBasis(CImageBasis *rs);
+        /**
+         * @brief Resample the view to the model input size directly into the input tensor (float32, int8 or uint8),
+         * gray / RGB adapted to the model input
+         */
+        bool LoadInputImage(const ImageView &_view);
         void Invoke();
         int GetAnzOutPut(bool silent = true);        
         int GetOutClassification(int _von = -1, int _bis = -1);
 
         int GetClassFromImageBasis(CImageBasis *rs);
+        int GetClassFromImage(const ImageView &_view);
         std::string GetStatusFlow();
 
         float GetOutputValue(int nr);
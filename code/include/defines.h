@@ -194,6 +194,7 @@
 //#define TENSOR_ARENA_SIZE         800 * 1024 // Space for the Tensor Arena, (819200 Bytes)
 #define TENSOR_ARENA_SIZE          (256 * 1024)
 #define IMAGE_SIZE                640 * 480 * 3 // Space for a extracted image (921600 Bytes)
+#define ROUND_ARENA_SIZE          (64 * 1024) // Temporary buffers of the image work in a round (RoundArena, high water of a VGA round with the default alignment 47 KB), larger ones (NCC tables, phase correlation FFT) go to the PSRAM heap
 /////////////////////////////////////////////
 ////      Conditionnal definitions       ////
 /////////////////////////////////////////////
@@ -0,0 +1,570 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <CAlignAndCutImage.h>
+#include <CFindTemplate.h>
+#include <CRotateImage.h>
+#include <CMatchKernels.h>
+#include <CTemplateCache.h>
+
+/* Demo images of sd-card/demo, aligned with the InitialRotate of sd-card/demo/config.ini */
+#define DEMO_INITIAL_ROTATE -34.6
+
+static const char *demoImages[] = {"/sdcard/demo/530.07077.jpg", "/sdcard/demo/530.48435.jpg", "/sdcard/demo/531.82235.jpg"};
+
+/* Reference marks cut out of the demo image itself: x, y, dx, dy */
+static const int demoMarks[2][4] = {{30, 189, 57, 31}, {536, 113, 44, 51}};
+
+/* Shift of the configured target position against the true position of the mark */
+#define DEMO_SHIFT_X 7
+#define DEMO_SHIFT_Y -5
+
+
+static CImageBasis *loadDemoImage(std::string _file)
+{
+    CImageBasis *image = new CImageBasis("demo", _file);
+    CImageBasis *tmp = new CImageBasis("demoTmp", image);
+    CRotateImage rt("demoRotate", image, tmp);
+    rt.Rotate(DEMO_INITIAL_ROTATE);
+    delete tmp;
+    return image;
+}
+
+
+/* Cut mark _m out of the image and save it as reference image, returns the file name */
+static std::string cutDemoMark(CAlignAndCutImage *_cut, int _m)
+{
+    std::string file = "/sdcard/img_tmp/test_ref" + std::to_string(_m) + ".jpg";
+    _cut->CutAndSave(file, demoMarks[_m][0], demoMarks[_m][1], demoMarks[_m][2], demoMarks[_m][3]);
+    TemplateCache.Invalidate(file);     // rewritten within the mtime resolution
+    return file;
+}
+
+
+static int64_t findTemplateTimed(CImageBasis *_image, RefInfo *_ref)
+{
+    CFindTemplate ft("test", _image->rgb_image, _image->channels, _image->width, _image->height, _image->bpp);
+    int64_t start = esp_timer_get_time();
+    ft.FindTemplate(_ref);
+    return esp_timer_get_time() - start;
+}
+
+
+/**
+ * @brief Run the exhaustive search ("Default") and the given algorithm on the demo images
+ * and check that both find the reference marks at the same position.
+ * @param _algo alignment_algo to compare
+ * @param _search search field (SearchFieldX/Y) in pixel
+ * @param _tolerance allowed difference to the exhaustive search in pixel
+ */
+static void compareWithExhaustiveSearch(int _algo, int _search, int _tolerance)
+{
+    for (int i = 0; i < sizeof(demoImages) / sizeof(demoImages[0]); ++i) {
+        CImageBasis *image = loadDemoImage(demoImages[i]);
+        TEST_ASSERT_TRUE(image->ImageOkay());
+
+        CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+
+        for (int m = 0; m < 2; ++m) {
+            std::string tplfile = cutDemoMark(&cut, m);
+
+            RefInfo exhaustive, undertest;
+            exhaustive.image_file = undertest.image_file = tplfile;
+            exhaustive.target_x = undertest.target_x = demoMarks[m][0] + DEMO_SHIFT_X;
+            exhaustive.target_y = undertest.target_y = demoMarks[m][1] + DEMO_SHIFT_Y;
+            exhaustive.search_x = undertest.search_x = _search;
+            exhaustive.search_y = undertest.search_y = _search;
+            exhaustive.alignment_algo = 0;
+            undertest.alignment_algo = _algo;
+
+            int64_t t_exhaustive = findTemplateTimed(image, &exhaustive);
+            int64_t t_undertest = findTemplateTimed(image, &undertest);
+
+            printf("%s ref%d: exhaustive (%d, %d) %lld us, algo %d (%d, %d) %lld us\n", demoImages[i], m,
+                    exhaustive.found_x, exhaustive.found_y, (long long)t_exhaustive,
+                    _algo, undertest.found_x, undertest.found_y, (long long)t_undertest);
+
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][0], exhaustive.found_x);
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][1], exhaustive.found_y);
+            TEST_ASSERT_INT_WITHIN(_tolerance, exhaustive.found_x, undertest.found_x);
+            TEST_ASSERT_INT_WITHIN(_tolerance, exhaustive.found_y, undertest.found_y);
+        }
+
+        delete image;
+    }
+}
+
+
+/**
+ * @brief Coarse-to-fine pyramid search ("Pyramid") must find the same offsets as the exhaustive search
+ */
+void test_findTemplatePyramid()
+{
+    compareWithExhaustiveSearch(4, 20, 1);
+    compareWithExhaustiveSearch(4, 60, 1);
+}
+
+
+/**
+ * @brief Normalized cross-correlation ("NCC") must find the same offsets as the exhaustive search
+ * and still find the marks after the illumination of the image changed. A flat reference (no variance)
+ * falls back to the exhaustive search.
+ */
+void test_findTemplateNCC()
+{
+    compareWithExhaustiveSearch(5, 20, 1);
+
+    {
+        CImageBasis *flat = new CImageBasis("flatImage", 120, 80, 3);
+        memset(flat->rgb_image, 128, 120 * 80 * 3);
+        CAlignAndCutImage cut("flatCut", flat->rgb_image, flat->channels, flat->width, flat->height, flat->bpp);
+        cut.CutAndSave("/sdcard/img_tmp/test_flat.jpg", 40, 30, 24, 16);
+        TemplateCache.Invalidate("/sdcard/img_tmp/test_flat.jpg");
+
+        RefInfo exhaustive, ncc;
+        exhaustive.image_file = ncc.image_file = "/sdcard/img_tmp/test_flat.jpg";
+        exhaustive.target_x = ncc.target_x = 40;
+        exhaustive.target_y = ncc.target_y = 30;
+        exhaustive.search_x = ncc.search_x = exhaustive.search_y = ncc.search_y = 10;
+        exhaustive.alignment_algo = 0;
+        ncc.alignment_algo = 5;
+
+        findTemplateTimed(flat, &exhaustive);
+        findTemplateTimed(flat, &ncc);
+        TEST_ASSERT_EQUAL_INT(exhaustive.found_x, ncc.found_x);
+        TEST_ASSERT_EQUAL_INT(exhaustive.found_y, ncc.found_y);
+        TEST_ASSERT_TRUE(ncc.confidence == ncc.confidence);     // no NaN
+        delete flat;
+    }
+
+    for (int i = 0; i < sizeof(demoImages) / sizeof(demoImages[0]); ++i) {
+        CImageBasis *image = loadDemoImage(demoImages[i]);
+        TEST_ASSERT_TRUE(image->ImageOkay());
+
+        CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+        for (int m = 0; m < 2; ++m)
+            cutDemoMark(&cut, m);
+
+        image->Contrast(-40);       // darker, less contrast than the reference marks
+
+        for (int m = 0; m < 2; ++m) {
+            RefInfo ref;
+            ref.image_file = "/sdcard/img_tmp/test_ref" + std::to_string(m) + ".jpg";
+            ref.target_x = demoMarks[m][0] + DEMO_SHIFT_X;
+            ref.target_y = demoMarks[m][1] + DEMO_SHIFT_Y;
+            ref.search_x = ref.search_y = 20;
+            ref.alignment_algo = 5;
+
+            int64_t t = findTemplateTimed(image, &ref);
+            printf("%s ref%d (contrast -40): NCC (%d, %d), confidence %.3f, %lld us\n", demoImages[i], m,
+                    ref.found_x, ref.found_y, ref.confidence, (long long)t);
+
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][0], ref.found_x);
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][1], ref.found_y);
+            TEST_ASSERT_TRUE(ref.confidence > 0.9);
+        }
+
+        delete image;
+    }
+}
+
+
+/**
+ * @brief Phase correlation ("PhaseCorrelation") must find the same offsets as the exhaustive search
+ * and also find the marks with the whole image as search field (SearchField 0)
+ */
+void test_findTemplatePhaseCorrelation()
+{
+    compareWithExhaustiveSearch(6, 20, 1);
+
+    for (int i = 0; i < sizeof(demoImages) / sizeof(demoImages[0]); ++i) {
+        CImageBasis *image = loadDemoImage(demoImages[i]);
+        TEST_ASSERT_TRUE(image->ImageOkay());
+
+        CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+
+        for (int m = 0; m < 2; ++m) {
+            RefInfo ref;
+            ref.image_file = cutDemoMark(&cut, m);
+            ref.target_x = demoMarks[m][0] + DEMO_SHIFT_X;
+            ref.target_y = demoMarks[m][1] + DEMO_SHIFT_Y;
+            ref.search_x = ref.search_y = 0;        // whole image
+            ref.alignment_algo = 6;
+
+            int64_t t = findTemplateTimed(image, &ref);
+            printf("%s ref%d (whole image): PhaseCorrelation (%d, %d), confidence %.3f, %lld us\n", demoImages[i], m,
+                    ref.found_x, ref.found_y, ref.confidence, (long long)t);
+
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][0], ref.found_x);
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][1], ref.found_y);
+            TEST_ASSERT_TRUE(ref.confidence > 0);
+        }
+
+        delete image;
+    }
+}
+
+
+/* Exhaustive search as it was before the integer kernels (double accumulator, column-major), kept as benchmark reference */
+static void findTemplateReference(CImageBasis *_image, RefInfo *_ref, uint8_t *_tpl, int _tplwidth, int _tplheight, int _anzchannels)
+{
+    int ow_start = std::max(_ref->target_x - _ref->search_x, 0);
+    int ow_stop = std::min(_ref->target_x + _ref->search_x, _image->width - _tplwidth);
+    int oh_start = std::max(_ref->target_y - _ref->search_y, 0);
+    int oh_stop = std::min(_ref->target_y + _ref->search_y, _image->height - _tplheight);
+    int channels = _image->channels;
+    double minSAD = pow(_tplwidth * _tplheight * 255, 2);
+
+    for (int xouter = ow_start; xouter <= ow_stop; xouter++)
+        for (int youter = oh_start; youter <= oh_stop; ++youter) {
+            double aktSAD = 0;
+            for (int tpl_x = 0; tpl_x < _tplwidth; tpl_x++)
+                for (int tpl_y = 0; tpl_y < _tplheight; tpl_y++) {
+                    uint8_t *p_org = _image->rgb_image + (channels * ((youter + tpl_y) * _image->width + (xouter + tpl_x)));
+                    uint8_t *p_tpl = _tpl + (channels * (tpl_y * _tplwidth + tpl_x));
+                    for (int _ch = 0; _ch < _anzchannels; ++_ch)
+                        aktSAD += pow(p_tpl[_ch] - p_org[_ch], 2);
+                }
+            if (aktSAD < minSAD) {
+                minSAD = aktSAD;
+                _ref->found_x = xouter;
+                _ref->found_y = youter;
+            }
+        }
+}
+
+
+/**
+ * @brief Integer SSD kernels against a naive implementation (also beyond 32 bit), then candidates per second of the
+ * exhaustive search ("Default" and "HighAccuracy") before and after the integer kernels
+ */
+void test_matchKernels()
+{
+    const int w = 23, h = 17;
+    uint8_t img[3 * w * h], tpl[3 * w * h];
+    for (int i = 0; i < 3 * w * h; ++i) {
+        img[i] = (i * 73 + 19) & 0xFF;
+        tpl[i] = (i * 151 + 7) & 0xFF;
+    }
+
+    uint32_t ssd1 = 0, ssd3 = 0;
+    for (int i = 0; i < w * h; ++i)
+        for (int ch = 0; ch < 3; ++ch) {
+            int dif = tpl[3 * i + ch] - img[3 * i + ch];
+            ssd3 += dif * dif;
+            if (ch == 0) {
+                ssd1 += dif * dif;
+            }
+        }
+
+    TEST_ASSERT_EQUAL_UINT32(ssd1, MatchSSD1(img, 3 * w, 3, tpl, 3 * w, 3, w, h, UINT64_MAX));
+    TEST_ASSERT_EQUAL_UINT32(ssd3, MatchSSD3(img, 3 * w, 3, tpl, 3 * w, 3, w, h, UINT64_MAX));
+    TEST_ASSERT_TRUE(MatchSSD3(img, 3 * w, 3, tpl, 3 * w, 3, w, h, ssd3 / 4) > ssd3 / 4);      // early termination
+    TEST_ASSERT_TRUE(MatchSSD3(img, 3 * w, 3, tpl, 3 * w, 3, w, h, ssd3 / 4) < ssd3);
+
+    // Large reference: the sum exceeds 32 bit
+    const int lw = 200, lh = 150;
+    uint8_t *black = (uint8_t *)calloc(3 * lw * lh, 1);
+    uint8_t *white = (uint8_t *)malloc(3 * lw * lh);
+    memset(white, 255, 3 * lw * lh);
+    TEST_ASSERT_TRUE(MatchSSD3(black, 3 * lw, 3, white, 3 * lw, 3, lw, lh, UINT64_MAX) == (uint64_t)3 * lw * lh * 255 * 255);
+    TEST_ASSERT_TRUE(MatchSSD1(black, 3 * lw, 3, white, 3 * lw, 3, lw, lh, UINT64_MAX) == (uint64_t)lw * lh * 255 * 255);
+    free(white);
+    free(black);
+
+    CImageBasis *image = loadDemoImage(demoImages[0]);
+    TEST_ASSERT_TRUE(image->ImageOkay());
+    CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+
+    for (int algo = 0; algo <= 1; ++algo) {
+        for (int m = 0; m < 2; ++m) {
+            CImageBasis *tplimage = cut.CutAndSave(demoMarks[m][0], demoMarks[m][1], demoMarks[m][2], demoMarks[m][3]);
+
+            RefInfo before, after;
+            before.image_file = after.image_file = cutDemoMark(&cut, m);
+            before.target_x = after.target_x = demoMarks[m][0] + DEMO_SHIFT_X;
+            before.target_y = after.target_y = demoMarks[m][1] + DEMO_SHIFT_Y;
+            before.search_x = after.search_x = before.search_y = after.search_y = 20;
+            after.alignment_algo = algo;
+
+            int64_t start = esp_timer_get_time();
+            findTemplateReference(image, &before, tplimage->rgb_image, tplimage->width, tplimage->height, algo == 0 ? 1 : 3);
+            int64_t t_before = esp_timer_get_time() - start;
+            int64_t t_after = findTemplateTimed(image, &after);
+            delete tplimage;
+
+            float candidates = 41 * 41;
+            printf("algo %d ref%d: before %.0f candidates/s, after %.0f candidates/s\n", algo, m,
+                    candidates * 1e6 / std::max(t_before, (int64_t)1), candidates * 1e6 / std::max(t_after, (int64_t)1));
+
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][0], after.found_x);
+            TEST_ASSERT_INT_WITHIN(1, demoMarks[m][1], after.found_y);
+        }
+    }
+
+    delete image;
+}
+
+
+/**
+ * @brief Reference images are decoded once: same content as stbi_load, hits on repeated access, reload after invalidation,
+ * an entry in use stays valid until it is released
+ */
+void test_templateCache()
+{
+    CImageBasis *image = loadDemoImage(demoImages[0]);
+    TEST_ASSERT_TRUE(image->ImageOkay());
+    CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+    std::string file = cutDemoMark(&cut, 0);
+
+    uint32_t hits = TemplateCache.hits;
+    uint32_t misses = TemplateCache.misses;
+
+    RefTemplate *tpl = TemplateCache.Get(file, 3);
+    TEST_ASSERT_NOT_NULL(tpl);
+    TEST_ASSERT_EQUAL(misses + 1, TemplateCache.misses);
+
+    int w, h, bpp;
+    uint8_t *decoded = stbi_load(file.c_str(), &w, &h, &bpp, 3);
+    TEST_ASSERT_NOT_NULL(decoded);
+    TEST_ASSERT_EQUAL(w, tpl->width);
+    TEST_ASSERT_EQUAL(h, tpl->height);
+    TEST_ASSERT_EQUAL_MEMORY(decoded, tpl->rgb, w * h * 3);
+
+    uint32_t sum = 0;
+    for (int i = 0; i < w * h; ++i)
+        sum += decoded[3 * i];
+    TEST_ASSERT_EQUAL_UINT32(sum, tpl->sum[0]);
+    TEST_ASSERT_EQUAL(CImagePyramid::MaxLevels(w, h), tpl->pyramid.levels);
+    stbi_image_free(decoded);
+
+    TEST_ASSERT_TRUE(TemplateCache.Get(file, 3) == tpl);
+    TEST_ASSERT_EQUAL(hits + 1, TemplateCache.hits);
+    TEST_ASSERT_EQUAL(misses + 1, TemplateCache.misses);
+    TEST_ASSERT_EQUAL(2, tpl->refs);
+    TemplateCache.Release(tpl);
+
+    // "cutref" while the entry is in use: taken out of the cache, but valid until it is released
+    cutDemoMark(&cut, 0);
+    TEST_ASSERT_FALSE(tpl->linked);
+    TEST_ASSERT_EQUAL(w, tpl->width);
+    TEST_ASSERT_EQUAL_UINT32(sum, tpl->sum[0]);
+
+    RefTemplate *reloaded = TemplateCache.Get(file, 3);
+    TEST_ASSERT_NOT_NULL(reloaded);
+    TEST_ASSERT_TRUE(reloaded != tpl);
+    TEST_ASSERT_EQUAL(misses + 2, TemplateCache.misses);
+    TemplateCache.Release(tpl);
+    TemplateCache.Release(reloaded);
+
+    delete image;
+}
+
+
+/**
+ * @brief Reduced (adaptive) search field: same result as the full search field if the drift is inside,
+ * fallback to the full search field if the match is on its border or too weak
+ */
+void test_findTemplateAdaptive()
+{
+    CImageBasis *image = loadDemoImage(demoImages[0]);
+    TEST_ASSERT_TRUE(image->ImageOkay());
+    CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+
+    for (int m = 0; m < 2; ++m) {
+        RefInfo ref;
+        ref.image_file = cutDemoMark(&cut, m);
+        ref.target_x = demoMarks[m][0] + DEMO_SHIFT_X;
+        ref.target_y = demoMarks[m][1] + DEMO_SHIFT_Y;
+        ref.search_x = ref.search_y = 60;
+
+        int64_t t_full = findTemplateTimed(image, &ref);
+        TEST_ASSERT_FALSE(ref.adaptive_fallback);
+        float rms = ref.match_rms;
+        TEST_ASSERT_TRUE(rms >= 0);
+
+        ref.adaptive_search_x = ref.adaptive_search_y = 10;      // drift (7, -5) inside
+        ref.adaptive_max_rms = 1.5 * rms + 3;
+        int64_t t_adaptive = findTemplateTimed(image, &ref);
+        printf("ref%d: full search field %lld us, adaptive %lld us\n", m, (long long)t_full, (long long)t_adaptive);
+        TEST_ASSERT_FALSE(ref.adaptive_fallback);
+        TEST_ASSERT_EQUAL(demoMarks[m][0], ref.found_x);
+        TEST_ASSERT_EQUAL(demoMarks[m][1], ref.found_y);
+
+        ref.adaptive_search_x = ref.adaptive_search_y = 3;       // drift outside -> match on the border
+        findTemplateTimed(image, &ref);
+        TEST_ASSERT_TRUE(ref.adaptive_fallback);
+        TEST_ASSERT_EQUAL(demoMarks[m][0], ref.found_x);
+        TEST_ASSERT_EQUAL(demoMarks[m][1], ref.found_y);
+
+        ref.adaptive_search_x = ref.adaptive_search_y = 10;      // similarity dropped
+        ref.adaptive_max_rms = rms / 2;
+        findTemplateTimed(image, &ref);
+        TEST_ASSERT_TRUE(ref.adaptive_fallback);
+        TEST_ASSERT_EQUAL(demoMarks[m][0], ref.found_x);
+        TEST_ASSERT_EQUAL(demoMarks[m][1], ref.found_y);
+    }
+
+    delete image;
+}
+
+
+/**
+ * @brief Sub-pixel refinement: find the reference marks in demo images shifted by fractions of a pixel
+ */
+void test_findTemplateSubPixel()
+{
+    const float shifts[][2] = {{0.25, -0.5}, {0.5, 0.25}, {-0.3, 0.7}, {0.0, 0.0}};
+
+    for (int s = 0; s < sizeof(shifts) / sizeof(shifts[0]); ++s) {
+        CImageBasis *image = loadDemoImage(demoImages[0]);
+        TEST_ASSERT_TRUE(image->ImageOkay());
+        CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+        std::string files[2] = {cutDemoMark(&cut, 0), cutDemoMark(&cut, 1)};
+
+        CImageBasis *tmp = new CImageBasis("demoTmp", image);
+        CRotateImage rt("demoShift", image, tmp);
+        rt.Translate(shifts[s][0], shifts[s][1]);
+        delete tmp;
+
+        for (int m = 0; m < 2; ++m) {
+            RefInfo ref;
+            ref.image_file = files[m];
+            ref.target_x = demoMarks[m][0];
+            ref.target_y = demoMarks[m][1];
+            ref.search_x = ref.search_y = 10;
+            findTemplateTimed(image, &ref);
+
+            float expected_x = demoMarks[m][0] + shifts[s][0];
+            float expected_y = demoMarks[m][1] + shifts[s][1];
+            printf("shift (%.2f, %.2f) ref%d: found (%d, %d) + (%.3f, %.3f), error integer %.3f / sub-pixel %.3f\n",
+                    shifts[s][0], shifts[s][1], m, ref.found_x, ref.found_y, ref.subpixel_x, ref.subpixel_y,
+                    hypot(ref.found_x - expected_x, ref.found_y - expected_y),
+                    hypot(ref.found_x + ref.subpixel_x - expected_x, ref.found_y + ref.subpixel_y - expected_y));
+
+            TEST_ASSERT_FLOAT_WITHIN(0.2, expected_x, ref.found_x + ref.subpixel_x);
+            TEST_ASSERT_FLOAT_WITHIN(0.2, expected_y, ref.found_y + ref.subpixel_y);
+        }
+
+        delete image;
+    }
+}
+
+
+/**
+ * @brief Alignment with four references: the rotated and shifted image must be aligned onto the targets,
+ * a reference with a wrong target position must be rejected by its residual without disturbing the others
+ */
+void test_alignMultipleReferences()
+{
+    const int marks[4][4] = {{30, 189, 57, 31}, {536, 113, 44, 51}, {148, 158, 50, 45}, {322, 428, 62, 24}};
+    const int badref = 2;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        CImageBasis *image = loadDemoImage(demoImages[0]);
+        TEST_ASSERT_TRUE(image->ImageOkay());
+
+        RefInfo refs[4];
+        CAlignAndCutImage cut("demoCut", image->rgb_image, image->channels, image->width, image->height, image->bpp);
+        for (int m = 0; m < 4; ++m) {
+            refs[m].image_file = "/sdcard/img_tmp/test_ref" + std::to_string(m) + ".jpg";
+            cut.CutAndSave(refs[m].image_file, marks[m][0], marks[m][1], marks[m][2], marks[m][3]);
+            TemplateCache.Invalidate(refs[m].image_file);
+            refs[m].target_x = marks[m][0];
+            refs[m].target_y = marks[m][1];
+            refs[m].search_x = refs[m].search_y = 20;
+        }
+
+        if (pass == 1) {
+            refs[badref].target_x += 8;         // e.g. a mark on a part which moved
+        }
+
+        // Misalign the image: rotation around the image center and a shift
+        CImageBasis *tmp = new CImageBasis("demoTmp", image);
+        CRotateImage rt("demoMisalign", image, tmp);
+        rt.Rotate(1.5);
+        rt.Translate(4, -3);
+
+        CAlignAndCutImage align("demoAlign", image, tmp);
+        int64_t start = esp_timer_get_time();
+        align.Align(refs, 4);
+        int64_t t = esp_timer_get_time() - start;
+
+        for (int m = 0; m < 4; ++m) {
+            printf("pass %d ref%d: found (%d, %d), residual %.3f%s\n", pass, m, refs[m].found_x, refs[m].found_y,
+                    refs[m].residual, refs[m].outlier ? " (outlier)" : "");
+
+            if ((pass == 1) && (m == badref)) {
+                TEST_ASSERT_TRUE(refs[m].outlier);
+                TEST_ASSERT_TRUE(refs[m].residual > ALIGN_MAX_RESIDUAL);
+            }
+            else {
+                TEST_ASSERT_FALSE(refs[m].outlier);
+                TEST_ASSERT_TRUE(refs[m].residual < 1);
+            }
+        }
+        printf("pass %d: Align %lld us\n", pass, (long long)t);
+
+        // The references are at their target positions after the alignment
+        for (int m = 0; m < 4; ++m) {
+            RefInfo ref = refs[m];
+            ref.target_x = marks[m][0];
+            ref.target_y = marks[m][1];
+            ref.search_x = ref.search_y = 5;
+            findTemplateTimed(image, &ref);
+            TEST_ASSERT_INT_WITHIN(1, marks[m][0], ref.found_x);
+            TEST_ASSERT_INT_WITHIN(1, marks[m][1], ref.found_y);
+        }
+
+        delete tmp;
+        delete image;
+    }
+}
+
+
+/**
+ * @brief Initial rotation and alignment rendered in one pass from the raw image: the references are searched
+ * in the rotated image in ImageTMP and are at their target positions in the final image
+ */
+void test_alignInitialRotation()
+{
+    CImageBasis *rotated = loadDemoImage(demoImages[1]);
+    TEST_ASSERT_TRUE(rotated->ImageOkay());
+    CAlignAndCutImage cut("demoCut", rotated->rgb_image, rotated->channels, rotated->width, rotated->height, rotated->bpp);
+
+    RefInfo refs[2];
+    for (int m = 0; m < 2; ++m) {
+        refs[m].image_file = cutDemoMark(&cut, m);
+        refs[m].target_x = demoMarks[m][0] + DEMO_SHIFT_X;
+        refs[m].target_y = demoMarks[m][1] + DEMO_SHIFT_Y;
+        refs[m].search_x = refs[m].search_y = 20;
+    }
+    delete rotated;
+
+    CImageBasis *raw = new CImageBasis("demo", demoImages[1]);
+    CImageBasis *tmp = new CImageBasis("demoTmp", raw);
+    CAlignAndCutImage align("demoAlign", raw, tmp);
+
+    CAffineTransform initial(raw->width, raw->height);
+    initial.Rotate(DEMO_INITIAL_ROTATE, raw->width / 2, raw->height / 2);
+    CRotateImage rt("demoRotate", &align, tmp);
+    rt.Warp(initial, false, false);
+
+    int64_t start = esp_timer_get_time();
+    align.Align(refs, 2, &initial);
+    printf("Align with initial rotation %lld us\n", (long long)(esp_timer_get_time() - start));
+
+    for (int m = 0; m < 2; ++m) {
+        printf("ref%d: found (%d, %d), residual %.3f\n", m, refs[m].found_x, refs[m].found_y, refs[m].residual);
+        TEST_ASSERT_INT_WITHIN(1, demoMarks[m][0], refs[m].found_x);
+        TEST_ASSERT_INT_WITHIN(1, demoMarks[m][1], refs[m].found_y);
+
+        RefInfo ref = refs[m];
+        ref.search_x = ref.search_y = 5;
+        findTemplateTimed(&align, &ref);
+        TEST_ASSERT_INT_WITHIN(1, refs[m].target_x, ref.found_x);
+        TEST_ASSERT_INT_WITHIN(1, refs[m].target_y, ref.found_y);
+    }
+
+    delete tmp;
+    delete raw;
+}
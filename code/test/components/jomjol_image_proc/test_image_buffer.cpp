@@ -0,0 +1,95 @@
+#include <unity.h>
+#include <string.h>
+#include <CImageBasis.h>
+#include <CImageBuffer.h>
+#include <CRotateImage.h>
+#include <CAffineTransform.h>
+#include "test_image_helpers.h"
+
+
+/**
+ * @brief Copy-on-write of the image buffers: copies share the buffer until they are written (also through
+ * a CRotateImage working on the copy), the original stays unchanged, moving transfers the buffer, live buffer counts
+ */
+void test_imageBuffer()
+{
+    const int w = 64, h = 48, size = w * h * 3;
+    uint8_t *expected = (uint8_t *)malloc(size);
+
+    CImageBuffer::NextRound();
+    int live = CImageBuffer::Live();
+    uint32_t copiesonwrite = CImageBuffer::CopiesOnWrite();
+
+    CImageBasis *original = createTestImage("cowOriginal", w, h);
+    memcpy(expected, original->rgb_image, size);
+
+    // A copy only takes a reference, reading does not duplicate it
+    CImageBasis *copy = new CImageBasis("cowCopy", original);
+    TEST_ASSERT_TRUE(copy->SharesBuffer(original));
+    TEST_ASSERT_TRUE(copy->rgb_image == original->rgb_image);
+    TEST_ASSERT_EQUAL_INT(live + 1, CImageBuffer::Live());
+
+    copy->RGBImageLockRead();
+    copy->RGBImageReleaseRead();
+    TEST_ASSERT_TRUE(copy->SharesBuffer(original));
+    TEST_ASSERT_EQUAL_UINT32(copiesonwrite, CImageBuffer::CopiesOnWrite());
+
+    // The first write gets an own buffer, the original keeps its pixels. Views taken before point into the old buffer.
+    ImageView view = copy->GetView(2, 2, 30, 30);
+    TEST_ASSERT_TRUE(copy->Contains(view));
+    copy->drawRect(5, 5, 20, 10, 255, 0, 0, 2);
+    TEST_ASSERT_FALSE(copy->SharesBuffer(original));
+    TEST_ASSERT_FALSE(copy->Contains(view));
+    TEST_ASSERT_TRUE(original->Contains(view));
+    TEST_ASSERT_EQUAL_INT(live + 2, CImageBuffer::Live());
+    TEST_ASSERT_EQUAL_UINT32(copiesonwrite + 1, CImageBuffer::CopiesOnWrite());
+    TEST_ASSERT_EQUAL_INT(0, memcmp(expected, original->rgb_image, size));
+    TEST_ASSERT_EQUAL_UINT8(255, copy->GetPixelColor(10, 5, 0));
+    TEST_ASSERT_EQUAL_UINT8(0, copy->GetPixelColor(10, 5, 1));
+
+    // Written again: no further copy
+    copy->drawRect(30, 20, 5, 5, 0, 255, 0, 1);
+    TEST_ASSERT_EQUAL_UINT32(copiesonwrite + 1, CImageBuffer::CopiesOnWrite());
+
+    // Writing through an image working on a copy: the copy is duplicated, the rotated image follows its buffer
+    CImageBasis *second = new CImageBasis("cowSecond", original);
+    CRotateImage *rt = new CRotateImage("cowRotate", second, NULL);
+    CAffineTransform shift(w, h);
+    shift.Translate(4, 0);
+    rt->Warp(shift, false);
+    TEST_ASSERT_FALSE(second->SharesBuffer(original));
+    TEST_ASSERT_TRUE(rt->SharesBuffer(second));
+    TEST_ASSERT_TRUE(rt->rgb_image == second->rgb_image);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(expected, original->rgb_image, size));
+    TEST_ASSERT_EQUAL_INT(0, memcmp(expected, second->rgb_image + 4 * 3, w * 3 - 4 * 3));
+    delete rt;
+
+    // Move: the buffer changes the owner without a copy
+    uint8_t *pixels = second->rgb_image;
+    CImageBasis *moved = new CImageBasis("cowMoved");
+    moved->MoveFrom(second);
+    TEST_ASSERT_TRUE(moved->rgb_image == pixels);
+    TEST_ASSERT_TRUE(second->rgb_image == NULL);
+    TEST_ASSERT_EQUAL_INT(w, moved->width);
+    TEST_ASSERT_EQUAL_INT(live + 3, CImageBuffer::Live());
+    delete second;
+    TEST_ASSERT_EQUAL_INT(live + 3, CImageBuffer::Live());
+
+    // The shared buffer lives as long as one of its images
+    CImageBasis *third = new CImageBasis("cowThird", original);
+    delete original;
+    TEST_ASSERT_EQUAL_INT(0, memcmp(expected, third->rgb_image, size));
+    TEST_ASSERT_EQUAL_INT(live + 3, CImageBuffer::Live());
+
+    delete third;
+    delete moved;
+    delete copy;
+    TEST_ASSERT_EQUAL_INT(live, CImageBuffer::Live());
+    TEST_ASSERT_EQUAL_INT(live + 3, CImageBuffer::Peak());
+
+    CImageBuffer::NextRound();
+    TEST_ASSERT_EQUAL_INT(live + 3, CImageBuffer::RoundPeak());
+    TEST_ASSERT_EQUAL_INT(live, CImageBuffer::Peak());
+
+    free(expected);
+}
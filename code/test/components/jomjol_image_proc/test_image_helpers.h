@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef TEST_IMAGE_HELPERS_H
+#define TEST_IMAGE_HELPERS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <CImageBasis.h>
+
+
+/* Byte pattern for plain buffers: no constant runs and no period of a word or vector length */
+static void fillTestPattern(uint8_t *_data, int _size)
+{
+    for (int i = 0; i < _size; ++i)
+        _data[i] = (i * 37 + (i >> 5) * 11) & 0xFF;
+}
+
+
+/* Gradients with hard edges, a distinct value per channel, written under the image lock */
+static void fillTestImage(CImageBasis *_image)
+{
+    uint8_t *data = _image->RGBImageLock();
+    for (int y = 0; y < _image->height; ++y)
+        for (int x = 0; x < _image->width; ++x)
+            for (int c = 0; c < _image->channels; ++c) {
+                int v = (x * 3 + y * 2 + c * 40) & 0xFF;        // Gradients
+                if (((x / 12) + (y / 9)) % 5 == 0)              // Hard edges
+                    v = 255 - v;
+                data[(y * _image->width + x) * _image->channels + c] = v;
+            }
+    _image->RGBImageRelease();
+}
+
+
+static CImageBasis *createTestImage(std::string _name, int _width, int _height, int _channels = 3)
+{
+    CImageBasis *image = new CImageBasis(_name, _width, _height, _channels);
+    fillTestImage(image);
+    return image;
+}
+
+
+/* Output of a JPEG encoder, collected by writeTestJpeg */
+struct TestJpeg {
+    std::vector<uint8_t> data;
+    std::vector<int> sizes;             // Size of each chunk
+    int calls = 0;
+    int limit = 0;                      // > 0: refuse the chunk that makes the output larger
+};
+
+
+static bool writeTestJpeg(void *_context, const uint8_t *_data, int _size)
+{
+    TestJpeg *out = (TestJpeg *)_context;
+    out->calls++;
+    out->sizes.push_back(_size);
+    if ((out->limit > 0) && ((int)out->data.size() + _size > out->limit))
+        return false;
+    out->data.insert(out->data.end(), _data, _data + _size);
+    return true;
+}
+
+#endif //TEST_IMAGE_HELPERS_H
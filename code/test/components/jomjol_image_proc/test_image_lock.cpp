@@ -0,0 +1,197 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <CImageBasis.h>
+#include <CImageLock.h>
+
+
+struct LockStressJob {
+    CImageBasis *image;
+    std::atomic<bool> writing;
+    std::atomic<int> finished;
+    std::atomic<int> reading;           // Readers inside the lock at the moment
+    std::atomic<int> maxreading;
+    std::atomic<int> frames;            // Frames checked by the readers
+    std::atomic<int> torn;              // Frames with pixels of two different writes
+};
+
+
+/* Writes frames with one value for the whole image, row by row with a yield in the middle */
+static void task_lockStressWriter(void *_param)
+{
+    LockStressJob *job = (LockStressJob *)_param;
+    CImageBasis *image = job->image;
+    int rowbytes = image->width * image->channels;
+
+    for (int frame = 1; frame <= 100; ++frame) {
+        uint8_t *data = image->RGBImageLock();
+        for (int y = 0; y < image->height; ++y) {
+            memset(data + y * rowbytes, frame, rowbytes);
+            if (y == image->height / 2)
+                vTaskDelay(1);
+        }
+        image->RGBImageRelease();
+        vTaskDelay(1);
+    }
+
+    job->writing = false;
+    job->finished++;
+    vTaskDelete(NULL);
+}
+
+
+/* Reads frames until the writer is done, every frame has to consist of one value */
+static void task_lockStressReader(void *_param)
+{
+    LockStressJob *job = (LockStressJob *)_param;
+    CImageBasis *image = job->image;
+    int size = image->width * image->height * image->channels;
+
+    while (job->writing) {
+        uint8_t *data = image->RGBImageLockRead();
+        int inside = ++job->reading;
+        int max = job->maxreading;
+        while ((inside > max) && !job->maxreading.compare_exchange_weak(max, inside))
+            ;
+
+        for (int i = 0; i < size; ++i)
+            if (data[i] != data[0]) {
+                job->torn++;
+                break;
+            }
+        vTaskDelay(1);                  // Keeps the frame locked a bit longer, the readers overlap
+
+        job->reading--;
+        job->frames++;
+        image->RGBImageReleaseRead();
+        vTaskDelay(1);
+    }
+
+    job->finished++;
+    vTaskDelete(NULL);
+}
+
+
+static void task_lockHoldWrite(void *_param)
+{
+    CImageLock *lock = (CImageLock *)_param;
+    lock->LockWrite(1000);
+    vTaskDelay(300 / portTICK_PERIOD_MS);
+    lock->ReleaseWrite();
+    vTaskDelete(NULL);
+}
+
+
+/**
+ * @brief Reader / writer lock of CImageBasis: recursion, refused upgrade, out of order release, timeout, no lock held after a
+ * failed lock of an empty image, and a stress test with
+ * one writer and four concurrent readers, which must never see a torn frame and have to read at the same time
+ */
+void test_imageLock()
+{
+    // Recursion within one task, upgrade of a read lock is refused
+    {
+        CImageLock lock;
+        TEST_ASSERT_TRUE(lock.LockWrite(100));
+        TEST_ASSERT_TRUE(lock.LockRead(100));
+        TEST_ASSERT_TRUE(lock.LockWrite(100));
+        lock.ReleaseWrite();
+        lock.ReleaseRead();
+        lock.ReleaseWrite();
+
+        TEST_ASSERT_TRUE(lock.LockRead(100));
+        TEST_ASSERT_TRUE(lock.LockRead(100));
+        TEST_ASSERT_FALSE(lock.LockWrite(100));
+        lock.ReleaseRead();
+        lock.ReleaseRead();
+        lock.ReleaseRead();             // Not held any more: ignored
+
+        TEST_ASSERT_TRUE(lock.LockWrite(100));
+        lock.ReleaseWrite();
+        TEST_ASSERT_EQUAL_INT(2, lock.writes);
+        TEST_ASSERT_EQUAL_INT(1, lock.reads);
+        TEST_ASSERT_EQUAL_INT(1, lock.timeouts);
+    }
+
+    // Write lock released before the read lock nested in it: the buffer is released with the read lock
+    {
+        CImageLock lock;
+        TEST_ASSERT_TRUE(lock.LockWrite(100));
+        TEST_ASSERT_TRUE(lock.LockRead(100));
+        lock.ReleaseWrite();
+        TEST_ASSERT_TRUE(lock.LockWrite(100));      // Still the writer
+        lock.ReleaseWrite();
+        lock.ReleaseRead();
+
+        TEST_ASSERT_TRUE(lock.LockRead(100));       // A new reader, not a read nested in a leaked write lock
+        TEST_ASSERT_FALSE(lock.LockWrite(100));
+        lock.ReleaseRead();
+        TEST_ASSERT_TRUE(lock.LockWrite(100));
+        lock.ReleaseWrite();
+        TEST_ASSERT_EQUAL_INT(2, lock.writes);
+        TEST_ASSERT_EQUAL_INT(1, lock.reads);
+    }
+
+    // An image without pixels can't be locked, the failed lock is not held
+    {
+        CImageBasis empty("lockEmpty");
+        TEST_ASSERT_NULL(empty.RGBImageLock(1));
+        TEST_ASSERT_NULL(empty.RGBImageLockRead(1));
+        TEST_ASSERT_TRUE(empty.GetLock()->LockWrite(100));
+        empty.GetLock()->ReleaseWrite();
+        TEST_ASSERT_EQUAL_INT(0, empty.GetLock()->timeouts);
+    }
+
+    // Timeout while another task writes
+    {
+        CImageLock lock;
+        xTaskCreatePinnedToCore(&task_lockHoldWrite, "lockHold", 4 * 1024, &lock, uxTaskPriorityGet(NULL), NULL, 0);
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+        TEST_ASSERT_FALSE(lock.LockRead(50));
+        TEST_ASSERT_TRUE(lock.LockRead(2000));
+        lock.ReleaseRead();
+        TEST_ASSERT_EQUAL_INT(1, lock.timeouts);
+        TEST_ASSERT_EQUAL_INT(2, lock.contended);
+        TEST_ASSERT_TRUE(lock.max_wait_ms >= 150);
+    }
+
+    // One writer, four readers
+    const int readers = 4;
+    LockStressJob job;
+    job.image = new CImageBasis("lockStress", 320, 240, 3);
+    memset(job.image->rgb_image, 0, 320 * 240 * 3);
+    job.writing = true;
+    job.finished = 0;
+    job.reading = 0;
+    job.maxreading = 0;
+    job.frames = 0;
+    job.torn = 0;
+
+    CImageLock *lock = job.image->GetLock();
+    uint32_t writes = lock->writes;        // The constructor writes, too
+
+    int64_t start = esp_timer_get_time();
+    for (int r = 0; r < readers; ++r)
+        xTaskCreatePinnedToCore(&task_lockStressReader, "lockReader", 4 * 1024, &job, uxTaskPriorityGet(NULL), NULL, r % 2);
+    xTaskCreatePinnedToCore(&task_lockStressWriter, "lockWriter", 4 * 1024, &job, uxTaskPriorityGet(NULL), NULL, 1);
+
+    while (job.finished < readers + 1)
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    int64_t duration = esp_timer_get_time() - start;
+
+    printf("Image lock stress: %lld us, %d frames read (%d torn), up to %d readers at the same time, "
+           "%u reads, %u writes, %u contended, %u timeouts, max. wait %u ms\n",
+           (long long)duration, (int)job.frames, (int)job.torn, (int)job.maxreading,
+           (unsigned)lock->reads, (unsigned)lock->writes, (unsigned)lock->contended, (unsigned)lock->timeouts, (unsigned)lock->max_wait_ms);
+
+    TEST_ASSERT_EQUAL_INT(0, job.torn);
+    TEST_ASSERT_EQUAL_INT(0, lock->timeouts);
+    TEST_ASSERT_EQUAL_INT(100, lock->writes - writes);
+    TEST_ASSERT_TRUE(job.maxreading > 1);
+    TEST_ASSERT_TRUE(job.frames > 0);
+
+    delete job.image;
+}
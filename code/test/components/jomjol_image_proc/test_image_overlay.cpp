@@ -0,0 +1,113 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <CImageBasis.h>
+#include <CImageOverlay.h>
+#include <CJpegEncoder.h>
+#include "test_image_helpers.h"
+
+
+static std::vector<uint8_t> encodeOverlayJpeg(JpegEncoderType _type, CImageBasis *_image, int _quality, const CImageOverlay *_overlay)
+{
+    TestJpeg out;
+    CJpegEncoder *encoder = CJpegEncoder::Create(_type);
+    uint8_t chunk[512];
+    TEST_ASSERT_TRUE(encoder->Encode(_image->GetView(), _quality, chunk, sizeof(chunk), writeTestJpeg, &out, _overlay));
+    delete encoder;
+    return out.data;
+}
+
+
+/* Reference boxes and ROI frames as drawn by the flows, some of them across the border and across MCU rows */
+static void addOverlayShapes(CImageOverlay *_overlay, CImageBasis *_draw)
+{
+    _overlay->AddRect(-3, 5, 30, 20, 255, 0, 0, 2);
+    _draw->drawRect(-3, 5, 30, 20, 255, 0, 0, 2);
+    _overlay->AddRect(40, 14, 50, 40, 0, 255, 0, 1);
+    _draw->drawRect(40, 14, 50, 40, 0, 255, 0, 1);
+    _overlay->AddEllipse(65, 34, 25, 20, 0, 255, 0, 2);
+    _draw->drawEllipse(65, 34, 25, 20, 0, 255, 0, 2);
+    _overlay->AddLine(65, 14, 65, 54, 0, 255, 0, 2);
+    _draw->drawLine(65, 14, 65, 54, 0, 255, 0, 2);
+    _overlay->AddLine(40, 34, 90, 34, 0, 255, 0, 2);
+    _draw->drawLine(40, 34, 90, 34, 0, 255, 0, 2);
+    _overlay->AddLine(10, 40, 60, 66, 255, 255, 0, 1);
+    _draw->drawLine(10, 40, 60, 66, 255, 255, 0, 1);
+    _overlay->AddRect(80, 60, 30, 20, 0, 0, 255, 2);       // Over the other shapes and out at the bottom right
+    _draw->drawRect(80, 60, 30, 20, 0, 0, 255, 2);
+}
+
+
+/**
+ * @brief Overlay drawn by the encoder: the same JPEG as drawing onto a copy and encoding the copy (both encoders,
+ * subsampled / full chroma, grayscale), the image itself stays unchanged
+ */
+void test_imageOverlay()
+{
+    const JpegEncoderType types[2] = {JPEG_ENCODER_FAST, JPEG_ENCODER_STB};
+    const int channels[2] = {3, 1};
+
+    for (int c = 0; c < 2; ++c) {
+        // Neither width nor height a multiple of the MCU size
+        CImageBasis *image = createTestImage("overlayImage", 100, 70, channels[c]);
+        uint8_t *pixels = image->rgb_image;
+
+        std::vector<uint8_t> original(pixels, pixels + 100 * 70 * channels[c]);
+
+        CImageBasis *drawn = new CImageBasis("overlayDrawn", 100, 70, channels[c]);
+        drawn->CopyFromMemory(pixels, 100 * 70 * channels[c]);
+
+        CImageOverlay overlay;
+        TEST_ASSERT_TRUE(overlay.Empty());
+        addOverlayShapes(&overlay, drawn);
+        TEST_ASSERT_EQUAL_INT(7, overlay.Items());
+
+        for (int t = 0; t < 2; ++t)
+            for (int quality = 80; quality <= 95; quality += 15) {
+                std::vector<uint8_t> expected = encodeOverlayJpeg(types[t], drawn, quality, NULL);
+                std::vector<uint8_t> composited = encodeOverlayJpeg(types[t], image, quality, &overlay);
+
+                TEST_ASSERT_EQUAL_INT(expected.size(), composited.size());
+                TEST_ASSERT_EQUAL_INT(0, memcmp(expected.data(), composited.data(), expected.size()));
+                TEST_ASSERT_EQUAL_INT(0, memcmp(original.data(), image->rgb_image, original.size()));
+            }
+
+        // Without the overlay (and with an empty one) the plain image
+        std::vector<uint8_t> plain = encodeOverlayJpeg(JPEG_ENCODER_FAST, image, 90, NULL);
+        overlay.Clear();
+        TEST_ASSERT_TRUE(overlay.Empty());
+        std::vector<uint8_t> cleared = encodeOverlayJpeg(JPEG_ENCODER_FAST, image, 90, &overlay);
+        TEST_ASSERT_EQUAL_INT(plain.size(), cleared.size());
+        TEST_ASSERT_EQUAL_INT(0, memcmp(plain.data(), cleared.data(), plain.size()));
+
+        delete drawn;
+        delete image;
+    }
+
+    // One round of alg_roi.jpg at VGA: copy of the frame, drawn and encoded, against the overlay drawn by the encoder
+    CImageBasis *frame = createTestImage("overlayFrame", 640, 480);
+
+    CImageOverlay overlay;
+    int64_t start = esp_timer_get_time();
+    CImageBasis *copy = new CImageBasis("overlayCopy", frame);
+    for (int i = 0; i < 8; ++i) {
+        copy->drawRect(20 + i * 70, 200, 60, 90, 0, 0, 255, 2);
+        overlay.AddRect(20 + i * 70, 200, 60, 90, 0, 0, 255, 2);
+    }
+    std::vector<uint8_t> expected = encodeOverlayJpeg(JPEG_ENCODER_FAST, copy, 90, NULL);
+    delete copy;
+    int64_t copied = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    std::vector<uint8_t> composited = encodeOverlayJpeg(JPEG_ENCODER_FAST, frame, 90, &overlay);
+    int64_t composed = esp_timer_get_time() - start;
+
+    TEST_ASSERT_EQUAL_INT(expected.size(), composited.size());
+    TEST_ASSERT_EQUAL_INT(0, memcmp(expected.data(), composited.data(), expected.size()));
+    printf("alg_roi.jpg 640x480: copy, draw and encode %lld us, overlay drawn by the encoder %lld us\n",
+           (long long)copied, (long long)composed);
+
+    delete frame;
+}
@@ -0,0 +1,235 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <vector>
+#include <CImageBasis.h>
+#include <CImageSlab.h>
+
+
+/* First-fit heap over a fixed capacity, like the PSRAM heap without the block headers */
+class SimulatedHeap
+{
+    public:
+        int allocations = 0;
+
+        SimulatedHeap(int _capacity) : memory(_capacity) { capacity = _capacity; };
+
+        uint8_t *Memory(int _offset) { return memory.data() + _offset; };
+        int Offset(uint8_t *_memory) { return _memory - memory.data(); };
+
+        /* Offset of the allocation, -1 if there is no free block large enough */
+        int Allocate(int _size) {
+            _size = (_size + 15) & ~15;
+            int start = 0;
+            for (std::map<int, int>::iterator it = used.begin(); it != used.end(); ++it) {
+                if (it->first - start >= _size)
+                    break;
+                start = it->first + it->second;
+            }
+            if (start + _size > capacity)
+                return -1;
+            used[start] = _size;
+            allocations++;
+            return start;
+        };
+
+        void Free(int _offset) { used.erase(_offset); };
+
+        int TotalFree() {
+            int total = capacity;
+            for (std::map<int, int>::iterator it = used.begin(); it != used.end(); ++it)
+                total -= it->second;
+            return total;
+        };
+
+        int LargestFree() {
+            int largest = 0, start = 0;
+            for (std::map<int, int>::iterator it = used.begin(); it != used.end(); ++it) {
+                largest = std::max(largest, it->first - start);
+                start = it->first + it->second;
+            }
+            return std::max(largest, capacity - start);
+        };
+
+    protected:
+        int capacity;
+        std::vector<uint8_t> memory;
+        std::map<int, int> used;        // Offset -> size
+};
+
+
+/* Block allocation of the slab on the simulated heap */
+static uint8_t *allocateSlabSimulated(void *_context, int _size)
+{
+    SimulatedHeap *heap = (SimulatedHeap *)_context;
+    int offset = heap->Allocate(_size);
+    return (offset >= 0) ? heap->Memory(offset) : NULL;
+}
+
+
+static void releaseSlabSimulated(void *_context, uint8_t *_block)
+{
+    SimulatedHeap *heap = (SimulatedHeap *)_context;
+    heap->Free(heap->Offset(_block));
+}
+
+
+#define SLAB_HEAP (96 * 1024)
+#define SLAB_RELOADS 8
+
+
+struct SlabConfig {
+    int rois;
+    int width, height;
+};
+
+
+/**
+ * Loads the ROI images of a config on the simulated heap like ClassFlowCNNGeneral::ReadParameter, separately or
+ * through the slab kept by the flow control (same size: the block is kept). Other tasks (MQTT outbox, web server)
+ * allocate while the flow is set up: one long-lived message every 2 ROI images.
+ */
+static void loadSlabConfig(SimulatedHeap &_heap, const SlabConfig &_config, CImageSlab *_slab, std::vector<int> &_images,
+        std::vector<int> &_messages)
+{
+    int size = CImageSlab::Bytes(_config.width, _config.height, 3);
+
+    for (int i = 0; i < _images.size(); ++i)
+        _heap.Free(_images[i]);
+    _images.clear();
+
+    // No block that large: separate images like CImageSlab::Carve, allocated on the simulated heap
+    bool slabbed = (_slab != NULL) && _slab->Reserve(_config.rois * size);
+
+    for (int i = 0; i < _config.rois; ++i) {
+        if (slabbed) {
+            TEST_ASSERT_NOT_NULL(_slab->Carve("simROI", _config.width, _config.height, 3));
+        }
+        else {
+            _images.push_back(_heap.Allocate(size));
+        }
+        if (i % 2 == 1) {
+            _messages.push_back(_heap.Allocate(400 + (i * 37) % 500));
+            TEST_ASSERT_TRUE(_messages.back() >= 0);
+        }
+    }
+
+    for (int i = 0; i < _images.size(); ++i) {
+        TEST_ASSERT_TRUE(_images[i] >= 0);
+    }
+    if (slabbed) {
+        TEST_ASSERT_EQUAL_INT(0, _slab->Separate());
+    }
+}
+
+
+/**
+ * Config loads of one flow, fragmentation (largest free block / total free) after each one.
+ * Half of the messages are delivered between the loads.
+ */
+static int simulateSlabReloads(bool _slab, const SlabConfig *_configs, int _loads, float *_ratio)
+{
+    SimulatedHeap heap(SLAB_HEAP);
+    CImageSlab slab("simSlab", allocateSlabSimulated, releaseSlabSimulated, &heap);
+    std::vector<int> images, messages;
+
+    int model = heap.Allocate(24 * 1024);               // Long-lived: the model, the reference images
+    TEST_ASSERT_TRUE(model >= 0);
+
+    for (int r = 0; r < _loads; ++r) {
+        std::vector<int> pending;
+        for (int i = 0; i < messages.size(); ++i) {
+            if (i % 2 == 0)
+                heap.Free(messages[i]);
+            else
+                pending.push_back(messages[i]);
+        }
+        messages = pending;
+
+        loadSlabConfig(heap, _configs[r], _slab ? &slab : NULL, images, messages);
+
+        _ratio[r] = (float) heap.LargestFree() / heap.TotalFree();
+        printf("  %-8s load %d (%2d x %2dx%2d): total free %6d, largest free block %6d (%3.0f%%)\n", _slab ? "slab" : "separate",
+                r, _configs[r].rois, _configs[r].width, _configs[r].height, heap.TotalFree(), heap.LargestFree(), 100 * _ratio[r]);
+    }
+
+    return heap.allocations;
+}
+
+
+/**
+ * @brief ROI images in one slab: contiguous and aligned, kept over a reload of the same size, separate images
+ * when the slab is full. Fragmentation of a capped heap over config reloads, separate images vs. slab.
+ */
+void test_imageSlab()
+{
+    CImageSlab slab("testSlab");
+    int size = CImageSlab::Bytes(20, 32, 3);
+    TEST_ASSERT_EQUAL_INT(1920, size);
+    TEST_ASSERT_EQUAL_INT(16, CImageSlab::Bytes(5, 1, 3));
+
+    TEST_ASSERT_TRUE(slab.Reserve(4 * size));
+    CImageBasis *first = slab.Carve("slab0", 20, 32, 3);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t) first->rgb_image % IMAGESLAB_ALIGN);
+    for (int i = 1; i < 4; ++i) {
+        CImageBasis *image = slab.Carve("slab" + std::to_string(i), 20, 32, 3);
+        TEST_ASSERT_TRUE(image->rgb_image == first->rgb_image + i * size);
+        TEST_ASSERT_EQUAL_INT(32, image->height);
+    }
+    TEST_ASSERT_EQUAL_INT(4 * size, slab.Used());
+
+    // Written like any other image, the neighbours are untouched
+    CImageBasis *second = new CImageBasis("slabCheck", first->rgb_image + size, 3, 20, 32, 3);
+    memset(second->rgb_image, 0x55, size);
+    first->setPixelColor(19, 31, 255, 255, 255);
+    TEST_ASSERT_EQUAL_UINT8(0x55, second->rgb_image[0]);
+    TEST_ASSERT_EQUAL_UINT8(255, first->rgb_image[size - 1]);
+    delete second;
+
+    // Full: separate image
+    CImageBasis *extra = slab.Carve("slabExtra", 20, 32, 3);
+    TEST_ASSERT_NOT_NULL(extra);
+    TEST_ASSERT_EQUAL_INT(1, slab.Separate());
+    TEST_ASSERT_EQUAL_INT(5, slab.Images());
+
+    // Reload with the same size keeps the block, another size gets a new one
+    uint8_t *block = first->rgb_image;
+    TEST_ASSERT_TRUE(slab.Reserve(4 * size));
+    TEST_ASSERT_EQUAL_INT(0, slab.Images());
+    TEST_ASSERT_EQUAL_INT(4 * size, slab.Size());
+    TEST_ASSERT_TRUE(slab.Carve("slabReload", 20, 32, 3)->rgb_image == block);
+
+    TEST_ASSERT_TRUE(slab.Reserve(3 * size));
+    TEST_ASSERT_EQUAL_INT(3 * size, slab.Size());
+
+    TEST_ASSERT_TRUE(slab.Reserve(8 * size));
+    TEST_ASSERT_EQUAL_INT(8 * size, slab.Size());
+    slab.Free();
+    TEST_ASSERT_EQUAL_INT(0, slab.Size());
+
+    // Fragmentation: largest free block vs. total free, before and after reloads of the same config and of changing configs
+    const SlabConfig same[4] = {{14, 20, 32}, {14, 20, 32}, {14, 20, 32}, {14, 20, 32}};
+    const SlabConfig changing[SLAB_RELOADS] = {{14, 20, 32}, {14, 32, 32}, {10, 20, 32}, {16, 32, 32},
+            {14, 20, 32}, {14, 32, 32}, {10, 20, 32}, {16, 32, 32}};
+    float separate[SLAB_RELOADS], slabbed[SLAB_RELOADS];
+
+    printf("ROI images on a simulated %d KB heap, 1 message every 2 ROIs, same config:\n", SLAB_HEAP / 1024);
+    int separateops = simulateSlabReloads(false, same, 4, separate);
+    int slabops = simulateSlabReloads(true, same, 4, slabbed);
+    printf("  allocations: separate %d, slab %d\n", separateops, slabops);
+
+    // The messages alone: a reload of the same config doesn't touch the heap for the images
+    TEST_ASSERT_EQUAL_INT(separateops - 4 * 14 + 1, slabops);
+    for (int r = 0; r < 4; ++r) {
+        TEST_ASSERT_TRUE(slabbed[r] >= 0.9);
+    }
+
+    // A new block for another model size: the freed block can be split by later small allocations
+    printf("changing configs:\n");
+    separateops = simulateSlabReloads(false, changing, SLAB_RELOADS, separate);
+    slabops = simulateSlabReloads(true, changing, SLAB_RELOADS, slabbed);
+    printf("  allocations: separate %d, slab %d\n", separateops, slabops);
+    TEST_ASSERT_TRUE(slabops < separateops);
+}
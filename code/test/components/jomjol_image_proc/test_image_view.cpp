@@ -0,0 +1,233 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <CImageBasis.h>
+#include <CAlignAndCutImage.h>
+#include <CRoiSampler.h>
+
+
+/**
+ * @brief ROI views: resize and JPEG encoding of a view must give the same result as the copy of CutAndSave,
+ * drawing on a view is clipped to the rectangle. Prints the time of cut + resize against resize of the view.
+ */
+void test_imageView()
+{
+    const int roi[4] = {452, 199, 120, 120};     // main.ana1 of the demo configuration
+
+    CAlignAndCutImage *image = new CAlignAndCutImage("view", "/sdcard/demo/530.07077.jpg");
+    TEST_ASSERT_TRUE(image->ImageOkay());
+
+    ImageView view = image->GetView(roi[0], roi[1], roi[2], roi[3]);
+    TEST_ASSERT_TRUE(view.Valid());
+    TEST_ASSERT_EQUAL_INT(roi[2], view.width);
+    TEST_ASSERT_EQUAL_INT(image->width * 3, view.stride);
+    TEST_ASSERT_TRUE(view.data == image->rgb_image + 3 * (roi[1] * image->width + roi[0]));
+
+    // Clipped at the image border
+    ImageView border = image->GetView(image->width - 10, -5, 20, 20);
+    TEST_ASSERT_EQUAL_INT(10, border.width);
+    TEST_ASSERT_EQUAL_INT(15, border.height);
+
+    // Resize: copy of the ROI against the view
+    CImageBasis *copied = new CImageBasis("copied", 32, 32, 3);
+    CImageBasis *viewed = new CImageBasis("viewed", 32, 32, 3);
+
+    int64_t start = esp_timer_get_time();
+    CImageBasis *org = new CImageBasis("org", roi[2], roi[3], 3);
+    image->CutAndSave(roi[0], roi[1], roi[2], roi[3], org);
+    org->Resize(32, 32, copied);
+    int64_t t_copy = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    CImageBasis::Resize(view, viewed);
+    int64_t t_view = esp_timer_get_time() - start;
+
+    printf("ROI %d x %d to 32 x 32: cut + resize %lld us, resize of the view %lld us\n",
+            roi[2], roi[3], (long long)t_copy, (long long)t_view);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(copied->rgb_image, viewed->rgb_image, 32 * 32 * 3));
+
+    // JPEG of the view equals the JPEG of the copy
+    CImageBasis::SaveToFile(view, "/sdcard/img_tmp/test_view.jpg");
+    org->SaveToFile("/sdcard/img_tmp/test_copy.jpg");
+    CImageBasis *fromview = new CImageBasis("fromview", "/sdcard/img_tmp/test_view.jpg");
+    CImageBasis *fromcopy = new CImageBasis("fromcopy", "/sdcard/img_tmp/test_copy.jpg");
+    TEST_ASSERT_EQUAL_INT(roi[2], fromview->width);
+    TEST_ASSERT_EQUAL_INT(roi[3], fromview->height);
+    TEST_ASSERT_EQUAL_INT(0, memcmp(fromcopy->rgb_image, fromview->rgb_image, roi[2] * roi[3] * 3));
+
+    // Drawing on the view stays inside the rectangle
+    uint8_t above = image->GetPixelColor(roi[0] + 10, roi[1] - 1, 0);
+    CImageBasis::drawRect(view, 0, 0, roi[2] - 1, roi[3] - 1, 0, 0, 0, 2);
+    TEST_ASSERT_EQUAL_UINT8(0, image->GetPixelColor(roi[0], roi[1] + 10, 1));
+    TEST_ASSERT_EQUAL_UINT8(0, image->GetPixelColor(roi[0] + roi[2] - 1, roi[1] + 10, 2));
+    TEST_ASSERT_EQUAL_UINT8(above, image->GetPixelColor(roi[0] + 10, roi[1] - 1, 0));
+
+    delete fromcopy;
+    delete fromview;
+    delete org;
+    delete viewed;
+    delete copied;
+    delete image;
+}
+
+
+/**
+ * @brief ROI resampling without intermediate image: integer reduction has to give the box average,
+ * the demo ROIs have to be close to the stbir resize. Prints the time against cut + resize.
+ */
+void test_roiSampler()
+{
+    const int rois[2][4] = {{438, 62, 49, 71}, {452, 199, 120, 120}};     // main.dig1, main.ana1
+    const int modelsize[2][2] = {{20, 32}, {32, 32}};
+
+    CAlignAndCutImage *image = new CAlignAndCutImage("sampler", "/sdcard/demo/530.07077.jpg");
+    TEST_ASSERT_TRUE(image->ImageOkay());
+
+    // 120 x 120 -> 30 x 30: exactly the 4 x 4 box average
+    ImageView view = image->GetView(rois[1][0], rois[1][1], 120, 120);
+    CImageBasis *box = new CImageBasis("box", 30, 30, 3);
+    TEST_ASSERT_TRUE(CRoiSampler::Resample(view, box));
+    for (int y = 0; y < 30; ++y)
+        for (int x = 0; x < 30; ++x)
+            for (int ch = 0; ch < 3; ++ch) {
+                int sum = 0;
+                for (int yy = 0; yy < 4; ++yy)
+                    for (int xx = 0; xx < 4; ++xx)
+                        sum += view.Pixel(4 * x + xx, 4 * y + yy)[ch];
+                TEST_ASSERT_INT_WITHIN(1, (sum + 8) / 16, box->GetPixelColor(x, y, ch));
+            }
+    delete box;
+
+    // Identity
+    CImageBasis *same = new CImageBasis("same", 49, 71, 3);
+    TEST_ASSERT_TRUE(CRoiSampler::Resample(image->GetView(rois[0][0], rois[0][1], 49, 71), same));
+    for (int y = 0; y < 71; ++y)
+        TEST_ASSERT_EQUAL_INT(0, memcmp(image->GetView(rois[0][0], rois[0][1], 49, 71).Pixel(0, y), same->rgb_image + y * 49 * 3, 49 * 3));
+    delete same;
+
+    for (int r = 0; r < 2; ++r) {
+        int w = modelsize[r][0], h = modelsize[r][1];
+        CImageBasis *resized = new CImageBasis("resized", w, h, 3);
+        CImageBasis *sampled = new CImageBasis("sampled", w, h, 3);
+
+        int64_t start = esp_timer_get_time();
+        CImageBasis *org = new CImageBasis("org", rois[r][2], rois[r][3], 3);
+        image->CutAndSave(rois[r][0], rois[r][1], rois[r][2], rois[r][3], org);
+        org->Resize(w, h, resized);
+        int64_t t_resize = esp_timer_get_time() - start;
+
+        // Row by row into a line buffer, as CTfLiteClass::LoadInputImage does for the input tensor
+        start = esp_timer_get_time();
+        CRoiSampler sampler;
+        TEST_ASSERT_TRUE(sampler.Init(image->GetView(rois[r][0], rois[r][1], rois[r][2], rois[r][3]), w, h));
+        for (int y = 0; y < h; ++y)
+            sampler.Row(y, sampled->rgb_image + y * w * 3);
+        int64_t t_sampler = esp_timer_get_time() - start;
+
+        int64_t sum = 0;
+        for (int i = 0; i < w * h * 3; ++i)
+            sum += abs(resized->rgb_image[i] - sampled->rgb_image[i]);
+        float meandiff = (float)sum / (w * h * 3);
+
+        printf("ROI %d x %d -> %d x %d: cut + resize %lld us, sampler %lld us, mean difference %.2f\n",
+                rois[r][2], rois[r][3], w, h, (long long)t_resize, (long long)t_sampler, meandiff);
+        TEST_ASSERT_TRUE(meandiff < 4);
+
+        delete org;
+        delete sampled;
+        delete resized;
+    }
+
+    delete image;
+}
+
+
+/**
+ * @brief Cached resampling plans: one plan per geometry, same result as a plan of its own, a second sampler on the
+ * same plan gets its own line, plans in use survive Invalidate. Prints time per ROI and the plan memory allocated
+ * per round with and without the cache.
+ */
+void test_roiSamplerPlans()
+{
+    // Digits and analog pointers of a typical configuration
+    const int rois[8][4] = {{438, 62, 49, 71}, {490, 62, 49, 71}, {542, 62, 49, 71}, {386, 62, 49, 71},
+                            {452, 199, 120, 120}, {300, 199, 120, 120}, {150, 230, 120, 120}, {20, 250, 120, 120}};
+    const int modelsize[8][2] = {{20, 32}, {20, 32}, {20, 32}, {20, 32}, {32, 32}, {32, 32}, {32, 32}, {32, 32}};
+
+    CAlignAndCutImage *image = new CAlignAndCutImage("plans", "/sdcard/demo/530.07077.jpg");
+    TEST_ASSERT_TRUE(image->ImageOkay());
+
+    RoiSamplerCache.Invalidate();
+    uint8_t cachedrow[32 * 3], ownrow[32 * 3], secondrow[32 * 3];
+
+    for (int r = 0; r < 8; ++r) {
+        ImageView view = image->GetView(rois[r][0], rois[r][1], rois[r][2], rois[r][3]);
+        int w = modelsize[r][0], h = modelsize[r][1];
+
+        CRoiSampler cached, own, second;
+        TEST_ASSERT_TRUE(cached.Init(view, w, h));
+        TEST_ASSERT_TRUE(own.Init(view, w, h, false));
+        TEST_ASSERT_TRUE(second.Init(view, w, h));           // Same plan at the same time
+
+        for (int y = 0; y < h; ++y) {
+            cached.Row(y, cachedrow);
+            second.Row(h - 1 - y, secondrow);               // Interleaved, the lines must not be shared
+            own.Row(y, ownrow);
+            TEST_ASSERT_EQUAL_INT(0, memcmp(cachedrow, ownrow, w * 3));
+            second.Row(y, secondrow);
+            TEST_ASSERT_EQUAL_INT(0, memcmp(cachedrow, secondrow, w * 3));
+        }
+
+        // In use: kept
+        RoiSamplerCache.Invalidate();
+        TEST_ASSERT_EQUAL_INT(1, RoiSamplerCache.Plans());
+    }
+
+    // 8 ROIs but 2 geometries
+    RoiSamplerCache.Invalidate();
+    TEST_ASSERT_EQUAL_INT(0, RoiSamplerCache.Plans());
+    uint32_t hits = RoiSamplerCache.hits, misses = RoiSamplerCache.misses;
+    for (int r = 0; r < 8; ++r) {
+        CRoiSampler sampler;
+        TEST_ASSERT_TRUE(sampler.Init(image->GetView(rois[r][0], rois[r][1], rois[r][2], rois[r][3]), modelsize[r][0], modelsize[r][1]));
+    }
+    TEST_ASSERT_EQUAL_INT(2, RoiSamplerCache.Plans());
+    TEST_ASSERT_EQUAL_UINT32(misses + 2, RoiSamplerCache.misses);
+    TEST_ASSERT_EQUAL_UINT32(hits + 6, RoiSamplerCache.hits);
+
+    // Rounds of all ROIs: plan computed per ROI against taken from the cache
+    // Rounds of all ROIs: plan computed per ROI against taken from the cache. Without the cache every ROI
+    // allocates its plan (4 vectors), with the cache nothing is allocated after the first round.
+    const int rounds = 20;
+    int64_t time[2];
+    int perround = 0;
+    uint32_t cachemisses = RoiSamplerCache.misses;
+
+    for (int r = 0; r < 8; ++r) {
+        RoiSamplerPlan plan;
+        plan.Build(rois[r][2], rois[r][3], modelsize[r][0], modelsize[r][1], 3);
+        perround += plan.Bytes();
+    }
+
+    for (int c = 0; c < 2; ++c) {
+        int64_t start = esp_timer_get_time();
+        for (int round = 0; round < rounds; ++round)
+            for (int r = 0; r < 8; ++r) {
+                int w = modelsize[r][0], h = modelsize[r][1];
+                CRoiSampler sampler;
+                sampler.Init(image->GetView(rois[r][0], rois[r][1], rois[r][2], rois[r][3]), w, h, c == 1);
+                for (int y = 0; y < h; ++y)
+                    sampler.Row(y, cachedrow);
+            }
+        time[c] = esp_timer_get_time() - start;
+    }
+
+    printf("ROI resampling, %d rounds of 8 ROIs: plan per ROI %lld us/ROI, %d bytes in %d allocations per round; "
+           "cached plans %lld us/ROI, no allocations (%d plans, %d bytes kept)\n",
+           rounds, (long long)(time[0] / (rounds * 8)), perround, 8 * 4,
+           (long long)(time[1] / (rounds * 8)), RoiSamplerCache.Plans(), RoiSamplerCache.Bytes());
+    TEST_ASSERT_EQUAL_UINT32(cachemisses, RoiSamplerCache.misses);
+
+    RoiSamplerCache.Invalidate();
+    delete image;
+}
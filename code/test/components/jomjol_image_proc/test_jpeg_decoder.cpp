@@ -0,0 +1,265 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <vector>
+#include <CImageBasis.h>
+#include <CJpegDecoder.h>
+#include <CAlignAndCutImage.h>
+#include <CRotateImage.h>
+#include <CAffineTransform.h>
+
+
+static uint8_t *readFile(const char *_file, int &_len)
+{
+    FILE *f = fopen(_file, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    _len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *)malloc(_len);
+    fread(data, 1, _len, f);
+    fclose(f);
+    return data;
+}
+
+
+/**
+ * @brief Streaming decoder against stbi on the demo images (full image), region decode only writes the MCUs
+ * of the regions with the same result as the full decode. Prints time, entropy bytes read and bytes written.
+ */
+void test_jpegDecoderRegions()
+{
+    const char *files[] = {"/sdcard/demo/530.07077.jpg", "/sdcard/demo/531.24108.jpg"};
+    // Alignment marks and a digit / pointer area of the demo configuration
+    std::vector<JpegRegion> regions = {{18, 177, 81, 55}, {524, 101, 68, 75}, {290, 170, 160, 70}};
+
+    for (int f = 0; f < sizeof(files) / sizeof(files[0]); ++f) {
+        int len = 0;
+        uint8_t *jpeg = readFile(files[f], len);
+        TEST_ASSERT_NOT_NULL(jpeg);
+
+        int w, h;
+        TEST_ASSERT_TRUE(CJpegDecoder::GetSize(jpeg, len, w, h));
+
+        CImageBasis *reference = new CImageBasis("stbi");
+        int64_t start = esp_timer_get_time();
+        reference->LoadFromMemory(jpeg, len);
+        int64_t t_stbi = esp_timer_get_time() - start;
+        TEST_ASSERT_EQUAL_INT(w, reference->width);
+
+        CJpegDecoder *decoder = new CJpegDecoder();
+        uint8_t *full = (uint8_t *)malloc(w * h * 3);
+        start = esp_timer_get_time();
+        TEST_ASSERT_TRUE(decoder->Decode(jpeg, len, full, w, h));
+        int64_t t_full = esp_timer_get_time() - start;
+        int full_entropy = decoder->entropy_bytes;
+
+        // stbi upsamples chroma with a filter, we replicate: small differences at color edges
+        int64_t sum = 0;
+        for (int i = 0; i < w * h * 3; ++i)
+            sum += abs(full[i] - reference->rgb_image[i]);
+        float meandiff = (float)sum / (w * h * 3);
+
+        uint8_t *partial = (uint8_t *)malloc(w * h * 3);
+        memset(partial, 0x5A, w * h * 3);      // Content of the last round, must not remain
+        start = esp_timer_get_time();
+        TEST_ASSERT_TRUE(decoder->Decode(jpeg, len, partial, w, h, &regions));
+        int64_t t_regions = esp_timer_get_time() - start;
+
+        for (const JpegRegion &r : regions)
+            for (int y = r.y; y < r.y + r.dy; ++y)
+                TEST_ASSERT_EQUAL_INT(0, memcmp(full + 3 * (y * w + r.x), partial + 3 * (y * w + r.x), 3 * r.dx));
+
+        // Every pixel is decoded (MCUs touching a region) or filled
+        const uint8_t black[3] = {JPEG_SKIPPED_FILL, JPEG_SKIPPED_FILL, JPEG_SKIPPED_FILL};
+        int filled = 0;
+        for (int i = 0; i < w * h * 3; i += 3) {
+            bool isfilled = (memcmp(partial + i, black, 3) == 0);
+            TEST_ASSERT_TRUE(isfilled || (memcmp(partial + i, full + i, 3) == 0));
+            filled += isfilled;
+        }
+        TEST_ASSERT_TRUE(filled > w * h / 4);
+
+        printf("%s: LoadFromMemory %lld us, full %lld us (mean difference %.2f, %d entropy bytes), regions %lld us "
+               "(%d MCUs decoded, %d skipped, %d of %d entropy bytes, %d of %d bytes written)\n",
+                files[f], (long long)t_stbi, (long long)t_full, meandiff, full_entropy, (long long)t_regions,
+                decoder->mcus_decoded, decoder->mcus_skipped, decoder->entropy_bytes, full_entropy,
+                decoder->output_bytes, w * h * 3);
+
+        TEST_ASSERT_TRUE(meandiff < 1.5);
+        TEST_ASSERT_TRUE(decoder->output_bytes < w * h * 3 / 4);
+        TEST_ASSERT_TRUE(decoder->entropy_bytes <= full_entropy);
+
+        free(partial);
+        free(full);
+        delete decoder;
+        delete reference;
+        free(jpeg);
+    }
+}
+
+
+/* Mean absolute difference of _scaled against the _scale x _scale box average of _full */
+static float meanDifferenceToBoxAverage(CImageBasis *_full, CImageBasis *_scaled, int _scale)
+{
+    int64_t sum = 0;
+    for (int y = 0; y < _scaled->height; ++y)
+        for (int x = 0; x < _scaled->width; ++x)
+            for (int ch = 0; ch < 3; ++ch) {
+                int box = 0, count = 0;
+                for (int ys = y * _scale; ys < std::min((y + 1) * _scale, _full->height); ++ys)
+                    for (int xs = x * _scale; xs < std::min((x + 1) * _scale, _full->width); ++xs, ++count)
+                        box += _full->rgb_image[3 * (ys * _full->width + xs) + ch];
+                sum += abs(_scaled->rgb_image[3 * (y * _scaled->width + x) + ch] - (box + count / 2) / count);
+            }
+    return (float)sum / (_scaled->width * _scaled->height * 3);
+}
+
+
+/**
+ * @brief Decode with scale 1/2, 1/4, 1/8 in the DCT domain against decode and resize (stbir_resize_uint8),
+ * the result has to match the box average of the full image
+ */
+void test_jpegDecoderScaled()
+{
+    const int scales[] = {2, 4, 8};
+
+    int len = 0;
+    uint8_t *jpeg = readFile("/sdcard/demo/530.07077.jpg", len);
+    TEST_ASSERT_NOT_NULL(jpeg);
+
+    CImageBasis *full = new CImageBasis("full");
+    full->LoadFromMemory(jpeg, len);
+
+    for (int s = 0; s < sizeof(scales) / sizeof(scales[0]); ++s) {
+        CImageBasis *resized = new CImageBasis("resized");
+        int64_t start = esp_timer_get_time();
+        resized->LoadFromMemory(jpeg, len);
+        int w = CJpegDecoder::ScaledSize(resized->width, scales[s]);
+        int h = CJpegDecoder::ScaledSize(resized->height, scales[s]);
+        resized->Resize(w, h);
+        int64_t t_resize = esp_timer_get_time() - start;
+
+        CImageBasis *scaled = new CImageBasis("scaled");
+        start = esp_timer_get_time();
+        scaled->LoadFromMemory(jpeg, len, scales[s]);
+        int64_t t_scaled = esp_timer_get_time() - start;
+
+        TEST_ASSERT_EQUAL_INT(w, scaled->width);
+        TEST_ASSERT_EQUAL_INT(h, scaled->height);
+
+        float diff_box = meanDifferenceToBoxAverage(full, scaled, scales[s]);
+        float diff_resize = meanDifferenceToBoxAverage(full, resized, scales[s]);
+
+        printf("Scale 1/%d (%d x %d): decode + resize %lld us (mean difference to box average %.2f), "
+               "DCT scaled %lld us (%.2f)\n",
+                scales[s], w, h, (long long)t_resize, diff_resize, (long long)t_scaled, diff_box);
+        TEST_ASSERT_TRUE(diff_box < 3);
+
+        delete scaled;
+        delete resized;
+    }
+
+    delete full;
+    free(jpeg);
+}
+
+
+/* One round of the demo configuration (sd-card/demo/config.ini) with 3 or 1 channel: decode, initial rotation,
+ * alignment on the two references, cut and resize of one digit and one analog ROI to the model size.
+ * Returns the time, _traffic the bytes of the images read and written by the stages (without template search). */
+static int64_t demoRound(uint8_t *_jpeg, int _len, int _channels, CImageBasis **_roi, RefInfo *_refs, int &_traffic)
+{
+    const int rois[2][4] = {{438, 62, 49, 71}, {452, 199, 120, 120}};     // main.dig1, main.ana1
+    const int modelsize[2][2] = {{20, 32}, {32, 32}};
+
+    int w, h;
+    CJpegDecoder::GetSize(_jpeg, _len, w, h);
+    CImageBasis *image = new CImageBasis("round", w, h, _channels);
+    CImageBasis *tmp = new CImageBasis("roundTmp", w, h, _channels);
+
+    int64_t start = esp_timer_get_time();
+
+    CJpegDecoder *decoder = new CJpegDecoder();
+    TEST_ASSERT_TRUE(decoder->Decode(_jpeg, _len, image->rgb_image, w, h, NULL, 1, _channels));
+    _traffic = decoder->output_bytes;
+    delete decoder;
+
+    CAlignAndCutImage *caic = new CAlignAndCutImage("roundAlign", image, tmp);
+    CAffineTransform initial(w, h);
+    initial.Rotate(-34.6, w / 2, h / 2);
+    CRotateImage rt("roundRotate", caic, tmp);
+    rt.Warp(initial, true, false);
+    caic->Align(_refs, 2, &initial);
+    _traffic += 4 * w * h * _channels;          // Two warps, each reads and writes the image
+
+    for (int r = 0; r < 2; ++r) {
+        _roi[r] = new CImageBasis("roundModel", modelsize[r][0], modelsize[r][1], _channels);
+        CImageBasis::Resize(caic->GetView(rois[r][0], rois[r][1], rois[r][2], rois[r][3]), _roi[r]);
+        _traffic += (rois[r][2] * rois[r][3] + modelsize[r][0] * modelsize[r][1]) * _channels;
+    }
+
+    int64_t duration = esp_timer_get_time() - start;
+
+    delete caic;
+    delete tmp;
+    delete image;
+    return duration;
+}
+
+
+/**
+ * @brief Benchmark of a full demo round in RGB and in luminance mode (TakeImage LuminanceOnly):
+ * both modes have to find the references at the same position, the luminance ROIs have to match
+ * the luminance of the RGB ROIs. Prints time and image traffic of both modes.
+ */
+void test_luminancePipeline()
+{
+    const int channels[] = {3, 1};
+    CImageBasis *roi[2][2];
+    RefInfo refs[2][2];
+    int64_t duration[2];
+    int traffic[2];
+
+    int len = 0;
+    uint8_t *jpeg = readFile("/sdcard/demo/530.07077.jpg", len);
+    TEST_ASSERT_NOT_NULL(jpeg);
+
+    for (int m = 0; m < 2; ++m) {
+        for (int r = 0; r < 2; ++r) {
+            refs[m][r].image_file = (r == 0) ? "/sdcard/demo/ref0.jpg" : "/sdcard/demo/ref1.jpg";
+            refs[m][r].target_x = (r == 0) ? 30 : 536;
+            refs[m][r].target_y = (r == 0) ? 189 : 113;
+            refs[m][r].search_x = refs[m][r].search_y = 20;
+        }
+
+        duration[m] = demoRound(jpeg, len, channels[m], roi[m], refs[m], traffic[m]);
+    }
+
+    for (int r = 0; r < 2; ++r) {
+        TEST_ASSERT_INT_WITHIN(1, refs[0][r].found_x, refs[1][r].found_x);
+        TEST_ASSERT_INT_WITHIN(1, refs[0][r].found_y, refs[1][r].found_y);
+
+        int pixels = roi[0][r]->width * roi[0][r]->height;
+        uint8_t *gray = (uint8_t *)malloc(pixels);
+        CImageBasis::CopyPixels(roi[0][r]->rgb_image, 3, gray, 1, pixels);
+
+        int64_t sum = 0;
+        for (int i = 0; i < pixels; ++i)
+            sum += abs(gray[i] - roi[1][r]->rgb_image[i]);
+        float meandiff = (float)sum / pixels;
+        printf("ROI %d: mean difference luminance mode to luminance of RGB mode %.2f\n", r, meandiff);
+        TEST_ASSERT_TRUE(meandiff < 3);
+
+        free(gray);
+        delete roi[0][r];
+        delete roi[1][r];
+    }
+
+    printf("Demo round RGB: %lld us, %d bytes image traffic; luminance: %lld us, %d bytes (%.1fx less)\n",
+            (long long)duration[0], traffic[0], (long long)duration[1], traffic[1], (float)traffic[0] / traffic[1]);
+    TEST_ASSERT_EQUAL_INT(traffic[0], 3 * traffic[1]);
+
+    free(jpeg);
+}
@@ -0,0 +1,145 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <CImageBasis.h>
+#include <CJpegEncoder.h>
+#include "test_image_helpers.h"
+
+
+/* PSNR in dB of the decoded JPEG against the view, 0 if it can't be decoded */
+static double encodedPSNR(const TestJpeg &_jpeg, const ImageView &_view)
+{
+    int w, h, ch;
+    uint8_t *decoded = stbi_load_from_memory(_jpeg.data.data(), _jpeg.data.size(), &w, &h, &ch, _view.channels);
+    if ((decoded == NULL) || (w != _view.width) || (h != _view.height))
+        return 0;
+
+    double sum = 0;
+    for (int y = 0; y < h; ++y)
+        for (int i = 0; i < w * _view.channels; ++i) {
+            double d = (double)decoded[y * w * _view.channels + i] - _view.Pixel(0, y)[i];
+            sum += d * d;
+        }
+    stbi_image_free(decoded);
+
+    double mse = sum / ((double)w * h * _view.channels);
+    return (mse > 0) ? 10 * log10(255.0 * 255.0 / mse) : 99;
+}
+
+
+/**
+ * @brief Integer DCT encoder: odd sizes, gray and RGB, a strided view and all qualities decode with a PSNR close to stb,
+ * the output arrives in chunks of the requested size, the encoding stops when the write function refuses a chunk
+ */
+void test_jpegEncoder()
+{
+    const int sizes[][2] = {{64, 48}, {37, 21}, {8, 8}, {1, 1}};
+
+    for (int s = 0; s < 4; ++s)
+        for (int ch = 1; ch <= 3; ch += 2) {
+            CImageBasis *image = createTestImage("encoderPattern", sizes[s][0], sizes[s][1], ch);
+
+            for (int quality = 20; quality <= 100; quality += 40) {
+                CJpegEncoder *fast = CJpegEncoder::Create(JPEG_ENCODER_FAST);
+                CJpegEncoder *stb = CJpegEncoder::Create(JPEG_ENCODER_STB);
+                uint8_t chunk[100];
+
+                TestJpeg a, b;
+                TEST_ASSERT_TRUE(fast->Encode(image->GetView(), quality, chunk, sizeof(chunk), writeTestJpeg, &a));
+                TEST_ASSERT_TRUE(stb->Encode(image->GetView(), quality, chunk, sizeof(chunk), writeTestJpeg, &b));
+                TEST_ASSERT_EQUAL_INT(a.data.size(), fast->output_bytes);
+                TEST_ASSERT_EQUAL_INT(a.calls, fast->chunks);
+                for (int i = 0; i + 1 < a.sizes.size(); ++i)
+                    TEST_ASSERT_EQUAL_INT(sizeof(chunk), a.sizes[i]);
+                TEST_ASSERT_TRUE((a.sizes.back() > 0) && (a.sizes.back() <= sizeof(chunk)));
+
+                double psnr_fast = encodedPSNR(a, image->GetView());
+                double psnr_stb = encodedPSNR(b, image->GetView());
+                TEST_ASSERT_TRUE(psnr_fast > 15);         // Chroma edges of the pattern suffer from the subsampling
+                TEST_ASSERT_TRUE(psnr_fast > psnr_stb - 1.5);
+
+                delete fast;
+                delete stb;
+            }
+            delete image;
+        }
+
+    // Strided view of a part of the image, no copy
+    CImageBasis *image = createTestImage("encoderPattern", 120, 90);
+    ImageView view = image->GetView(13, 7, 50, 33);
+    CJpegEncoder *encoder = CJpegEncoder::Create();
+    uint8_t chunk[HTTP_BUFFER_SENT];
+
+    CJpegEncoder *stb = CJpegEncoder::Create(JPEG_ENCODER_STB);
+    TestJpeg part, stbpart;
+    TEST_ASSERT_TRUE(encoder->Encode(view, 90, chunk, sizeof(chunk), writeTestJpeg, &part));
+    TEST_ASSERT_TRUE(stb->Encode(view, 90, chunk, sizeof(chunk), writeTestJpeg, &stbpart));
+    TEST_ASSERT_TRUE(encodedPSNR(part, view) > 15);
+    TEST_ASSERT_TRUE(encodedPSNR(part, view) > encodedPSNR(stbpart, view) - 1.5);
+    delete stb;
+
+    // Aborted by the write function: no more chunks after the refused one
+    TestJpeg limited;
+    limited.limit = 2 * HTTP_BUFFER_SENT;
+    TEST_ASSERT_FALSE(encoder->Encode(image->GetView(), 100, chunk, sizeof(chunk), writeTestJpeg, &limited));
+    TEST_ASSERT_EQUAL_INT(3, limited.calls);
+    TEST_ASSERT_EQUAL_INT(2 * HTTP_BUFFER_SENT, encoder->output_bytes);
+
+    // Invalid input
+    TEST_ASSERT_FALSE(encoder->Encode(ImageView(), 90, chunk, sizeof(chunk), writeTestJpeg, &limited));
+
+    delete encoder;
+    delete image;
+}
+
+
+/**
+ * @brief Quality vs. bytes vs. time of the encoders on a demo image (RGB) and its luminance
+ */
+void test_jpegEncoderBenchmark()
+{
+    CImageBasis *image = new CImageBasis("encoderDemo", "/sdcard/demo/530.07077.jpg");
+    TEST_ASSERT_NOT_NULL(image->rgb_image);
+
+    CImageBasis *gray = new CImageBasis("encoderGray", image->width, image->height, 1);
+    CImageBasis::CopyPixels(image->rgb_image, 3, gray->RGBImageLock(), 1, image->width * image->height);
+    gray->RGBImageRelease();
+
+    const int qualities[] = {50, 75, 90, 95};
+    uint8_t chunk[HTTP_BUFFER_SENT];
+
+    printf("JPEG encoder %dx%d: encoder, channels, quality, bytes, us, PSNR dB\n", image->width, image->height);
+
+    for (int g = 0; g < 2; ++g) {
+        CImageBasis *source = (g == 0) ? image : gray;
+
+        for (int q = 0; q < 4; ++q) {
+            int64_t time[2];
+            int bytes[2];
+            double psnr[2];
+
+            for (int e = 0; e < 2; ++e) {
+                CJpegEncoder *encoder = CJpegEncoder::Create((e == 0) ? JPEG_ENCODER_FAST : JPEG_ENCODER_STB);
+                TestJpeg out;
+                out.data.reserve(MAX_JPG_SIZE);
+
+                int64_t start = esp_timer_get_time();
+                TEST_ASSERT_TRUE(encoder->Encode(source->GetView(), qualities[q], chunk, sizeof(chunk), writeTestJpeg, &out));
+                time[e] = esp_timer_get_time() - start;
+                bytes[e] = out.data.size();
+                psnr[e] = encodedPSNR(out, source->GetView());
+
+                printf("  %-4s %d %3d %7d %8lld %6.2f\n", encoder->Name(), source->channels, qualities[q], bytes[e], (long long)time[e], psnr[e]);
+                delete encoder;
+            }
+
+            TEST_ASSERT_TRUE(psnr[0] > 28);
+            TEST_ASSERT_TRUE(psnr[0] > psnr[1] - 1.0);
+        }
+    }
+
+    delete gray;
+    delete image;
+}
@@ -0,0 +1,231 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <CImageBasis.h>
+#include <CPixelKernels.h>
+#include "test_image_helpers.h"
+
+
+/* Scalar reference implementations: the per-pixel loops of CImageBasis before the kernels */
+static void referenceContrast(uint8_t *_data, int _size, float _contrast)
+{
+    float contrast = (_contrast / 100) + 1;
+    float intercept = 128 * (1 - contrast);
+    for (int i = 0; i < _size; ++i)
+        _data[i] = (uint8_t)std::min(255, std::max(0, (int)(_data[i] * contrast + intercept)));
+}
+
+
+static void referenceBrightness(uint8_t *_data, int _size, int _offset)
+{
+    for (int i = 0; i < _size; ++i)
+        _data[i] = (uint8_t)std::min(255, std::max(0, _data[i] + _offset));
+}
+
+
+static void referenceNegate(uint8_t *_data, int _size)
+{
+    for (int i = 0; i < _size; ++i)
+        _data[i] = 255 - _data[i];
+}
+
+
+static void referenceExtractChannel(const uint8_t *_source, int _channels, int _channel, uint8_t *_target, int _pixels)
+{
+    for (int i = 0; i < _pixels; ++i)
+        _target[i] = _source[i * _channels + _channel];
+}
+
+
+static void referenceFill(uint8_t *_data, int _pixels, int _channels, const uint8_t *_color)
+{
+    for (int i = 0; i < _pixels; ++i)
+        for (int ch = 0; ch < _channels; ++ch)
+            _data[i * _channels + ch] = _color[ch];
+}
+
+
+static void referenceSetPixel(const ImageView &_view, int _x, int _y, const uint8_t *_color)
+{
+    if ((_x < 0) || (_x >= _view.width) || (_y < 0) || (_y >= _view.height))
+        return;
+    for (int ch = 0; ch < _view.channels; ++ch)
+        _view.Pixel(_x, _y)[ch] = _color[ch];
+}
+
+
+static void referenceDrawRect(const ImageView &_view, int _x, int _y, int _dx, int _dy, const uint8_t *_color, int _thickness)
+{
+    for (int t = 0; t < _thickness; t++) {
+        for (int x = _x - _thickness + 1; x <= _x + _dx + _thickness - 1; ++x) {
+            referenceSetPixel(_view, x, _y - t, _color);
+            referenceSetPixel(_view, x, _y + _dy + t, _color);
+        }
+        for (int y = _y; y <= _y + _dy; ++y) {
+            referenceSetPixel(_view, _x - t, y, _color);
+            referenceSetPixel(_view, _x + _dx + t, y, _color);
+        }
+    }
+}
+
+
+/**
+ * @brief Every kernel against its scalar reference for all alignments of the buffer and sizes around
+ * the word and vector lengths (head, body and tail), drawRect against the per-pixel frame incl. clipping
+ */
+void test_pixelKernels()
+{
+    const int maxsize = 200;
+    uint8_t *buffer = (uint8_t *)malloc(maxsize * 4 + 8);
+    uint8_t *expected = (uint8_t *)malloc(maxsize * 4 + 8);
+    const float contrasts[] = {-100, -30, 0, 42.5, 90, 100};
+    const int offsets[] = {-300, -128, -1, 0, 1, 77, 255};
+    const uint8_t color[4] = {200, 17, 255, 3};
+
+    printf("Pixel kernel backend: %s\n", PixelKernelBackend());
+
+    for (int align = 0; align < 4; ++align)
+        for (int size = 0; size <= maxsize; size += (size < 70) ? 1 : 13) {
+            uint8_t *data = buffer + align;
+            uint8_t lut[256];
+
+            for (int c = 0; c < sizeof(contrasts) / sizeof(contrasts[0]); ++c) {
+                fillTestPattern(data, size);
+                fillTestPattern(expected, size);
+                PixelContrastTable(lut, contrasts[c]);
+                PixelApplyTable(data, size, lut);
+                referenceContrast(expected, size, contrasts[c]);
+                TEST_ASSERT_EQUAL_INT(0, memcmp(expected, data, size));
+            }
+
+            for (int o = 0; o < sizeof(offsets) / sizeof(offsets[0]); ++o) {
+                fillTestPattern(data, size);
+                fillTestPattern(expected, size);
+                PixelBrightness(data, size, offsets[o]);
+                referenceBrightness(expected, size, offsets[o]);
+                TEST_ASSERT_EQUAL_INT(0, memcmp(expected, data, size));
+
+                fillTestPattern(data, size);
+                PixelBrightnessTable(lut, offsets[o]);
+                PixelApplyTable(data, size, lut);
+                TEST_ASSERT_EQUAL_INT(0, memcmp(expected, data, size));
+            }
+
+            fillTestPattern(data, size);
+            fillTestPattern(expected, size);
+            PixelNegate(data, size);
+            referenceNegate(expected, size);
+            TEST_ASSERT_EQUAL_INT(0, memcmp(expected, data, size));
+
+            for (int channels = 1; channels <= 4; ++channels) {
+                fillTestPattern(data, size * channels);
+                memcpy(expected, data, size * channels);
+                int pixels = std::max(0, size - 2);                         // The pixels around the filled range stay
+                PixelFill(data + channels, pixels, channels, color);
+                referenceFill(expected + channels, pixels, channels, color);
+                TEST_ASSERT_EQUAL_INT(0, memcmp(expected, data, size * channels));
+
+                fillTestPattern(data, size * channels);
+                for (int ch = 0; ch < channels; ++ch) {
+                    uint8_t plane[maxsize + 4], reference[maxsize];
+                    PixelExtractChannel(data, channels, ch, plane + align, size);
+                    referenceExtractChannel(data, channels, ch, reference, size);
+                    TEST_ASSERT_EQUAL_INT(0, memcmp(reference, plane + align, size));
+                }
+            }
+        }
+
+    // Frames inside, across the border and outside of a view with an odd stride
+    const int rects[][5] = {{10, 8, 20, 12, 1}, {10, 8, 20, 12, 3}, {-5, -4, 30, 50, 2}, {35, 20, 40, 40, 4}, {-20, 5, 5, 5, 2}, {3, 3, 0, 0, 1}};
+    for (int channels = 1; channels <= 3; channels += 2) {
+        CImageBasis *image = new CImageBasis("kernelRect", 53, 41, channels);
+        CImageBasis *reference = new CImageBasis("kernelRectRef", 53, 41, channels);
+        for (int r = 0; r < sizeof(rects) / sizeof(rects[0]); ++r) {
+            fillTestPattern(image->rgb_image, 53 * 41 * channels);
+            fillTestPattern(reference->rgb_image, 53 * 41 * channels);
+            ImageView view = image->GetView(2, 1, 45, 37);
+            CImageBasis::drawRect(view, rects[r][0], rects[r][1], rects[r][2], rects[r][3], color[0], color[1], color[2], rects[r][4]);
+            referenceDrawRect(reference->GetView(2, 1, 45, 37), rects[r][0], rects[r][1], rects[r][2], rects[r][3], color, rects[r][4]);
+            TEST_ASSERT_EQUAL_INT(0, memcmp(reference->rgb_image, image->rgb_image, 53 * 41 * channels));
+        }
+        delete reference;
+        delete image;
+    }
+
+    free(expected);
+    free(buffer);
+}
+
+
+/* Time of _rounds calls in us */
+#define KERNEL_TIME(_rounds, _call) [&]() { int64_t start = esp_timer_get_time(); for (int k = 0; k < (_rounds); ++k) { _call; } return esp_timer_get_time() - start; }()
+
+/* Same result as the reference, not slower than it (a margin for timer noise), throughput printed */
+static void checkKernel(const char *_kernel, const uint8_t *_reference, const uint8_t *_result, int _size, int _bytes, int _rounds,
+                        int64_t _t_reference, int64_t _t_kernel)
+{
+    printf("%-16s reference %7.1f MB/s, %s %7.1f MB/s (%.1fx)\n", _kernel,
+           (double)_bytes * _rounds / std::max<int64_t>(_t_reference, 1), PixelKernelBackend(),
+           (double)_bytes * _rounds / std::max<int64_t>(_t_kernel, 1), (double)_t_reference / std::max<int64_t>(_t_kernel, 1));
+
+    TEST_ASSERT_EQUAL_INT(0, memcmp(_reference, _result, _size));
+    TEST_ASSERT_TRUE(_t_kernel <= _t_reference * 5 / 4 + 200);
+}
+
+
+/**
+ * @brief Every kernel against the scalar reference on a VGA RGB image: the same pixels after all rounds and at least
+ * the speed of the reference, the throughput is printed
+ */
+void test_pixelKernelsBenchmark()
+{
+    const int w = 640, h = 480, rounds = 10;
+    const int size = w * h * 3;
+    const uint8_t color[3] = {255, 0, 0};
+    CImageBasis *reference = new CImageBasis("kernelBenchRef", w, h, 3);
+    CImageBasis *image = new CImageBasis("kernelBench", w, h, 3);
+    uint8_t *referenceplane = (uint8_t *)malloc(w * h);
+    uint8_t *plane = (uint8_t *)malloc(w * h);
+    uint8_t lut[256];
+    fillTestPattern(reference->rgb_image, size);
+    fillTestPattern(image->rgb_image, size);
+
+    int64_t t_reference = KERNEL_TIME(rounds, referenceContrast(reference->rgb_image, size, 90));
+    int64_t t_kernel = KERNEL_TIME(rounds, (PixelContrastTable(lut, 90), PixelApplyTable(image->rgb_image, size, lut)));
+    checkKernel("Contrast", reference->rgb_image, image->rgb_image, size, size, rounds, t_reference, t_kernel);
+
+    t_reference = KERNEL_TIME(rounds, referenceBrightness(reference->rgb_image, size, (k & 1) ? 40 : -40));
+    t_kernel = KERNEL_TIME(rounds, PixelBrightness(image->rgb_image, size, (k & 1) ? 40 : -40));
+    checkKernel("Brightness", reference->rgb_image, image->rgb_image, size, size, rounds, t_reference, t_kernel);
+
+    t_reference = KERNEL_TIME(rounds, referenceBrightness(reference->rgb_image, size, (k & 1) ? 40 : -40));
+    t_kernel = KERNEL_TIME(rounds, (PixelBrightnessTable(lut, (k & 1) ? 40 : -40), PixelApplyTable(image->rgb_image, size, lut)));
+    checkKernel("Brightness LUT", reference->rgb_image, image->rgb_image, size, size, rounds, t_reference, t_kernel);
+
+    t_reference = KERNEL_TIME(rounds, referenceNegate(reference->rgb_image, size));
+    t_kernel = KERNEL_TIME(rounds, PixelNegate(image->rgb_image, size));
+    checkKernel("Negate", reference->rgb_image, image->rgb_image, size, size, rounds, t_reference, t_kernel);
+
+    t_reference = KERNEL_TIME(rounds, referenceExtractChannel(reference->rgb_image, 3, 1, referenceplane, w * h));
+    t_kernel = KERNEL_TIME(rounds, PixelExtractChannel(image->rgb_image, 3, 1, plane, w * h));
+    checkKernel("ExtractChannel", referenceplane, plane, w * h, size, rounds, t_reference, t_kernel);
+
+    t_reference = KERNEL_TIME(rounds, referenceFill(reference->rgb_image, w * h, 3, color));
+    t_kernel = KERNEL_TIME(rounds, PixelFill(image->rgb_image, w * h, 3, color));
+    checkKernel("Fill", reference->rgb_image, image->rgb_image, size, size, rounds, t_reference, t_kernel);
+
+    // 40 ROI frames as drawn by DrawROI onto the pattern, the bytes are the pixels of the frames
+    fillTestPattern(reference->rgb_image, size);
+    fillTestPattern(image->rgb_image, size);
+    ImageView referenceview = reference->GetView();
+    ImageView view = image->GetView();
+    int framebytes = 40 * 2 * (60 + 80) * 2 * 3;
+    t_reference = KERNEL_TIME(rounds, for (int r = 0; r < 40; ++r) referenceDrawRect(referenceview, 10 + r * 15, 10 + r * 10, 60, 80, color, 2));
+    t_kernel = KERNEL_TIME(rounds, for (int r = 0; r < 40; ++r) CImageBasis::drawRect(view, 10 + r * 15, 10 + r * 10, 60, 80, 255, 0, 0, 2));
+    checkKernel("drawRect", reference->rgb_image, image->rgb_image, size, framebytes, rounds, t_reference, t_kernel);
+
+    free(plane);
+    free(referenceplane);
+    delete image;
+    delete reference;
+}
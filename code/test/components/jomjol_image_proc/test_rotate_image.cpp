@@ -0,0 +1,296 @@
+#include <unity.h>
+#include <esp_timer.h>
+#include <math.h>
+#include <CRotateImage.h>
+#include <CAffineTransform.h>
+#include "test_image_helpers.h"
+
+
+/* Smooth image, for comparing resampled results */
+static void fillSmoothPattern(CImageBasis *_image)
+{
+    for (int y = 0; y < _image->height; ++y)
+        for (int x = 0; x < _image->width; ++x)
+            for (int ch = 0; ch < _image->channels; ++ch)
+                _image->rgb_image[_image->channels * (y * _image->width + x) + ch] = 128 + 100 * sin(x / (10.0 + ch)) * cos(y / 15.0);
+}
+
+
+static float meanAbsDifference(CImageBasis *_a, CImageBasis *_b, int _border)
+{
+    int64_t sum = 0;
+    int count = 0;
+    for (int y = _border; y < _a->height - _border; ++y)
+        for (int x = _border; x < _a->width - _border; ++x)
+            for (int ch = 0; ch < _a->channels; ++ch) {
+                int i = _a->channels * (y * _a->width + x) + ch;
+                sum += abs(_a->rgb_image[i] - _b->rgb_image[i]);
+                count++;
+            }
+    return (float)sum / count;
+}
+
+
+/**
+ * @brief Single pass affine warp: identity, integer shift and rotation with flip must map every pixel exactly,
+ * the fused shift + rotation must match the two separate passes
+ */
+void test_warpAffine()
+{
+    const int w = 640, h = 480;
+    CImageBasis *org = createTestImage("pattern", w, h);
+    CImageBasis *image = createTestImage("pattern", w, h);
+    CImageBasis *tmp = new CImageBasis("warpTmp", w, h, 3);
+
+    // Identity and integer shift (nearest neighbour and bilinear)
+    for (int bilinear = 0; bilinear < 2; ++bilinear) {
+        CRotateImage rt("warp", image, tmp);
+        CAffineTransform transform(w, h);
+        rt.Warp(transform, bilinear);
+        TEST_ASSERT_EQUAL_INT(0, memcmp(org->rgb_image, image->rgb_image, w * h * 3));
+
+        transform.Translate(5, -3);
+        rt.Warp(transform, bilinear);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) {
+                int xs = x - 5, ys = y + 3;
+                uint8_t expected = ((xs >= 0) && (ys < h)) ? org->rgb_image[3 * (ys * w + xs)] : 255;
+                TEST_ASSERT_EQUAL_UINT8(expected, image->rgb_image[3 * (y * w + x)]);
+            }
+        memcpy(image->rgb_image, org->rgb_image, w * h * 3);
+    }
+
+    // Rotation by 90 degree with flip of the image size: target (x, y) = source (y, h - x)
+    {
+        CRotateImage rt("warp", image, tmp);
+        CAffineTransform transform(w, h);
+        transform.Rotate(90, w / 2, h / 2);
+        transform.FlipImageSize();
+        rt.Warp(transform, false);
+
+        TEST_ASSERT_EQUAL_INT(h, image->width);
+        TEST_ASSERT_EQUAL_INT(w, image->height);
+        for (int y = 0; y < w; ++y)
+            for (int x = 1; x < h; ++x)
+                TEST_ASSERT_EQUAL_UINT8(org->rgb_image[3 * ((h - x) * w + y) + 1], image->rgb_image[3 * (y * h + x) + 1]);
+
+        image->width = w;
+        image->height = h;
+        tmp->width = w;
+        tmp->height = h;
+        memcpy(image->rgb_image, org->rgb_image, w * h * 3);
+    }
+
+    // Sub-pixel shift and rotation: one fused pass against Translate + RotateAntiAliasing
+    {
+        CImageBasis *sequential = createTestImage("pattern", w, h);
+        fillSmoothPattern(sequential);
+        fillSmoothPattern(image);
+        CRotateImage rts("sequential", sequential, tmp);
+        int64_t start = esp_timer_get_time();
+        rts.Translate(2.5f, -1.25f);
+        rts.RotateAntiAliasing(3, w / 2, h / 2);
+        int64_t t_sequential = esp_timer_get_time() - start;
+
+        CRotateImage rt("warp", image, tmp);
+        CAffineTransform transform(w, h);
+        transform.Translate(2.5f, -1.25f);
+        transform.Rotate(3, w / 2, h / 2);
+        start = esp_timer_get_time();
+        rt.Warp(transform, true);
+        int64_t t_warp = esp_timer_get_time() - start;
+
+        float diff = meanAbsDifference(sequential, image, 30);
+        printf("Translate + RotateAntiAliasing %lld us, Warp %lld us, mean difference %.2f\n",
+                (long long)t_sequential, (long long)t_warp, diff);
+        TEST_ASSERT_TRUE(diff < 1);
+
+        delete sequential;
+    }
+
+    delete tmp;
+    delete image;
+    delete org;
+}
+
+
+/* Float implementation of RotateAntiAliasing before the fixed point version (without flip), reference for the comparison.
+ * The result is rounded here, the original truncated it (0.5 darker on average). */
+static void rotateAntiAliasingReference(CImageBasis *_image, uint8_t *_odata, float _angle, int _centerx, int _centery)
+{
+    int width = _image->width, height = _image->height, channels = _image->channels;
+    float m[2][3];
+    _angle = _angle / 180 * M_PI;
+
+    m[0][0] = cos(_angle);
+    m[0][1] = sin(_angle);
+    m[0][2] = (1 - m[0][0]) * _centerx - m[0][1] * _centery;
+    m[1][0] = -m[0][1];
+    m[1][1] = m[0][0];
+    m[1][2] = m[0][1] * _centerx + (1 - m[0][0]) * _centery;
+
+    for (int x = 0; x < width; ++x)
+        for (int y = 0; y < height; ++y) {
+            uint8_t *p_target = _odata + (channels * (y * width + x));
+            float x_source = m[0][0] * x + m[0][1] * y + m[0][2];
+            float y_source = m[1][0] * x + m[1][1] * y + m[1][2];
+            int x_source_1 = (int)x_source, x_source_2 = x_source_1 + 1;
+            int y_source_1 = (int)y_source, y_source_2 = y_source_1 + 1;
+
+            float quad_ul = (x_source_2 - x_source) * (y_source_2 - y_source);
+            float quad_ur = (1 - (x_source_2 - x_source)) * (y_source_2 - y_source);
+            float quad_or = (x_source_2 - x_source) * (1 - (y_source_2 - y_source));
+            float quad_ol = (1 - (x_source_2 - x_source)) * (1 - (y_source_2 - y_source));
+
+            if ((x_source_1 >= 0) && (x_source_2 < width) && (y_source_1 >= 0) && (y_source_2 < height)) {
+                uint8_t *p_ul = _image->rgb_image + (channels * (y_source_1 * width + x_source_1));
+                uint8_t *p_ur = _image->rgb_image + (channels * (y_source_1 * width + x_source_2));
+                uint8_t *p_or = _image->rgb_image + (channels * (y_source_2 * width + x_source_1));
+                uint8_t *p_ol = _image->rgb_image + (channels * (y_source_2 * width + x_source_2));
+                for (int ch = 0; ch < channels; ++ch)
+                    p_target[ch] = (int)(p_ul[ch] * quad_ul + p_ur[ch] * quad_ur + p_or[ch] * quad_or + p_ol[ch] * quad_ol + 0.5f);
+            }
+            else {
+                for (int ch = 0; ch < channels; ++ch)
+                    p_target[ch] = 255;
+            }
+        }
+}
+
+
+/**
+ * @brief Fixed point RotateAntiAliasing must match the float implementation within +-1
+ * (pixels at the image border, which are white in one of the results, are not compared)
+ */
+void test_rotateAntiAliasingFixedPoint()
+{
+    const float angles[] = {-34.6, 1.5, 3, 90, 180};
+
+    CImageBasis *org = new CImageBasis("demo", "/sdcard/demo/530.07077.jpg");
+    TEST_ASSERT_TRUE(org->ImageOkay());
+    int w = org->width, h = org->height, memsize = w * h * org->channels;
+    uint8_t *reference = (uint8_t *)malloc(memsize);
+
+    for (int a = 0; a < sizeof(angles) / sizeof(angles[0]); ++a) {
+        int64_t start = esp_timer_get_time();
+        rotateAntiAliasingReference(org, reference, angles[a], w / 2, h / 2);
+        int64_t t_float = esp_timer_get_time() - start;
+
+        CImageBasis *image = new CImageBasis("rotated", org);
+        CImageBasis *tmp = new CImageBasis("rotateTmp", w, h, org->channels);
+        CRotateImage rt("rotate", image, tmp);
+        start = esp_timer_get_time();
+        rt.RotateAntiAliasing(angles[a], w / 2, h / 2);
+        int64_t t_fixed = esp_timer_get_time() - start;
+
+        int compared = 0, maxdiff = 0;
+        for (int i = 0; i < w * h; ++i) {
+            uint8_t *p_ref = reference + 3 * i, *p_new = image->rgb_image + 3 * i;
+            if (((p_ref[0] & p_ref[1] & p_ref[2]) == 255) || ((p_new[0] & p_new[1] & p_new[2]) == 255))
+                continue;
+            compared++;
+            for (int ch = 0; ch < 3; ++ch)
+                maxdiff = std::max(maxdiff, abs(p_ref[ch] - p_new[ch]));
+        }
+
+        printf("RotateAntiAliasing %.1f deg: float %lld us, Q16 %lld us, %d pixel compared, max difference %d\n",
+                angles[a], (long long)t_float, (long long)t_fixed, compared, maxdiff);
+        TEST_ASSERT_TRUE(compared > w * h / 2);
+        TEST_ASSERT_TRUE(maxdiff <= 1);
+
+        delete tmp;
+        delete image;
+    }
+
+    free(reference);
+    delete org;
+}
+
+
+/* Nearest neighbour through the inverse transform, computed per pixel */
+static void warpNearestReference(const uint8_t *_source, int _width, int _height, int _channels, uint8_t *_target, CAffineTransform &_transform)
+{
+    float inv[2][3];
+    _transform.Inverse(inv);
+
+    for (int y = 0; y < _transform.height; ++y)
+        for (int x = 0; x < _transform.width; ++x) {
+            int xs = lroundf(inv[0][0] * x + inv[0][1] * y + inv[0][2]);
+            int ys = lroundf(inv[1][0] * x + inv[1][1] * y + inv[1][2]);
+            uint8_t *p_target = _target + _channels * (y * _transform.width + x);
+            for (int ch = 0; ch < _channels; ++ch)
+                p_target[ch] = ((xs >= 0) && (xs < _width) && (ys >= 0) && (ys < _height)) ? _source[_channels * (ys * _width + xs) + ch] : 255;
+        }
+}
+
+
+/**
+ * @brief Multiples of 90 degree (with and without flip of the image size, odd and even sizes, tiles cut at the border)
+ * take the exact copy path: nearest neighbour and bilinear give the same pixels as the per-pixel mapping.
+ * Rotate and RotateAntiAliasing by multiples of 90 degree give the same result as Warp.
+ */
+void test_rotateAxisAligned()
+{
+    const int sizes[][2] = {{37, 23}, {64, 48}, {33, 70}};
+    const float angles[] = {0, 90, 180, 270, -90};
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+        for (int channels = 1; channels <= 3; channels += 2) {
+            int w = sizes[s][0], h = sizes[s][1], memsize = w * h * channels;
+            CImageBasis *org = new CImageBasis("axisOrg", w, h, channels);
+            fillTestPattern(org->rgb_image, memsize);
+            uint8_t *reference = (uint8_t *)malloc(memsize);
+
+            for (int a = 0; a < sizeof(angles) / sizeof(angles[0]); ++a)
+                for (int flip = 0; flip < 2; ++flip) {
+                    CAffineTransform transform(w, h);
+                    transform.Rotate(angles[a], w / 2, h / 2);
+                    if (flip)
+                        transform.FlipImageSize();
+                    warpNearestReference(org->rgb_image, w, h, channels, reference, transform);
+
+                    for (int bilinear = 0; bilinear < 2; ++bilinear) {
+                        CImageBasis *image = new CImageBasis("axisImage", org);
+                        CImageBasis *tmp = new CImageBasis("axisTmp", w, h, channels);
+                        CRotateImage rt("axis", image, tmp);
+                        rt.Warp(transform, bilinear);
+                        TEST_ASSERT_EQUAL_INT(transform.width, image->width);
+                        TEST_ASSERT_EQUAL_INT(0, memcmp(reference, image->rgb_image, memsize));
+                        delete tmp;
+                        delete image;
+                    }
+
+                    for (int antialiasing = 0; antialiasing < 2; ++antialiasing) {
+                        CImageBasis *image = new CImageBasis("axisImage", org);
+                        CImageBasis *tmp = new CImageBasis("axisTmp", w, h, channels);
+                        CRotateImage rt("axis", image, tmp, flip);
+                        if (antialiasing)
+                            rt.RotateAntiAliasing(angles[a], w / 2, h / 2);
+                        else
+                            rt.Rotate(angles[a], w / 2, h / 2);
+                        TEST_ASSERT_EQUAL_INT(0, memcmp(reference, image->rgb_image, memsize));
+                        delete tmp;
+                        delete image;
+                    }
+                }
+
+            free(reference);
+            delete org;
+        }
+
+    // Speed of the exact copy against the interpolating warp at almost the same angle
+    const int w = 640, h = 480;
+    CImageBasis *image = createTestImage("pattern", w, h);
+    CImageBasis *tmp = new CImageBasis("axisTmp", w, h, 3);
+    const float speedangles[] = {90, 89.9f, 180, 179.9f};
+    for (int a = 0; a < 4; ++a) {
+        CRotateImage rt("axis", image, tmp);
+        CAffineTransform transform(w, h);
+        transform.Rotate(speedangles[a], w / 2, h / 2);
+        int64_t start = esp_timer_get_time();
+        rt.Warp(transform, true, false);
+        printf("Warp %.1f deg (bilinear): %lld us\n", speedangles[a], (long long)(esp_timer_get_time() - start));
+    }
+    delete tmp;
+    delete image;
+}
@@ -0,0 +1,119 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <CImageBasis.h>
+#include <CImagePyramid.h>
+#include <CPhaseCorrelation.h>
+#include <CJpegEncoder.h>
+#include <CRoundArena.h>
+#include "test_image_helpers.h"
+
+
+/* Temporary buffers of an alignment and an encode: search region pyramid, FFT buffers, copy of a strided view for stb */
+static void arenaRoundWork(CImageBasis *_image)
+{
+    CImagePyramid region("arena region", true);
+    TEST_ASSERT_TRUE(region.Build(_image->rgb_image, _image->width, _image->channels, 0, 10, 10, 120, 90, 3));
+
+    CPhaseCorrelation pc("arena");
+    PhaseCorrPeak peaks[PHASECORR_MAX_PEAKS];
+    TEST_ASSERT_TRUE(pc.Correlate(region.plane[1], region.width[1], region.height[1],
+                                  region.plane[2], region.width[2], region.height[2], peaks));
+    pc.Free();
+    region.Free();
+
+    CJpegEncoder *stb = CJpegEncoder::Create(JPEG_ENCODER_STB);
+    uint8_t chunk[256];
+    TestJpeg out;
+    TEST_ASSERT_TRUE(stb->Encode(_image->GetView(5, 5, 100, 60), 90, chunk, sizeof(chunk), writeTestJpeg, &out));
+    delete stb;
+}
+
+
+/**
+ * @brief Round arena: aligned allocations, the most recent one is taken back, everything with the last free,
+ * large requests go to the heap, the reset waits for buffers in use, rounds of image work without heap allocations
+ */
+void test_roundArena()
+{
+    CRoundArena arena;
+    TEST_ASSERT_TRUE(arena.Reserve(4096));
+
+    uint8_t *a = (uint8_t *)arena.Allocate("a", 100);
+    uint8_t *b = (uint8_t *)arena.Allocate("b", 1);
+    TEST_ASSERT_TRUE(arena.Contains(a) && arena.Contains(b));
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t)a % ROUNDARENA_ALIGN);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t)b % ROUNDARENA_ALIGN);
+    TEST_ASSERT_TRUE(b >= a + 100);
+    memset(a, 1, 100);
+    memset(b, 2, 1);
+    size_t used = arena.Used();
+
+    // Stack order: the most recent allocation is taken back
+    arena.Free("b", b);
+    TEST_ASSERT_TRUE(arena.Used() < used);
+    TEST_ASSERT_TRUE(arena.Allocate("c", 1) == b);
+    arena.Free("c", b);
+
+    // Other order: released with the last allocation
+    b = (uint8_t *)arena.Allocate("b", 1);
+    arena.Free("a", a);
+    TEST_ASSERT_EQUAL_INT(used, arena.Used());
+    arena.Free("b", b);
+    TEST_ASSERT_EQUAL_INT(0, arena.Used());
+    TEST_ASSERT_EQUAL_INT(used, arena.HighWater());
+    TEST_ASSERT_EQUAL_UINT32(0, arena.overflows);
+
+    // Too large: heap
+    uint8_t *large = (uint8_t *)arena.Allocate("large", 8192);
+    TEST_ASSERT_NOT_NULL(large);
+    TEST_ASSERT_FALSE(arena.Contains(large));
+    TEST_ASSERT_EQUAL_UINT32(1, arena.overflows);
+    memset(large, 3, 8192);
+    arena.Free("large", large);
+
+    // Reset while a buffer is in use (other task): deferred until it is freed
+    a = (uint8_t *)arena.Allocate("a", 1000);
+    arena.Reset();
+    TEST_ASSERT_EQUAL_INT(1, arena.Live());
+    TEST_ASSERT_TRUE(arena.Used() > 1000);
+    TEST_ASSERT_EQUAL_INT(arena.Used(), arena.RoundHighWater());
+    TEST_ASSERT_EQUAL_INT(arena.Used(), arena.HighWater());     // The next round starts with the buffer in use
+    b = (uint8_t *)arena.Allocate("b", 16);
+    TEST_ASSERT_TRUE(b > a);
+    arena.Free("a", a);
+    TEST_ASSERT_TRUE(arena.Used() > 0);
+    arena.Free("b", NULL);
+    TEST_ASSERT_EQUAL_INT(1, arena.Live());
+    arena.Free("b", b);
+    TEST_ASSERT_EQUAL_INT(0, arena.Used());
+
+    // Image work of two rounds: the same high water mark, no overflow to the heap
+    if (RoundArena.Size() == 0)
+        RoundArena.Reserve(ROUND_ARENA_SIZE);
+
+    CImageBasis *image = createTestImage("arenaImage", 160, 120);
+
+    RoundArena.Reset();
+    size_t highwater[2];
+    for (int round = 0; round < 2; ++round) {
+        uint32_t allocations = RoundArena.allocations;
+        uint32_t overflows = RoundArena.overflows;
+
+        arenaRoundWork(image);
+
+        TEST_ASSERT_EQUAL_INT(0, RoundArena.Live());
+        TEST_ASSERT_EQUAL_INT(0, RoundArena.Used());
+        TEST_ASSERT_EQUAL_UINT32(overflows, RoundArena.overflows);
+        RoundArena.Reset();
+        highwater[round] = RoundArena.RoundHighWater();
+
+        printf("Round %d: %u allocations in the arena, high water %u of %u bytes\n", round,
+               (unsigned)(RoundArena.allocations - allocations), (unsigned)highwater[round], (unsigned)RoundArena.Size());
+        TEST_ASSERT_TRUE(RoundArena.allocations - allocations >= 6);
+    }
+    TEST_ASSERT_EQUAL_INT(highwater[0], highwater[1]);
+    TEST_ASSERT_TRUE(highwater[0] > 0);
+
+    delete image;
+}
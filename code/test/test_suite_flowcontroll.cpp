@@ -22,6 +22,17 @@
 #include "components/jomjol-flowcontroll/test_cnnflowcontroll.cpp"
 #include "components/openmetrics/test_openmetrics.cpp"
 #include "components/jomjol_mqtt/test_server_mqtt.cpp"
+#include "components/jomjol_image_proc/test_find_template.cpp"
+#include "components/jomjol_image_proc/test_rotate_image.cpp"
+#include "components/jomjol_image_proc/test_jpeg_decoder.cpp"
+#include "components/jomjol_image_proc/test_image_view.cpp"
+#include "components/jomjol_image_proc/test_pixel_kernels.cpp"
+#include "components/jomjol_image_proc/test_image_lock.cpp"
+#include "components/jomjol_image_proc/test_image_buffer.cpp"
+#include "components/jomjol_image_proc/test_jpeg_encoder.cpp"
+#include "components/jomjol_image_proc/test_image_slab.cpp"
+#include "components/jomjol_image_proc/test_round_arena.cpp"
+#include "components/jomjol_image_proc/test_image_overlay.cpp"
 
 bool Init_NVS_SDCard()
 {
@@ -170,6 +181,35 @@ extern "C" void app_main()
     RUN_TEST(test_getReadoutRawString);
     RUN_TEST(test_openmetrics);
     RUN_TEST(test_mqtt);
+
+    // alignment / template matching (uses the images of sd-card/demo)
+    RUN_TEST(test_findTemplatePyramid);
+    RUN_TEST(test_findTemplateNCC);
+    RUN_TEST(test_findTemplatePhaseCorrelation);
+    RUN_TEST(test_matchKernels);
+    RUN_TEST(test_templateCache);
+    RUN_TEST(test_findTemplateAdaptive);
+    RUN_TEST(test_findTemplateSubPixel);
+    RUN_TEST(test_alignMultipleReferences);
+    RUN_TEST(test_alignInitialRotation);
+    RUN_TEST(test_warpAffine);
+    RUN_TEST(test_rotateAxisAligned);
+    RUN_TEST(test_rotateAntiAliasingFixedPoint);
+    RUN_TEST(test_jpegDecoderRegions);
+    RUN_TEST(test_jpegDecoderScaled);
+    RUN_TEST(test_luminancePipeline);
+    RUN_TEST(test_imageView);
+    RUN_TEST(test_roiSampler);
+    RUN_TEST(test_roiSamplerPlans);
+    RUN_TEST(test_pixelKernels);
+    RUN_TEST(test_pixelKernelsBenchmark);
+    RUN_TEST(test_imageLock);
+    RUN_TEST(test_imageBuffer);
+    RUN_TEST(test_jpegEncoder);
+    RUN_TEST(test_jpegEncoderBenchmark);
+    RUN_TEST(test_imageSlab);
+    RUN_TEST(test_roundArena);
+    RUN_TEST(test_imageOverlay);
   
   UNITY_END();
 }
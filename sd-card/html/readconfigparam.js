@@ -133,6 +133,8 @@ function ParseConfig() {
     ParamAddValue(param, catname, "CamZoomSize");
     ParamAddValue(param, catname, "LEDIntensity");
     ParamAddValue(param, catname, "Demo");
+    ParamAddValue(param, catname, "DecodeRegionsOnly");
+    ParamAddValue(param, catname, "LuminanceOnly");
 
     var catname = "Alignment";
     category[catname] = new Object();